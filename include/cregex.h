@@ -1,6 +1,8 @@
 #ifndef CREGEX_H
 #define CREGEX_H
 
+#include <stddef.h>
+
 typedef enum {
     REGEX_NODE_TYPE_EPSILON = 0,
     /* Characters */
@@ -61,6 +63,7 @@ typedef enum {
     /* Control-flow */
     REGEX_PROGRAM_OPCODE_SPLIT,
     REGEX_PROGRAM_OPCODE_JUMP,
+    REGEX_PROGRAM_OPCODE_DISPATCH,
     /* Assertions */
     REGEX_PROGRAM_OPCODE_ASSERT_BEGIN,
     REGEX_PROGRAM_OPCODE_ASSERT_END,
@@ -105,6 +108,13 @@ typedef struct cregex_program_instr {
         struct {
             struct cregex_program_instr *target;
         };
+        /* REGEX_PROGRAM_OPCODE_DISPATCH: the next input byte indexes a
+         * table of 256 offsets from this instruction to the alternative it
+         * can begin, 0 if none can (the thread dies, as at the end of input)
+         */
+        struct {
+            int *table;
+        };
         /* REGEX_PROGRAM_OPCODE_SAVE */
         struct {
             int save;
@@ -112,27 +122,558 @@ typedef struct cregex_program_instr {
     };
 } cregex_program_instr_t;
 
+/* Strategy cregex_program_run() uses for a program, chosen at compile time */
+typedef enum {
+    /* Pike VM from the start of the string, through the .*? prefix */
+    CREGEX_PLAN_PIKE_VM = 0,
+    /* Pike VM run once at the start of the string (pattern starts with ^) */
+    CREGEX_PLAN_ANCHORED,
+    /* Pike VM started only where a byte which can begin a match is found by
+     * a vector scan
+     */
+    CREGEX_PLAN_PREFILTER,
+    /* Reversed program run from the end of the string (pattern ends with $),
+     * followed by an anchored forward run only if submatches are wanted
+     */
+    CREGEX_PLAN_REVERSE,
+    /* Substring search for a pattern which is a plain string, bypassing the
+     * VM
+     */
+    CREGEX_PLAN_LITERAL,
+} cregex_plan_t;
+
 typedef struct {
     int ninstructions;
+    /* Execution strategy, see cregex_program_plan() */
+    cregex_plan_t plan;
+    /* Index of the first instruction after the .*? prefix which unanchored
+     * patterns start with, or 0 if the pattern starts with ^
+     */
+    int start;
+    /* Index of the reversed program of an end-anchored pattern, which
+     * follows the forward program, or 0 if there is none
+     */
+    int reverse;
+    /* Shortest and longest possible match in bytes (-1 if unbounded) */
+    int min_length, max_length;
+    /* Bytes which can begin a match of an unanchored pattern, used to skip
+     * ahead to candidate match positions, or nfirst = 0 if a match can start
+     * anywhere (e.g. because the pattern matches the empty string)
+     */
+    int nfirst;
+    cregex_char_class first;
+    /* first as nibble lookup tables for the vector scanner */
+    unsigned char first_low[16], first_high[16];
+    /* A pattern which is a plain string, possibly with ^ and $ and a
+     * capture around it all, is searched for as such. Its bytes follow the
+     * instructions; length is 0 for other patterns.
+     */
+    struct {
+        int length;
+        int begin, end; /* anchored with ^ or $ */
+        int capture;    /* enclosed in a capture group */
+    } literal;
+    /* Number of DISPATCH tables, which follow the instructions (and come
+     * before the bytes of a literal)
+     */
+    int ndispatch;
+    /* The instructions threads wait at after being added at an instruction,
+     * with what happens on the way, precomputed so that the VM need not
+     * follow control flow on every byte. NULL (and nclosures 0) if they
+     * would take too much memory. Allocated apart from the program.
+     */
+    int *closures;
+    size_t nclosures;
+    /* Compile flags (CREGEX_FLAG_*) the program was compiled with */
+    int flags;
     cregex_program_instr_t instructions[];
 } cregex_program_t;
 
+/* Execution statistics collected by cregex_program_run_stats(). Counters are
+ * accumulated across runs, so zero the structure before the first run.
+ */
+typedef struct {
+    size_t nbytes;       /* input bytes scanned */
+    size_t nthreads;     /* threads added to a thread list */
+    size_t nadd_thread;  /* vm_add_thread() invocations, including repeats */
+    int max_threads;     /* peak thread list size */
+    unsigned long *hits; /* per-instruction execution counts, indexed like
+                          * program->instructions (optional, may be NULL)
+                          */
+} cregex_program_stats_t;
+
+/* Error results. Run functions return them instead of 1 (match) or 0 (no
+ * match); compile functions store them through their error argument.
+ */
+enum {
+    CREGEX_ERROR = -1,       /* out of memory, or a pattern which does not
+                              * parse
+                              */
+    CREGEX_ERROR_LIMIT = -2, /* a cregex_limits_t budget ran out */
+};
+
+/* Budgets bounding the work done for one pattern, e.g. to keep a single
+ * pattern or input from monopolizing a shared service. A field of zero
+ * means no limit.
+ */
+typedef struct {
+    /* Instructions of a compiled program, counted as the upper bound
+     * reserved before compiling, so huge repetitions are refused before any
+     * memory is allocated
+     */
+    int max_instructions;
+    /* Thread steps per run: the number of threads running at each input
+     * position, summed over all positions visited
+     */
+    size_t max_steps;
+    /* Input bytes examined per run, including bytes skipped over while
+     * looking for a possible match start
+     */
+    size_t max_bytes;
+} cregex_limits_t;
+
 /* Run program on string */
 int cregex_program_run(const cregex_program_t *program,
                        const char *string,
                        const char **matches,
                        int nmatches);
 
+/* Run program on the first length bytes of string, which need not be
+ * NUL-terminated and may contain NUL bytes
+ */
+int cregex_program_run_n(const cregex_program_t *program,
+                         const char *string,
+                         size_t length,
+                         const char **matches,
+                         int nmatches);
+
+/* Run program on the first length bytes of string, collecting execution
+ * statistics into stats (unless built with -DCREGEX_NO_STATS)
+ */
+int cregex_program_run_stats(const cregex_program_t *program,
+                             const char *string,
+                             size_t length,
+                             const char **matches,
+                             int nmatches,
+                             cregex_program_stats_t *stats);
+
+/* Run program on the first length bytes of string, giving up with
+ * CREGEX_ERROR_LIMIT once a run budget of limits is exceeded
+ */
+int cregex_program_run_limited(const cregex_program_t *program,
+                               const char *string,
+                               size_t length,
+                               const char **matches,
+                               int nmatches,
+                               const cregex_limits_t *limits);
+
+/* What the planner found out about a program, for callers wondering why a
+ * pattern is slow
+ */
+typedef struct {
+    cregex_plan_t plan;
+    const char *reason;   /* why the plan was chosen */
+    int ninstructions;    /* program size */
+    int ncaptures;        /* capture groups, not counting the whole match */
+    int anchored;         /* matches can only start at the beginning */
+    int end_anchored;     /* matches can only end at the end */
+    int prefix_length;    /* bytes of the literal every match starts with */
+    int nfirst;           /* bytes which can begin a match, 0 if any */
+    int onepass;          /* at most one thread survives each input byte */
+} cregex_plan_info_t;
+
+/* Describe the plan of program */
+void cregex_program_plan(const cregex_program_t *program,
+                         cregex_plan_info_t *info);
+
+/* Name of a plan, e.g. "prefilter" */
+const char *cregex_plan_name(cregex_plan_t plan);
+
+/* Memory allocator for parsed patterns, compiled programs and what is
+ * allocated only while compiling. Functions taking an allocator use malloc()
+ * and free() when it is NULL.
+ */
+typedef struct {
+    void *(*alloc)(void *context, size_t size);
+    void (*free)(void *context, void *ptr);
+    void *context;
+} cregex_allocator_t;
+
+/* Bump allocator over a caller-supplied buffer. Individual frees are no-ops;
+ * all memory is released at once with cregex_arena_reset().
+ */
+typedef struct {
+    char *buffer;
+    size_t size, used;
+} cregex_arena_t;
+
+/* Initialize an arena over size bytes of buffer */
+void cregex_arena_init(cregex_arena_t *arena, void *buffer, size_t size);
+
+/* Release everything allocated from an arena */
+void cregex_arena_reset(cregex_arena_t *arena);
+
+/* Allocator which allocates from an arena */
+cregex_allocator_t cregex_arena_allocator(cregex_arena_t *arena);
+
+/* Replace every match of program in the first length bytes of string with
+ * replacement, in which \0 stands for the whole match, \1 to \9 for the
+ * capture groups (empty if they did not take part) and \\ for a backslash;
+ * any other escape, or a backslash at the end, is an error. Matches are
+ * found left to right, each search starting where the last match ended; an
+ * empty match right after a match is not replaced.
+ *
+ * The result is written to output like snprintf() does: truncated to
+ * size - 1 bytes and NUL-terminated, unless size is 0. *output_length
+ * (unless output_length is NULL) is set to the full length, so a call with
+ * a buffer of *output_length + 1 bytes succeeds. Returns the number of
+ * replacements, or CREGEX_ERROR if replacement has an unknown escape or a
+ * trailing backslash, refers to a group the pattern does not have, or if
+ * memory runs out.
+ */
+int cregex_program_replace(const cregex_program_t *program,
+                           const char *string,
+                           size_t length,
+                           const char *replacement,
+                           char *output,
+                           size_t size,
+                           size_t *output_length);
+
+/* Like cregex_program_replace(), but into a buffer allocated with allocator,
+ * starting at length + 1 bytes and grown only if replacements make the
+ * result longer. On success, *output is the NUL-terminated result, to be
+ * freed with allocator (free() if allocator is NULL).
+ */
+int cregex_program_replace_with(const cregex_program_t *program,
+                                const char *string,
+                                size_t length,
+                                const char *replacement,
+                                const cregex_allocator_t *allocator,
+                                char **output,
+                                size_t *output_length);
+
+/* The matches of a program in a document being edited, e.g. for syntax
+ * highlighting. The document is scanned once, taking a checkpoint of the
+ * VM every so many bytes. After an edit, scanning resumes from the last
+ * checkpoint before it and stops as soon as the VM is back in the state of
+ * a checkpoint past the edit, whose matches are then reused. The work done
+ * is proportional to the size of the edit rather than of the document,
+ * unless the edit changes matches further away.
+ */
+typedef struct cregex_incremental cregex_incremental_t;
+
+/* Find all matches of program in the first length bytes of string, as
+ * cregex_program_replace() does, with a checkpoint every interval bytes (0
+ * for a default of 1024). nmatches slots are kept per match, at least 2 and
+ * at most 20. Returns NULL if memory runs out. program must outlive the
+ * scan.
+ */
+cregex_incremental_t *cregex_incremental_scan(const cregex_program_t *program,
+                                              const char *string,
+                                              size_t length,
+                                              int nmatches,
+                                              size_t interval);
+
+/* Update the matches after removed bytes at offset of the document were
+ * replaced with inserted bytes, string and length being the edited
+ * document. Returns 0, or CREGEX_ERROR if the edit does not fit the
+ * document, or if memory runs out, after which the scan can only be freed.
+ */
+int cregex_incremental_edit(cregex_incremental_t *scan,
+                            const char *string,
+                            size_t length,
+                            size_t offset,
+                            size_t removed,
+                            size_t inserted);
+
+/* Number of matches found */
+size_t cregex_incremental_count(const cregex_incremental_t *scan);
+
+/* Slots of the ith match as offsets into the document, like the matches of
+ * cregex_program_run(), -1 for groups which did not take part
+ */
+const ptrdiff_t *cregex_incremental_match(const cregex_incremental_t *scan,
+                                          size_t i);
+
+/* Input bytes the VM read during the scan or the last edit */
+size_t cregex_incremental_rescanned(const cregex_incremental_t *scan);
+
+/* Free an incremental scan */
+void cregex_incremental_free(cregex_incremental_t *scan);
+
 /* Compile a parsed pattern */
 cregex_program_t *cregex_compile_node(const cregex_node_t *root);
 
+/* Compile flags */
+enum {
+    /* Match ASCII letters regardless of case. Characters and classes are
+     * folded at compile time, so the program size is unchanged and input is
+     * matched as is.
+     */
+    CREGEX_FLAG_ICASE = 1 << 0,
+    /* Treat the pattern and input as UTF-8: . and classes match whole code
+     * points (not surrogates), and non-ASCII characters are quantified as
+     * one. Patterns must be valid UTF-8 and parsed with this flag too. The
+     * VM still reads bytes; each class becomes alternatives of byte
+     * sequences, so input need not be valid.
+     */
+    CREGEX_FLAG_UTF8 = 1 << 1,
+};
+
+/* Compile a parsed pattern with flags, allocating the program with
+ * allocator
+ */
+cregex_program_t *cregex_compile_node_with(const cregex_node_t *root,
+                                           int flags,
+                                           const cregex_allocator_t *allocator);
+
+/* Parse and compile a pattern in one step, allocating only the program with
+ * allocator. The parsed pattern lives in a temporary arena (on the stack for
+ * short patterns) and is released in bulk.
+ */
+cregex_program_t *cregex_compile(const char *pattern,
+                                 int flags,
+                                 const cregex_allocator_t *allocator);
+
+/* Parse and compile a pattern like cregex_compile(), refusing programs
+ * larger than limits->max_instructions. On failure, NULL is returned and
+ * *error (unless error is NULL) is set to CREGEX_ERROR_LIMIT or
+ * CREGEX_ERROR.
+ */
+cregex_program_t *cregex_compile_limited(const char *pattern,
+                                         int flags,
+                                         const cregex_allocator_t *allocator,
+                                         const cregex_limits_t *limits,
+                                         int *error);
+
+/* What running a pattern would cost, worked out from the parsed pattern
+ * without compiling it, e.g. to refuse patterns from untrusted sources
+ * before they are run. Counts which do not fit in an int are -1.
+ */
+typedef struct {
+    /* Instructions of the compiled program, which max_instructions of
+     * cregex_limits_t bounds
+     */
+    int ninstructions;
+    /* Capture groups, not counting the whole match */
+    int ncaptures;
+    /* Threads a thread list can hold at once: one per character instruction
+     * and MATCH of the forward program. Each costs 2 * nmatches slots.
+     */
+    int max_threads;
+    /* Instructions the VM executes per input byte at most: each thread steps
+     * once, and each instruction of the forward program is followed at most
+     * once while adding the threads for the next byte
+     */
+    int work_per_byte;
+    /* Copies counted repetitions make of the most repeated part of the
+     * pattern, e.g. 1 for a+ and 10000 for (a{100}){100}
+     */
+    int repetition_copies;
+} cregex_cost_t;
+
+/* Work out the costs of a parsed pattern compiled with flags */
+void cregex_node_cost(const cregex_node_t *root,
+                      int flags,
+                      cregex_cost_t *cost);
+
+/* Parse a pattern and work out its costs, allocating no more than parsing
+ * for cregex_compile() does. Returns 0, or CREGEX_ERROR if the pattern does
+ * not parse or memory runs out.
+ */
+int cregex_cost(const char *pattern, int flags, cregex_cost_t *cost);
+
 /* Free a compiled program */
 void cregex_compile_free(cregex_program_t *program);
 
-/* Parse a pattern */
+/* Free a compiled program allocated with allocator */
+void cregex_compile_free_with(cregex_program_t *program,
+                              const cregex_allocator_t *allocator);
+
+/* Programs compiled from a set of patterns, e.g. a list of indicators to
+ * look for, stored one after the other in a single block
+ */
+typedef struct cregex_program_set cregex_program_set_t;
+
+/* Compile npatterns patterns like cregex_compile_limited() (limits may be
+ * NULL), in nthreads threads, or one per online CPU if nthreads is 0. A
+ * pattern which fails to compile leaves the others be. Returns NULL only if
+ * memory runs out.
+ */
+cregex_program_set_t *cregex_compile_set(const char *const *patterns,
+                                         size_t npatterns,
+                                         int flags,
+                                         const cregex_limits_t *limits,
+                                         int nthreads);
+
+/* Number of patterns of a set */
+size_t cregex_program_set_count(const cregex_program_set_t *set);
+
+/* Program of the ith pattern, NULL if it did not compile. It belongs to the
+ * set and must not be freed with cregex_compile_free().
+ */
+const cregex_program_t *cregex_program_set_program(
+    const cregex_program_set_t *set,
+    size_t i);
+
+/* 0 if the ith pattern compiled, else CREGEX_ERROR_LIMIT or CREGEX_ERROR */
+int cregex_program_set_error(const cregex_program_set_t *set, size_t i);
+
+/* Free a set and all its programs */
+void cregex_program_set_free(cregex_program_set_t *set);
+
+/* Parse a pattern. Returns NULL on syntax errors, and for groups and
+ * quantifiers nested more than 1000 deep; long alternations and
+ * concatenations are fine.
+ */
 cregex_node_t *cregex_parse(const char *pattern);
 
+/* Parse a pattern, allocating the nodes with allocator */
+cregex_node_t *cregex_parse_with(const char *pattern,
+                                 const cregex_allocator_t *allocator);
+
+/* Parse a pattern with compile flags (CREGEX_FLAG_UTF8 changes parsing),
+ * allocating the nodes with allocator
+ */
+cregex_node_t *cregex_parse_with_flags(const char *pattern,
+                                       int flags,
+                                       const cregex_allocator_t *allocator);
+
 /* Free a parsed pattern */
 void cregex_parse_free(cregex_node_t *root);
 
+/* Free a parsed pattern allocated with allocator */
+void cregex_parse_free_with(cregex_node_t *root,
+                            const cregex_allocator_t *allocator);
+
+/* Thread-safe cache of compiled programs keyed by pattern text, with LRU
+ * eviction once the memory used by cached entries exceeds capacity bytes
+ */
+typedef struct cregex_cache cregex_cache_t;
+typedef struct cregex_cache_entry cregex_cache_entry_t;
+
+/* Create a cache */
+cregex_cache_t *cregex_cache_create(size_t capacity);
+
+/* Free a cache (entries still referenced stay valid until released) */
+void cregex_cache_free(cregex_cache_t *cache);
+
+/* Look up a pattern, parsing and compiling it on a miss. Returns a reference
+ * which must be released with cregex_cache_release(), or NULL if the pattern
+ * does not compile.
+ */
+cregex_cache_entry_t *cregex_cache_get(cregex_cache_t *cache,
+                                       const char *pattern);
+
+/* Compiled program of a cache entry, valid until the entry is released */
+const cregex_program_t *cregex_cache_program(const cregex_cache_entry_t *entry);
+
+/* Release a reference returned by cregex_cache_get() */
+void cregex_cache_release(cregex_cache_entry_t *entry);
+
+/* Native code for a compiled program, built from its match-only DFA on
+ * x86-64. Programs which are not translated (other architectures, too many
+ * DFA states, patterns ending with $, which are scanned from the end, and
+ * plain strings) are run by the interpreter, so results are always those of
+ * cregex_program_run_n().
+ */
+typedef struct cregex_jit cregex_jit_t;
+
+/* Translate program, which must outlive the result. Returns NULL if out of
+ * memory.
+ */
+cregex_jit_t *cregex_jit_compile(const cregex_program_t *program);
+
+/* Whether jit runs native code rather than the interpreter */
+int cregex_jit_is_native(const cregex_jit_t *jit);
+
+/* Run the program of jit on the first length bytes of string. Strings which
+ * do not match never reach the interpreter; submatches of matching strings
+ * are found by it.
+ */
+int cregex_jit_run(const cregex_jit_t *jit,
+                   const char *string,
+                   size_t length,
+                   const char **matches,
+                   int nmatches);
+
+/* Free translated code */
+void cregex_jit_free(cregex_jit_t *jit);
+
+/* Minimized match-only DFA of a compiled program, stored as a dense table of
+ * transitions, so that checking a string costs one lookup per byte. The
+ * table can be saved, e.g. at build time, and loaded back without being
+ * rebuilt. Programs without a table (too many DFA states, patterns ending
+ * with $ and plain strings, as for the JIT) are run by the interpreter, so
+ * results are always those of cregex_program_run_n().
+ */
+typedef struct cregex_dfa cregex_dfa_t;
+
+/* Build the DFA of program, which must outlive the result. The interpreter
+ * is used instead if subset construction reaches max_states states (0 for
+ * a default of 4096), before minimization. Returns NULL if out of memory.
+ */
+cregex_dfa_t *cregex_dfa_compile(const cregex_program_t *program,
+                                 int max_states);
+
+/* Number of states of the table of dfa, or 0 if it runs the interpreter */
+int cregex_dfa_nstates(const cregex_dfa_t *dfa);
+
+/* Run the program of dfa on the first length bytes of string. Submatches of
+ * matching strings are found by the interpreter.
+ */
+int cregex_dfa_run(const cregex_dfa_t *dfa,
+                   const char *string,
+                   size_t length,
+                   const char **matches,
+                   int nmatches);
+
+/* Store dfa into the size bytes at buffer, returning the number of bytes it
+ * takes, which are only written if they fit
+ */
+size_t cregex_dfa_save(const cregex_dfa_t *dfa, void *buffer, size_t size);
+
+/* Load a DFA saved by cregex_dfa_save() for program, which must be compiled
+ * from the same pattern with the same flags and outlive the result. Returns
+ * NULL if data is not a valid saved DFA, if it was saved for a different
+ * program (as told by a hash of the program stored with it), or if out of
+ * memory.
+ */
+cregex_dfa_t *cregex_dfa_load(const cregex_program_t *program,
+                              const void *data,
+                              size_t size);
+
+/* Free a DFA */
+void cregex_dfa_free(cregex_dfa_t *dfa);
+
+/* Tagged DFA of a compiled program, which finds submatches as well: its
+ * transitions carry the register operations of the SAVE instructions they
+ * pass, and the thread order of the interpreter is kept in its states, so
+ * that submatches are those of the interpreter at the cost of a lookup and
+ * a few register operations per byte. Programs without a table (too many
+ * states, patterns ending with $ and plain strings, as for the JIT) are run
+ * by the interpreter, so results are always those of cregex_program_run_n().
+ */
+typedef struct cregex_tdfa cregex_tdfa_t;
+
+/* Build the tagged DFA of program, which must outlive the result. The
+ * interpreter is used instead if it would have more than max_states states
+ * (0 for a default of 1024). Returns NULL if out of memory.
+ */
+cregex_tdfa_t *cregex_tdfa_compile(const cregex_program_t *program,
+                                   int max_states);
+
+/* Number of states of the table of tdfa, or 0 if it runs the interpreter */
+int cregex_tdfa_nstates(const cregex_tdfa_t *tdfa);
+
+/* Run the program of tdfa on the first length bytes of string */
+int cregex_tdfa_run(const cregex_tdfa_t *tdfa,
+                    const char *string,
+                    size_t length,
+                    const char **matches,
+                    int nmatches);
+
+/* Free a tagged DFA */
+void cregex_tdfa_free(cregex_tdfa_t *tdfa);
+
 #endif
@@ -1,3 +1,6 @@
+# Cases of our own, kept in the repository rather than downloaded
+TESTCASES = tests/utf8.dat
+
 TESTDATA = basic.dat nullsubexpr.dat repetition.dat
 TESTDATA := $(addprefix tests/,$(TESTDATA))
 
@@ -0,0 +1,44 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cregex.h"
+
+static void *arena_alloc(void *context, size_t size)
+{
+    cregex_arena_t *arena = context;
+    uintptr_t align = _Alignof(max_align_t);
+    /* the buffer itself need not be aligned */
+    uintptr_t next = (uintptr_t) (arena->buffer + arena->used);
+    size_t used = arena->used + (((next + align - 1) & ~(align - 1)) - next);
+
+    if (used > arena->size || size > arena->size - used)
+        return NULL;
+
+    arena->used = used + size;
+    return arena->buffer + used;
+}
+
+static void arena_free(void *context, void *ptr)
+{
+    /* memory is released in bulk by cregex_arena_reset() */
+    (void) context;
+    (void) ptr;
+}
+
+void cregex_arena_init(cregex_arena_t *arena, void *buffer, size_t size)
+{
+    arena->buffer = buffer;
+    arena->size = size;
+    arena->used = 0;
+}
+
+void cregex_arena_reset(cregex_arena_t *arena)
+{
+    arena->used = 0;
+}
+
+cregex_allocator_t cregex_arena_allocator(cregex_arena_t *arena)
+{
+    return (cregex_allocator_t){
+        .alloc = arena_alloc, .free = arena_free, .context = arena};
+}
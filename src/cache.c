@@ -0,0 +1,255 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+/* The cache is split into independently locked shards, selected by pattern
+ * hash, so that concurrent lookups of different patterns rarely contend and
+ * no lock is shared by all callers. Each shard keeps a hash table and an LRU
+ * list of its entries, and evicts from the LRU tail once its share of the
+ * memory budget is exceeded.
+ */
+#define REGEX_CACHE_SHARDS 16
+#define REGEX_CACHE_MIN_BUCKETS 64
+
+struct cregex_cache_entry {
+    /* one reference is held by the cache while the entry is resident */
+    atomic_int refcount;
+    uint32_t hash;
+    size_t size;
+    cregex_program_t *program;
+    struct cregex_cache_entry *chain;       /* hash bucket chain */
+    struct cregex_cache_entry *prev, *next; /* LRU list, most recent first */
+    char pattern[];
+};
+
+typedef struct {
+    pthread_mutex_t lock;
+    cregex_cache_entry_t **buckets;
+    size_t nbuckets, nentries;
+    size_t size, capacity;
+    cregex_cache_entry_t *head, *tail;
+} regex_cache_shard;
+
+struct cregex_cache {
+    regex_cache_shard shards[REGEX_CACHE_SHARDS];
+};
+
+/* FNV-1a */
+static uint32_t hash_pattern(const char *pattern)
+{
+    uint32_t hash = 2166136261u;
+    for (; *pattern; ++pattern)
+        hash = (hash ^ (unsigned char) *pattern) * 16777619u;
+    return hash;
+}
+
+static size_t program_size(const cregex_program_t *program)
+{
+    return sizeof(cregex_program_t) +
+           sizeof(cregex_program_instr_t) * program->ninstructions +
+           sizeof(int) * REGEX_DISPATCH_SIZE * program->ndispatch +
+           program->literal.length + sizeof(int) * program->nclosures;
+}
+
+static void entry_unref(cregex_cache_entry_t *entry)
+{
+    if (atomic_fetch_sub_explicit(&entry->refcount, 1, memory_order_acq_rel) ==
+        1) {
+        cregex_compile_free(entry->program);
+        free(entry);
+    }
+}
+
+static void lru_unlink(regex_cache_shard *shard, cregex_cache_entry_t *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        shard->head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        shard->tail = entry->prev;
+}
+
+static void lru_push(regex_cache_shard *shard, cregex_cache_entry_t *entry)
+{
+    entry->prev = NULL;
+    entry->next = shard->head;
+    if (shard->head)
+        shard->head->prev = entry;
+    else
+        shard->tail = entry;
+    shard->head = entry;
+}
+
+static cregex_cache_entry_t *shard_find(regex_cache_shard *shard,
+                                        uint32_t hash,
+                                        const char *pattern)
+{
+    cregex_cache_entry_t *entry = shard->buckets[hash & (shard->nbuckets - 1)];
+    for (; entry; entry = entry->chain)
+        if (entry->hash == hash && strcmp(entry->pattern, pattern) == 0)
+            return entry;
+    return NULL;
+}
+
+static void shard_remove(regex_cache_shard *shard, cregex_cache_entry_t *entry)
+{
+    cregex_cache_entry_t **link =
+        &shard->buckets[entry->hash & (shard->nbuckets - 1)];
+    while (*link != entry)
+        link = &(*link)->chain;
+    *link = entry->chain;
+
+    lru_unlink(shard, entry);
+    --shard->nentries;
+    shard->size -= entry->size;
+    entry_unref(entry);
+}
+
+static void shard_grow(regex_cache_shard *shard)
+{
+    size_t nbuckets = shard->nbuckets * 2;
+    cregex_cache_entry_t **buckets = calloc(nbuckets, sizeof(buckets[0]));
+
+    /* keep the current table if the allocation fails */
+    if (!buckets)
+        return;
+
+    for (size_t i = 0; i < shard->nbuckets; ++i) {
+        for (cregex_cache_entry_t *entry = shard->buckets[i], *chain; entry;
+             entry = chain) {
+            chain = entry->chain;
+            entry->chain = buckets[entry->hash & (nbuckets - 1)];
+            buckets[entry->hash & (nbuckets - 1)] = entry;
+        }
+    }
+
+    free(shard->buckets);
+    shard->buckets = buckets;
+    shard->nbuckets = nbuckets;
+}
+
+static void shard_insert(regex_cache_shard *shard, cregex_cache_entry_t *entry)
+{
+    if (shard->nentries >= shard->nbuckets)
+        shard_grow(shard);
+
+    entry->chain = shard->buckets[entry->hash & (shard->nbuckets - 1)];
+    shard->buckets[entry->hash & (shard->nbuckets - 1)] = entry;
+    lru_push(shard, entry);
+    ++shard->nentries;
+    shard->size += entry->size;
+
+    /* evict least recently used entries, but never the one just inserted */
+    while (shard->size > shard->capacity && shard->tail != entry)
+        shard_remove(shard, shard->tail);
+}
+
+cregex_cache_t *cregex_cache_create(size_t capacity)
+{
+    cregex_cache_t *cache = calloc(1, sizeof(*cache));
+    if (!cache)
+        return NULL;
+
+    for (int i = 0; i < REGEX_CACHE_SHARDS; ++i) {
+        regex_cache_shard *shard = &cache->shards[i];
+        shard->capacity = capacity / REGEX_CACHE_SHARDS;
+        shard->nbuckets = REGEX_CACHE_MIN_BUCKETS;
+        shard->buckets = calloc(shard->nbuckets, sizeof(shard->buckets[0]));
+        if (!shard->buckets || pthread_mutex_init(&shard->lock, NULL)) {
+            free(shard->buckets);
+            while (--i >= 0) {
+                pthread_mutex_destroy(&cache->shards[i].lock);
+                free(cache->shards[i].buckets);
+            }
+            free(cache);
+            return NULL;
+        }
+    }
+
+    return cache;
+}
+
+void cregex_cache_free(cregex_cache_t *cache)
+{
+    if (!cache)
+        return;
+
+    for (int i = 0; i < REGEX_CACHE_SHARDS; ++i) {
+        regex_cache_shard *shard = &cache->shards[i];
+        while (shard->head)
+            shard_remove(shard, shard->head);
+        pthread_mutex_destroy(&shard->lock);
+        free(shard->buckets);
+    }
+    free(cache);
+}
+
+cregex_cache_entry_t *cregex_cache_get(cregex_cache_t *cache,
+                                       const char *pattern)
+{
+    uint32_t hash = hash_pattern(pattern);
+    /* the low bits of the hash select the bucket within the shard */
+    regex_cache_shard *shard =
+        &cache->shards[(hash >> 16) % REGEX_CACHE_SHARDS];
+    cregex_cache_entry_t *entry, *found;
+    size_t length = strlen(pattern);
+
+    /* hit: take a reference and mark the entry most recently used */
+    pthread_mutex_lock(&shard->lock);
+    if ((entry = shard_find(shard, hash, pattern))) {
+        atomic_fetch_add_explicit(&entry->refcount, 1, memory_order_relaxed);
+        lru_unlink(shard, entry);
+        lru_push(shard, entry);
+        pthread_mutex_unlock(&shard->lock);
+        return entry;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    /* miss: compile without holding the shard lock */
+    if (!(entry = malloc(sizeof(*entry) + length + 1)))
+        return NULL;
+    if (!(entry->program = cregex_compile(pattern, 0, NULL))) {
+        free(entry);
+        return NULL;
+    }
+    atomic_init(&entry->refcount, 2);
+    entry->hash = hash;
+    entry->size = sizeof(*entry) + length + 1 + program_size(entry->program);
+    memcpy(entry->pattern, pattern, length + 1);
+
+    /* another thread may have inserted the same pattern meanwhile */
+    pthread_mutex_lock(&shard->lock);
+    if ((found = shard_find(shard, hash, pattern))) {
+        atomic_fetch_add_explicit(&found->refcount, 1, memory_order_relaxed);
+        lru_unlink(shard, found);
+        lru_push(shard, found);
+    } else {
+        shard_insert(shard, entry);
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (found) {
+        cregex_compile_free(entry->program);
+        free(entry);
+        return found;
+    }
+    return entry;
+}
+
+const cregex_program_t *cregex_cache_program(const cregex_cache_entry_t *entry)
+{
+    return entry->program;
+}
+
+void cregex_cache_release(cregex_cache_entry_t *entry)
+{
+    if (entry)
+        entry_unref(entry);
+}
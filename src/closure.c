@@ -0,0 +1,301 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "internal.h"
+
+/* The closure of an instruction lists the instructions a thread added there
+ * ends up waiting at (characters and MATCH), in the order vm_add_thread()
+ * would reach them, each with the DISPATCH choices and the SAVEs on its
+ * path. Adding a thread is then a walk over a flat list. ^ and $ prune
+ * paths, so a closure passing either is kept for each combination of being
+ * at the beginning and at the end of the string.
+ *
+ * Marking only the waiting instructions as visited, as the VM then does,
+ * leaves threads as they are: a control-flow instruction a thread of higher
+ * priority passed leads to waiting instructions it has reached already. The
+ * alternatives of a DISPATCH cannot be left without consuming input, so
+ * following all of them here only marks instructions no other path leads
+ * to.
+ *
+ * Closures are laid out in one array of ints. Its first ninstructions
+ * entries hold the offset of the closures of each instruction threads can be
+ * added at, or 0 for none (as for characters and MATCH, where a thread added
+ * simply waits): four offsets of lists, indexed by 2 * begin + end. A list
+ * is its number of entries followed by the entries, each the waiting
+ * instruction, the number of DISPATCH choices, a DISPATCH and the
+ * instruction it must choose for each, the number of SAVEs and their slots.
+ */
+
+/* Closures taking more ints than this per instruction are not kept */
+#define REGEX_CLOSURE_MAX_INTS 32
+
+typedef struct {
+    const cregex_program_t *program;
+    int *marks, generation;
+
+    /* DISPATCH choices and SAVEs on the current path */
+    int *path, npath;
+    int *saves, nsaves;
+
+    int *closures;
+    size_t size, capacity, max_size;
+    int nentries;
+    bool asserted;
+} closure_builder;
+
+/* Append n ints at *offset, returning false if the closures would grow too
+ * large or memory runs out
+ */
+static bool closure_reserve(closure_builder *builder, size_t n, size_t *offset)
+{
+    if (builder->size + n > builder->max_size)
+        return false;
+    if (builder->size + n > builder->capacity) {
+        size_t capacity = (builder->size + n) * 2;
+        int *closures;
+        if (capacity > builder->max_size)
+            capacity = builder->max_size;
+        if (!(closures = realloc(builder->closures,
+                                 sizeof(closures[0]) * capacity)))
+            return false;
+        builder->closures = closures;
+        builder->capacity = capacity;
+    }
+    *offset = builder->size;
+    builder->size += n;
+    return true;
+}
+
+/* Append the entries reachable from pc to the list being built */
+static bool closure_walk(closure_builder *builder, int pc, bool begin, bool end)
+{
+    const cregex_program_instr_t *instructions =
+        builder->program->instructions;
+
+    for (;;) {
+        const cregex_program_instr_t *instruction = instructions + pc;
+        size_t offset;
+        int *entry;
+
+        if (builder->marks[pc] == builder->generation)
+            return true;
+        builder->marks[pc] = builder->generation;
+
+        switch (instruction->opcode) {
+        case REGEX_PROGRAM_OPCODE_MATCH:
+            /* fall-through */
+
+        /* Characters */
+        case REGEX_PROGRAM_OPCODE_CHARACTER:
+        case REGEX_PROGRAM_OPCODE_ANY_CHARACTER:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS_NEGATED:
+            if (!closure_reserve(builder,
+                                 3 + (size_t) builder->npath + builder->nsaves,
+                                 &offset))
+                return false;
+            entry = builder->closures + offset;
+            *entry++ = pc;
+            *entry++ = builder->npath / 2;
+            memcpy(entry, builder->path, sizeof(entry[0]) * builder->npath);
+            entry += builder->npath;
+            *entry++ = builder->nsaves;
+            memcpy(entry, builder->saves, sizeof(entry[0]) * builder->nsaves);
+            ++builder->nentries;
+            return true;
+
+        /* Control-flow */
+        case REGEX_PROGRAM_OPCODE_SPLIT:
+            if (!closure_walk(builder, instruction->first - instructions,
+                              begin, end))
+                return false;
+            pc = instruction->second - instructions;
+            break;
+        case REGEX_PROGRAM_OPCODE_JUMP:
+            pc = instruction->target - instructions;
+            break;
+        case REGEX_PROGRAM_OPCODE_DISPATCH:
+            for (int ch = 0; ch <= UCHAR_MAX; ++ch) {
+                if (!instruction->table[ch] ||
+                    (ch > 0 &&
+                     instruction->table[ch] == instruction->table[ch - 1]))
+                    continue;
+                builder->path[builder->npath++] = pc;
+                builder->path[builder->npath++] = pc + instruction->table[ch];
+                if (!closure_walk(builder, pc + instruction->table[ch], begin,
+                                  end))
+                    return false;
+                builder->npath -= 2;
+            }
+            return true;
+
+        /* Assertions */
+        case REGEX_PROGRAM_OPCODE_ASSERT_BEGIN:
+            builder->asserted = true;
+            if (!begin)
+                return true;
+            ++pc;
+            break;
+        case REGEX_PROGRAM_OPCODE_ASSERT_END:
+            builder->asserted = true;
+            if (!end)
+                return true;
+            ++pc;
+            break;
+
+        /* Saving */
+        case REGEX_PROGRAM_OPCODE_SAVE:
+            builder->saves[builder->nsaves++] = instruction->save;
+            if (!closure_walk(builder, pc + 1, begin, end))
+                return false;
+            --builder->nsaves;
+            return true;
+        }
+    }
+}
+
+/* Append the list of pc for a thread added at the beginning and end of the
+ * string as given, storing its offset in the closures at lists
+ */
+static bool closure_list(closure_builder *builder,
+                         int pc,
+                         bool begin,
+                         bool end,
+                         size_t lists)
+{
+    size_t offset;
+
+    if (!closure_reserve(builder, 1, &offset))
+        return false;
+    ++builder->generation;
+    builder->nentries = 0;
+    if (!closure_walk(builder, pc, begin, end))
+        return false;
+
+    builder->closures[offset] = builder->nentries;
+    builder->closures[lists + 2 * begin + end] = offset;
+    return true;
+}
+
+/* Append the closures of pc, which threads are added at, unless done */
+static bool closure_add(closure_builder *builder, int pc)
+{
+    const cregex_program_instr_t *instructions =
+        builder->program->instructions;
+    size_t lists;
+    int target = pc;
+
+    if (builder->closures[pc])
+        return true;
+
+    /* a thread added at a character or MATCH waits right there, which the
+     * VM needs no list for
+     */
+    switch (instructions[pc].opcode) {
+    case REGEX_PROGRAM_OPCODE_MATCH:
+    case REGEX_PROGRAM_OPCODE_CHARACTER:
+    case REGEX_PROGRAM_OPCODE_ANY_CHARACTER:
+    case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS:
+    case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS_NEGATED:
+        return true;
+    default:
+        break;
+    }
+
+    /* the alternatives of an alternation all jump to where it ends, and
+     * share the closures there
+     */
+    for (int n = 0; instructions[target].opcode == REGEX_PROGRAM_OPCODE_JUMP &&
+                    n < builder->program->ninstructions;
+         ++n)
+        target = instructions[target].target - instructions;
+    if (target != pc &&
+        instructions[target].opcode != REGEX_PROGRAM_OPCODE_JUMP) {
+        if (!closure_add(builder, target))
+            return false;
+        builder->closures[pc] = builder->closures[target];
+        return true;
+    }
+
+    if (!closure_reserve(builder, 4, &lists))
+        return false;
+    builder->closures[pc] = lists;
+
+    builder->asserted = false;
+    if (!closure_list(builder, pc, false, false, lists))
+        return false;
+    if (!builder->asserted) {
+        for (int i = 1; i < 4; ++i)
+            builder->closures[lists + i] = builder->closures[lists];
+        return true;
+    }
+    return closure_list(builder, pc, false, true, lists) &&
+           closure_list(builder, pc, true, false, lists) &&
+           closure_list(builder, pc, true, true, lists);
+}
+
+/* Add the closures of all instructions threads are added at: where runs
+ * start, and after each character
+ */
+static bool closure_build(closure_builder *builder)
+{
+    const cregex_program_t *program = builder->program;
+    size_t offset;
+
+    /* no instruction has closures yet */
+    if (!closure_reserve(builder, program->ninstructions, &offset))
+        return false;
+    memset(builder->closures, 0,
+           sizeof(builder->closures[0]) * program->ninstructions);
+
+    if (!closure_add(builder, 0) || !closure_add(builder, program->start) ||
+        (program->reverse && !closure_add(builder, program->reverse)))
+        return false;
+
+    for (int pc = 0; pc < program->ninstructions; ++pc) {
+        switch (program->instructions[pc].opcode) {
+        case REGEX_PROGRAM_OPCODE_CHARACTER:
+        case REGEX_PROGRAM_OPCODE_ANY_CHARACTER:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS_NEGATED:
+            if (!closure_add(builder, pc + 1))
+                return false;
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+void regex_closures_build(cregex_program_t *program,
+                          const cregex_allocator_t *allocator)
+{
+    int ninstructions = program->ninstructions;
+    closure_builder builder = {
+        .program = program,
+        .max_size = ((size_t) ninstructions + 32) * REGEX_CLOSURE_MAX_INTS};
+
+    program->closures = NULL;
+    program->nclosures = 0;
+    if (builder.max_size > INT_MAX)
+        builder.max_size = INT_MAX;
+
+    builder.marks = calloc(ninstructions, sizeof(builder.marks[0]));
+    builder.path = malloc(sizeof(builder.path[0]) * 2 * ninstructions);
+    builder.saves = malloc(sizeof(builder.saves[0]) * ninstructions);
+    if (builder.marks && builder.path && builder.saves &&
+        closure_build(&builder) &&
+        (program->closures =
+             regex_alloc(allocator, sizeof(int) * builder.size))) {
+        memcpy(program->closures, builder.closures,
+               sizeof(int) * builder.size);
+        program->nclosures = builder.size;
+    }
+
+    free(builder.marks);
+    free(builder.path);
+    free(builder.saves);
+    free(builder.closures);
+}
@@ -1,39 +1,525 @@
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include "cregex.h"
+#include "internal.h"
+
+/* The byte sequences of a class in UTF-8 mode, as compiled by
+ * compile_utf8_class()
+ */
+typedef struct {
+    int nsequences, ninstructions, ncharacters;
+    int min, max;
+    cregex_char_class first;
+} regex_utf8_summary;
+
+/* A class in UTF-8 mode, decoded and summarized once per compile */
+typedef struct {
+    const cregex_node_t *node;
+    regex_utf8_range *ranges;
+    int nranges;
+    regex_utf8_summary summary;
+} regex_utf8_class;
+
+/* The classes of a pattern in UTF-8 mode, sorted by node address */
+typedef struct {
+    regex_utf8_class *classes;
+    size_t nclasses;
+    const cregex_allocator_t *allocator; /* of classes and their ranges */
+} regex_utf8_classes;
 
 typedef struct {
     cregex_program_instr_t *pc;
     int ncaptures;
+    int flags;
+    /* the classes of the pattern, or NULL to summarize them as needed */
+    const regex_utf8_classes *utf8;
+    /* compile the reversed, capture-free program for end-anchored patterns */
+    bool reverse;
+    /* next free DISPATCH table */
+    int *table;
+    /* top of the stack of concatenated items the reversed program compiles
+     * last to first
+     */
+    const cregex_node_t **items;
 } regex_compile_context;
 
-static int count_instructions(const cregex_node_t *node)
+/* Plain string collected from a parsed pattern */
+typedef struct {
+    char *bytes;
+    int length;
+    bool begin, end;
+} regex_literal_builder;
+
+/* Add node to literal, copying its bytes to literal->bytes unless NULL.
+ * Returns false unless node is made of characters only, with ^ allowed
+ * before the first and $ after the last.
+ */
+static bool literal_append(const cregex_node_t *node,
+                           regex_literal_builder *literal)
 {
     switch (node->type) {
     case REGEX_NODE_TYPE_EPSILON:
+        return true;
+    case REGEX_NODE_TYPE_CHARACTER:
+        if (literal->end)
+            return false;
+        if (literal->bytes)
+            literal->bytes[literal->length] = node->ch;
+        ++literal->length;
+        return true;
+    case REGEX_NODE_TYPE_CONCATENATION:
+        for (; node->type == REGEX_NODE_TYPE_CONCATENATION; node = node->right)
+            if (!literal_append(node->left, literal))
+                return false;
+        return literal_append(node, literal);
+    case REGEX_NODE_TYPE_ANCHOR_BEGIN:
+        if (literal->length || literal->begin || literal->end)
+            return false;
+        literal->begin = true;
+        return true;
+    case REGEX_NODE_TYPE_ANCHOR_END:
+        if (literal->end)
+            return false;
+        literal->end = true;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Number of bytes of root if it is a pure literal (see literal_append(),
+ * optionally enclosed in one capture group) of at least one byte matched
+ * with flags, else 0
+ */
+static int node_literal(const cregex_node_t *root,
+                        int flags,
+                        regex_literal_builder *literal)
+{
+    if (flags & CREGEX_FLAG_ICASE)
         return 0;
+    if (root->type == REGEX_NODE_TYPE_CAPTURE)
+        root = root->captured;
+    return literal_append(root, literal) ? literal->length : 0;
+}
+
+/* Saturating arithmetic on match lengths and instruction counts, where -1
+ * means unbounded
+ */
+static int length_add(int a, int b)
+{
+    if (a < 0 || b < 0)
+        return -1;
+    return (a > INT_MAX - b) ? -1 : a + b;
+}
+
+static int length_mul(int a, int n)
+{
+    if (a < 0)
+        return (n > 0) ? -1 : 0;
+    return (n > 0 && a > INT_MAX / n) ? -1 : a * n;
+}
+
+/* Whether node matches a code point rather than a byte */
+static inline bool is_utf8_class(const cregex_node_t *node, int flags)
+{
+    return (flags & CREGEX_FLAG_UTF8) &&
+           (node->type == REGEX_NODE_TYPE_ANY_CHARACTER ||
+            node->type == REGEX_NODE_TYPE_CHARACTER_CLASS ||
+            node->type == REGEX_NODE_TYPE_CHARACTER_CLASS_NEGATED);
+}
+
+static void summarize_sequence(void *arg, const regex_utf8_sequence *sequence)
+{
+    regex_utf8_summary *summary = arg;
+
+    summary->ninstructions += sequence->length;
+    if (sequence->length < summary->min)
+        summary->min = sequence->length;
+    if (sequence->length > summary->max)
+        summary->max = sequence->length;
+    for (size_t i = 0; i < sizeof(cregex_char_class); ++i)
+        summary->first[i] |= sequence->bytes[0][i];
+}
+
+/* Summarize the byte sequences of the code points ranges */
+static void summarize_ranges(const regex_utf8_range *ranges,
+                             int nranges,
+                             regex_utf8_summary *summary)
+{
+    *summary = (regex_utf8_summary){.min = INT_MAX};
+    if (nranges < 0) {
+        /* out of memory: nothing fits, and matches are one byte or more */
+        summary->nsequences = summary->ninstructions =
+            summary->ncharacters = -1;
+        summary->min = 1;
+        summary->max = -1;
+        memset(summary->first, 0xff, sizeof(summary->first));
+        return;
+    }
+    summary->nsequences =
+        regex_utf8_sequences(ranges, nranges, summarize_sequence, summary);
+    if (summary->nsequences == 0) {
+        /* an empty class, which never matches */
+        summary->ninstructions = summary->ncharacters = 1;
+        summary->min = summary->max = 1;
+        return;
+    }
+    summary->ncharacters = summary->ninstructions;
+    /* a SPLIT and a JUMP for every sequence but the last */
+    summary->ninstructions += 2 * (summary->nsequences - 1);
+}
+
+static int compare_classes(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) ((const regex_utf8_class *) a)->node,
+              y = (uintptr_t) ((const regex_utf8_class *) b)->node;
+    return (x > y) - (x < y);
+}
+
+/* The class of node kept in context, or NULL */
+static const regex_utf8_class *find_utf8_class(
+    const regex_compile_context *context,
+    const cregex_node_t *node)
+{
+    regex_utf8_class key = {.node = node};
+
+    if (!context->utf8)
+        return NULL;
+    return bsearch(&key, context->utf8->classes, context->utf8->nclasses,
+                   sizeof(key), compare_classes);
+}
+
+static void summarize_utf8_class(const regex_compile_context *context,
+                                 const cregex_node_t *node,
+                                 regex_utf8_summary *summary)
+{
+    const regex_utf8_class *klass = find_utf8_class(context, node);
+    regex_utf8_range *ranges = NULL;
+
+    if (klass) {
+        *summary = klass->summary;
+        return;
+    }
+    summarize_ranges(ranges,
+                     regex_utf8_ranges(node, context->flags,
+                                       context->utf8->allocator, &ranges),
+                     summary);
+    regex_free(context->utf8->allocator, ranges);
+}
+
+/* Count the classes of node in UTF-8 mode, storing their nodes in classes
+ * unless NULL
+ */
+static size_t collect_utf8_classes(const cregex_node_t *node,
+                                   int flags,
+                                   regex_utf8_class *classes)
+{
+    switch (node->type) {
+    /* Characters */
+    case REGEX_NODE_TYPE_ANY_CHARACTER:
+    case REGEX_NODE_TYPE_CHARACTER_CLASS:
+    case REGEX_NODE_TYPE_CHARACTER_CLASS_NEGATED:
+        if (!is_utf8_class(node, flags))
+            return 0;
+        if (classes)
+            classes->node = node;
+        return 1;
+
+    /* Composites, whose chains are walked in a loop */
+    case REGEX_NODE_TYPE_CONCATENATION:
+    case REGEX_NODE_TYPE_ALTERNATION: {
+        cregex_node_type type = node->type;
+        size_t count = 0;
+        for (; node->type == type; node = node->right)
+            count += collect_utf8_classes(node->left, flags,
+                                          classes ? classes + count : NULL);
+        return count + collect_utf8_classes(node, flags,
+                                            classes ? classes + count : NULL);
+    }
+
+    /* Quantifiers, whose copies share their classes */
+    case REGEX_NODE_TYPE_QUANTIFIER:
+        return collect_utf8_classes(node->quantified, flags, classes);
+
+    /* Captures */
+    case REGEX_NODE_TYPE_CAPTURE:
+        return collect_utf8_classes(node->captured, flags, classes);
+
+    /* Characters, anchors and empty nodes */
+    default:
+        return 0;
+    }
+}
+
+/* Decode and summarize every class of root in UTF-8 mode once, so that
+ * sizing and compiling look them up instead of walking their text again.
+ * Returns false if memory runs out.
+ */
+static bool utf8_classes_build(regex_utf8_classes *utf8,
+                               const cregex_node_t *root,
+                               int flags,
+                               const cregex_allocator_t *allocator)
+{
+    *utf8 = (regex_utf8_classes){.allocator = allocator};
+    if (!(flags & CREGEX_FLAG_UTF8) ||
+        !(utf8->nclasses = collect_utf8_classes(root, flags, NULL)))
+        return true;
+    if (!(utf8->classes = regex_alloc(allocator, sizeof(utf8->classes[0]) *
+                                                     utf8->nclasses)))
+        return false;
+    memset(utf8->classes, 0, sizeof(utf8->classes[0]) * utf8->nclasses);
+    collect_utf8_classes(root, flags, utf8->classes);
+    qsort(utf8->classes, utf8->nclasses, sizeof(utf8->classes[0]),
+          compare_classes);
+
+    for (size_t i = 0; i < utf8->nclasses; ++i) {
+        regex_utf8_class *klass = &utf8->classes[i];
+        if ((klass->nranges = regex_utf8_ranges(klass->node, flags, allocator,
+                                                &klass->ranges)) < 0)
+            return false;
+        summarize_ranges(klass->ranges, klass->nranges, &klass->summary);
+    }
+    return true;
+}
+
+static void utf8_classes_free(regex_utf8_classes *utf8)
+{
+    for (size_t i = 0; i < utf8->nclasses && utf8->classes; ++i)
+        regex_free(utf8->allocator, utf8->classes[i].ranges);
+    regex_free(utf8->allocator, utf8->classes);
+}
+
+/* Other case of an ASCII letter, or -1 */
+static inline int other_case(int ch)
+{
+    if (ch >= 'a' && ch <= 'z')
+        return ch - 'a' + 'A';
+    if (ch >= 'A' && ch <= 'Z')
+        return ch - 'A' + 'a';
+    return -1;
+}
+
+/* Add the other case of every letter in a character class */
+static void fold_char_class(cregex_char_class klass)
+{
+    for (int ch = 'A'; ch <= 'Z'; ++ch) {
+        if (cregex_char_class_contains(klass, ch) ||
+            cregex_char_class_contains(klass, other_case(ch))) {
+            cregex_char_class_add(klass, ch);
+            cregex_char_class_add(klass, other_case(ch));
+        }
+    }
+}
+
+static cregex_program_instr_t *compile_char_class(
+    const regex_compile_context *context,
+    const cregex_node_t *node,
+    cregex_program_instr_t *instruction)
+{
+    const char *sp = node->from;
+
+    for (;;) {
+        int ch = (unsigned char) *sp++;
+        switch (ch) {
+        case ']':
+            if (sp - 1 == node->from)
+                goto CHARACTER;
+            /* a negated class is folded before negation, so that e.g. [^a]
+             * excludes both 'a' and 'A'
+             */
+            if (context->flags & CREGEX_FLAG_ICASE)
+                fold_char_class(instruction->klass);
+            return instruction;
+        case '\\':
+            ch = (unsigned char) *sp++;
+            /* fall-through */
+        default:
+        CHARACTER:
+            if (*sp == '-' && sp[1] != ']') {
+                for (; ch <= (unsigned char) sp[1]; ++ch)
+                    cregex_char_class_add(instruction->klass, ch);
+                sp += 2;
+            } else {
+                cregex_char_class_add(instruction->klass, ch);
+            }
+            break;
+        }
+    }
+}
+
+/* Add the bytes which can begin a match of node to klass, returning whether
+ * node can also match the empty string
+ */
+static bool node_first_bytes(const regex_compile_context *context,
+                             const cregex_node_t *node,
+                             cregex_char_class klass)
+{
+    cregex_program_instr_t instruction = {0};
+    regex_utf8_summary summary;
+
+    if (is_utf8_class(node, context->flags)) {
+        summarize_utf8_class(context, node, &summary);
+        for (size_t i = 0; i < sizeof(cregex_char_class); ++i)
+            klass[i] |= summary.first[i];
+        return false;
+    }
+
+    switch (node->type) {
+    case REGEX_NODE_TYPE_EPSILON:
+        return true;
 
     /* Characters */
     case REGEX_NODE_TYPE_CHARACTER:
+        cregex_char_class_add(klass, node->ch);
+        if ((context->flags & CREGEX_FLAG_ICASE) && other_case(node->ch) >= 0)
+            cregex_char_class_add(klass, other_case(node->ch));
+        return false;
     case REGEX_NODE_TYPE_ANY_CHARACTER:
+        memset(klass, 0xff, sizeof(cregex_char_class));
+        return false;
     case REGEX_NODE_TYPE_CHARACTER_CLASS:
     case REGEX_NODE_TYPE_CHARACTER_CLASS_NEGATED:
+        compile_char_class(context, node, &instruction);
+        for (size_t i = 0; i < sizeof(cregex_char_class); ++i)
+            klass[i] |= (node->type == REGEX_NODE_TYPE_CHARACTER_CLASS)
+                            ? instruction.klass[i]
+                            : ~instruction.klass[i];
+        return false;
+
+    /* Composites, whose chains are walked in a loop */
+    case REGEX_NODE_TYPE_CONCATENATION:
+        for (; node->type == REGEX_NODE_TYPE_CONCATENATION; node = node->right)
+            if (!node_first_bytes(context, node->left, klass))
+                return false;
+        return node_first_bytes(context, node, klass);
+    case REGEX_NODE_TYPE_ALTERNATION: {
+        /* all alternatives must be visited */
+        bool empty = false;
+        for (; node->type == REGEX_NODE_TYPE_ALTERNATION; node = node->right)
+            empty |= node_first_bytes(context, node->left, klass);
+        return node_first_bytes(context, node, klass) || empty;
+    }
+
+    /* Quantifiers */
+    case REGEX_NODE_TYPE_QUANTIFIER:
+        if (node->nmin == 0 && node->nmax == 0)
+            return true;
+        return node_first_bytes(context, node->quantified, klass) ||
+               node->nmin == 0;
+
+    /* Anchors are zero-width; the bytes after them still begin the match */
+    case REGEX_NODE_TYPE_ANCHOR_BEGIN:
+    case REGEX_NODE_TYPE_ANCHOR_END:
+        return true;
+
+    /* Captures */
+    case REGEX_NODE_TYPE_CAPTURE:
+        return node_first_bytes(context, node->captured, klass);
+    }
+
+    /* should not reach here */
+    memset(klass, 0xff, sizeof(cregex_char_class));
+    return true;
+}
+
+/* Alternations of at least this many alternatives may compile to a DISPATCH
+ * instead of a chain of SPLITs, which every thread reaching them would have
+ * to walk
+ */
+#define REGEX_COMPILE_MIN_DISPATCH 4
+
+/* Whether the alternation node compiles to a DISPATCH in the forward
+ * program: none of its alternatives can match the empty string and no two
+ * can begin with the same byte, so the next byte picks the only one which
+ * can match
+ */
+static bool is_dispatch(const regex_compile_context *context,
+                        const cregex_node_t *node)
+{
+    cregex_char_class seen = {0};
+    int count = 0;
+
+    for (const cregex_node_t *chain = node;
+         chain->type == REGEX_NODE_TYPE_ALTERNATION; chain = chain->right)
+        ++count;
+    if (count + 1 < REGEX_COMPILE_MIN_DISPATCH)
+        return false;
+
+    for (;; node = node->right) {
+        bool last = node->type != REGEX_NODE_TYPE_ALTERNATION;
+        cregex_char_class first = {0};
+        if (node_first_bytes(context, last ? node : node->left, first))
+            return false;
+        for (size_t i = 0; i < sizeof(cregex_char_class); ++i) {
+            if (seen[i] & first[i])
+                return false;
+            seen[i] |= first[i];
+        }
+        if (last)
+            return true;
+    }
+}
+
+/* Number of instructions node compiles to in the forward program, with SAVE
+ * instructions for captures and DISPATCHes, or in the reversed program, or
+ * -1 if that does not fit in an int
+ */
+static int count_instructions(const regex_compile_context *context,
+                              const cregex_node_t *node,
+                              bool forward)
+{
+    regex_utf8_summary summary;
+
+    switch (node->type) {
+    case REGEX_NODE_TYPE_EPSILON:
+        return 0;
+
+    /* Characters */
+    case REGEX_NODE_TYPE_CHARACTER:
         return 1;
+    case REGEX_NODE_TYPE_ANY_CHARACTER:
+    case REGEX_NODE_TYPE_CHARACTER_CLASS:
+    case REGEX_NODE_TYPE_CHARACTER_CLASS_NEGATED:
+        if (!is_utf8_class(node, context->flags))
+            return 1;
+        summarize_utf8_class(context, node, &summary);
+        return summary.ninstructions;
 
-    /* Composites */
+    /* Composites, whose chains are walked in a loop */
     case REGEX_NODE_TYPE_CONCATENATION:
-        return count_instructions(node->left) + count_instructions(node->right);
-    case REGEX_NODE_TYPE_ALTERNATION:
-        return 2 + count_instructions(node->left) +
-               count_instructions(node->right);
+    case REGEX_NODE_TYPE_ALTERNATION: {
+        cregex_node_type type = node->type;
+        /* a SPLIT and a JUMP for every alternative but the last, or a
+         * DISPATCH and the JUMPs
+         */
+        int count = 0, extra = 0;
+        if (type == REGEX_NODE_TYPE_ALTERNATION) {
+            extra = 2;
+            if (forward && is_dispatch(context, node)) {
+                count = 1;
+                extra = 1;
+            }
+        }
+        for (; node->type == type; node = node->right)
+            count = length_add(
+                count,
+                length_add(count_instructions(context, node->left, forward),
+                           extra));
+        return length_add(count, count_instructions(context, node, forward));
+    }
 
     /* Quantifiers */
     case REGEX_NODE_TYPE_QUANTIFIER: {
-        int num = count_instructions(node->quantified);
+        int num = count_instructions(context, node->quantified, forward);
         if (node->nmax >= node->nmin)
-            return node->nmin * num + (node->nmax - node->nmin) * (num + 1);
-        return 1 + (node->nmin ? node->nmin * num : num + 1);
+            return length_add(
+                length_mul(num, node->nmin),
+                length_mul(length_add(num, 1), node->nmax - node->nmin));
+        return length_add(1, node->nmin ? length_mul(num, node->nmin)
+                                        : length_add(num, 1));
     }
 
     /* Anchors */
@@ -43,49 +529,346 @@ static int count_instructions(const cregex_node_t *node)
 
     /* Captures */
     case REGEX_NODE_TYPE_CAPTURE:
-        return 2 + count_instructions(node->captured);
+        return length_add(forward * 2,
+                          count_instructions(context, node->captured, forward));
     }
 
     /* should not reach here */
     return 0;
 }
 
+/* Number of DISPATCH tables node compiles to, one for every copy of a
+ * dispatching alternation, or -1 if that does not fit in an int
+ */
+static int count_tables(const regex_compile_context *context,
+                        const cregex_node_t *node)
+{
+    switch (node->type) {
+    /* Composites, whose chains are walked in a loop */
+    case REGEX_NODE_TYPE_CONCATENATION:
+    case REGEX_NODE_TYPE_ALTERNATION: {
+        cregex_node_type type = node->type;
+        int count = (type == REGEX_NODE_TYPE_ALTERNATION &&
+                     is_dispatch(context, node));
+        for (; node->type == type; node = node->right)
+            count = length_add(count, count_tables(context, node->left));
+        return length_add(count, count_tables(context, node));
+    }
+
+    /* Quantifiers, whose copies are compiled as in count_instructions() */
+    case REGEX_NODE_TYPE_QUANTIFIER: {
+        int num = count_tables(context, node->quantified);
+        if (node->nmax >= node->nmin)
+            return length_mul(num, node->nmax);
+        return node->nmin ? length_mul(num, node->nmin) : num;
+    }
+
+    /* Captures */
+    case REGEX_NODE_TYPE_CAPTURE:
+        return count_tables(context, node->captured);
+
+    /* Characters, anchors and empty nodes */
+    default:
+        return 0;
+    }
+}
+
+/* Number of character instructions node compiles to in the forward
+ * program, where threads wait for the next byte, or -1 if that does not fit
+ * in an int
+ */
+static int count_characters(const regex_compile_context *context,
+                            const cregex_node_t *node)
+{
+    regex_utf8_summary summary;
+
+    switch (node->type) {
+    /* Characters */
+    case REGEX_NODE_TYPE_CHARACTER:
+    case REGEX_NODE_TYPE_ANY_CHARACTER:
+    case REGEX_NODE_TYPE_CHARACTER_CLASS:
+    case REGEX_NODE_TYPE_CHARACTER_CLASS_NEGATED:
+        if (!is_utf8_class(node, context->flags))
+            return 1;
+        summarize_utf8_class(context, node, &summary);
+        return summary.ncharacters;
+
+    /* Composites, whose chains are walked in a loop */
+    case REGEX_NODE_TYPE_CONCATENATION:
+    case REGEX_NODE_TYPE_ALTERNATION: {
+        cregex_node_type type = node->type;
+        int count = 0;
+        for (; node->type == type; node = node->right)
+            count = length_add(count, count_characters(context, node->left));
+        return length_add(count, count_characters(context, node));
+    }
+
+    /* Quantifiers, whose copies are compiled as in count_instructions() */
+    case REGEX_NODE_TYPE_QUANTIFIER: {
+        int num = count_characters(context, node->quantified);
+        if (node->nmax >= node->nmin)
+            return length_mul(num, node->nmax);
+        return node->nmin ? length_mul(num, node->nmin) : num;
+    }
+
+    /* Captures */
+    case REGEX_NODE_TYPE_CAPTURE:
+        return count_characters(context, node->captured);
+
+    /* Anchors and empty nodes */
+    default:
+        return 0;
+    }
+}
+
+/* Number of capture groups of node */
+static int count_captures(const cregex_node_t *node)
+{
+    switch (node->type) {
+    /* Composites, whose chains are walked in a loop */
+    case REGEX_NODE_TYPE_CONCATENATION:
+    case REGEX_NODE_TYPE_ALTERNATION: {
+        cregex_node_type type = node->type;
+        int count = 0;
+        for (; node->type == type; node = node->right)
+            count += count_captures(node->left);
+        return count + count_captures(node);
+    }
+
+    /* Quantifiers, whose copies share their groups */
+    case REGEX_NODE_TYPE_QUANTIFIER:
+        return count_captures(node->quantified);
+
+    /* Captures */
+    case REGEX_NODE_TYPE_CAPTURE:
+        return 1 + count_captures(node->captured);
+
+    /* Characters, anchors and empty nodes */
+    default:
+        return 0;
+    }
+}
+
+/* Number of copies of the most repeated part of node the compiler makes for
+ * counted repetitions, or -1 if that does not fit in an int
+ */
+static int count_copies(const cregex_node_t *node)
+{
+    switch (node->type) {
+    /* Composites, whose chains are walked in a loop */
+    case REGEX_NODE_TYPE_CONCATENATION:
+    case REGEX_NODE_TYPE_ALTERNATION: {
+        cregex_node_type type = node->type;
+        int max = 1, copies;
+        for (;; node = node->right) {
+            bool last = node->type != type;
+            copies = count_copies(last ? node : node->left);
+            if (copies < 0)
+                return -1;
+            if (copies > max)
+                max = copies;
+            if (last)
+                return max;
+        }
+    }
+
+    /* Quantifiers, copied as in count_instructions() */
+    case REGEX_NODE_TYPE_QUANTIFIER: {
+        int copies = node->nmax >= node->nmin ? node->nmax : node->nmin;
+        return length_mul(count_copies(node->quantified),
+                          copies > 1 ? copies : 1);
+    }
+
+    /* Captures */
+    case REGEX_NODE_TYPE_CAPTURE:
+        return count_copies(node->captured);
+
+    /* Characters, anchors and empty nodes */
+    default:
+        return 1;
+    }
+}
+
+/* Number of nodes of node, which bounds the concatenated items the reversed
+ * program stacks at once
+ */
+static size_t count_nodes(const cregex_node_t *node)
+{
+    switch (node->type) {
+    /* Composites, whose chains are walked in a loop */
+    case REGEX_NODE_TYPE_CONCATENATION:
+    case REGEX_NODE_TYPE_ALTERNATION: {
+        cregex_node_type type = node->type;
+        size_t count = 0;
+        for (; node->type == type; node = node->right)
+            count += 1 + count_nodes(node->left);
+        return count + count_nodes(node);
+    }
+
+    /* Quantifiers, whose copies are compiled one at a time */
+    case REGEX_NODE_TYPE_QUANTIFIER:
+        return 1 + count_nodes(node->quantified);
+
+    /* Captures */
+    case REGEX_NODE_TYPE_CAPTURE:
+        return 1 + count_nodes(node->captured);
+
+    /* Characters, anchors and empty nodes */
+    default:
+        return 1;
+    }
+}
+
 static bool node_is_anchored(const cregex_node_t *node)
 {
+    for (;;) {
+        switch (node->type) {
+        /* Composites */
+        case REGEX_NODE_TYPE_CONCATENATION:
+            node = node->left;
+            break;
+        case REGEX_NODE_TYPE_ALTERNATION:
+            if (!node_is_anchored(node->left))
+                return false;
+            node = node->right;
+            break;
+
+        /* Quantifiers, which anchor only if they cannot be skipped */
+        case REGEX_NODE_TYPE_QUANTIFIER:
+            if (node->nmin == 0)
+                return false;
+            node = node->quantified;
+            break;
+
+        /* Anchors */
+        case REGEX_NODE_TYPE_ANCHOR_BEGIN:
+            return true;
+
+        /* Captures */
+        case REGEX_NODE_TYPE_CAPTURE:
+            node = node->captured;
+            break;
+
+        default:
+            return false;
+        }
+    }
+}
+
+/* Whether every match of node ends with $ */
+static bool node_is_end_anchored(const cregex_node_t *node)
+{
+    for (;;) {
+        switch (node->type) {
+        /* Composites */
+        case REGEX_NODE_TYPE_CONCATENATION:
+            node = node->right;
+            break;
+        case REGEX_NODE_TYPE_ALTERNATION:
+            if (!node_is_end_anchored(node->left))
+                return false;
+            node = node->right;
+            break;
+
+        /* Anchors */
+        case REGEX_NODE_TYPE_ANCHOR_END:
+            return true;
+
+        /* Captures */
+        case REGEX_NODE_TYPE_CAPTURE:
+            node = node->captured;
+            break;
+
+        default:
+            return false;
+        }
+    }
+}
+
+/* Shortest and longest possible match of node in bytes. The maximum is -1 if
+ * matches can be arbitrarily long; the minimum saturates at INT_MAX, which is
+ * still a valid lower bound.
+ */
+static void node_length_bounds(const regex_compile_context *context,
+                               const cregex_node_t *node,
+                               int *min,
+                               int *max)
+{
+    int lmin, lmax, rmin, rmax;
+    regex_utf8_summary summary;
+
     switch (node->type) {
     case REGEX_NODE_TYPE_EPSILON:
-        return false;
+        *min = *max = 0;
+        return;
 
     /* Characters */
     case REGEX_NODE_TYPE_CHARACTER:
     case REGEX_NODE_TYPE_ANY_CHARACTER:
     case REGEX_NODE_TYPE_CHARACTER_CLASS:
     case REGEX_NODE_TYPE_CHARACTER_CLASS_NEGATED:
-        return false;
+        *min = *max = 1;
+        if (is_utf8_class(node, context->flags)) {
+            summarize_utf8_class(context, node, &summary);
+            *min = summary.min;
+            *max = summary.max;
+        }
+        return;
 
-    /* Composites */
+    /* Composites, whose chains are walked in a loop */
     case REGEX_NODE_TYPE_CONCATENATION:
-        return node_is_anchored(node->left);
+        *min = *max = 0;
+        for (;; node = node->right) {
+            bool last = node->type != REGEX_NODE_TYPE_CONCATENATION;
+            node_length_bounds(context, last ? node : node->left, &rmin, &rmax);
+            *min = length_add(*min, rmin);
+            if (*min < 0)
+                *min = INT_MAX;
+            *max = length_add(*max, rmax);
+            if (last)
+                return;
+        }
     case REGEX_NODE_TYPE_ALTERNATION:
-        return node_is_anchored(node->left) && node_is_anchored(node->right);
+        *min = INT_MAX;
+        *max = 0;
+        for (;; node = node->right) {
+            bool last = node->type != REGEX_NODE_TYPE_ALTERNATION;
+            node_length_bounds(context, last ? node : node->left, &rmin, &rmax);
+            if (rmin < *min)
+                *min = rmin;
+            *max = (*max < 0 || rmax < 0) ? -1 : (*max > rmax) ? *max : rmax;
+            if (last)
+                return;
+        }
 
     /* Quantifiers */
     case REGEX_NODE_TYPE_QUANTIFIER:
-        return node_is_anchored(node->quantified);
+        node_length_bounds(context, node->quantified, &lmin, &lmax);
+        *min = length_mul(lmin, node->nmin);
+        if (*min < 0)
+            *min = INT_MAX;
+        /* nmax < nmin means unbounded, as in count_instructions() */
+        if (node->nmax >= node->nmin)
+            *max = length_mul(lmax, node->nmax);
+        else
+            *max = (lmax == 0) ? 0 : -1;
+        return;
 
     /* Anchors */
     case REGEX_NODE_TYPE_ANCHOR_BEGIN:
-        return true;
     case REGEX_NODE_TYPE_ANCHOR_END:
-        return false;
+        *min = *max = 0;
+        return;
 
     /* Captures */
     case REGEX_NODE_TYPE_CAPTURE:
-        return node_is_anchored(node->captured);
+        node_length_bounds(context, node->captured, min, max);
+        return;
     }
 
     /* should not reach here */
-    return false;
+    *min = 0;
+    *max = -1;
 }
 
 static inline cregex_program_instr_t *emit(
@@ -96,33 +879,79 @@ static inline cregex_program_instr_t *emit(
     return context->pc++;
 }
 
-static cregex_program_instr_t *compile_char_class(
-    const cregex_node_t *node,
-    cregex_program_instr_t *instruction)
+/* Emit an instruction matching the bytes of klass */
+static void compile_byte_class(regex_compile_context *context,
+                               const cregex_char_class klass)
 {
-    const char *sp = node->from;
+    int nbytes = 0, last = 0;
+    cregex_program_instr_t *instruction;
 
-    for (;;) {
-        int ch = *sp++;
-        switch (ch) {
-        case ']':
-            if (sp - 1 == node->from)
-                goto CHARACTER;
-            return instruction;
-        case '\\':
-            ch = *sp++;
-            /* fall-through */
-        default:
-        CHARACTER:
-            if (*sp == '-' && sp[1] != ']') {
-                for (; ch <= sp[1]; ++ch)
-                    cregex_char_class_add(instruction->klass, ch);
-                sp += 2;
-            } else {
-                cregex_char_class_add(instruction->klass, ch);
-            }
-            break;
-        }
+    for (int ch = 0; ch <= UCHAR_MAX; ++ch)
+        if (cregex_char_class_contains(klass, ch))
+            ++nbytes, last = ch;
+    if (nbytes == 1) {
+        emit(context,
+             &(cregex_program_instr_t){.opcode = REGEX_PROGRAM_OPCODE_CHARACTER,
+                                       .ch = last});
+        return;
+    }
+    instruction =
+        emit(context, &(cregex_program_instr_t){
+                          .opcode = REGEX_PROGRAM_OPCODE_CHARACTER_CLASS});
+    memcpy(instruction->klass, klass, sizeof(cregex_char_class));
+}
+
+typedef struct {
+    regex_compile_context *context;
+    int remaining;
+    /* JUMPs past the class, chained through their targets until patched */
+    cregex_program_instr_t *jumps;
+} regex_utf8_compiler;
+
+static void compile_sequence(void *arg, const regex_utf8_sequence *sequence)
+{
+    regex_utf8_compiler *compiler = arg;
+    regex_compile_context *context = compiler->context;
+    cregex_program_instr_t *split = NULL, *jump;
+
+    if (--compiler->remaining > 0)
+        split = emit(context, &(cregex_program_instr_t){
+                                  .opcode = REGEX_PROGRAM_OPCODE_SPLIT});
+    for (int i = 0; i < sequence->length; ++i)
+        compile_byte_class(
+            context,
+            sequence->bytes[context->reverse ? sequence->length - 1 - i : i]);
+    if (split) {
+        split->first = split + 1;
+        jump = emit(context, &(cregex_program_instr_t){
+                                 .opcode = REGEX_PROGRAM_OPCODE_JUMP,
+                                 .target = compiler->jumps});
+        compiler->jumps = jump;
+        split->second = context->pc;
+    }
+}
+
+/* Compile a class (or .) in UTF-8 mode to alternatives of byte sequences,
+ * from the classes decoded before sizing the program
+ */
+static void compile_utf8_class(regex_compile_context *context,
+                               const cregex_node_t *node)
+{
+    const regex_utf8_class *klass = find_utf8_class(context, node);
+    regex_utf8_compiler compiler = {
+        .context = context, .remaining = klass->summary.nsequences};
+
+    if (compiler.remaining == 0) {
+        emit(context, &(cregex_program_instr_t){
+                          .opcode = REGEX_PROGRAM_OPCODE_CHARACTER_CLASS});
+        return;
+    }
+    regex_utf8_sequences(klass->ranges, klass->nranges, compile_sequence,
+                         &compiler);
+    while (compiler.jumps) {
+        cregex_program_instr_t *next = compiler.jumps->target;
+        compiler.jumps->target = context->pc;
+        compiler.jumps = next;
     }
 }
 
@@ -132,12 +961,28 @@ static cregex_program_instr_t *compile_context(regex_compile_context *context,
     cregex_program_instr_t *bottom = context->pc, *split, *jump;
     int ncaptures = context->ncaptures, capture;
 
+    if (is_utf8_class(node, context->flags)) {
+        compile_utf8_class(context, node);
+        return bottom;
+    }
+
     switch (node->type) {
     case REGEX_NODE_TYPE_EPSILON:
         break;
 
     /* Characters */
     case REGEX_NODE_TYPE_CHARACTER:
+        /* a case-insensitive letter becomes a two-member class, which is
+         * still a single instruction
+         */
+        if ((context->flags & CREGEX_FLAG_ICASE) && other_case(node->ch) >= 0) {
+            cregex_program_instr_t *instruction = emit(
+                context, &(cregex_program_instr_t){
+                             .opcode = REGEX_PROGRAM_OPCODE_CHARACTER_CLASS});
+            cregex_char_class_add(instruction->klass, node->ch);
+            cregex_char_class_add(instruction->klass, other_case(node->ch));
+            break;
+        }
         emit(context,
              &(cregex_program_instr_t){.opcode = REGEX_PROGRAM_OPCODE_CHARACTER,
                                        .ch = node->ch});
@@ -148,32 +993,88 @@ static cregex_program_instr_t *compile_context(regex_compile_context *context,
         break;
     case REGEX_NODE_TYPE_CHARACTER_CLASS:
         compile_char_class(
-            node,
+            context, node,
             emit(context, &(cregex_program_instr_t){
                               .opcode = REGEX_PROGRAM_OPCODE_CHARACTER_CLASS}));
         break;
     case REGEX_NODE_TYPE_CHARACTER_CLASS_NEGATED:
         compile_char_class(
-            node,
+            context, node,
             emit(context,
                  &(cregex_program_instr_t){
                      .opcode = REGEX_PROGRAM_OPCODE_CHARACTER_CLASS_NEGATED}));
         break;
 
-    /* Composites */
+    /* Composites, whose chains are walked in a loop */
     case REGEX_NODE_TYPE_CONCATENATION:
-        compile_context(context, node->left);
-        compile_context(context, node->right);
+        if (context->reverse) {
+            /* the reversed program has the items in the opposite order:
+             * they are pushed, then popped and compiled one after the other,
+             * so no item needs sizing
+             */
+            const cregex_node_t **items = context->items;
+            for (; node->type == REGEX_NODE_TYPE_CONCATENATION;
+                 node = node->right)
+                *context->items++ = node->left;
+            *context->items++ = node;
+            while (context->items > items)
+                compile_context(context, *--context->items);
+        } else {
+            for (; node->type == REGEX_NODE_TYPE_CONCATENATION;
+                 node = node->right)
+                compile_context(context, node->left);
+            compile_context(context, node);
+        }
         break;
-    case REGEX_NODE_TYPE_ALTERNATION:
-        split = emit(context, &(cregex_program_instr_t){
-                                  .opcode = REGEX_PROGRAM_OPCODE_SPLIT});
-        split->first = compile_context(context, node->left);
-        jump = emit(context, &(cregex_program_instr_t){
-                                 .opcode = REGEX_PROGRAM_OPCODE_JUMP});
-        split->second = compile_context(context, node->right);
-        jump->target = context->pc;
+    case REGEX_NODE_TYPE_ALTERNATION: {
+        /* JUMPs to the end, chained through their targets until patched */
+        cregex_program_instr_t *jumps = NULL;
+        if (!context->reverse && is_dispatch(context, node)) {
+            cregex_program_instr_t *dispatch = emit(
+                context, &(cregex_program_instr_t){
+                             .opcode = REGEX_PROGRAM_OPCODE_DISPATCH,
+                             .table = context->table});
+            memset(context->table, 0,
+                   sizeof(context->table[0]) * REGEX_DISPATCH_SIZE);
+            context->table += REGEX_DISPATCH_SIZE;
+            for (;; node = node->right) {
+                bool last = node->type != REGEX_NODE_TYPE_ALTERNATION;
+                const cregex_node_t *item = last ? node : node->left;
+                cregex_char_class first = {0};
+                int offset = compile_context(context, item) - dispatch;
+                node_first_bytes(context, item, first);
+                for (int ch = 0; ch <= UCHAR_MAX; ++ch)
+                    if (cregex_char_class_contains(first, ch))
+                        dispatch->table[ch] = offset;
+                if (last)
+                    break;
+                jump = emit(context, &(cregex_program_instr_t){
+                                         .opcode = REGEX_PROGRAM_OPCODE_JUMP,
+                                         .target = jumps});
+                jumps = jump;
+            }
+        } else {
+            for (; node->type == REGEX_NODE_TYPE_ALTERNATION;
+                 node = node->right) {
+                split = emit(context,
+                             &(cregex_program_instr_t){
+                                 .opcode = REGEX_PROGRAM_OPCODE_SPLIT});
+                split->first = compile_context(context, node->left);
+                jump = emit(context, &(cregex_program_instr_t){
+                                         .opcode = REGEX_PROGRAM_OPCODE_JUMP,
+                                         .target = jumps});
+                jumps = jump;
+                split->second = context->pc;
+            }
+            compile_context(context, node);
+        }
+        while (jumps) {
+            jump = jumps->target;
+            jumps->target = context->pc;
+            jumps = jump;
+        }
         break;
+    }
 
     /* Quantifiers */
     case REGEX_NODE_TYPE_QUANTIFIER: {
@@ -230,6 +1131,10 @@ static cregex_program_instr_t *compile_context(regex_compile_context *context,
 
     /* Captures */
     case REGEX_NODE_TYPE_CAPTURE:
+        if (context->reverse) {
+            compile_context(context, node->captured);
+            break;
+        }
         capture = context->ncaptures++ * 2;
         emit(context,
              &(cregex_program_instr_t){.opcode = REGEX_PROGRAM_OPCODE_SAVE,
@@ -244,75 +1149,408 @@ static cregex_program_instr_t *compile_context(regex_compile_context *context,
     return bottom;
 }
 
-/* Compile a parsed pattern (using a previously allocated program with at least
- * estimate_instructions(root) instructions).
+/* Compile a parsed pattern (using a previously allocated program with room
+ * for count_program() instructions, followed by count_tables() DISPATCH
+ * tables and the bytes of the pattern if it is a pure literal, and with
+ * ninstructions, ndispatch, min_length and max_length already set), with
+ * the classes of utf8 if flags has CREGEX_FLAG_UTF8. Temporaries are
+ * allocated with allocator. Returns NULL if memory runs out.
  */
-static cregex_program_t *compile_node_with_program(const cregex_node_t *root,
-                                                   cregex_program_t *program)
+static cregex_program_t *compile_node_with_program(
+    const cregex_node_t *root,
+    int flags,
+    const cregex_allocator_t *allocator,
+    const regex_utf8_classes *utf8,
+    cregex_program_t *program)
 {
     /* add capture node for entire match */
-    root = &(cregex_node_t){.type = REGEX_NODE_TYPE_CAPTURE,
-                            .captured = (cregex_node_t *) root};
-
-    /* add .*? unless pattern starts with ^ */
-    if (!node_is_anchored(root))
-        root = &(cregex_node_t){
-            .type = REGEX_NODE_TYPE_CONCATENATION,
-            .left =
-                &(cregex_node_t){
-                    .type = REGEX_NODE_TYPE_QUANTIFIER,
-                    .nmin = 0,
-                    .nmax = -1,
-                    .greedy = 0,
-                    .quantified = &(
-                        cregex_node_t){.type = REGEX_NODE_TYPE_ANY_CHARACTER}},
-            .right = (cregex_node_t *) root};
+    cregex_node_t *capture =
+        &(cregex_node_t){.type = REGEX_NODE_TYPE_CAPTURE,
+                         .captured = (cregex_node_t *) root};
+
+    /* add .*? unless pattern starts with ^
+     * (the compound literals must outlive compile_context() below, so they
+     * are declared at function scope rather than inside a conditional)
+     */
+    cregex_node_t *prefixed = &(cregex_node_t){
+        .type = REGEX_NODE_TYPE_CONCATENATION,
+        .left =
+            &(cregex_node_t){
+                .type = REGEX_NODE_TYPE_QUANTIFIER,
+                .nmin = 0,
+                .nmax = -1,
+                .greedy = 0,
+                .quantified =
+                    &(cregex_node_t){.type = REGEX_NODE_TYPE_ANY_CHARACTER}},
+        .right = capture};
+    root = node_is_anchored(capture) ? capture : prefixed;
 
     /* compile */
     regex_compile_context *context =
-        &(regex_compile_context){.pc = program->instructions, .ncaptures = 0};
-    compile_context(context, root);
+        &(regex_compile_context){
+            .pc = program->instructions,
+            .ncaptures = 0,
+            .flags = flags,
+            .utf8 = utf8,
+            .table = (int *) (program->instructions + program->ninstructions)};
+    if (root == prefixed) {
+        /* the prefix steps over bytes, so that a search can start anywhere,
+         * even in input which is not valid UTF-8
+         */
+        context->flags = flags & ~CREGEX_FLAG_UTF8;
+        compile_context(context, prefixed->left);
+        context->flags = flags;
+    }
+    compile_context(context, capture);
+    program->start = (root == capture) ? 0 : 3;
 
     /* emit final match instruction */
     emit(context,
          &(cregex_program_instr_t){.opcode = REGEX_PROGRAM_OPCODE_MATCH});
 
+    /* let the VM skip over bytes which cannot begin a match */
+    program->nfirst = 0;
+    memset(program->first, 0, sizeof(program->first));
+    if (program->start && !node_first_bytes(context, capture, program->first)) {
+        for (int ch = 0; ch <= UCHAR_MAX; ++ch)
+            program->nfirst += !!cregex_char_class_contains(program->first, ch);
+        /* nothing to skip */
+        if (program->nfirst > UCHAR_MAX)
+            program->nfirst = 0;
+    }
+    regex_scan_prepare(program);
+
+    /* an end-anchored pattern is followed by its reversal, which is matched
+     * backwards from the end of the string to find where the match starts.
+     * Anchored patterns of bounded length need not look past their maximum
+     * length, so scanning from the end would only waste time.
+     */
+    program->reverse = 0;
+    if (node_is_end_anchored(capture) &&
+        !(program->start == 0 && program->max_length >= 0)) {
+        const cregex_node_t **items =
+            regex_alloc(allocator, sizeof(items[0]) * count_nodes(capture));
+        if (!items)
+            return NULL;
+        program->reverse = context->pc - program->instructions;
+        context->reverse = true;
+        context->items = items;
+        compile_context(context, capture);
+        emit(context,
+             &(cregex_program_instr_t){.opcode = REGEX_PROGRAM_OPCODE_MATCH});
+        regex_free(allocator, items);
+    }
+
     /* set total number of instructions */
     program->ninstructions = context->pc - program->instructions;
 
+    /* plain strings are searched for without the VM; the bytes follow the
+     * instructions (there are no DISPATCH tables in a plain string), where
+     * compile_node_limited() reserved room for them
+     */
+    regex_literal_builder literal = {0};
+    program->literal.length = node_literal(capture->captured, flags, &literal);
+    if (program->literal.length) {
+        literal = (regex_literal_builder){
+            .bytes = (char *) regex_literal(program)};
+        node_literal(capture->captured, flags, &literal);
+    }
+    program->literal.begin = literal.begin;
+    program->literal.end = literal.end;
+    program->literal.capture =
+        capture->captured->type == REGEX_NODE_TYPE_CAPTURE;
+
+    regex_plan(program);
+
     return program;
 }
 
-/* Upper bound of number of instructions required to compile parsed pattern. */
-static int estimate_instructions(const cregex_node_t *root)
+/* Number of instructions of the forward program of a parsed pattern, or -1
+ * if it does not fit in an int
+ */
+static int count_forward(const regex_compile_context *context,
+                         const cregex_node_t *root)
+{
+    /* .*? is added unless pattern starts with ^,
+     * save instructions are added for beginning and end of match,
+     * a final match instruction is added to the end of the program
+     */
+    return length_add(count_instructions(context, root, true),
+                      !node_is_anchored(root) * 3 + 2 + 1);
+}
+
+/* Number of instructions compile_node_with_program() emits for a parsed
+ * pattern whose matches are at most max_length bytes long (-1 if unbounded),
+ * or -1 if it does not fit in an int
+ */
+static int count_program(const regex_compile_context *context,
+                         const cregex_node_t *root,
+                         int max_length)
 {
-    return count_instructions(root)
-           /* .*? is added unless pattern starts with ^,
-            * save instructions are added for beginning and end of match,
-            * a final match instruction is added to the end of the program
-            */
-           + !node_is_anchored(root) * 3 + 2 + 1;
+    bool anchored = node_is_anchored(root);
+    int count = count_forward(context, root);
+
+    /* reversed program without saves, followed by a match, under the same
+     * conditions as in compile_node_with_program()
+     */
+    if (node_is_end_anchored(root) && !(anchored && max_length >= 0))
+        count = length_add(
+            count, length_add(count_instructions(context, root, false), 1));
+    return count;
+}
+
+/* Instructions taking as much memory as a DISPATCH table, rounded up */
+#define REGEX_COMPILE_TABLE_INSTRUCTIONS                                       \
+    ((int) (sizeof(int) * REGEX_DISPATCH_SIZE /                                \
+            sizeof(cregex_program_instr_t)) +                                  \
+     1)
+
+/* Compile a parsed pattern within limits, setting *error on failure */
+static cregex_program_t *compile_node_limited(
+    const cregex_node_t *root,
+    int flags,
+    const cregex_allocator_t *allocator,
+    const cregex_limits_t *limits,
+    int *error)
+{
+    regex_literal_builder literal = {0};
+    size_t nliteral = node_literal(root, flags, &literal);
+    regex_utf8_classes utf8;
+    regex_compile_context context = {.flags = flags, .utf8 = &utf8};
+    cregex_program_t *program = NULL;
+    int min_length, max_length, ninstructions, ntables;
+
+    if (!utf8_classes_build(&utf8, root, flags, allocator)) {
+        *error = CREGEX_ERROR;
+        goto out;
+    }
+
+    /* needed to size the program, and kept in it */
+    node_length_bounds(&context, root, &min_length, &max_length);
+    ninstructions = count_program(&context, root, max_length);
+    ntables = count_tables(&context, root);
+
+    /* checked before anything is allocated, so oversized repetitions cost
+     * no more than walking the parsed pattern
+     */
+    if (ninstructions < 0 || ntables < 0 ||
+        (limits && limits->max_instructions &&
+         length_add(ninstructions,
+                    length_mul(ntables, REGEX_COMPILE_TABLE_INSTRUCTIONS)) >
+             limits->max_instructions)) {
+        *error = CREGEX_ERROR_LIMIT;
+        goto out;
+    }
+
+    if (!(program = regex_alloc(allocator,
+                                sizeof(cregex_program_t) +
+                                    sizeof(cregex_program_instr_t) *
+                                        (size_t) ninstructions +
+                                    sizeof(int) * REGEX_DISPATCH_SIZE *
+                                        (size_t) ntables +
+                                    nliteral))) {
+        *error = CREGEX_ERROR;
+        goto out;
+    }
+
+    program->ninstructions = ninstructions;
+    program->ndispatch = ntables;
+    program->flags = flags;
+    program->min_length = min_length;
+    program->max_length = max_length;
+    if (!compile_node_with_program(root, flags, allocator, &utf8, program)) {
+        regex_free(allocator, program);
+        program = NULL;
+        *error = CREGEX_ERROR;
+        goto out;
+    }
+    regex_closures_build(program, allocator);
+
+out:
+    utf8_classes_free(&utf8);
+    return program;
 }
 
 cregex_program_t *cregex_compile_node(const cregex_node_t *root)
 {
-    size_t size = sizeof(cregex_program_t) +
-                  sizeof(cregex_program_instr_t) * estimate_instructions(root);
+    return cregex_compile_node_with(root, 0, NULL);
+}
+
+cregex_program_t *cregex_compile_node_with(const cregex_node_t *root,
+                                           int flags,
+                                           const cregex_allocator_t *allocator)
+{
+    int error;
+    return compile_node_limited(root, flags, allocator, NULL, &error);
+}
+
+/* Patterns needing at most this many nodes are parsed on the stack */
+#define REGEX_COMPILE_STACK_NODES 256
+
+cregex_program_t *cregex_compile(const char *pattern,
+                                 int flags,
+                                 const cregex_allocator_t *allocator)
+{
+    return cregex_compile_limited(pattern, flags, allocator, NULL, NULL);
+}
+
+cregex_program_t *cregex_compile_limited(const char *pattern,
+                                         int flags,
+                                         const cregex_allocator_t *allocator,
+                                         const cregex_limits_t *limits,
+                                         int *error)
+{
+    cregex_node_t nodes[REGEX_COMPILE_STACK_NODES];
+    cregex_arena_t arena;
+    cregex_allocator_t scratch;
+    const cregex_allocator_t *parse_allocator = allocator;
+    cregex_node_t *root;
     cregex_program_t *program;
+    int ignored;
 
-    if (!(program = malloc(size)))
-        return NULL;
+    if (!error)
+        error = &ignored;
 
-    if (!compile_node_with_program(root, program)) {
-        free(program);
+    /* parse into a temporary arena, which needs no cleanup, if it fits */
+    if (regex_estimate_nodes(pattern) <= REGEX_COMPILE_STACK_NODES) {
+        cregex_arena_init(&arena, nodes, sizeof(nodes));
+        scratch = cregex_arena_allocator(&arena);
+        parse_allocator = &scratch;
+    }
+
+    if (!(root = cregex_parse_with_flags(pattern, flags, parse_allocator))) {
+        *error = CREGEX_ERROR;
         return NULL;
     }
 
+    program = compile_node_limited(root, flags, allocator, limits, error);
+    cregex_parse_free_with(root, parse_allocator);
     return program;
 }
 
+void cregex_node_cost(const cregex_node_t *root,
+                      int flags,
+                      cregex_cost_t *cost)
+{
+    regex_utf8_classes utf8;
+    regex_compile_context context = {.flags = flags, .utf8 = &utf8};
+    int min_length, max_length, forward;
+
+    /* without memory for the classes, each is decoded where needed */
+    if (!utf8_classes_build(&utf8, root, flags, NULL)) {
+        utf8_classes_free(&utf8);
+        utf8 = (regex_utf8_classes){0};
+    }
+
+    node_length_bounds(&context, root, &min_length, &max_length);
+    forward = count_forward(&context, root);
+
+    cost->ninstructions = count_program(&context, root, max_length);
+    cost->ncaptures = count_captures(root);
+    /* the characters of the pattern, the .*? of unanchored patterns and
+     * MATCH
+     */
+    cost->max_threads = length_add(count_characters(&context, root),
+                                   !node_is_anchored(root) + 1);
+    /* each thread steps once, then every instruction of the forward program
+     * is followed at most once while adding the threads for the next byte
+     */
+    cost->work_per_byte = length_add(cost->max_threads, forward);
+    cost->repetition_copies = count_copies(root);
+    utf8_classes_free(&utf8);
+}
+
+int cregex_cost(const char *pattern, int flags, cregex_cost_t *cost)
+{
+    cregex_node_t nodes[REGEX_COMPILE_STACK_NODES];
+    cregex_arena_t arena;
+    cregex_allocator_t scratch;
+    const cregex_allocator_t *parse_allocator = NULL;
+    cregex_node_t *root;
+
+    /* parsed like cregex_compile_limited() does */
+    if (regex_estimate_nodes(pattern) <= REGEX_COMPILE_STACK_NODES) {
+        cregex_arena_init(&arena, nodes, sizeof(nodes));
+        scratch = cregex_arena_allocator(&arena);
+        parse_allocator = &scratch;
+    }
+
+    if (!(root = cregex_parse_with_flags(pattern, flags, parse_allocator)))
+        return CREGEX_ERROR;
+    cregex_node_cost(root, flags, cost);
+    cregex_parse_free_with(root, parse_allocator);
+    return 0;
+}
+
 /* Free a compiled program */
 void cregex_compile_free(cregex_program_t *program)
 {
-    free(program);
+    cregex_compile_free_with(program, NULL);
+}
+
+void cregex_compile_free_with(cregex_program_t *program,
+                              const cregex_allocator_t *allocator)
+{
+    if (program && program->closures)
+        regex_free(allocator, program->closures);
+    regex_free(allocator, program);
+}
+
+/* Bytes of program before its closures */
+static size_t program_bytes(const cregex_program_t *program)
+{
+    return sizeof(cregex_program_t) +
+           sizeof(cregex_program_instr_t) * program->ninstructions +
+           sizeof(int) * REGEX_DISPATCH_SIZE * program->ndispatch +
+           program->literal.length;
+}
+
+/* Offset of the closures in a copy of program */
+static size_t program_closures_offset(const cregex_program_t *program)
+{
+    return (program_bytes(program) + _Alignof(int) - 1) &
+           ~(_Alignof(int) - 1);
+}
+
+size_t regex_program_copy_size(const cregex_program_t *program)
+{
+    return program_closures_offset(program) +
+           sizeof(int) * program->nclosures;
+}
+
+cregex_program_t *regex_program_copy(void *memory,
+                                     const cregex_program_t *program)
+{
+    cregex_program_t *copy = memory;
+    const cregex_program_instr_t *from = program->instructions;
+    cregex_program_instr_t *to = copy->instructions;
+
+    memcpy(copy, program, program_bytes(program));
+
+    /* instructions point into the program */
+    for (int i = 0; i < program->ninstructions; ++i) {
+        switch (from[i].opcode) {
+        case REGEX_PROGRAM_OPCODE_SPLIT:
+            to[i].first = to + (from[i].first - from);
+            to[i].second = to + (from[i].second - from);
+            break;
+        case REGEX_PROGRAM_OPCODE_JUMP:
+            to[i].target = to + (from[i].target - from);
+            break;
+        case REGEX_PROGRAM_OPCODE_DISPATCH:
+            to[i].table = (int *) (to + program->ninstructions) +
+                          (from[i].table - regex_dispatch_tables(program));
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (program->closures) {
+        copy->closures =
+            (int *) ((char *) copy + program_closures_offset(program));
+        memcpy(copy->closures, program->closures,
+               sizeof(int) * program->nclosures);
+    }
+    return copy;
 }
@@ -0,0 +1,951 @@
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+/* The DFA is built by subset construction over the program. A DFA state is
+ * the sorted set of instructions threads may be waiting at: characters,
+ * MATCH, and $ assertions which can only be passed at the end of input. The
+ * state reached at the beginning of input is kept apart from identical sets
+ * seen later, since ^ assertions may still be passed from it.
+ */
+typedef struct {
+    const cregex_program_t *program;
+    int ninstructions;
+    int max_states;
+
+    /* scratch space for closures */
+    int *marks, generation;
+    int *stack;
+    int *seeds;
+    int *set, nset;
+
+    /* states, whose instruction sets live in pool */
+    int nstates, capacity;
+    size_t *offsets;
+    int *sizes;
+    bool *begins;
+    int *pool;
+    size_t npool, pool_capacity;
+
+    /* open addressing hash table of state index + 1 */
+    int *table;
+    size_t ntable;
+
+    regex_dfa *dfa;
+} dfa_builder;
+
+static int compare_int(const void *a, const void *b)
+{
+    int x = *(const int *) a, y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+/* Collect into builder->set the instructions reachable from seeds without
+ * consuming input, passing ^ only if begin and $ only if end
+ */
+static void closure(dfa_builder *builder,
+                    const int *seeds,
+                    int nseeds,
+                    bool begin,
+                    bool end)
+{
+    const cregex_program_instr_t *instructions =
+        builder->program->instructions;
+    int nstack = 0;
+
+    ++builder->generation;
+    builder->nset = 0;
+
+    for (int i = nseeds - 1; i >= 0; --i)
+        builder->stack[nstack++] = seeds[i];
+
+    while (nstack > 0) {
+        int pc = builder->stack[--nstack];
+        const cregex_program_instr_t *instruction = instructions + pc;
+
+        if (builder->marks[pc] == builder->generation)
+            continue;
+        builder->marks[pc] = builder->generation;
+
+        switch (instruction->opcode) {
+        case REGEX_PROGRAM_OPCODE_MATCH:
+            /* fall-through */
+
+        /* Characters */
+        case REGEX_PROGRAM_OPCODE_CHARACTER:
+        case REGEX_PROGRAM_OPCODE_ANY_CHARACTER:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS_NEGATED:
+            builder->set[builder->nset++] = pc;
+            break;
+
+        /* Control-flow */
+        case REGEX_PROGRAM_OPCODE_SPLIT:
+            builder->stack[nstack++] = instruction->second - instructions;
+            builder->stack[nstack++] = instruction->first - instructions;
+            break;
+        case REGEX_PROGRAM_OPCODE_JUMP:
+            builder->stack[nstack++] = instruction->target - instructions;
+            break;
+        case REGEX_PROGRAM_OPCODE_DISPATCH:
+            /* the next byte is not known yet, but the alternatives it does
+             * not select fail on it anyway
+             */
+            for (int ch = UCHAR_MAX; ch >= 0; --ch)
+                if (instruction->table[ch] &&
+                    (ch == UCHAR_MAX ||
+                     instruction->table[ch] != instruction->table[ch + 1]))
+                    builder->stack[nstack++] = pc + instruction->table[ch];
+            break;
+
+        /* Assertions */
+        case REGEX_PROGRAM_OPCODE_ASSERT_BEGIN:
+            if (begin)
+                builder->stack[nstack++] = pc + 1;
+            break;
+        case REGEX_PROGRAM_OPCODE_ASSERT_END:
+            if (end)
+                builder->stack[nstack++] = pc + 1;
+            else
+                builder->set[builder->nset++] = pc;
+            break;
+
+        /* Saving */
+        case REGEX_PROGRAM_OPCODE_SAVE:
+            builder->stack[nstack++] = pc + 1;
+            break;
+        }
+    }
+
+    qsort(builder->set, builder->nset, sizeof(builder->set[0]), compare_int);
+}
+
+static uint32_t hash_set(const int *set, int nset, bool begin)
+{
+    uint32_t hash = 2166136261u ^ begin;
+    for (int i = 0; i < nset; ++i)
+        hash = (hash ^ (uint32_t) set[i]) * 16777619u;
+    return hash;
+}
+
+static bool state_equals(const dfa_builder *builder, int state, bool begin)
+{
+    return builder->begins[state] == begin &&
+           builder->sizes[state] == builder->nset &&
+           memcmp(builder->pool + builder->offsets[state], builder->set,
+                  sizeof(builder->set[0]) * builder->nset) == 0;
+}
+
+static bool grow_states(dfa_builder *builder)
+{
+    int capacity = builder->capacity ? builder->capacity * 2 : 64;
+    regex_dfa *dfa = builder->dfa;
+    size_t *offsets;
+    int *sizes, *next;
+    bool *begins;
+    unsigned char *flags;
+
+    if (capacity > builder->max_states)
+        capacity = builder->max_states;
+
+    if (!(offsets = realloc(builder->offsets, sizeof(offsets[0]) * capacity)))
+        return false;
+    builder->offsets = offsets;
+    if (!(sizes = realloc(builder->sizes, sizeof(sizes[0]) * capacity)))
+        return false;
+    builder->sizes = sizes;
+    if (!(begins = realloc(builder->begins, sizeof(begins[0]) * capacity)))
+        return false;
+    builder->begins = begins;
+    if (!(flags = realloc(dfa->flags, sizeof(flags[0]) * capacity)))
+        return false;
+    dfa->flags = flags;
+    if (!(next = realloc(dfa->next, sizeof(next[0]) * 256 * capacity)))
+        return false;
+    dfa->next = next;
+
+    builder->capacity = capacity;
+    return true;
+}
+
+static bool grow_table(dfa_builder *builder)
+{
+    size_t ntable = builder->ntable ? builder->ntable * 2 : 128;
+    int *table = calloc(ntable, sizeof(table[0]));
+
+    if (!table)
+        return false;
+
+    for (int state = 0; state < builder->nstates; ++state) {
+        size_t i = hash_set(builder->pool + builder->offsets[state],
+                            builder->sizes[state], builder->begins[state]) &
+                   (ntable - 1);
+        while (table[i])
+            i = (i + 1) & (ntable - 1);
+        table[i] = state + 1;
+    }
+
+    free(builder->table);
+    builder->table = table;
+    builder->ntable = ntable;
+    return true;
+}
+
+/* Index of the state for the current closure, added if new. Returns -1 if
+ * the state limit is reached or memory runs out.
+ */
+static int add_state(dfa_builder *builder, bool begin)
+{
+    size_t i;
+    int state;
+
+    /* keep the table at most half full */
+    if ((size_t) builder->nstates * 2 >= builder->ntable &&
+        !grow_table(builder))
+        return -1;
+
+    i = hash_set(builder->set, builder->nset, begin) & (builder->ntable - 1);
+    for (; builder->table[i]; i = (i + 1) & (builder->ntable - 1))
+        if (state_equals(builder, builder->table[i] - 1, begin))
+            return builder->table[i] - 1;
+
+    if (builder->nstates == builder->max_states)
+        return -1;
+    if (builder->nstates == builder->capacity && !grow_states(builder))
+        return -1;
+
+    if (builder->npool + builder->nset >= builder->pool_capacity) {
+        size_t capacity = (builder->npool + builder->nset) * 2 + 64;
+        int *pool = realloc(builder->pool, sizeof(pool[0]) * capacity);
+        if (!pool)
+            return -1;
+        builder->pool = pool;
+        builder->pool_capacity = capacity;
+    }
+
+    state = builder->nstates++;
+    builder->offsets[state] = builder->npool;
+    builder->sizes[state] = builder->nset;
+    builder->begins[state] = begin;
+    memcpy(builder->pool + builder->npool, builder->set,
+           sizeof(builder->set[0]) * builder->nset);
+    builder->npool += builder->nset;
+    builder->table[i] = state + 1;
+
+    return state;
+}
+
+int regex_byte_classes(const cregex_program_t *program,
+                       int ninstructions,
+                       unsigned char classes[256])
+{
+    const cregex_program_instr_t *instructions = program->instructions;
+    bool boundary[256] = {false};
+    int nclasses = 0;
+
+    for (int pc = 0; pc < ninstructions; ++pc) {
+        switch (instructions[pc].opcode) {
+        case REGEX_PROGRAM_OPCODE_CHARACTER:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS_NEGATED:
+            for (int ch = 1; ch < 256; ++ch)
+                if (regex_accepts(instructions + pc, ch) !=
+                    regex_accepts(instructions + pc, ch - 1))
+                    boundary[ch] = true;
+            break;
+        case REGEX_PROGRAM_OPCODE_DISPATCH:
+            for (int ch = 1; ch < 256; ++ch)
+                if (instructions[pc].table[ch] !=
+                    instructions[pc].table[ch - 1])
+                    boundary[ch] = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    for (int ch = 0; ch < 256; ++ch) {
+        nclasses += boundary[ch];
+        classes[ch] = nclasses;
+    }
+    return nclasses + 1;
+}
+
+/* Compute flags and transitions of state */
+static bool expand_state(dfa_builder *builder,
+                         int state,
+                         const unsigned char classes[256],
+                         int nclasses)
+{
+    const cregex_program_instr_t *instructions =
+        builder->program->instructions;
+    regex_dfa *dfa = builder->dfa;
+    int *next = dfa->next + (size_t) state * 256;
+    int nset = builder->sizes[state];
+    bool begin = builder->begins[state];
+    int *seeds = builder->seeds, nseeds;
+    int targets[256];
+    const int *set;
+
+    /* match states absorb all input */
+    dfa->flags[state] = 0;
+    set = builder->pool + builder->offsets[state];
+    for (int i = 0; i < nset; ++i) {
+        if (instructions[set[i]].opcode == REGEX_PROGRAM_OPCODE_MATCH) {
+            dfa->flags[state] = REGEX_DFA_MATCH | REGEX_DFA_EOF_MATCH;
+            for (int ch = 0; ch < 256; ++ch)
+                next[ch] = state;
+            return true;
+        }
+    }
+
+    /* pass the $ assertions at the end of input */
+    nseeds = 0;
+    for (int i = 0; i < nset; ++i)
+        if (instructions[set[i]].opcode == REGEX_PROGRAM_OPCODE_ASSERT_END)
+            seeds[nseeds++] = set[i];
+    closure(builder, seeds, nseeds, begin, true);
+    for (int i = 0; i < builder->nset; ++i)
+        if (instructions[builder->set[i]].opcode == REGEX_PROGRAM_OPCODE_MATCH)
+            dfa->flags[state] = REGEX_DFA_EOF_MATCH;
+
+    /* one transition per byte class, using its first byte */
+    for (int class = 0, ch = 0; class < nclasses; ++class) {
+        while (classes[ch] != class)
+            ++ch;
+
+        /* the pool may move while states are added */
+        set = builder->pool + builder->offsets[state];
+        nseeds = 0;
+        for (int i = 0; i < nset; ++i)
+            if (instructions[set[i]].opcode !=
+                    REGEX_PROGRAM_OPCODE_ASSERT_END &&
+                regex_accepts(instructions + set[i], ch))
+                seeds[nseeds++] = set[i] + 1;
+        closure(builder, seeds, nseeds, false, false);
+
+        if ((targets[class] = add_state(builder, false)) < 0)
+            return false;
+    }
+
+    /* the transition table may have moved as well */
+    next = dfa->next + (size_t) state * 256;
+    for (int ch = 0; ch < 256; ++ch)
+        next[ch] = targets[classes[ch]];
+    return true;
+}
+
+regex_dfa *regex_dfa_build(const cregex_program_t *program, int max_states)
+{
+    /* the reversed program, if any, is not part of the search */
+    int ninstructions =
+        program->reverse ? program->reverse : program->ninstructions;
+    dfa_builder builder = {.program = program,
+                           .ninstructions = ninstructions,
+                           .max_states = max_states};
+    unsigned char classes[256];
+    int nclasses, start = 0;
+    bool ok = false;
+
+    if (!(builder.dfa = calloc(1, sizeof(*builder.dfa))))
+        return NULL;
+    builder.marks = calloc(ninstructions, sizeof(builder.marks[0]));
+    /* every instruction is expanded at most once, pushing at most two, or
+     * one per byte for a DISPATCH
+     */
+    builder.stack = malloc(sizeof(builder.stack[0]) *
+                           ((size_t) ninstructions * 3 +
+                            (size_t) program->ndispatch * REGEX_DISPATCH_SIZE));
+    builder.seeds = malloc(sizeof(builder.seeds[0]) * ninstructions);
+    builder.set = malloc(sizeof(builder.set[0]) * ninstructions);
+    if (!builder.marks || !builder.stack || !builder.seeds || !builder.set)
+        goto done;
+
+    nclasses = regex_byte_classes(program, ninstructions, classes);
+
+    /* the dead state, then the start state */
+    builder.nset = 0;
+    if (max_states < 2 || add_state(&builder, false) != 0)
+        goto done;
+    closure(&builder, &start, 1, true, false);
+    if ((builder.dfa->start = add_state(&builder, true)) < 0)
+        goto done;
+
+    /* states are expanded in the order they are discovered */
+    for (int state = 0; state < builder.nstates; ++state)
+        if (!expand_state(&builder, state, classes, nclasses))
+            goto done;
+
+    builder.dfa->nstates = builder.nstates;
+    memcpy(builder.dfa->classes, classes, sizeof(classes));
+    builder.dfa->nclasses = nclasses;
+    ok = true;
+
+done:
+    free(builder.marks);
+    free(builder.stack);
+    free(builder.seeds);
+    free(builder.set);
+    free(builder.offsets);
+    free(builder.sizes);
+    free(builder.begins);
+    free(builder.pool);
+    free(builder.table);
+    if (!ok) {
+        regex_dfa_free(builder.dfa);
+        return NULL;
+    }
+    return builder.dfa;
+}
+
+void regex_dfa_free(regex_dfa *dfa)
+{
+    if (!dfa)
+        return;
+    free(dfa->flags);
+    free(dfa->next);
+    free(dfa);
+}
+
+/* Partition of the states of a DFA into blocks of states which no input
+ * seen so far tells apart, refined by Hopcroft's algorithm
+ */
+typedef struct {
+    int nstates, nclasses;
+    /* states whose transition on class c leads to state t are
+     * predecessors[starts[t * nclasses + c] .. starts[t * nclasses + c + 1])
+     */
+    int *starts, *predecessors;
+    /* the states of each block form a range of elements, with the states
+     * marked by the current splitter at its front
+     */
+    int *elements, *locations, *blocks;
+    int *firsts, *ends, *marked;
+    int nblocks;
+    /* blocks with marked states */
+    int *touched, ntouched;
+    /* blocks waiting to be used as splitters */
+    int *pending, npending;
+    bool *waiting;
+    /* states of the current splitter */
+    int *splitter;
+} dfa_partition;
+
+static void mark_state(dfa_partition *partition, int state)
+{
+    int block = partition->blocks[state];
+    int at = partition->firsts[block] + partition->marked[block];
+    int location = partition->locations[state], other;
+
+    if (location < at)
+        return;
+    if (partition->marked[block]++ == 0)
+        partition->touched[partition->ntouched++] = block;
+
+    other = partition->elements[at];
+    partition->elements[at] = state;
+    partition->locations[state] = at;
+    partition->elements[location] = other;
+    partition->locations[other] = location;
+}
+
+static void push_block(dfa_partition *partition, int block)
+{
+    if (!partition->waiting[block]) {
+        partition->waiting[block] = true;
+        partition->pending[partition->npending++] = block;
+    }
+}
+
+/* Split the touched blocks into their marked and unmarked states */
+static void split_touched(dfa_partition *partition)
+{
+    for (int i = 0; i < partition->ntouched; ++i) {
+        int block = partition->touched[i];
+        int marked = partition->marked[block];
+        int size = partition->ends[block] - partition->firsts[block];
+        int split;
+
+        partition->marked[block] = 0;
+        if (marked == size)
+            continue;
+
+        split = partition->nblocks++;
+        partition->firsts[split] = partition->firsts[block];
+        partition->ends[split] = partition->firsts[block] + marked;
+        partition->firsts[block] += marked;
+        for (int j = partition->firsts[split]; j < partition->ends[split]; ++j)
+            partition->blocks[partition->elements[j]] = split;
+
+        /* a waiting block is used as both halves; otherwise the smaller
+         * half is enough, which bounds the work by n log n
+         */
+        if (partition->waiting[block] || marked <= size - marked)
+            push_block(partition, split);
+        else
+            push_block(partition, block);
+    }
+    partition->ntouched = 0;
+}
+
+static void refine(dfa_partition *partition)
+{
+    int nclasses = partition->nclasses;
+
+    while (partition->npending > 0) {
+        int block = partition->pending[--partition->npending], nsplitter = 0;
+
+        /* the splitter may itself be split while it is used */
+        partition->waiting[block] = false;
+        for (int i = partition->firsts[block]; i < partition->ends[block]; ++i)
+            partition->splitter[nsplitter++] = partition->elements[i];
+
+        for (int class = 0; class < nclasses; ++class) {
+            for (int i = 0; i < nsplitter; ++i) {
+                const int *at = partition->starts +
+                                (size_t) partition->splitter[i] * nclasses +
+                                class;
+                for (int j = at[0]; j < at[1]; ++j)
+                    mark_state(partition, partition->predecessors[j]);
+            }
+            split_touched(partition);
+        }
+    }
+}
+
+/* Replace the states of dfa with the blocks of partition */
+static bool merge_blocks(regex_dfa *dfa, const dfa_partition *partition)
+{
+    int *numbers = malloc(sizeof(numbers[0]) * partition->nblocks);
+    int nstates = 2, match = -1;
+    unsigned char *flags = NULL;
+    int *next = NULL;
+
+    if (!numbers)
+        return false;
+
+    /* the dead state first, then the match state, then the others in the
+     * order of their first states
+     */
+    for (int block = 0; block < partition->nblocks; ++block)
+        numbers[block] = -1;
+    numbers[partition->blocks[0]] = 0;
+    for (int state = 0; state < dfa->nstates; ++state)
+        if (dfa->flags[state] & REGEX_DFA_MATCH)
+            match = state;
+    if (match >= 0)
+        numbers[partition->blocks[match]] = 1;
+    for (int state = 0; state < dfa->nstates; ++state)
+        if (numbers[partition->blocks[state]] < 0)
+            numbers[partition->blocks[state]] = nstates++;
+
+    flags = malloc(sizeof(flags[0]) * nstates);
+    next = malloc(sizeof(next[0]) * 256 * (size_t) nstates);
+    if (!flags || !next) {
+        free(numbers);
+        free(flags);
+        free(next);
+        return false;
+    }
+
+    /* a pattern which never matches still gets a match state */
+    flags[1] = REGEX_DFA_MATCH | REGEX_DFA_EOF_MATCH;
+    for (int ch = 0; ch < 256; ++ch)
+        next[256 + ch] = 1;
+
+    for (int block = 0; block < partition->nblocks; ++block) {
+        int state = partition->elements[partition->firsts[block]];
+        int number = numbers[block];
+        flags[number] = dfa->flags[state];
+        for (int ch = 0; ch < 256; ++ch)
+            next[(size_t) number * 256 + ch] =
+                numbers[partition->blocks[dfa->next[(size_t) state * 256 +
+                                                    ch]]];
+    }
+
+    free(dfa->flags);
+    free(dfa->next);
+    dfa->flags = flags;
+    dfa->next = next;
+    dfa->start = numbers[partition->blocks[dfa->start]];
+    dfa->nstates = nstates;
+    free(numbers);
+    return true;
+}
+
+bool regex_dfa_minimize(regex_dfa *dfa)
+{
+    int nstates = dfa->nstates, nclasses = dfa->nclasses;
+    size_t ntransitions = (size_t) nstates * nclasses;
+    dfa_partition partition = {.nstates = nstates, .nclasses = nclasses};
+    int bytes[256];
+    bool ok = false;
+
+    partition.starts = calloc(ntransitions + 1, sizeof(partition.starts[0]));
+    partition.predecessors =
+        malloc(sizeof(partition.predecessors[0]) * ntransitions);
+    partition.elements = malloc(sizeof(partition.elements[0]) * nstates);
+    partition.locations = malloc(sizeof(partition.locations[0]) * nstates);
+    partition.blocks = malloc(sizeof(partition.blocks[0]) * nstates);
+    partition.firsts = malloc(sizeof(partition.firsts[0]) * nstates);
+    partition.ends = malloc(sizeof(partition.ends[0]) * nstates);
+    partition.marked = calloc(nstates, sizeof(partition.marked[0]));
+    partition.touched = malloc(sizeof(partition.touched[0]) * nstates);
+    partition.pending = malloc(sizeof(partition.pending[0]) * nstates);
+    partition.waiting = calloc(nstates, sizeof(partition.waiting[0]));
+    partition.splitter = malloc(sizeof(partition.splitter[0]) * nstates);
+    if (!partition.starts || !partition.predecessors || !partition.elements ||
+        !partition.locations || !partition.blocks || !partition.firsts ||
+        !partition.ends || !partition.marked || !partition.touched ||
+        !partition.pending || !partition.waiting || !partition.splitter)
+        goto done;
+
+    /* a byte of each class */
+    for (int ch = 255; ch >= 0; --ch)
+        bytes[dfa->classes[ch]] = ch;
+
+    /* predecessors, counted and then placed, which leaves starts shifted by
+     * one entry
+     */
+    for (int state = 0; state < nstates; ++state)
+        for (int class = 0; class < nclasses; ++class)
+            ++partition.starts[(size_t) dfa->next[(size_t) state * 256 +
+                                                  bytes[class]] *
+                                   nclasses +
+                               class + 1];
+    for (size_t i = 0; i < ntransitions; ++i)
+        partition.starts[i + 1] += partition.starts[i];
+    for (int state = 0; state < nstates; ++state)
+        for (int class = 0; class < nclasses; ++class)
+            partition.predecessors
+                [partition.starts[(size_t) dfa->next[(size_t) state * 256 +
+                                                     bytes[class]] *
+                                      nclasses +
+                                  class]++] = state;
+    memmove(partition.starts + 1, partition.starts,
+            sizeof(partition.starts[0]) * ntransitions);
+    partition.starts[0] = 0;
+
+    /* states start out apart only if their flags differ */
+    for (int flags = 0; flags <= (REGEX_DFA_MATCH | REGEX_DFA_EOF_MATCH);
+         ++flags) {
+        int block = partition.nblocks, size = 0;
+        int first = (block > 0) ? partition.ends[block - 1] : 0;
+        for (int state = 0; state < nstates; ++state) {
+            if (dfa->flags[state] != flags)
+                continue;
+            partition.elements[first + size] = state;
+            partition.locations[state] = first + size;
+            partition.blocks[state] = block;
+            ++size;
+        }
+        if (size > 0) {
+            partition.firsts[block] = first;
+            partition.ends[block] = first + size;
+            ++partition.nblocks;
+            push_block(&partition, block);
+        }
+    }
+
+    refine(&partition);
+    ok = merge_blocks(dfa, &partition);
+
+done:
+    free(partition.starts);
+    free(partition.predecessors);
+    free(partition.elements);
+    free(partition.locations);
+    free(partition.blocks);
+    free(partition.firsts);
+    free(partition.ends);
+    free(partition.marked);
+    free(partition.touched);
+    free(partition.pending);
+    free(partition.waiting);
+    free(partition.splitter);
+    return ok;
+}
+
+/* States of a cregex_dfa_t before minimization, unless told otherwise */
+#define REGEX_DFA_MAX_STATES 4096
+
+/* A saved DFA is the magic, then version, number of program instructions,
+ * hash of the program (see program_hash()), nstates, start and nclasses as
+ * 32-bit little-endian integers. Unless
+ * nstates is 0, these are followed by the class of every byte and the flags
+ * of every state, one byte each, and the transitions of every state on
+ * every class as 32-bit integers.
+ */
+#define REGEX_DFA_MAGIC "CRXD"
+#define REGEX_DFA_VERSION 2
+#define REGEX_DFA_HEADER 28
+
+struct cregex_dfa {
+    const cregex_program_t *program;
+    regex_dfa *table; /* NULL if the interpreter is used */
+};
+
+cregex_dfa_t *cregex_dfa_compile(const cregex_program_t *program,
+                                 int max_states)
+{
+    cregex_dfa_t *dfa = calloc(1, sizeof(*dfa));
+
+    if (!dfa)
+        return NULL;
+    dfa->program = program;
+
+    /* end-anchored patterns and plain strings are found faster by scanning
+     * from the end and by substring search, as with the JIT
+     */
+    if (program->plan == CREGEX_PLAN_REVERSE ||
+        program->plan == CREGEX_PLAN_LITERAL)
+        return dfa;
+
+    if (!max_states)
+        max_states = REGEX_DFA_MAX_STATES;
+    dfa->table = regex_dfa_build(program, max_states);
+    if (dfa->table && !regex_dfa_minimize(dfa->table)) {
+        regex_dfa_free(dfa->table);
+        dfa->table = NULL;
+    }
+    return dfa;
+}
+
+int cregex_dfa_nstates(const cregex_dfa_t *dfa)
+{
+    return dfa->table ? dfa->table->nstates : 0;
+}
+
+int cregex_dfa_run(const cregex_dfa_t *dfa,
+                   const char *string,
+                   size_t length,
+                   const char **matches,
+                   int nmatches)
+{
+    const unsigned char *sp = (const unsigned char *) string;
+    const unsigned char *end = sp + length;
+    const regex_dfa *table = dfa->table;
+    int state, matched;
+
+    if (!table)
+        return cregex_program_run_n(dfa->program, string, length, matches,
+                                    nmatches);
+
+    /* the dead and the match state, 0 and 1, end the scan */
+    for (state = table->start; state > 1 && sp < end; ++sp)
+        state = table->next[(size_t) state * 256 + *sp];
+    matched = state == 1 || (table->flags[state] & REGEX_DFA_EOF_MATCH);
+
+    /* the interpreter reports where the match is */
+    if (matched && nmatches > 0)
+        return cregex_program_run_n(dfa->program, string, length, matches,
+                                    nmatches);
+    return matched;
+}
+
+static unsigned char *put_u32(unsigned char *p, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        p[i] = value >> (8 * i);
+    return p + 4;
+}
+
+static uint32_t get_u32(const unsigned char *p)
+{
+    return p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 |
+           (uint32_t) p[3] << 24;
+}
+
+/* FNV-1a of length bytes, continuing from hash */
+static uint32_t hash_bytes(uint32_t hash, const void *bytes, size_t length)
+{
+    const unsigned char *p = bytes;
+    for (size_t i = 0; i < length; ++i)
+        hash = (hash ^ p[i]) * 16777619u;
+    return hash;
+}
+
+static uint32_t hash_u32(uint32_t hash, uint32_t value)
+{
+    unsigned char bytes[4];
+    put_u32(bytes, value);
+    return hash_bytes(hash, bytes, 4);
+}
+
+/* Hash of what the DFA of program is built from: its flags, instructions
+ * (with pointers as indices, so that copies hash alike), DISPATCH tables and
+ * literal, so that a DFA saved for another pattern is not loaded
+ */
+static uint32_t program_hash(const cregex_program_t *program)
+{
+    const cregex_program_instr_t *instructions = program->instructions;
+    const int *tables = regex_dispatch_tables(program);
+    size_t nentries = (size_t) program->ndispatch * REGEX_DISPATCH_SIZE;
+    uint32_t hash = 2166136261u;
+
+    hash = hash_u32(hash, program->flags);
+    for (int pc = 0; pc < program->ninstructions; ++pc) {
+        const cregex_program_instr_t *instr = &instructions[pc];
+
+        hash = hash_u32(hash, instr->opcode);
+        switch (instr->opcode) {
+        case REGEX_PROGRAM_OPCODE_CHARACTER:
+            hash = hash_u32(hash, instr->ch);
+            break;
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS_NEGATED:
+            hash = hash_bytes(hash, instr->klass, sizeof(instr->klass));
+            break;
+        case REGEX_PROGRAM_OPCODE_SPLIT:
+            hash = hash_u32(hash, instr->first - instructions);
+            hash = hash_u32(hash, instr->second - instructions);
+            break;
+        case REGEX_PROGRAM_OPCODE_JUMP:
+            hash = hash_u32(hash, instr->target - instructions);
+            break;
+        case REGEX_PROGRAM_OPCODE_DISPATCH:
+            hash = hash_u32(hash,
+                            (instr->table - tables) / REGEX_DISPATCH_SIZE);
+            break;
+        case REGEX_PROGRAM_OPCODE_SAVE:
+            hash = hash_u32(hash, instr->save);
+            break;
+        default:
+            break;
+        }
+    }
+    for (size_t i = 0; i < nentries; ++i)
+        hash = hash_u32(hash, tables[i]);
+    return hash_bytes(hash, regex_literal(program), program->literal.length);
+}
+
+size_t cregex_dfa_save(const cregex_dfa_t *dfa, void *buffer, size_t size)
+{
+    const regex_dfa *table = dfa->table;
+    int nstates = table ? table->nstates : 0;
+    int nclasses = table ? table->nclasses : 0;
+    size_t needed = REGEX_DFA_HEADER;
+    unsigned char *p = buffer;
+    int bytes[256];
+
+    if (table)
+        needed += 256 + (size_t) nstates + 4 * (size_t) nstates * nclasses;
+    if (needed > size)
+        return needed;
+
+    memcpy(p, REGEX_DFA_MAGIC, 4);
+    p = put_u32(p + 4, REGEX_DFA_VERSION);
+    p = put_u32(p, dfa->program->ninstructions);
+    p = put_u32(p, program_hash(dfa->program));
+    p = put_u32(p, nstates);
+    p = put_u32(p, table ? table->start : 0);
+    p = put_u32(p, nclasses);
+    if (!table)
+        return needed;
+
+    memcpy(p, table->classes, 256);
+    memcpy(p + 256, table->flags, nstates);
+    p += 256 + nstates;
+    for (int ch = 255; ch >= 0; --ch)
+        bytes[table->classes[ch]] = ch;
+    for (int state = 0; state < nstates; ++state)
+        for (int class = 0; class < nclasses; ++class)
+            p = put_u32(p, table->next[(size_t) state * 256 + bytes[class]]);
+    return needed;
+}
+
+/* Check the tables of a saved DFA and expand its transitions by byte */
+static regex_dfa *load_table(const unsigned char *p,
+                             uint32_t nstates,
+                             uint32_t start,
+                             uint32_t nclasses)
+{
+    const unsigned char *classes = p, *flags = p + 256;
+    const unsigned char *transitions = flags + nstates;
+    regex_dfa *table;
+
+    for (int ch = 0; ch < 256; ++ch)
+        if (classes[ch] >= nclasses)
+            return NULL;
+    /* states 0 and 1 end the scan */
+    if (start >= nstates || flags[0] != 0 || !(flags[1] & REGEX_DFA_MATCH))
+        return NULL;
+    for (uint32_t i = 0; i < nstates; ++i)
+        if (flags[i] & ~(REGEX_DFA_MATCH | REGEX_DFA_EOF_MATCH))
+            return NULL;
+    for (size_t i = 0; i < (size_t) nstates * nclasses; ++i)
+        if (get_u32(transitions + 4 * i) >= nstates)
+            return NULL;
+
+    if (!(table = calloc(1, sizeof(*table))))
+        return NULL;
+    table->flags = malloc(nstates);
+    table->next = malloc(sizeof(table->next[0]) * 256 * (size_t) nstates);
+    if (!table->flags || !table->next) {
+        regex_dfa_free(table);
+        return NULL;
+    }
+
+    table->nstates = nstates;
+    table->start = start;
+    table->nclasses = nclasses;
+    memcpy(table->classes, classes, 256);
+    memcpy(table->flags, flags, nstates);
+    for (uint32_t state = 0; state < nstates; ++state)
+        for (int ch = 0; ch < 256; ++ch)
+            table->next[(size_t) state * 256 + ch] = get_u32(
+                transitions + 4 * ((size_t) state * nclasses + classes[ch]));
+    return table;
+}
+
+cregex_dfa_t *cregex_dfa_load(const cregex_program_t *program,
+                              const void *data,
+                              size_t size)
+{
+    const unsigned char *p = data;
+    uint32_t nstates, start, nclasses;
+    cregex_dfa_t *dfa;
+
+    if (size < REGEX_DFA_HEADER || memcmp(p, REGEX_DFA_MAGIC, 4) != 0 ||
+        get_u32(p + 4) != REGEX_DFA_VERSION ||
+        get_u32(p + 8) != (uint32_t) program->ninstructions ||
+        get_u32(p + 12) != program_hash(program))
+        return NULL;
+    nstates = get_u32(p + 16);
+    start = get_u32(p + 20);
+    nclasses = get_u32(p + 24);
+
+    /* with these bounds, the size cannot overflow 64 bits */
+    if (nstates == 0) {
+        if (size != REGEX_DFA_HEADER)
+            return NULL;
+    } else if (nstates < 2 || nstates > INT_MAX / 256 || nclasses < 1 ||
+               nclasses > 256 ||
+               size != REGEX_DFA_HEADER + 256 + (uint64_t) nstates +
+                           4 * (uint64_t) nstates * nclasses) {
+        return NULL;
+    }
+
+    if (!(dfa = calloc(1, sizeof(*dfa))))
+        return NULL;
+    dfa->program = program;
+    if (nstates &&
+        !(dfa->table =
+              load_table(p + REGEX_DFA_HEADER, nstates, start, nclasses))) {
+        free(dfa);
+        return NULL;
+    }
+    return dfa;
+}
+
+void cregex_dfa_free(cregex_dfa_t *dfa)
+{
+    if (!dfa)
+        return;
+    regex_dfa_free(dfa->table);
+    free(dfa);
+}
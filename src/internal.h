@@ -0,0 +1,210 @@
+#ifndef CREGEX_INTERNAL_H
+#define CREGEX_INTERNAL_H
+
+/* Declarations shared between the library sources, not part of the API */
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "cregex.h"
+
+static inline void *regex_alloc(const cregex_allocator_t *allocator,
+                                size_t size)
+{
+    return allocator ? allocator->alloc(allocator->context, size)
+                     : malloc(size);
+}
+
+static inline void regex_free(const cregex_allocator_t *allocator, void *ptr)
+{
+    if (allocator)
+        allocator->free(allocator->context, ptr);
+    else
+        free(ptr);
+}
+
+/* Whether the character instruction pc accepts input byte ch, which is -1 at
+ * the end of string
+ */
+static inline int regex_accepts(const cregex_program_instr_t *pc, int ch)
+{
+    switch (pc->opcode) {
+    /* Characters */
+    case REGEX_PROGRAM_OPCODE_CHARACTER:
+        return ch == pc->ch;
+    case REGEX_PROGRAM_OPCODE_ANY_CHARACTER:
+        return ch >= 0;
+    case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS:
+        return ch >= 0 && cregex_char_class_contains(pc->klass, ch);
+    case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS_NEGATED:
+        return ch >= 0 && !cregex_char_class_contains(pc->klass, ch);
+
+    default:
+        /* other instructions consume no input */
+        abort();
+    }
+}
+
+/* Submatch slots kept per thread; later slots are never saved */
+#define REGEX_VM_MAX_MATCHES 20
+
+/* Number of nodes cregex_parse_with() allocates for pattern */
+int regex_estimate_nodes(const char *pattern);
+
+/* Fill the vector lookup tables of program from program->first */
+void regex_scan_prepare(cregex_program_t *program);
+
+/* First position in [sp, end) holding a byte of program->first, or end */
+const char *regex_scan_first(const cregex_program_t *program,
+                             const char *sp,
+                             const char *end);
+
+/* Entries of a DISPATCH table, one per byte value */
+#define REGEX_DISPATCH_SIZE (UCHAR_MAX + 1)
+
+/* DISPATCH tables of program, which follow the instructions */
+static inline const int *regex_dispatch_tables(const cregex_program_t *program)
+{
+    return (const int *) (program->instructions + program->ninstructions);
+}
+
+/* Bytes of a pure literal program */
+static inline const char *regex_literal(const cregex_program_t *program)
+{
+    return (const char *) (regex_dispatch_tables(program) +
+                           (size_t) program->ndispatch * REGEX_DISPATCH_SIZE);
+}
+
+/* First occurrence of the length bytes of literal in [sp, end), or NULL */
+const char *regex_scan_literal(const char *literal,
+                               size_t length,
+                               const char *sp,
+                               const char *end);
+
+/* Decode the UTF-8 character at sp into *cp, returning its length, or 0 if
+ * it is not valid UTF-8
+ */
+int regex_utf8_decode(const char *sp, int *cp);
+
+/* Start of the character after the one at sp, in [sp + 1, end]: past a
+ * lead byte and its continuation bytes if program was compiled with
+ * CREGEX_FLAG_UTF8, or the next byte otherwise. sp must be before end.
+ */
+const char *regex_next_character(const cregex_program_t *program,
+                                 const char *sp,
+                                 const char *end);
+
+/* Parse the next item of a character class whose text starts at from, in
+ * UTF-8 mode, advancing *sp past it. Returns 1 for the code points
+ * [*lo, *hi], 0 at the closing bracket, or -1 if the class is invalid.
+ */
+int regex_utf8_class_item(const char **sp, const char *from, int *lo, int *hi);
+
+/* One UTF-8 byte sequence, matched by a class per byte */
+typedef struct {
+    cregex_char_class bytes[4];
+    int length;
+} regex_utf8_sequence;
+
+/* Code points [lo, hi] */
+typedef struct {
+    int lo, hi;
+} regex_utf8_range;
+
+/* Store the code points of a character class or . node under flags in
+ * *ranges, allocated with allocator, as sorted ranges which neither overlap
+ * nor touch. The items of the class are decoded once and sorted. Returns the
+ * number of ranges, or -1 if memory runs out.
+ */
+int regex_utf8_ranges(const cregex_node_t *node,
+                      int flags,
+                      const cregex_allocator_t *allocator,
+                      regex_utf8_range **ranges);
+
+/* Call fn (unless NULL) for each byte sequence matching the code points of
+ * ranges, as stored by regex_utf8_ranges(), single bytes first. Returns the
+ * number of sequences.
+ */
+int regex_utf8_sequences(const regex_utf8_range *ranges,
+                         int nranges,
+                         void (*fn)(void *arg,
+                                    const regex_utf8_sequence *sequence),
+                         void *arg);
+
+/* Bytes of scratch space regex_search() needs for program */
+size_t regex_search_scratch_size(const cregex_program_t *program);
+
+/* Find the leftmost match of program in [string, end) starting at from or
+ * later, as cregex_program_run_n() would, except that ^ matches at string
+ * only. Repeated searches of one string share scratch, of at least
+ * regex_search_scratch_size(program) bytes.
+ */
+int regex_search(const cregex_program_t *program,
+                 const char *string,
+                 const char *from,
+                 const char *end,
+                 const char **matches,
+                 int nmatches,
+                 void *scratch);
+
+/* Precompute the closures of a compiled program, allocated with allocator,
+ * leaving program->closures NULL if they are too large or memory runs out
+ */
+void regex_closures_build(cregex_program_t *program,
+                          const cregex_allocator_t *allocator);
+
+/* Bytes regex_program_copy() needs for program */
+size_t regex_program_copy_size(const cregex_program_t *program);
+
+/* Copy program, with its closures after it, to memory of
+ * regex_program_copy_size(program) bytes aligned for any type, returning the
+ * copy. Unlike the original, the copy is freed with memory.
+ */
+cregex_program_t *regex_program_copy(void *memory,
+                                     const cregex_program_t *program);
+
+/* Choose the execution plan of a compiled program */
+void regex_plan(cregex_program_t *program);
+
+/* Match-only DFA of a program, answering whether the program matches
+ * anywhere in a string. State 0 is the dead state; match states are
+ * absorbing.
+ */
+enum {
+    REGEX_DFA_MATCH = 1 << 0,     /* a match has been found */
+    REGEX_DFA_EOF_MATCH = 1 << 1, /* a match is found if the input ends here */
+};
+
+typedef struct {
+    int nstates;
+    int start;
+    unsigned char *flags; /* REGEX_DFA_* per state */
+    int *next;            /* nstates * 256 transitions, indexed by byte */
+    /* bytes no transition tells apart share a class */
+    unsigned char classes[256];
+    int nclasses;
+} regex_dfa;
+
+/* Partition the byte values into classes which no instruction among the
+ * first ninstructions of program tells apart, returning the number of
+ * classes
+ */
+int regex_byte_classes(const cregex_program_t *program,
+                       int ninstructions,
+                       unsigned char classes[256]);
+
+/* Build the DFA of program, or return NULL if it would need more than
+ * max_states states or memory runs out
+ */
+regex_dfa *regex_dfa_build(const cregex_program_t *program, int max_states);
+
+/* Merge the states of dfa which no input tells apart, numbering them so
+ * that the dead state is 0 and the match state 1 (added if there is none).
+ * Returns false if memory runs out, leaving dfa as it was.
+ */
+bool regex_dfa_minimize(regex_dfa *dfa);
+
+/* Free a DFA */
+void regex_dfa_free(regex_dfa *dfa);
+
+#endif
@@ -0,0 +1,375 @@
+#if defined(__x86_64__) && !defined(_WIN32)
+#define _DEFAULT_SOURCE
+#define REGEX_JIT_X86_64
+#include <sys/mman.h>
+#include <unistd.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+/* The JIT translates the match-only DFA of a program into x86-64 code, one
+ * block per state. A block tests for the end of input, loads the next byte
+ * and branches to the next state with immediate compares, either testing the
+ * byte ranges which leave the most common transition one by one or through a
+ * binary search over all ranges. Entering a match state returns 1 at once;
+ * the dead state returns 0. Submatches are left to the interpreter, which
+ * only has to run on strings known to match.
+ *
+ * Programs whose DFA has more than REGEX_JIT_MAX_STATES states, and programs
+ * on other architectures, are run by the interpreter instead. So are
+ * end-anchored patterns, which the interpreter scans from the end of the
+ * input rather than reading all of it, and plain strings, which it finds
+ * with a substring search.
+ */
+#define REGEX_JIT_MAX_STATES 1024
+
+/* int (*)(const char *sp, const char *end), System V calling convention */
+typedef int (*jit_function)(const char *, const char *);
+
+struct cregex_jit {
+    const cregex_program_t *program;
+    void *code; /* NULL if the interpreter is used */
+    size_t size;
+    jit_function function;
+};
+
+#ifdef REGEX_JIT_X86_64
+typedef struct {
+    unsigned char *code;
+    size_t size, capacity;
+    bool error;
+    /* jumps to state blocks, patched once all blocks are emitted */
+    struct {
+        size_t at;
+        int state;
+    } *fixups;
+    size_t nfixups, fixups_capacity;
+} jit_emitter;
+
+/* Offsets of the shared return blocks and of the entry point */
+enum { JIT_RETURN_0 = 0, JIT_RETURN_1 = 3, JIT_ENTRY = 9 };
+
+static void emit_bytes(jit_emitter *emitter, const void *bytes, size_t size)
+{
+    if (emitter->size + size > emitter->capacity) {
+        size_t capacity = (emitter->size + size) * 2;
+        unsigned char *code = realloc(emitter->code, capacity);
+        if (!code) {
+            emitter->error = true;
+            return;
+        }
+        emitter->code = code;
+        emitter->capacity = capacity;
+    }
+    memcpy(emitter->code + emitter->size, bytes, size);
+    emitter->size += size;
+}
+
+static void emit_u8(jit_emitter *emitter, unsigned char byte)
+{
+    emit_bytes(emitter, &byte, 1);
+}
+
+static void emit_u32(jit_emitter *emitter, uint32_t value)
+{
+    unsigned char bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+    emit_bytes(emitter, bytes, 4);
+}
+
+/* Store the displacement from the end of the rel32 at offset at to target */
+static void patch_rel32(jit_emitter *emitter, size_t at, size_t target)
+{
+    uint32_t rel = (uint32_t) (target - (at + 4));
+    if (emitter->error)
+        return;
+    for (int i = 0; i < 4; ++i)
+        emitter->code[at + i] = rel >> (8 * i);
+}
+
+/* Emit a jump (jmp if condition is 0, else the two-byte jcc opcode) to
+ * target, a code offset or the block of a state
+ */
+static void emit_jump(jit_emitter *emitter,
+                      unsigned char condition,
+                      size_t target,
+                      int state)
+{
+    if (condition) {
+        emit_u8(emitter, 0x0f);
+        emit_u8(emitter, condition);
+    } else {
+        emit_u8(emitter, 0xe9);
+    }
+    emit_u32(emitter, 0);
+
+    if (state < 0) {
+        patch_rel32(emitter, emitter->size - 4, target);
+        return;
+    }
+
+    if (emitter->nfixups == emitter->fixups_capacity) {
+        size_t capacity =
+            emitter->fixups_capacity ? emitter->fixups_capacity * 2 : 256;
+        void *fixups =
+            realloc(emitter->fixups, sizeof(emitter->fixups[0]) * capacity);
+        if (!fixups) {
+            emitter->error = true;
+            return;
+        }
+        emitter->fixups = fixups;
+        emitter->fixups_capacity = capacity;
+    }
+    emitter->fixups[emitter->nfixups].at = emitter->size - 4;
+    emitter->fixups[emitter->nfixups].state = state;
+    ++emitter->nfixups;
+}
+
+#define JIT_JE 0x84
+#define JIT_JBE 0x86
+#define JIT_JA 0x87
+
+/* States with more ranges than this not leading to their most common target
+ * branch through a binary search instead of testing each range in turn
+ */
+#define JIT_MAX_LINEAR_RANGES 8
+
+/* Jump to where entering state leads */
+static void emit_goto(jit_emitter *emitter,
+                      const regex_dfa *dfa,
+                      unsigned char condition,
+                      int state)
+{
+    if (state == 0)
+        emit_jump(emitter, condition, JIT_RETURN_0, -1);
+    else if (dfa->flags[state] & REGEX_DFA_MATCH)
+        emit_jump(emitter, condition, JIT_RETURN_1, -1);
+    else
+        emit_jump(emitter, condition, 0, state);
+}
+
+/* Binary search over the ranges [l, r], where range i ends at byte his[i]
+ * and leads to targets[i]; the byte is in eax
+ */
+static void emit_ranges(jit_emitter *emitter,
+                        const regex_dfa *dfa,
+                        const int *his,
+                        const int *targets,
+                        int l,
+                        int r)
+{
+    size_t right;
+    int m;
+
+    if (l == r) {
+        emit_goto(emitter, dfa, 0, targets[l]);
+        return;
+    }
+
+    /* cmp eax, his[m]; ja right */
+    m = (l + r) / 2;
+    emit_u8(emitter, 0x3d);
+    emit_u32(emitter, his[m]);
+    emit_jump(emitter, JIT_JA, 0, -1);
+    right = emitter->size - 4;
+
+    emit_ranges(emitter, dfa, his, targets, l, m);
+    patch_rel32(emitter, right, emitter->size);
+    emit_ranges(emitter, dfa, his, targets, m + 1, r);
+}
+
+/* Test the ranges not leading to the most common target one by one, which
+ * predicts well since the common target is usually taken
+ */
+static bool emit_linear(jit_emitter *emitter,
+                        const regex_dfa *dfa,
+                        const int *his,
+                        const int *targets,
+                        int nranges)
+{
+    int counts[256] = {0}, common = 0, nrare = 0;
+
+    /* bytes per target, counted at the first range leading to it */
+    for (int i = 0; i < nranges; ++i) {
+        counts[i] = his[i] - (i ? his[i - 1] : -1);
+        for (int j = 0; j < i; ++j) {
+            if (targets[j] == targets[i]) {
+                counts[j] += counts[i];
+                counts[i] = 0;
+                break;
+            }
+        }
+    }
+    for (int i = 0; i < nranges; ++i)
+        if (counts[i] > counts[common])
+            common = i;
+    for (int i = 0; i < nranges; ++i)
+        nrare += targets[i] != targets[common];
+    if (nrare > JIT_MAX_LINEAR_RANGES)
+        return false;
+
+    for (int i = 0; i < nranges; ++i) {
+        int lo = i ? his[i - 1] + 1 : 0;
+        if (targets[i] == targets[common])
+            continue;
+        if (lo == his[i]) {
+            /* cmp eax, lo; je target */
+            emit_u8(emitter, 0x3d);
+            emit_u32(emitter, lo);
+            emit_goto(emitter, dfa, JIT_JE, targets[i]);
+        } else {
+            /* lea ecx, [rax - lo]; cmp ecx, hi - lo; jbe target */
+            emit_bytes(emitter, "\x8d\x88", 2);
+            emit_u32(emitter, -lo);
+            emit_bytes(emitter, "\x81\xf9", 2);
+            emit_u32(emitter, his[i] - lo);
+            emit_goto(emitter, dfa, JIT_JBE, targets[i]);
+        }
+    }
+    emit_goto(emitter, dfa, 0, targets[common]);
+    return true;
+}
+
+static void emit_state(jit_emitter *emitter, const regex_dfa *dfa, int state)
+{
+    const int *next = dfa->next + (size_t) state * 256;
+    int his[256], targets[256], nranges = 0;
+
+    /* cmp rdi, rsi; je <end of input> */
+    emit_bytes(emitter, "\x48\x39\xf7", 3);
+    emit_jump(emitter, JIT_JE,
+              (dfa->flags[state] & REGEX_DFA_EOF_MATCH) ? JIT_RETURN_1
+                                                        : JIT_RETURN_0,
+              -1);
+
+    /* movzx eax, byte [rdi]; add rdi, 1 */
+    emit_bytes(emitter, "\x0f\xb6\x07\x48\x83\xc7\x01", 7);
+
+    for (int ch = 0; ch < 256; ++ch) {
+        if (ch == 255 || next[ch + 1] != next[ch]) {
+            his[nranges] = ch;
+            targets[nranges] = next[ch];
+            ++nranges;
+        }
+    }
+    if (!emit_linear(emitter, dfa, his, targets, nranges))
+        emit_ranges(emitter, dfa, his, targets, 0, nranges - 1);
+}
+
+static void *jit_translate(const regex_dfa *dfa, size_t *size)
+{
+    jit_emitter emitter = {0};
+    size_t *blocks = malloc(sizeof(blocks[0]) * dfa->nstates);
+    size_t page = sysconf(_SC_PAGESIZE);
+    void *code = NULL;
+
+    if (!blocks)
+        return NULL;
+
+    /* xor eax, eax; ret / mov eax, 1; ret */
+    emit_bytes(&emitter, "\x31\xc0\xc3\xb8\x01\x00\x00\x00\xc3", 9);
+
+    /* the entry point jumps to the start state */
+    emit_goto(&emitter, dfa, 0, dfa->start);
+    for (int state = 1; state < dfa->nstates; ++state) {
+        blocks[state] = emitter.size;
+        if (!(dfa->flags[state] & REGEX_DFA_MATCH))
+            emit_state(&emitter, dfa, state);
+    }
+    for (size_t i = 0; i < emitter.nfixups; ++i)
+        patch_rel32(&emitter, emitter.fixups[i].at,
+                    blocks[emitter.fixups[i].state]);
+
+    /* copy to executable memory, which is never writable at the same time */
+    if (!emitter.error) {
+        *size = (emitter.size + page - 1) / page * page;
+        code = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED) {
+            code = NULL;
+        } else {
+            memcpy(code, emitter.code, emitter.size);
+            if (mprotect(code, *size, PROT_READ | PROT_EXEC) < 0) {
+                munmap(code, *size);
+                code = NULL;
+            }
+        }
+    }
+
+    free(blocks);
+    free(emitter.fixups);
+    free(emitter.code);
+    return code;
+}
+#endif
+
+cregex_jit_t *cregex_jit_compile(const cregex_program_t *program)
+{
+    cregex_jit_t *jit = calloc(1, sizeof(*jit));
+
+    if (!jit)
+        return NULL;
+    jit->program = program;
+
+#ifdef REGEX_JIT_X86_64
+    regex_dfa *dfa = (program->plan == CREGEX_PLAN_REVERSE ||
+                      program->plan == CREGEX_PLAN_LITERAL)
+                         ? NULL
+                         : regex_dfa_build(program, REGEX_JIT_MAX_STATES);
+    if (dfa) {
+        unsigned char *code = jit_translate(dfa, &jit->size);
+        if (code) {
+            void *entry = code + JIT_ENTRY;
+            jit->code = code;
+            /* ISO C has no conversion from object to function pointers */
+            memcpy(&jit->function, &entry, sizeof(jit->function));
+        }
+        regex_dfa_free(dfa);
+    }
+#endif
+
+    return jit;
+}
+
+int cregex_jit_is_native(const cregex_jit_t *jit)
+{
+    return jit->code != NULL;
+}
+
+int cregex_jit_run(const cregex_jit_t *jit,
+                   const char *string,
+                   size_t length,
+                   const char **matches,
+                   int nmatches)
+{
+    int matched;
+
+    if (!jit->code)
+        return cregex_program_run_n(jit->program, string, length, matches,
+                                    nmatches);
+
+    /* the interpreter reports where the match is */
+    matched = jit->function(string, string + length);
+    if (matched && nmatches > 0)
+        return cregex_program_run_n(jit->program, string, length, matches,
+                                    nmatches);
+    return matched;
+}
+
+void cregex_jit_free(cregex_jit_t *jit)
+{
+    if (!jit)
+        return;
+#ifdef REGEX_JIT_X86_64
+    if (jit->code)
+        munmap(jit->code, jit->size);
+#endif
+    free(jit);
+}
@@ -1,12 +1,19 @@
 #include <assert.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "cregex.h"
+#include "internal.h"
+
+/* Patterns whose groups and quantifiers nest deeper than this are rejected,
+ * which bounds the recursion of the parser and the compiler
+ */
+#define REGEX_PARSE_MAX_DEPTH 1000
 
 typedef struct {
     const char *sp;
     cregex_node_t *stack, *output;
+    int flags;
 } regex_parse_context;
 
 /* Shunting-yard algorithm
@@ -21,11 +28,6 @@ static inline cregex_node_t *push(regex_parse_context *context,
     return context->stack++;
 }
 
-static inline cregex_node_t *drop(regex_parse_context *context)
-{
-    return --context->stack;
-}
-
 static inline cregex_node_t *consume(regex_parse_context *context)
 {
     *--context->output = *--context->stack;
@@ -50,6 +52,26 @@ static inline cregex_node_t *concatenate(regex_parse_context *context,
     return context->stack - 1;
 }
 
+/* Push the bytes of the UTF-8 character starting at context->sp - 1 as one
+ * concatenation, so that quantifiers apply to all of it
+ */
+static cregex_node_t *parse_utf8_character(regex_parse_context *context)
+{
+    const cregex_node_t *bottom = context->stack;
+    int cp, length = regex_utf8_decode(context->sp - 1, &cp);
+
+    if (!length)
+        /* invalid UTF-8 */
+        return NULL;
+
+    --context->sp;
+    for (int i = 0; i < length; ++i)
+        push(context,
+             &(cregex_node_t){.type = REGEX_NODE_TYPE_CHARACTER,
+                              .ch = (unsigned char) *context->sp++});
+    return concatenate(context, bottom);
+}
+
 static cregex_node_t *parse_char_class(regex_parse_context *context)
 {
     cregex_node_type type =
@@ -58,8 +80,19 @@ static cregex_node_t *parse_char_class(regex_parse_context *context)
             : REGEX_NODE_TYPE_CHARACTER_CLASS;
     const char *from = context->sp;
 
+    /* code points rather than bytes, with ranges compared as such */
+    if (context->flags & CREGEX_FLAG_UTF8) {
+        int lo, hi, result;
+        while ((result = regex_utf8_class_item(&context->sp, from, &lo, &hi)))
+            if (result < 0)
+                return NULL;
+        return push(context,
+                    &(cregex_node_t){
+                        .type = type, .from = from, .to = context->sp - 1});
+    }
+
     for (;;) {
-        int ch = *context->sp++;
+        int ch = (unsigned char) *context->sp++;
         switch (ch) {
         case '\0':
             /* premature end of character class */
@@ -71,12 +104,12 @@ static cregex_node_t *parse_char_class(regex_parse_context *context)
                         &(cregex_node_t){
                             .type = type, .from = from, .to = context->sp - 1});
         case '\\':
-            ch = *context->sp++;
+            ch = (unsigned char) *context->sp++;
             /* fall-through */
         default:
         CHARACTER:
             if (*context->sp == '-' && context->sp[1] != ']') {
-                if (context->sp[1] < ch)
+                if ((unsigned char) context->sp[1] < ch)
                     /* empty range in character class */
                     return NULL;
                 context->sp += 2;
@@ -125,71 +158,104 @@ static cregex_node_t *parse_interval(regex_parse_context *context)
                     .quantified = consume(context)});
 }
 
-static cregex_node_t *parse_context(regex_parse_context *context, int depth)
+/* Join the alternatives between bottom and the top of the stack, each
+ * already concatenated. Empty alternatives are tried last, so a||b is parsed
+ * as (a|b)?, which raises *height by one.
+ */
+static cregex_node_t *alternate(regex_parse_context *context,
+                                cregex_node_t *bottom,
+                                int *height)
 {
-    cregex_node_t *bottom = context->stack;
+    cregex_node_t *kept = bottom;
+    bool empty = false;
+
+    /* drop the empty alternatives; nothing refers to the stack yet */
+    for (cregex_node_t *node = bottom; node < context->stack; ++node) {
+        if (node->type == REGEX_NODE_TYPE_EPSILON)
+            empty = true;
+        else
+            *kept++ = *node;
+    }
+    context->stack = kept;
 
+    if (context->stack == bottom)
+        return push(context,
+                    &(cregex_node_t){.type = REGEX_NODE_TYPE_EPSILON});
+
+    while (context->stack - 1 > bottom) {
+        cregex_node_t *right = consume(context);
+        cregex_node_t *left = consume(context);
+        push(context, &(cregex_node_t){.type = REGEX_NODE_TYPE_ALTERNATION,
+                                       .left = left,
+                                       .right = right});
+    }
+    if (empty) {
+        ++*height;
+        push(context, &(cregex_node_t){.type = REGEX_NODE_TYPE_QUANTIFIER,
+                                       .nmin = 0,
+                                       .nmax = 1,
+                                       .greedy = 1,
+                                       .quantified = consume(context)});
+    }
+    return context->stack - 1;
+}
+
+/* Parse up to the closing parenthesis (or the end of the pattern at depth 0),
+ * setting *height to the height of the result. Chains of concatenations and
+ * alternations count as one level, since the compiler walks them in loops,
+ * so only groups and quantifiers nest.
+ */
+static cregex_node_t *parse_context(regex_parse_context *context,
+                                    int depth,
+                                    int *height)
+{
+    /* each alternative is concatenated above the previous ones */
+    cregex_node_t *bottom = context->stack, *branch = bottom;
+    /* height of the item on top of the stack */
+    int top = 0, inner;
+
+    *height = 0;
     for (;;) {
-        int ch = *context->sp++;
+        int ch = (unsigned char) *context->sp++;
         switch (ch) {
         /* Characters */
         case '\\':
-            ch = *context->sp++;
+            ch = (unsigned char) *context->sp++;
             /* fall-through */
         default:
         CHARACTER:
+            if ((context->flags & CREGEX_FLAG_UTF8) && ch >= 0x80) {
+                if (!parse_utf8_character(context))
+                    return NULL;
+                top = 2;
+                break;
+            }
             push(context,
                  &(cregex_node_t){.type = REGEX_NODE_TYPE_CHARACTER, .ch = ch});
+            top = 1;
             break;
         case '.':
             push(context,
                  &(cregex_node_t){.type = REGEX_NODE_TYPE_ANY_CHARACTER});
+            top = 1;
             break;
         case '[':
             if (!parse_char_class(context))
                 return NULL;
+            top = 1;
             break;
 
-        /* Composites */
-        case '|': {
-            cregex_node_t *left = concatenate(context, bottom), *right;
-            if (!(right = parse_context(context, depth)))
-                return NULL;
-            if (left->type == REGEX_NODE_TYPE_EPSILON &&
-                right->type == left->type) {
-                drop(context);
-            } else if (left->type == REGEX_NODE_TYPE_EPSILON) {
-                right = consume(context);
-                drop(context);
-                push(context,
-                     &(cregex_node_t){.type = REGEX_NODE_TYPE_QUANTIFIER,
-                                      .nmin = 0,
-                                      .nmax = 1,
-                                      .greedy = 1,
-                                      .quantified = right});
-            } else if (right->type == REGEX_NODE_TYPE_EPSILON) {
-                drop(context);
-                left = consume(context);
-                push(context,
-                     &(cregex_node_t){.type = REGEX_NODE_TYPE_QUANTIFIER,
-                                      .nmin = 0,
-                                      .nmax = 1,
-                                      .greedy = 1,
-                                      .quantified = left});
-            } else {
-                right = consume(context);
-                left = consume(context);
-                push(context,
-                     &(cregex_node_t){.type = REGEX_NODE_TYPE_ALTERNATION,
-                                      .left = left,
-                                      .right = right});
-            }
-            return bottom;
-        }
+        /* Composites: alternatives are joined at the end of the group, so
+         * that any number of them costs no recursion
+         */
+        case '|':
+            concatenate(context, branch);
+            branch = context->stack;
+            break;
 
 #define QUANTIFIER(ch, min, max)                                           \
     case ch:                                                               \
-        if (context->stack == bottom)                                      \
+        if (context->stack == branch)                                      \
             goto CHARACTER;                                                \
         push(context,                                                      \
              &(cregex_node_t){                                             \
@@ -198,6 +264,7 @@ static cregex_node_t *parse_context(regex_parse_context *context, int depth)
                  .nmax = max,                                              \
                  .greedy = (*context->sp == '?') ? (++context->sp, 0) : 1, \
                  .quantified = consume(context)});                         \
+        ++top;                                                             \
         break
 
             /* clang-format off */
@@ -209,69 +276,101 @@ static cregex_node_t *parse_context(regex_parse_context *context, int depth)
 #undef QUANTIFIER
 
         case '{':
-            if ((context->stack == bottom) || !parse_interval(context))
+            if ((context->stack == branch) || !parse_interval(context))
                 goto CHARACTER;
+            ++top;
             break;
 
         /* Anchors */
         case '^':
             push(context,
                  &(cregex_node_t){.type = REGEX_NODE_TYPE_ANCHOR_BEGIN});
+            top = 1;
             break;
         case '$':
             push(context, &(cregex_node_t){.type = REGEX_NODE_TYPE_ANCHOR_END});
+            top = 1;
             break;
 
         /* Captures */
         case '(':
-            if (!parse_context(context, depth + 1))
+            if (depth >= REGEX_PARSE_MAX_DEPTH ||
+                !parse_context(context, depth + 1, &inner))
                 return NULL;
             push(context, &(cregex_node_t){.type = REGEX_NODE_TYPE_CAPTURE,
                                            .captured = consume(context)});
+            top = inner + 1;
             break;
         case ')':
-            if (depth > 0)
-                return concatenate(context, bottom);
+            if (depth > 0) {
+                concatenate(context, branch);
+                return alternate(context, bottom, height);
+            }
             /* unmatched close parenthesis */
             return NULL;
 
         /* End of string */
         case '\0':
-            if (depth == 0)
-                return concatenate(context, bottom);
+            if (depth == 0) {
+                concatenate(context, branch);
+                return alternate(context, bottom, height);
+            }
             /* unmatched open parenthesis */
             return NULL;
         }
+
+        if (top > *height)
+            *height = top;
+        if (*height > REGEX_PARSE_MAX_DEPTH)
+            /* nested too deeply */
+            return NULL;
     }
 }
 
-static inline int estimate_nodes(const char *pattern)
+int regex_estimate_nodes(const char *pattern)
 {
-    return strlen(pattern) * 2;
+    /* an empty pattern still needs its epsilon node */
+    return strlen(pattern) * 2 + 1;
 }
 
 /* Parse a pattern (using a previously allocated buffer of at least
- * estimate_nodes(pattern) nodes).
+ * regex_estimate_nodes(pattern) nodes).
  */
 static cregex_node_t *parse_with_nodes(const char *pattern,
+                                       int flags,
                                        cregex_node_t *nodes)
 {
     regex_parse_context *context =
         &(regex_parse_context){.sp = pattern,
                                .stack = nodes,
-                               .output = nodes + estimate_nodes(pattern)};
-    return parse_context(context, 0);
+                               .output = nodes + regex_estimate_nodes(pattern),
+                               .flags = flags};
+    int height;
+    return parse_context(context, 0, &height);
 }
 
 cregex_node_t *cregex_parse(const char *pattern)
 {
-    size_t size = sizeof(cregex_node_t) * estimate_nodes(pattern);
-    cregex_node_t *nodes = malloc(size);
+    return cregex_parse_with(pattern, NULL);
+}
+
+cregex_node_t *cregex_parse_with(const char *pattern,
+                                 const cregex_allocator_t *allocator)
+{
+    return cregex_parse_with_flags(pattern, 0, allocator);
+}
+
+cregex_node_t *cregex_parse_with_flags(const char *pattern,
+                                       int flags,
+                                       const cregex_allocator_t *allocator)
+{
+    size_t size = sizeof(cregex_node_t) * regex_estimate_nodes(pattern);
+    cregex_node_t *nodes = regex_alloc(allocator, size);
     if (!nodes)
         return NULL;
 
-    if (!parse_with_nodes(pattern, nodes)) {
-        free(nodes);
+    if (!parse_with_nodes(pattern, flags, nodes)) {
+        regex_free(allocator, nodes);
         return NULL;
     }
 
@@ -280,5 +379,11 @@ cregex_node_t *cregex_parse(const char *pattern)
 
 void cregex_parse_free(cregex_node_t *root)
 {
-    free(root);
+    cregex_parse_free_with(root, NULL);
+}
+
+void cregex_parse_free_with(cregex_node_t *root,
+                            const cregex_allocator_t *allocator)
+{
+    regex_free(allocator, root);
 }
@@ -0,0 +1,214 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+/* Programs larger than this are not checked for being one-pass, which takes
+ * time quadratic in the program size
+ */
+#define REGEX_PLAN_MAX_ONEPASS 4096
+
+/* Number of instructions of the forward program */
+static int forward_size(const cregex_program_t *program)
+{
+    return program->reverse ? program->reverse : program->ninstructions;
+}
+
+void regex_plan(cregex_program_t *program)
+{
+    if (program->literal.length)
+        program->plan = CREGEX_PLAN_LITERAL;
+    else if (program->reverse)
+        program->plan = CREGEX_PLAN_REVERSE;
+    else if (program->start == 0)
+        program->plan = CREGEX_PLAN_ANCHORED;
+    else if (program->nfirst)
+        program->plan = CREGEX_PLAN_PREFILTER;
+    else
+        program->plan = CREGEX_PLAN_PIKE_VM;
+}
+
+/* Whether MATCH can be reached from pc without passing a $ assertion */
+static bool reaches_match(const cregex_program_t *program,
+                          const cregex_program_instr_t *pc,
+                          bool *visited)
+{
+    while (!visited[pc - program->instructions]) {
+        visited[pc - program->instructions] = true;
+
+        switch (pc->opcode) {
+        case REGEX_PROGRAM_OPCODE_MATCH:
+            return true;
+        case REGEX_PROGRAM_OPCODE_SPLIT:
+            if (reaches_match(program, pc->first, visited))
+                return true;
+            pc = pc->second;
+            break;
+        case REGEX_PROGRAM_OPCODE_JUMP:
+            pc = pc->target;
+            break;
+        case REGEX_PROGRAM_OPCODE_DISPATCH:
+            for (int ch = 0; ch <= UCHAR_MAX; ++ch)
+                if (pc->table[ch] &&
+                    reaches_match(program, pc + pc->table[ch], visited))
+                    return true;
+            return false;
+        case REGEX_PROGRAM_OPCODE_ASSERT_END:
+            return false;
+        default:
+            ++pc;
+            break;
+        }
+    }
+    return false;
+}
+
+/* Add the bytes a thread at pc can consume next to klass, following control
+ * flow, assertions and saves. *match is set if it can reach MATCH instead.
+ */
+static void next_bytes(const cregex_program_t *program,
+                       const cregex_program_instr_t *pc,
+                       bool *visited,
+                       cregex_char_class klass,
+                       bool *match)
+{
+    while (!visited[pc - program->instructions]) {
+        visited[pc - program->instructions] = true;
+
+        switch (pc->opcode) {
+        case REGEX_PROGRAM_OPCODE_MATCH:
+            *match = true;
+            return;
+
+        /* Characters */
+        case REGEX_PROGRAM_OPCODE_CHARACTER:
+        case REGEX_PROGRAM_OPCODE_ANY_CHARACTER:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS_NEGATED:
+            for (int ch = 0; ch <= UCHAR_MAX; ++ch)
+                if (regex_accepts(pc, ch))
+                    cregex_char_class_add(klass, ch);
+            return;
+
+        /* Control-flow */
+        case REGEX_PROGRAM_OPCODE_SPLIT:
+            next_bytes(program, pc->first, visited, klass, match);
+            pc = pc->second;
+            break;
+        case REGEX_PROGRAM_OPCODE_JUMP:
+            pc = pc->target;
+            break;
+        case REGEX_PROGRAM_OPCODE_DISPATCH:
+            for (int ch = 0; ch <= UCHAR_MAX; ++ch)
+                if (pc->table[ch])
+                    next_bytes(program, pc + pc->table[ch], visited, klass,
+                               match);
+            return;
+
+        /* Assertions and saving */
+        default:
+            ++pc;
+            break;
+        }
+    }
+}
+
+/* A program is one-pass if at every SPLIT, the next byte (or the end of the
+ * match) tells which branch to take, so a single thread could run it. A
+ * DISPATCH always does.
+ */
+static bool is_onepass(const cregex_program_t *program, bool *visited)
+{
+    for (int i = program->start; i < forward_size(program); ++i) {
+        const cregex_program_instr_t *pc = program->instructions + i;
+        cregex_char_class first = {0}, second = {0};
+        bool first_match = false, second_match = false;
+
+        if (pc->opcode != REGEX_PROGRAM_OPCODE_SPLIT)
+            continue;
+
+        memset(visited, 0, sizeof(visited[0]) * program->ninstructions);
+        next_bytes(program, pc->first, visited, first, &first_match);
+        memset(visited, 0, sizeof(visited[0]) * program->ninstructions);
+        next_bytes(program, pc->second, visited, second, &second_match);
+
+        if (first_match && second_match)
+            return false;
+        for (size_t j = 0; j < sizeof(first); ++j)
+            if (first[j] & second[j])
+                return false;
+    }
+    return true;
+}
+
+void cregex_program_plan(const cregex_program_t *program,
+                         cregex_plan_info_t *info)
+{
+    const cregex_program_instr_t *pc = program->instructions + program->start;
+    bool *visited = calloc(program->ninstructions, sizeof(visited[0]));
+
+    memset(info, 0, sizeof(*info));
+    info->plan = program->plan;
+    info->ninstructions = program->ninstructions;
+    info->anchored = program->start == 0;
+    info->nfirst = program->nfirst;
+
+    for (int i = 0; i < forward_size(program); ++i)
+        if (program->instructions[i].opcode == REGEX_PROGRAM_OPCODE_SAVE &&
+            program->instructions[i].save / 2 > info->ncaptures)
+            info->ncaptures = program->instructions[i].save / 2;
+
+    /* characters before the first branch, past saves and ^ */
+    for (;; ++pc) {
+        if (pc->opcode == REGEX_PROGRAM_OPCODE_CHARACTER)
+            ++info->prefix_length;
+        else if (pc->opcode != REGEX_PROGRAM_OPCODE_SAVE &&
+                 pc->opcode != REGEX_PROGRAM_OPCODE_ASSERT_BEGIN)
+            break;
+    }
+
+    /* without memory, the properties needing a walk are left unset */
+    if (visited) {
+        info->end_anchored = !reaches_match(
+            program, program->instructions + program->start, visited);
+        info->onepass = forward_size(program) <= REGEX_PLAN_MAX_ONEPASS &&
+                        is_onepass(program, visited);
+        free(visited);
+    }
+
+    switch (program->plan) {
+    case CREGEX_PLAN_PIKE_VM:
+        info->reason = "a match can begin with any byte or be empty";
+        break;
+    case CREGEX_PLAN_ANCHORED:
+        info->reason = "the pattern starts with ^";
+        break;
+    case CREGEX_PLAN_PREFILTER:
+        info->reason = "only some bytes can begin a match";
+        break;
+    case CREGEX_PLAN_REVERSE:
+        info->reason = "the pattern ends with $";
+        break;
+    case CREGEX_PLAN_LITERAL:
+        info->reason = "the pattern is a plain string";
+        break;
+    }
+}
+
+const char *cregex_plan_name(cregex_plan_t plan)
+{
+    switch (plan) {
+    case CREGEX_PLAN_PIKE_VM:
+        return "pike-vm";
+    case CREGEX_PLAN_ANCHORED:
+        return "anchored";
+    case CREGEX_PLAN_PREFILTER:
+        return "prefilter";
+    case CREGEX_PLAN_REVERSE:
+        return "reverse";
+    case CREGEX_PLAN_LITERAL:
+        return "literal";
+    }
+    return "unknown";
+}
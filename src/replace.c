@@ -0,0 +1,211 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+/* \0 to \9 */
+#define REGEX_REPLACE_MAX_GROUPS 10
+
+/* Result of a replacement, either in a caller-supplied buffer which is
+ * filled as far as it goes, or in an allocated one grown as needed
+ */
+typedef struct {
+    char *buffer;
+    size_t size, length;
+    const cregex_allocator_t *allocator; /* of the buffer, if it grows */
+    bool grow, error;
+} replace_output;
+
+static void output_append(replace_output *output,
+                          const char *bytes,
+                          size_t length)
+{
+    /* room is kept for the terminating NUL */
+    if (output->grow && !output->error &&
+        output->length + length >= output->size) {
+        size_t size = output->size * 2;
+        char *buffer;
+
+        if (size <= output->length + length)
+            size = output->length + length + 1;
+        if (!(buffer = regex_alloc(output->allocator, size))) {
+            output->error = true;
+            return;
+        }
+        memcpy(buffer, output->buffer, output->length);
+        regex_free(output->allocator, output->buffer);
+        output->buffer = buffer;
+        output->size = size;
+    }
+
+    if (output->length < output->size) {
+        size_t room = output->size - 1 - output->length;
+        memcpy(output->buffer + output->length, bytes,
+               (length < room) ? length : room);
+    }
+    output->length += length;
+}
+
+/* Highest group replacement refers to (0 if none), or -1 if it has a
+ * backslash followed by anything but a digit or another backslash
+ */
+static int replacement_groups(const char *replacement)
+{
+    int ngroups = 0;
+
+    for (const char *sp = replacement; (sp = strchr(sp, '\\')); sp += 2) {
+        if (sp[1] >= '0' && sp[1] <= '9') {
+            if (sp[1] - '0' > ngroups)
+                ngroups = sp[1] - '0';
+        } else if (sp[1] != '\\') {
+            return -1;
+        }
+    }
+    return ngroups;
+}
+
+/* Number of capture groups of program, not counting the whole match */
+static int program_groups(const cregex_program_t *program)
+{
+    int ngroups = 0;
+
+    for (int i = 0; i < program->ninstructions; ++i)
+        if (program->instructions[i].opcode == REGEX_PROGRAM_OPCODE_SAVE &&
+            program->instructions[i].save / 2 > ngroups)
+            ngroups = program->instructions[i].save / 2;
+    return ngroups;
+}
+
+/* Append replacement for one match, copying the text between references in
+ * bulk
+ */
+static void expand(replace_output *output,
+                   const char *replacement,
+                   const char **matches)
+{
+    const char *sp = replacement, *backslash;
+
+    while ((backslash = strchr(sp, '\\'))) {
+        output_append(output, sp, backslash - sp);
+        if (backslash[1] == '\\') {
+            output_append(output, backslash, 1);
+        } else {
+            int group = backslash[1] - '0';
+            if (matches[2 * group] && matches[2 * group + 1])
+                output_append(output, matches[2 * group],
+                              matches[2 * group + 1] - matches[2 * group]);
+        }
+        sp = backslash + 2;
+    }
+    output_append(output, sp, strlen(sp));
+}
+
+static int replace(const cregex_program_t *program,
+                   const char *string,
+                   size_t length,
+                   const char *replacement,
+                   replace_output *output)
+{
+    const char *matches[2 * REGEX_REPLACE_MAX_GROUPS];
+    const char *end = string + length, *sp = string, *last = NULL;
+    int ngroups = replacement_groups(replacement), nmatches, count = 0;
+    int matched = 0;
+    void *scratch;
+
+    if (ngroups < 0 || ngroups > program_groups(program))
+        return CREGEX_ERROR;
+    nmatches = 2 * (ngroups + 1);
+
+    /* the VM's threads are allocated once for all searches */
+    if (!(scratch = malloc(regex_search_scratch_size(program))))
+        return CREGEX_ERROR;
+
+    while (sp <= end) {
+        /* groups which do not take part in a match stay NULL */
+        memset(matches, 0, sizeof(matches[0]) * nmatches);
+        matched = regex_search(program, string, sp, end, matches, nmatches,
+                               scratch);
+        if (matched <= 0)
+            break;
+
+        /* the text before the match, in one piece */
+        output_append(output, sp, matches[0] - sp);
+
+        /* skip an empty match where the last match ended, as RE2 does */
+        if (matches[0] == matches[1] && matches[0] == last) {
+            const char *next;
+
+            if (sp == end)
+                break;
+            /* a whole character, not part of one, in UTF-8 mode */
+            next = regex_next_character(program, sp, end);
+            output_append(output, sp, next - sp);
+            sp = next;
+            continue;
+        }
+
+        expand(output, replacement, matches);
+        sp = last = matches[1];
+        ++count;
+    }
+    free(scratch);
+
+    if (matched < 0)
+        return matched;
+    if (sp < end)
+        output_append(output, sp, end - sp);
+    if (output->error)
+        return CREGEX_ERROR;
+
+    if (output->size)
+        output->buffer[(output->length < output->size) ? output->length
+                                                       : output->size - 1] =
+            '\0';
+    return count;
+}
+
+int cregex_program_replace(const cregex_program_t *program,
+                           const char *string,
+                           size_t length,
+                           const char *replacement,
+                           char *output,
+                           size_t size,
+                           size_t *output_length)
+{
+    replace_output result = {.buffer = output, .size = size};
+    int count = replace(program, string, length, replacement, &result);
+
+    if (count >= 0 && output_length)
+        *output_length = result.length;
+    return count;
+}
+
+int cregex_program_replace_with(const cregex_program_t *program,
+                                const char *string,
+                                size_t length,
+                                const char *replacement,
+                                const cregex_allocator_t *allocator,
+                                char **output,
+                                size_t *output_length)
+{
+    /* as long as the result is no longer than the input, it fits at once */
+    replace_output result = {.size = length + 1,
+                             .allocator = allocator,
+                             .grow = true};
+    int count;
+
+    if (!(result.buffer = regex_alloc(allocator, result.size)))
+        return CREGEX_ERROR;
+
+    count = replace(program, string, length, replacement, &result);
+    if (count < 0) {
+        regex_free(allocator, result.buffer);
+        return count;
+    }
+
+    *output = result.buffer;
+    if (output_length)
+        *output_length = result.length;
+    return count;
+}
@@ -0,0 +1,216 @@
+#include <stdatomic.h>
+#include <string.h>
+
+#include "internal.h"
+
+/* Finding the next byte of a set is done with the "truffle" technique: the
+ * set is split into two 16-entry tables indexed by the low nibble of a byte,
+ * one for bytes below 0x80 and one for the rest, whose entries have bit n set
+ * if the byte with high nibble n (modulo 8) is a member. A vector shuffle
+ * looks up 16 or 32 bytes at once, and a second shuffle turns each high
+ * nibble into the bit to test. Building with -DCREGEX_NO_SIMD leaves only the
+ * scalar loop.
+ */
+#if !defined(CREGEX_NO_SIMD) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define REGEX_SCAN_X86
+#include <immintrin.h>
+#endif
+
+void regex_scan_prepare(cregex_program_t *program)
+{
+    memset(program->first_low, 0, sizeof(program->first_low));
+    memset(program->first_high, 0, sizeof(program->first_high));
+
+    for (int ch = 0; ch <= UCHAR_MAX; ++ch) {
+        if (!cregex_char_class_contains(program->first, ch))
+            continue;
+        if (ch < 0x80)
+            program->first_low[ch & 0x0f] |= 1 << (ch >> 4);
+        else
+            program->first_high[ch & 0x0f] |= 1 << ((ch >> 4) - 8);
+    }
+}
+
+static const char *scan_scalar(const cregex_program_t *program,
+                               const char *sp,
+                               const char *end)
+{
+    while (sp < end &&
+           !cregex_char_class_contains(program->first, (unsigned char) *sp))
+        ++sp;
+    return sp;
+}
+
+#ifdef REGEX_SCAN_X86
+__attribute__((target("ssse3"))) static const char *scan_ssse3(
+    const cregex_program_t *program,
+    const char *sp,
+    const char *end)
+{
+    const __m128i low = _mm_loadu_si128((const __m128i *) program->first_low);
+    const __m128i high =
+        _mm_loadu_si128((const __m128i *) program->first_high);
+    const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4,
+                                       8, 16, 32, 64, -128);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i flip = _mm_set1_epi8(-128);
+
+    for (; end - sp >= 16; sp += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) sp);
+        /* shuffles yield zero for indices with the top bit set, so each
+         * table only answers for its own half of the byte range
+         */
+        __m128i row =
+            _mm_or_si128(_mm_shuffle_epi8(low, v),
+                         _mm_shuffle_epi8(high, _mm_xor_si128(v, flip)));
+        __m128i bit = _mm_shuffle_epi8(
+            bits, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        unsigned mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(
+                            _mm_and_si128(row, bit), _mm_setzero_si128())) &
+                        0xffff;
+        if (mask)
+            return sp + __builtin_ctz(mask);
+    }
+
+    return scan_scalar(program, sp, end);
+}
+
+__attribute__((target("avx2"))) static const char *scan_avx2(
+    const cregex_program_t *program,
+    const char *sp,
+    const char *end)
+{
+    const __m256i low = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *) program->first_low));
+    const __m256i high = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *) program->first_high));
+    const __m256i bits = _mm256_setr_epi8(
+        1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8,
+        16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i flip = _mm256_set1_epi8(-128);
+
+    for (; end - sp >= 32; sp += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) sp);
+        __m256i row = _mm256_or_si256(
+            _mm256_shuffle_epi8(low, v),
+            _mm256_shuffle_epi8(high, _mm256_xor_si256(v, flip)));
+        __m256i bit = _mm256_shuffle_epi8(
+            bits, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+        unsigned mask = ~(unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_and_si256(row, bit), _mm256_setzero_si256()));
+        if (mask)
+            return sp + __builtin_ctz(mask);
+    }
+
+    return scan_ssse3(program, sp, end);
+}
+
+/* 0: scalar, 1: SSSE3, 2: AVX2, -1: not yet detected */
+static atomic_int scan_level = -1;
+
+static int detect_scan_level(void)
+{
+    int level = atomic_load_explicit(&scan_level, memory_order_relaxed);
+    if (level < 0) {
+        __builtin_cpu_init();
+        level = __builtin_cpu_supports("avx2")    ? 2
+                : __builtin_cpu_supports("ssse3") ? 1
+                                                  : 0;
+        atomic_store_explicit(&scan_level, level, memory_order_relaxed);
+    }
+    return level;
+}
+#endif
+
+/* Plain strings are found by testing the first and the last byte at many
+ * positions at once and comparing the rest only where both match, which is
+ * rare for all but the most repetitive input
+ */
+static const char *literal_scalar(const char *literal,
+                                  size_t length,
+                                  const char *sp,
+                                  const char *end)
+{
+    while ((size_t) (end - sp) >= length) {
+        const char *found = memchr(sp, literal[0], end - sp - length + 1);
+        if (!found)
+            break;
+        if (memcmp(found + 1, literal + 1, length - 1) == 0)
+            return found;
+        sp = found + 1;
+    }
+    return NULL;
+}
+
+#ifdef REGEX_SCAN_X86
+__attribute__((target("avx2"))) static const char *literal_avx2(
+    const char *literal,
+    size_t length,
+    const char *sp,
+    const char *end)
+{
+    const __m256i first = _mm256_set1_epi8(literal[0]);
+    const __m256i last = _mm256_set1_epi8(literal[length - 1]);
+
+    /* the loads for the last byte reach length - 1 bytes further */
+    for (; (size_t) (end - sp) >= length + 31; sp += 32) {
+        __m256i head = _mm256_loadu_si256((const __m256i *) sp);
+        __m256i tail =
+            _mm256_loadu_si256((const __m256i *) (sp + length - 1));
+        unsigned mask = (unsigned) _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(head, first),
+                             _mm256_cmpeq_epi8(tail, last)));
+        while (mask) {
+            int i = __builtin_ctz(mask);
+            if (memcmp(sp + i + 1, literal + 1, length - 2) == 0)
+                return sp + i;
+            mask &= mask - 1;
+        }
+    }
+
+    return literal_scalar(literal, length, sp, end);
+}
+#endif
+
+const char *regex_scan_literal(const char *literal,
+                               size_t length,
+                               const char *sp,
+                               const char *end)
+{
+    if (length == 1)
+        return memchr(sp, literal[0], end - sp);
+
+#ifdef REGEX_SCAN_X86
+    if (detect_scan_level() == 2)
+        return literal_avx2(literal, length, sp, end);
+#endif
+
+    return literal_scalar(literal, length, sp, end);
+}
+
+const char *regex_scan_first(const cregex_program_t *program,
+                             const char *sp,
+                             const char *end)
+{
+    /* a single byte is best left to the C library */
+    if (program->nfirst == 1) {
+        int ch = 0;
+        while (!cregex_char_class_contains(program->first, ch))
+            ++ch;
+        const char *found = memchr(sp, ch, end - sp);
+        return found ? found : end;
+    }
+
+#ifdef REGEX_SCAN_X86
+    switch (detect_scan_level()) {
+    case 2:
+        return scan_avx2(program, sp, end);
+    case 1:
+        return scan_ssse3(program, sp, end);
+    }
+#endif
+
+    return scan_scalar(program, sp, end);
+}
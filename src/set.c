@@ -0,0 +1,177 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "internal.h"
+
+/* Patterns are compiled by a pool of threads, each taking the next pattern
+ * until none is left, so that a few large patterns do not hold up the rest.
+ * Once all are compiled, their sizes are known: the programs are copied, in
+ * pattern order, into one block allocated for them all, again by the pool.
+ */
+#define REGEX_SET_MAX_THREADS 64
+
+struct cregex_program_set {
+    size_t nprograms;
+    cregex_program_t **programs;
+    int *errors;
+    char *block;
+};
+
+typedef struct {
+    cregex_program_set_t *set;
+    const char *const *patterns;
+    int flags;
+    const cregex_limits_t *limits;
+    /* programs compiled separately, then where they go in the block */
+    cregex_program_t **compiled;
+    size_t *offsets;
+    atomic_size_t next;
+} regex_set_job;
+
+/* Compile patterns until none is left */
+static void *set_compile(void *arg)
+{
+    regex_set_job *job = arg;
+    cregex_program_set_t *set = job->set;
+
+    for (;;) {
+        size_t i =
+            atomic_fetch_add_explicit(&job->next, 1, memory_order_relaxed);
+        if (i >= set->nprograms)
+            return NULL;
+        job->compiled[i] =
+            cregex_compile_limited(job->patterns[i], job->flags, NULL,
+                                   job->limits, &set->errors[i]);
+        if (job->compiled[i])
+            set->errors[i] = 0;
+    }
+}
+
+/* Copy compiled programs into the block until none is left */
+static void *set_copy(void *arg)
+{
+    regex_set_job *job = arg;
+    cregex_program_set_t *set = job->set;
+
+    for (;;) {
+        size_t i =
+            atomic_fetch_add_explicit(&job->next, 1, memory_order_relaxed);
+        if (i >= set->nprograms)
+            return NULL;
+        if (job->compiled[i]) {
+            set->programs[i] = regex_program_copy(
+                set->block + job->offsets[i], job->compiled[i]);
+            cregex_compile_free(job->compiled[i]);
+        }
+    }
+}
+
+/* Run fn on job in nthreads threads, the calling thread being one of them.
+ * Fewer run if threads cannot be started.
+ */
+static void set_run(void *(*fn)(void *), regex_set_job *job, int nthreads)
+{
+    pthread_t threads[REGEX_SET_MAX_THREADS];
+    int nstarted = 1;
+
+    atomic_store_explicit(&job->next, 0, memory_order_relaxed);
+    while (nstarted < nthreads &&
+           !pthread_create(&threads[nstarted], NULL, fn, job))
+        ++nstarted;
+    fn(job);
+    for (int i = 1; i < nstarted; ++i)
+        pthread_join(threads[i], NULL);
+}
+
+cregex_program_set_t *cregex_compile_set(const char *const *patterns,
+                                         size_t npatterns,
+                                         int flags,
+                                         const cregex_limits_t *limits,
+                                         int nthreads)
+{
+    cregex_program_set_t *set = calloc(1, sizeof(*set));
+    regex_set_job job = {.set = set,
+                         .patterns = patterns,
+                         .flags = flags,
+                         .limits = limits};
+    size_t align = _Alignof(max_align_t), size = 0;
+
+    if (!set)
+        return NULL;
+    if (nthreads <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (online > 0) ? online : 1;
+    }
+    if (nthreads > REGEX_SET_MAX_THREADS)
+        nthreads = REGEX_SET_MAX_THREADS;
+    if ((size_t) nthreads > npatterns)
+        nthreads = npatterns ? npatterns : 1;
+
+    set->nprograms = npatterns;
+    set->programs = calloc(npatterns + 1, sizeof(set->programs[0]));
+    set->errors = calloc(npatterns + 1, sizeof(set->errors[0]));
+    job.compiled = calloc(npatterns + 1, sizeof(job.compiled[0]));
+    job.offsets = calloc(npatterns + 1, sizeof(job.offsets[0]));
+    if (!set->programs || !set->errors || !job.compiled || !job.offsets) {
+        free(job.compiled);
+        free(job.offsets);
+        cregex_program_set_free(set);
+        return NULL;
+    }
+
+    set_run(set_compile, &job, nthreads);
+
+    /* lay the programs out one after the other */
+    for (size_t i = 0; i < npatterns; ++i) {
+        job.offsets[i] = size;
+        if (job.compiled[i])
+            size += (regex_program_copy_size(job.compiled[i]) + align - 1) &
+                    ~(align - 1);
+    }
+
+    if ((set->block = malloc(size ? size : 1))) {
+        set_run(set_copy, &job, nthreads);
+    } else {
+        for (size_t i = 0; i < npatterns; ++i)
+            cregex_compile_free(job.compiled[i]);
+        cregex_program_set_free(set);
+        set = NULL;
+    }
+
+    free(job.compiled);
+    free(job.offsets);
+    return set;
+}
+
+size_t cregex_program_set_count(const cregex_program_set_t *set)
+{
+    return set->nprograms;
+}
+
+const cregex_program_t *cregex_program_set_program(
+    const cregex_program_set_t *set,
+    size_t i)
+{
+    return set->programs[i];
+}
+
+int cregex_program_set_error(const cregex_program_set_t *set, size_t i)
+{
+    return set->errors[i];
+}
+
+void cregex_program_set_free(cregex_program_set_t *set)
+{
+    if (!set)
+        return;
+    free(set->programs);
+    free(set->errors);
+    free(set->block);
+    free(set);
+}
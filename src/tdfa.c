@@ -0,0 +1,624 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+/* The tagged DFA runs the threads of the VM in lockstep, as the DFA does,
+ * but also keeps their submatches, in registers. A state is the ordered list
+ * of instructions threads resume at after consuming a byte, each with the
+ * registers holding its submatch slots. Closures are taken on transitions,
+ * once the next byte (or the end of input) is known, following the order of
+ * vm_add_thread(), so that threads come out in the same priority order and
+ * a MATCH cuts off the same threads as in the VM. The SAVE instructions
+ * passed become register operations of the transition.
+ *
+ * Registers are numbered in the order threads first use them, so states
+ * whose threads share registers alike are one state; the copies a
+ * transition makes to where its target keeps each value are mostly no-ops
+ * in loops. Matches found on a transition copy the slots of the matching
+ * thread out before the registers are updated.
+ */
+
+/* States built by cregex_tdfa_compile(), unless told otherwise */
+#define REGEX_TDFA_MAX_STATES 1024
+
+/* Register operation source standing for the current position */
+#define REGEX_TDFA_CURRENT (-1)
+
+/* Set register dst to register src, or to the current position */
+typedef struct {
+    int dst, src;
+} tdfa_op;
+
+typedef struct {
+    int target;    /* 0, the dead state, if no thread is left */
+    int match;     /* offset of the nslots slot sources of a match, or -1 */
+    int ops, nops; /* register operations, to be done in order */
+} tdfa_transition;
+
+struct cregex_tdfa {
+    const cregex_program_t *program;
+    /* no table if the interpreter is used */
+    int nstates, start;
+    int nslots, nregisters;
+    unsigned char classes[256];
+    int nsymbols; /* byte classes, then the end of input */
+    tdfa_transition *transitions;
+    tdfa_op *ops;
+};
+
+/* A state is stored as its key: whether ^ can still match, the number of
+ * threads and of registers, the instruction of each thread, and the
+ * registers of each thread, nslots per thread
+ */
+enum { TDFA_BEGIN, TDFA_NTHREADS, TDFA_NREGISTERS, TDFA_HEADER };
+
+typedef struct {
+    const cregex_program_t *program;
+    int ninstructions;
+    int max_states;
+    cregex_tdfa_t *tdfa;
+
+    /* scratch space for closures */
+    int *marks, generation;
+    int *values; /* slots of the thread being added, as registers */
+    int nthreads, *threads, *thread_values;
+
+    /* the key of the next state, and where its registers come from */
+    int *key, nkey;
+    int *sources;
+    int *renumber;
+    int *nreads, *pending;
+
+    /* states, whose keys live in pool */
+    int capacity;
+    size_t *offsets;
+    int *pool;
+    size_t npool, pool_capacity;
+
+    /* open addressing hash table of state index + 1 */
+    int *table;
+    size_t ntable;
+
+    size_t nops, ops_capacity;
+} tdfa_builder;
+
+/* Add the thread at pc to the closure as vm_add_thread() would, with the
+ * next byte ch (-1 at the end of input) deciding DISPATCH and $
+ */
+static void add_thread(tdfa_builder *builder, int pc, bool begin, int ch)
+{
+    const cregex_program_instr_t *instructions =
+        builder->program->instructions;
+    int nslots = builder->tdfa->nslots;
+
+    for (;;) {
+        const cregex_program_instr_t *instruction = instructions + pc;
+
+        if (builder->marks[pc] == builder->generation)
+            return;
+        builder->marks[pc] = builder->generation;
+
+        switch (instruction->opcode) {
+        case REGEX_PROGRAM_OPCODE_MATCH:
+            /* fall-through */
+
+        /* Characters */
+        case REGEX_PROGRAM_OPCODE_CHARACTER:
+        case REGEX_PROGRAM_OPCODE_ANY_CHARACTER:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS_NEGATED:
+            builder->threads[builder->nthreads] = pc;
+            memcpy(builder->thread_values + (size_t) builder->nthreads * nslots,
+                   builder->values, sizeof(builder->values[0]) * nslots);
+            ++builder->nthreads;
+            return;
+
+        /* Control-flow */
+        case REGEX_PROGRAM_OPCODE_SPLIT:
+            add_thread(builder, instruction->first - instructions, begin, ch);
+            pc = instruction->second - instructions;
+            break;
+        case REGEX_PROGRAM_OPCODE_JUMP:
+            pc = instruction->target - instructions;
+            break;
+        case REGEX_PROGRAM_OPCODE_DISPATCH:
+            if (ch < 0 || !instruction->table[ch])
+                return;
+            pc += instruction->table[ch];
+            break;
+
+        /* Assertions */
+        case REGEX_PROGRAM_OPCODE_ASSERT_BEGIN:
+            if (!begin)
+                return;
+            ++pc;
+            break;
+        case REGEX_PROGRAM_OPCODE_ASSERT_END:
+            if (ch >= 0)
+                return;
+            ++pc;
+            break;
+
+        /* Saving */
+        case REGEX_PROGRAM_OPCODE_SAVE:
+            if (instruction->save < nslots) {
+                int saved = builder->values[instruction->save];
+                builder->values[instruction->save] = REGEX_TDFA_CURRENT;
+                add_thread(builder, pc + 1, begin, ch);
+                builder->values[instruction->save] = saved;
+                return;
+            }
+            ++pc;
+            break;
+        }
+    }
+}
+
+static uint32_t hash_key(const int *key, int nkey)
+{
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < nkey; ++i)
+        hash = (hash ^ (uint32_t) key[i]) * 16777619u;
+    return hash;
+}
+
+/* Length of the key of a state with nthreads threads */
+static int key_size(const tdfa_builder *builder, int nthreads)
+{
+    return TDFA_HEADER + nthreads * (1 + builder->tdfa->nslots);
+}
+
+static bool grow_states(tdfa_builder *builder)
+{
+    int capacity = builder->capacity ? builder->capacity * 2 : 64;
+    cregex_tdfa_t *tdfa = builder->tdfa;
+    size_t *offsets;
+    tdfa_transition *transitions;
+
+    if (capacity > builder->max_states)
+        capacity = builder->max_states;
+
+    if (!(offsets = realloc(builder->offsets, sizeof(offsets[0]) * capacity)))
+        return false;
+    builder->offsets = offsets;
+    if (!(transitions =
+              realloc(tdfa->transitions, sizeof(transitions[0]) *
+                                             tdfa->nsymbols * capacity)))
+        return false;
+    tdfa->transitions = transitions;
+
+    builder->capacity = capacity;
+    return true;
+}
+
+static bool grow_table(tdfa_builder *builder)
+{
+    size_t ntable = builder->ntable ? builder->ntable * 2 : 128;
+    int *table = calloc(ntable, sizeof(table[0]));
+
+    if (!table)
+        return false;
+
+    for (int state = 0; state < builder->tdfa->nstates; ++state) {
+        const int *key = builder->pool + builder->offsets[state];
+        size_t i = hash_key(key, key_size(builder, key[TDFA_NTHREADS])) &
+                   (ntable - 1);
+        while (table[i])
+            i = (i + 1) & (ntable - 1);
+        table[i] = state + 1;
+    }
+
+    free(builder->table);
+    builder->table = table;
+    builder->ntable = ntable;
+    return true;
+}
+
+/* Index of the state of builder->key, added if new. Returns -1 if the state
+ * limit is reached or memory runs out.
+ */
+static int add_state(tdfa_builder *builder)
+{
+    cregex_tdfa_t *tdfa = builder->tdfa;
+    size_t nkey = builder->nkey, i;
+    int state;
+
+    /* keep the table at most half full */
+    if ((size_t) tdfa->nstates * 2 >= builder->ntable && !grow_table(builder))
+        return -1;
+
+    i = hash_key(builder->key, nkey) & (builder->ntable - 1);
+    for (; builder->table[i]; i = (i + 1) & (builder->ntable - 1)) {
+        const int *key =
+            builder->pool + builder->offsets[builder->table[i] - 1];
+        if (key[TDFA_NTHREADS] == builder->key[TDFA_NTHREADS] &&
+            memcmp(key, builder->key, sizeof(key[0]) * nkey) == 0)
+            return builder->table[i] - 1;
+    }
+
+    if (tdfa->nstates == builder->max_states)
+        return -1;
+    if (tdfa->nstates == builder->capacity && !grow_states(builder))
+        return -1;
+
+    if (builder->npool + nkey >= builder->pool_capacity) {
+        size_t capacity = (builder->npool + nkey) * 2 + 64;
+        int *pool = realloc(builder->pool, sizeof(pool[0]) * capacity);
+        if (!pool)
+            return -1;
+        builder->pool = pool;
+        builder->pool_capacity = capacity;
+    }
+
+    state = tdfa->nstates++;
+    builder->offsets[state] = builder->npool;
+    memcpy(builder->pool + builder->npool, builder->key,
+           sizeof(builder->key[0]) * nkey);
+    builder->npool += nkey;
+    builder->table[i] = state + 1;
+
+    return state;
+}
+
+static bool emit_op(tdfa_builder *builder, int dst, int src)
+{
+    cregex_tdfa_t *tdfa = builder->tdfa;
+
+    if (builder->nops == builder->ops_capacity) {
+        size_t capacity =
+            builder->ops_capacity ? builder->ops_capacity * 2 : 256;
+        tdfa_op *ops = realloc(tdfa->ops, sizeof(ops[0]) * capacity);
+        if (!ops)
+            return false;
+        tdfa->ops = ops;
+        builder->ops_capacity = capacity;
+    }
+    tdfa->ops[builder->nops++] = (tdfa_op){.dst = dst, .src = src};
+    if (dst >= tdfa->nregisters)
+        tdfa->nregisters = dst + 1;
+    return true;
+}
+
+/* Emit the operations moving register sources[t] (or the current position)
+ * to register t, for the nregisters registers of the target state, all at
+ * once. Registers from first on are free in both states, and hold the
+ * values a cycle of copies would otherwise overwrite.
+ */
+static bool emit_moves(tdfa_builder *builder, int nregisters, int first)
+{
+    int *sources = builder->sources, *nreads = builder->nreads;
+    int *pending = builder->pending, npending = 0;
+
+    for (int t = 0; t < nregisters; ++t) {
+        if (sources[t] != REGEX_TDFA_CURRENT && sources[t] != t) {
+            pending[npending++] = t;
+            ++nreads[sources[t]];
+        }
+    }
+
+    while (npending > 0) {
+        int n = 0;
+
+        /* copy to registers no pending copy reads any more */
+        for (int i = 0; i < npending; ++i) {
+            int t = pending[i];
+            if (nreads[t] == 0) {
+                if (!emit_op(builder, t, sources[t]))
+                    return false;
+                --nreads[sources[t]];
+            } else {
+                pending[n++] = t;
+            }
+        }
+
+        /* only cycles are left: set one of their values aside */
+        if (n == npending) {
+            int t = pending[0];
+            if (!emit_op(builder, first, t))
+                return false;
+            for (int i = 0; i < n; ++i) {
+                if (sources[pending[i]] == t) {
+                    sources[pending[i]] = first;
+                    ++nreads[first];
+                }
+            }
+            nreads[t] = 0;
+            ++first;
+        }
+        npending = n;
+    }
+
+    for (int t = 0; t < nregisters; ++t)
+        if (sources[t] == REGEX_TDFA_CURRENT &&
+            !emit_op(builder, t, REGEX_TDFA_CURRENT))
+            return false;
+    return true;
+}
+
+/* Compute the transition of state on a byte of a class, or on the end of
+ * input if ch is -1
+ */
+static bool expand_symbol(tdfa_builder *builder, int state, int symbol, int ch)
+{
+    const cregex_program_instr_t *instructions =
+        builder->program->instructions;
+    cregex_tdfa_t *tdfa = builder->tdfa;
+    int nslots = tdfa->nslots;
+    /* the pool may move while states are added */
+    const int *key = builder->pool + builder->offsets[state];
+    int nthreads = key[TDFA_NTHREADS], nregisters = key[TDFA_NREGISTERS];
+    const int *pcs = key + TDFA_HEADER, *registers = pcs + nthreads;
+    tdfa_transition transition = {.match = -1};
+    int *next = builder->key, n = 0, nnext = 0, target;
+
+    ++builder->generation;
+    builder->nthreads = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        memcpy(builder->values, registers + (size_t) i * nslots,
+               sizeof(builder->values[0]) * nslots);
+        add_thread(builder, pcs[i], key[TDFA_BEGIN], ch);
+    }
+
+    /* threads step past their byte up to the first MATCH, which reports the
+     * slots of its thread
+     */
+    for (int i = 0; i < builder->nthreads; ++i) {
+        int pc = builder->threads[i];
+        if (instructions[pc].opcode == REGEX_PROGRAM_OPCODE_MATCH) {
+            transition.match = builder->nops;
+            for (int slot = 0; slot < nslots; ++slot)
+                if (!emit_op(builder, slot,
+                             builder->thread_values[(size_t) i * nslots +
+                                                    slot]))
+                    return false;
+            break;
+        }
+        if (regex_accepts(instructions + pc, ch)) {
+            builder->threads[nnext] = pc + 1;
+            memmove(builder->thread_values + (size_t) nnext * nslots,
+                    builder->thread_values + (size_t) i * nslots,
+                    sizeof(builder->thread_values[0]) * nslots);
+            ++nnext;
+        }
+    }
+
+    /* number the registers of the next state by first use */
+    next[TDFA_BEGIN] = false;
+    next[TDFA_NTHREADS] = nnext;
+    for (int i = 0; i < nnext; ++i) {
+        const int *values = builder->thread_values + (size_t) i * nslots;
+        next[TDFA_HEADER + i] = builder->threads[i];
+        for (int slot = 0; slot < nslots; ++slot) {
+            int *renumbered = builder->renumber + values[slot] + 1;
+            if (*renumbered < 0) {
+                *renumbered = n;
+                builder->sources[n++] = values[slot];
+            }
+            next[TDFA_HEADER + nnext + i * nslots + slot] = *renumbered;
+        }
+    }
+    next[TDFA_NREGISTERS] = n;
+    builder->nkey = key_size(builder, nnext);
+    for (int t = 0; t < n; ++t)
+        builder->renumber[builder->sources[t] + 1] = -1;
+
+    if ((target = add_state(builder)) < 0)
+        return false;
+    transition.target = target;
+    transition.ops = builder->nops;
+    if (!emit_moves(builder, n, (n > nregisters) ? n : nregisters))
+        return false;
+    transition.nops = builder->nops - transition.ops;
+
+    tdfa->transitions[(size_t) state * tdfa->nsymbols + symbol] = transition;
+    return true;
+}
+
+static bool expand_state(tdfa_builder *builder, int state)
+{
+    cregex_tdfa_t *tdfa = builder->tdfa;
+
+    /* one transition per byte class, using its first byte */
+    for (int symbol = 0, ch = 0; symbol + 1 < tdfa->nsymbols; ++symbol) {
+        while (tdfa->classes[ch] != symbol)
+            ++ch;
+        if (!expand_symbol(builder, state, symbol, ch))
+            return false;
+    }
+    return expand_symbol(builder, state, tdfa->nsymbols - 1, -1);
+}
+
+/* Build the tables of tdfa, returning false if there would be more than
+ * max_states states or memory runs out
+ */
+static bool tdfa_build(cregex_tdfa_t *tdfa, int max_states)
+{
+    const cregex_program_t *program = tdfa->program;
+    /* the reversed program, if any, is not part of the search */
+    int ninstructions =
+        program->reverse ? program->reverse : program->ninstructions;
+    tdfa_builder builder = {.program = program,
+                            .ninstructions = ninstructions,
+                            .max_states = max_states,
+                            .tdfa = tdfa};
+    size_t nregisters;
+    bool ok = false;
+
+    for (int pc = 0; pc < ninstructions; ++pc)
+        if (program->instructions[pc].opcode == REGEX_PROGRAM_OPCODE_SAVE &&
+            program->instructions[pc].save >= tdfa->nslots)
+            tdfa->nslots = program->instructions[pc].save + 1;
+    if (tdfa->nslots > REGEX_VM_MAX_MATCHES)
+        tdfa->nslots = REGEX_VM_MAX_MATCHES;
+
+    /* a state has at most one thread per instruction, with a register per
+     * slot, and needs as many more for the values of cycles of copies
+     */
+    nregisters = (size_t) ninstructions * tdfa->nslots + 1;
+    builder.marks = calloc(ninstructions, sizeof(builder.marks[0]));
+    builder.values = malloc(sizeof(builder.values[0]) * (tdfa->nslots + 1));
+    builder.threads = malloc(sizeof(builder.threads[0]) * ninstructions);
+    builder.thread_values = malloc(sizeof(builder.thread_values[0]) *
+                                   ((size_t) ninstructions * tdfa->nslots + 1));
+    builder.key = malloc(sizeof(builder.key[0]) *
+                         key_size(&builder, ninstructions));
+    builder.sources = malloc(sizeof(builder.sources[0]) * nregisters);
+    builder.renumber = malloc(sizeof(builder.renumber[0]) * (nregisters + 1));
+    builder.nreads = calloc(nregisters * 2, sizeof(builder.nreads[0]));
+    builder.pending = malloc(sizeof(builder.pending[0]) * nregisters);
+    if (!builder.marks || !builder.values || !builder.threads ||
+        !builder.thread_values || !builder.key || !builder.sources ||
+        !builder.renumber || !builder.nreads || !builder.pending)
+        goto done;
+    for (size_t i = 0; i <= nregisters; ++i)
+        builder.renumber[i] = -1;
+
+    tdfa->nsymbols =
+        regex_byte_classes(program, ninstructions, tdfa->classes) + 1;
+
+    /* the dead state, then the start state, whose single thread holds the
+     * slots passed in
+     */
+    builder.key[TDFA_BEGIN] = false;
+    builder.key[TDFA_NTHREADS] = 0;
+    builder.key[TDFA_NREGISTERS] = 0;
+    builder.nkey = key_size(&builder, 0);
+    if (max_states < 2 || add_state(&builder) != 0)
+        goto done;
+    builder.key[TDFA_BEGIN] = true;
+    builder.key[TDFA_NTHREADS] = 1;
+    builder.key[TDFA_NREGISTERS] = tdfa->nslots;
+    builder.key[TDFA_HEADER] = 0;
+    for (int slot = 0; slot < tdfa->nslots; ++slot)
+        builder.key[TDFA_HEADER + 1 + slot] = slot;
+    builder.nkey = key_size(&builder, 1);
+    if ((tdfa->start = add_state(&builder)) < 0)
+        goto done;
+    if (tdfa->nregisters < tdfa->nslots)
+        tdfa->nregisters = tdfa->nslots;
+
+    /* states are expanded in the order they are discovered */
+    for (int state = 0; state < tdfa->nstates; ++state)
+        if (!expand_state(&builder, state))
+            goto done;
+    ok = true;
+
+done:
+    free(builder.marks);
+    free(builder.values);
+    free(builder.threads);
+    free(builder.thread_values);
+    free(builder.key);
+    free(builder.sources);
+    free(builder.renumber);
+    free(builder.nreads);
+    free(builder.pending);
+    free(builder.offsets);
+    free(builder.pool);
+    free(builder.table);
+    return ok;
+}
+
+cregex_tdfa_t *cregex_tdfa_compile(const cregex_program_t *program,
+                                   int max_states)
+{
+    cregex_tdfa_t *tdfa = calloc(1, sizeof(*tdfa));
+
+    if (!tdfa)
+        return NULL;
+    tdfa->program = program;
+
+    /* as for the JIT and the DFA, end-anchored patterns and plain strings
+     * are left to the interpreter, which finds them without reading the
+     * whole input
+     */
+    if (program->plan == CREGEX_PLAN_REVERSE ||
+        program->plan == CREGEX_PLAN_LITERAL)
+        return tdfa;
+
+    if (!tdfa_build(tdfa, max_states ? max_states : REGEX_TDFA_MAX_STATES)) {
+        free(tdfa->transitions);
+        free(tdfa->ops);
+        tdfa->transitions = NULL;
+        tdfa->ops = NULL;
+        tdfa->nstates = 0;
+    }
+    return tdfa;
+}
+
+int cregex_tdfa_nstates(const cregex_tdfa_t *tdfa)
+{
+    return tdfa->nstates;
+}
+
+/* Registers of a run kept on the stack, unless more are needed */
+#define REGEX_TDFA_STACK_REGISTERS 64
+
+int cregex_tdfa_run(const cregex_tdfa_t *tdfa,
+                    const char *string,
+                    size_t length,
+                    const char **matches,
+                    int nmatches)
+{
+    const char *end = string + length;
+    const char *stack[REGEX_TDFA_STACK_REGISTERS], **registers = stack;
+    int nslots = tdfa->nslots, state = tdfa->start, matched = 0;
+
+    if (!tdfa->nstates)
+        return cregex_program_run_n(tdfa->program, string, length, matches,
+                                    nmatches);
+
+    if (length < (size_t) tdfa->program->min_length)
+        return 0;
+    if (tdfa->nregisters > REGEX_TDFA_STACK_REGISTERS &&
+        !(registers = malloc(sizeof(registers[0]) * tdfa->nregisters)))
+        return CREGEX_ERROR;
+
+    /* slots no SAVE sets keep what the caller passed in */
+    for (int slot = 0; slot < nslots; ++slot)
+        registers[slot] = (slot < nmatches) ? matches[slot] : NULL;
+    if (nslots > nmatches)
+        nslots = (nmatches > 0) ? nmatches : 0;
+
+    for (const char *sp = string;; ++sp) {
+        int symbol = (sp < end) ? tdfa->classes[(unsigned char) *sp]
+                                : tdfa->nsymbols - 1;
+        const tdfa_transition *transition =
+            tdfa->transitions + (size_t) state * tdfa->nsymbols + symbol;
+        const tdfa_op *op;
+
+        if (transition->match >= 0) {
+            op = tdfa->ops + transition->match;
+            for (int slot = 0; slot < nslots; ++slot)
+                matches[slot] = (op[slot].src == REGEX_TDFA_CURRENT)
+                                    ? sp
+                                    : registers[op[slot].src];
+            matched = 1;
+        }
+
+        op = tdfa->ops + transition->ops;
+        for (int i = 0; i < transition->nops; ++i)
+            registers[op[i].dst] =
+                (op[i].src == REGEX_TDFA_CURRENT) ? sp : registers[op[i].src];
+
+        /* done if no more threads are running or end of string reached */
+        if (!(state = transition->target) || sp == end)
+            break;
+    }
+
+    if (registers != stack)
+        free(registers);
+    return matched;
+}
+
+void cregex_tdfa_free(cregex_tdfa_t *tdfa)
+{
+    if (!tdfa)
+        return;
+    free(tdfa->transitions);
+    free(tdfa->ops);
+    free(tdfa);
+}
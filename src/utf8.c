@@ -0,0 +1,311 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+
+/* In UTF-8 mode, classes and . match code points, but the VM still reads
+ * bytes: every code point range is split into ranges whose UTF-8 encodings
+ * share a length and all leading bytes but one, each of which is matched by
+ * a sequence of byte ranges (as in RE2 and Go's regexp/syntax).
+ */
+#define UTF8_MAX 0x10ffff
+#define UTF8_SURROGATE_MIN 0xd800
+#define UTF8_SURROGATE_MAX 0xdfff
+
+int regex_utf8_decode(const char *sp, int *cp)
+{
+    const unsigned char *s = (const unsigned char *) sp;
+    int length, min;
+
+    if (s[0] < 0x80) {
+        *cp = s[0];
+        return 1;
+    } else if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+        *cp = s[0] & 0x1f;
+        length = 2;
+        min = 0x80;
+    } else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+        *cp = s[0] & 0x0f;
+        length = 3;
+        min = 0x800;
+    } else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+        *cp = s[0] & 0x07;
+        length = 4;
+        min = 0x10000;
+    } else {
+        return 0;
+    }
+
+    for (int i = 1; i < length; ++i) {
+        /* also stops at the terminating NUL */
+        if ((s[i] & 0xc0) != 0x80)
+            return 0;
+        *cp = (*cp << 6) | (s[i] & 0x3f);
+    }
+
+    /* overlong encodings, surrogates and values beyond Unicode */
+    if (*cp < min || *cp > UTF8_MAX ||
+        (*cp >= UTF8_SURROGATE_MIN && *cp <= UTF8_SURROGATE_MAX))
+        return 0;
+    return length;
+}
+
+const char *regex_next_character(const cregex_program_t *program,
+                                 const char *sp,
+                                 const char *end)
+{
+    unsigned char lead = *sp;
+    const char *next = sp + 1, *last = sp + 1;
+
+    if (!(program->flags & CREGEX_FLAG_UTF8))
+        return next;
+
+    /* as many continuation bytes as the lead byte announces, so invalid
+     * input is stepped over a byte at a time
+     */
+    if (lead >= 0xc0)
+        last += (lead >= 0xf0) ? 3 : (lead >= 0xe0) ? 2 : 1;
+    while (next < last && next < end && ((unsigned char) *next & 0xc0) == 0x80)
+        ++next;
+    return next;
+}
+
+/* Encode cp, returning the number of bytes */
+static int utf8_encode(int cp, unsigned char *s)
+{
+    if (cp < 0x80) {
+        s[0] = cp;
+        return 1;
+    } else if (cp < 0x800) {
+        s[0] = 0xc0 | (cp >> 6);
+        s[1] = 0x80 | (cp & 0x3f);
+        return 2;
+    } else if (cp < 0x10000) {
+        s[0] = 0xe0 | (cp >> 12);
+        s[1] = 0x80 | ((cp >> 6) & 0x3f);
+        s[2] = 0x80 | (cp & 0x3f);
+        return 3;
+    }
+    s[0] = 0xf0 | (cp >> 18);
+    s[1] = 0x80 | ((cp >> 12) & 0x3f);
+    s[2] = 0x80 | ((cp >> 6) & 0x3f);
+    s[3] = 0x80 | (cp & 0x3f);
+    return 4;
+}
+
+int regex_utf8_class_item(const char **sp, const char *from, int *lo, int *hi)
+{
+    int length;
+
+    switch (**sp) {
+    case '\0':
+        /* premature end of character class */
+        return -1;
+    case ']':
+        if (*sp != from) {
+            ++*sp;
+            return 0;
+        }
+        break;
+    case '\\':
+        ++*sp;
+        break;
+    }
+
+    if (!(length = regex_utf8_decode(*sp, lo)))
+        return -1;
+    *sp += length;
+    *hi = *lo;
+
+    if ((*sp)[0] == '-' && (*sp)[1] != ']') {
+        if (!(length = regex_utf8_decode(*sp + 1, hi)) || *hi < *lo)
+            /* invalid or empty range in character class */
+            return -1;
+        *sp += 1 + length;
+    }
+    return 1;
+}
+
+static int compare_ranges(const void *a, const void *b)
+{
+    const regex_utf8_range *x = a, *y = b;
+    return (x->lo > y->lo) - (x->lo < y->lo);
+}
+
+/* Append [lo, hi] to ranges unless it is empty */
+static void add_range(regex_utf8_range *ranges, int *nranges, int lo, int hi)
+{
+    if (lo <= hi)
+        ranges[(*nranges)++] = (regex_utf8_range){lo, hi};
+}
+
+int regex_utf8_ranges(const cregex_node_t *node,
+                      int flags,
+                      const cregex_allocator_t *allocator,
+                      regex_utf8_range **ranges)
+{
+    const char *from = node->from, *sp = from;
+    bool icase = (flags & CREGEX_FLAG_ICASE) != 0;
+    int nitems = 0, nranges = 0, merged = 0, lo, hi, cp = 0;
+
+    if (node->type == REGEX_NODE_TYPE_ANY_CHARACTER) {
+        if (!(*ranges = regex_alloc(allocator, sizeof(regex_utf8_range))))
+            return -1;
+        (*ranges)[0] = (regex_utf8_range){0, UTF8_MAX};
+        return 1;
+    }
+
+    /* the parser has checked the class already */
+    while (regex_utf8_class_item(&sp, from, &lo, &hi) > 0)
+        ++nitems;
+    /* each item, the other case of the ASCII letters in it, and one more
+     * range for the complement of a negated class
+     */
+    if (!(*ranges = regex_alloc(allocator,
+                                sizeof(regex_utf8_range) *
+                                    ((icase ? 3 : 1) * (size_t) nitems + 1))))
+        return -1;
+
+    for (sp = from; regex_utf8_class_item(&sp, from, &lo, &hi) > 0;) {
+        add_range(*ranges, &nranges, lo, hi);
+        if (icase) {
+            add_range(*ranges, &nranges, lo > 'a' ? lo - 'a' + 'A' : 'A',
+                      hi < 'z' ? hi - 'a' + 'A' : 'Z');
+            add_range(*ranges, &nranges, lo > 'A' ? lo - 'A' + 'a' : 'a',
+                      hi < 'Z' ? hi - 'A' + 'a' : 'z');
+        }
+    }
+
+    /* sort, then merge overlapping and adjacent ranges */
+    qsort(*ranges, nranges, sizeof(regex_utf8_range), compare_ranges);
+    for (int i = 0; i < nranges; ++i) {
+        if (merged && (*ranges)[i].lo <= (*ranges)[merged - 1].hi + 1) {
+            if ((*ranges)[i].hi > (*ranges)[merged - 1].hi)
+                (*ranges)[merged - 1].hi = (*ranges)[i].hi;
+        } else {
+            (*ranges)[merged++] = (*ranges)[i];
+        }
+    }
+    if (node->type != REGEX_NODE_TYPE_CHARACTER_CLASS_NEGATED)
+        return merged;
+
+    /* the gaps between the ranges, in place, as each gap ends before the
+     * range it is stored over
+     */
+    nranges = 0;
+    for (int i = 0; i < merged; ++i) {
+        regex_utf8_range range = (*ranges)[i];
+        add_range(*ranges, &nranges, cp, range.lo - 1);
+        cp = range.hi + 1;
+    }
+    add_range(*ranges, &nranges, cp, UTF8_MAX);
+    return nranges;
+}
+
+typedef struct {
+    void (*fn)(void *arg, const regex_utf8_sequence *sequence);
+    void *arg;
+    int nsequences;
+    /* single bytes, collected into one class emitted before the rest */
+    regex_utf8_sequence ascii;
+} utf8_emitter;
+
+static void emit_sequence(utf8_emitter *emitter,
+                          const regex_utf8_sequence *sequence)
+{
+    if (emitter->fn)
+        emitter->fn(emitter->arg, sequence);
+    ++emitter->nsequences;
+}
+
+static void flush_ascii(utf8_emitter *emitter)
+{
+    if (emitter->ascii.length) {
+        emit_sequence(emitter, &emitter->ascii);
+        emitter->ascii.length = 0;
+    }
+}
+
+/* Emit the byte sequences of the code points [lo, hi], which contain no
+ * surrogates
+ */
+static void split_range(utf8_emitter *emitter, int lo, int hi)
+{
+    static const int max[] = {0x7f, 0x7ff, 0xffff};
+    unsigned char from[4], to[4];
+    regex_utf8_sequence sequence = {0};
+    int length;
+
+    if (lo > hi)
+        return;
+
+    /* encodings of different lengths */
+    for (size_t i = 0; i < sizeof(max) / sizeof(max[0]); ++i) {
+        if (lo <= max[i] && max[i] < hi) {
+            split_range(emitter, lo, max[i]);
+            split_range(emitter, max[i] + 1, hi);
+            return;
+        }
+    }
+
+    if (hi < 0x80) {
+        emitter->ascii.length = 1;
+        for (int ch = lo; ch <= hi; ++ch)
+            cregex_char_class_add(emitter->ascii.bytes[0], ch);
+        return;
+    }
+    flush_ascii(emitter);
+
+    /* all but one byte range must be full continuation ranges */
+    length = utf8_encode(lo, from);
+    for (int i = 1; i < length; ++i) {
+        int mask = (1 << (6 * i)) - 1;
+        if ((lo & ~mask) != (hi & ~mask)) {
+            if ((lo & mask) != 0) {
+                split_range(emitter, lo, lo | mask);
+                split_range(emitter, (lo | mask) + 1, hi);
+                return;
+            }
+            if ((hi & mask) != mask) {
+                split_range(emitter, lo, (hi & ~mask) - 1);
+                split_range(emitter, hi & ~mask, hi);
+                return;
+            }
+        }
+    }
+
+    utf8_encode(hi, to);
+    sequence.length = length;
+    for (int i = 0; i < length; ++i)
+        for (int ch = from[i]; ch <= to[i]; ++ch)
+            cregex_char_class_add(sequence.bytes[i], ch);
+    emit_sequence(emitter, &sequence);
+}
+
+/* Emit [lo, hi] without the surrogates */
+static void emit_range(utf8_emitter *emitter, int lo, int hi)
+{
+    if (hi < UTF8_SURROGATE_MIN || lo > UTF8_SURROGATE_MAX) {
+        split_range(emitter, lo, hi);
+    } else {
+        split_range(emitter, lo, UTF8_SURROGATE_MIN - 1);
+        split_range(emitter, UTF8_SURROGATE_MAX + 1, hi);
+    }
+}
+
+int regex_utf8_sequences(const regex_utf8_range *ranges,
+                         int nranges,
+                         void (*fn)(void *arg,
+                                    const regex_utf8_sequence *sequence),
+                         void *arg)
+{
+    utf8_emitter emitter = {.fn = fn, .arg = arg};
+
+    /* ranges come in order, so the single bytes are all seen first */
+    for (int i = 0; i < nranges; ++i)
+        emit_range(&emitter, ranges[i].lo, ranges[i].hi);
+    flush_ascii(&emitter);
+
+    return emitter.nsequences;
+}
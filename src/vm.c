@@ -1,9 +1,9 @@
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include "cregex.h"
-
-#define REGEX_VM_MAX_MATCHES 20
+#include "internal.h"
 
 /* The VM executes one or more threads, each running a regular expression
  * program, which is just a list of regular expression instructions. Each
@@ -16,177 +16,431 @@ typedef struct {
     const char *matches[REGEX_VM_MAX_MATCHES];
 } vm_thread;
 
-/* Run program on string */
-static int vm_run(const cregex_program_t *program,
-                  const char *string,
+/* Work left before a run gives up with CREGEX_ERROR_LIMIT, SIZE_MAX if
+ * unlimited. It is charged once per input position, outside the thread
+ * loops.
+ */
+typedef struct {
+    size_t steps, bytes;
+} vm_budget;
+
+/* State shared by all threads of one run */
+typedef struct {
+    const cregex_program_t *program;
+    const char *string, *end;
+    int nmatches;
+    cregex_program_stats_t *stats;
+    vm_budget *budget;
+} vm_context;
+
+/* Update execution statistics, if requested by the caller. Building with
+ * -DCREGEX_NO_STATS removes the bookkeeping from the VM entirely.
+ */
+#ifdef CREGEX_NO_STATS
+#define VM_STATS(context, statement) ((void) 0)
+#else
+#define VM_STATS(context, statement)                      \
+    do {                                                  \
+        cregex_program_stats_t *stats = (context)->stats; \
+        if (stats) {                                      \
+            statement;                                    \
+        }                                                 \
+    } while (0)
+#endif
+
+/* Count one execution of instruction pc */
+#define VM_HIT(context, pc)                                         \
+    VM_STATS(context, {                                             \
+        if (stats->hits)                                            \
+            ++stats->hits[(pc) - (context)->program->instructions]; \
+    })
+
+/* Run program on string [string, end) (using a previously allocated buffer
+ * of at least vm_estimate_threads(program) threads)
+ */
+static int vm_run(const vm_context *context,
                   const char **matches,
-                  int nmatches);
+                  vm_thread *threads);
 
-/* Run program on string (using a previously allocated buffer of at least
- * vm_estimate_threads(program) threads)
+/* Run program on string [string, end) from instruction pc at position from
+ * (using a previously allocated buffer of at least vm_estimate_threads(program)
+ * threads)
  */
-static int vm_run_with_threads(const cregex_program_t *program,
-                               const char *string,
+static int vm_run_with_threads(const vm_context *context,
+                               const cregex_program_instr_t *pc,
+                               const char *from,
                                const char **matches,
-                               int nmatches,
                                vm_thread *threads);
 
+/* Run the reversed program of an end-anchored pattern backwards from the end
+ * of string, returning where the leftmost match starts or NULL if there is no
+ * match (using a previously allocated buffer as above). *status is set to
+ * CREGEX_ERROR_LIMIT if the budget runs out.
+ */
+static const char *vm_run_reverse(const vm_context *context,
+                                  vm_thread *threads,
+                                  int *status);
+
 typedef struct {
     int nthreads;
     vm_thread *threads;
 } vm_thread_list;
 
-static void vm_add_thread(vm_thread_list *list,
-                          const cregex_program_t *program,
+static void vm_add_thread(const vm_context *context,
+                          vm_thread_list *list,
                           const cregex_program_instr_t *pc,
-                          const char *string,
                           const char *sp,
-                          const char **matches,
-                          int nmatches)
+                          const char **matches)
 {
-    if (list->threads[pc - program->instructions].visited == sp - string + 1)
-        return;
-    list->threads[pc - program->instructions].visited = sp - string + 1;
-
-    switch (pc->opcode) {
-    case REGEX_PROGRAM_OPCODE_MATCH:
-        /* fall-through */
-
-    /* Characters */
-    case REGEX_PROGRAM_OPCODE_CHARACTER:
-    case REGEX_PROGRAM_OPCODE_ANY_CHARACTER:
-    case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS:
-    case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS_NEGATED:
-        list->threads[list->nthreads].pc = pc;
-        memcpy(list->threads[list->nthreads].matches, matches,
-               sizeof(matches[0]) * ((nmatches <= REGEX_VM_MAX_MATCHES)
-                                         ? nmatches
-                                         : REGEX_VM_MAX_MATCHES));
-        ++list->nthreads;
-        break;
+    const cregex_program_t *program = context->program;
+    int nmatches = context->nmatches;
 
-    /* Control-flow */
-    case REGEX_PROGRAM_OPCODE_SPLIT:
-        vm_add_thread(list, program, pc->first, string, sp, matches, nmatches);
-        vm_add_thread(list, program, pc->second, string, sp, matches, nmatches);
-        break;
-    case REGEX_PROGRAM_OPCODE_JUMP:
-        vm_add_thread(list, program, pc->target, string, sp, matches, nmatches);
-        break;
+    /* tail calls are loops, so that long alternations do not recurse */
+    for (;;) {
+        VM_STATS(context, ++stats->nadd_thread);
 
-    /* Assertions */
-    case REGEX_PROGRAM_OPCODE_ASSERT_BEGIN:
-        if (sp == string)
-            vm_add_thread(list, program, pc + 1, string, sp, matches, nmatches);
-        break;
-    case REGEX_PROGRAM_OPCODE_ASSERT_END:
-        if (!*sp)
-            vm_add_thread(list, program, pc + 1, string, sp, matches, nmatches);
-        break;
+        if (list->threads[pc - program->instructions].visited ==
+            sp - context->string + 1)
+            return;
+        list->threads[pc - program->instructions].visited =
+            sp - context->string + 1;
 
-    /* Saving */
-    case REGEX_PROGRAM_OPCODE_SAVE:
-        if (pc->save < nmatches && pc->save < REGEX_VM_MAX_MATCHES) {
-            const char *saved = matches[pc->save];
-            matches[pc->save] = sp;
-            vm_add_thread(list, program, pc + 1, string, sp, matches, nmatches);
-            matches[pc->save] = saved;
-        } else {
-            vm_add_thread(list, program, pc + 1, string, sp, matches, nmatches);
+        switch (pc->opcode) {
+        case REGEX_PROGRAM_OPCODE_MATCH:
+            /* fall-through */
+
+        /* Characters */
+        case REGEX_PROGRAM_OPCODE_CHARACTER:
+        case REGEX_PROGRAM_OPCODE_ANY_CHARACTER:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS_NEGATED:
+            list->threads[list->nthreads].pc = pc;
+            if (nmatches > 0)
+                memcpy(list->threads[list->nthreads].matches, matches,
+                       sizeof(matches[0]) *
+                           ((nmatches <= REGEX_VM_MAX_MATCHES)
+                                ? nmatches
+                                : REGEX_VM_MAX_MATCHES));
+            ++list->nthreads;
+            VM_STATS(context, {
+                ++stats->nthreads;
+                if (list->nthreads > stats->max_threads)
+                    stats->max_threads = list->nthreads;
+            });
+            return;
+
+        /* Control-flow */
+        case REGEX_PROGRAM_OPCODE_SPLIT:
+            VM_HIT(context, pc);
+            vm_add_thread(context, list, pc->first, sp, matches);
+            pc = pc->second;
+            break;
+        case REGEX_PROGRAM_OPCODE_JUMP:
+            VM_HIT(context, pc);
+            pc = pc->target;
+            break;
+        case REGEX_PROGRAM_OPCODE_DISPATCH:
+            VM_HIT(context, pc);
+            if (sp == context->end || !pc->table[(unsigned char) *sp])
+                return;
+            pc += pc->table[(unsigned char) *sp];
+            break;
+
+        /* Assertions */
+        case REGEX_PROGRAM_OPCODE_ASSERT_BEGIN:
+            VM_HIT(context, pc);
+            if (sp != context->string)
+                return;
+            ++pc;
+            break;
+        case REGEX_PROGRAM_OPCODE_ASSERT_END:
+            VM_HIT(context, pc);
+            if (sp != context->end)
+                return;
+            ++pc;
+            break;
+
+        /* Saving */
+        case REGEX_PROGRAM_OPCODE_SAVE:
+            VM_HIT(context, pc);
+            if (pc->save < nmatches && pc->save < REGEX_VM_MAX_MATCHES) {
+                const char *saved = matches[pc->save];
+                matches[pc->save] = sp;
+                vm_add_thread(context, list, pc + 1, sp, matches);
+                matches[pc->save] = saved;
+                return;
+            }
+            ++pc;
+            break;
         }
-        break;
     }
 }
 
+/* Add the threads waiting where a thread added at pc would, as listed in
+ * the precomputed closures of the program (see closure.c). The same threads
+ * as with vm_add_thread() result, but only instructions threads wait at are
+ * marked as visited.
+ */
+static void vm_add_closure(const vm_context *context,
+                           vm_thread_list *list,
+                           const cregex_program_instr_t *pc,
+                           const char *sp,
+                           const char **matches)
+{
+    const cregex_program_t *program = context->program;
+    const cregex_program_instr_t *instructions = program->instructions;
+    const int *closures = program->closures;
+    const int *lists = closures + closures[pc - instructions];
+    const int *entry =
+        closures +
+        lists[2 * (sp == context->string) + (sp == context->end)];
+    int ch = (sp < context->end) ? (unsigned char) *sp : -1;
+    int visited = sp - context->string + 1;
+    int nmatches = (context->nmatches <= REGEX_VM_MAX_MATCHES)
+                       ? context->nmatches
+                       : REGEX_VM_MAX_MATCHES;
+
+    for (int n = *entry++; n > 0; --n) {
+        int to = entry[0], nchoices = entry[1];
+        const int *choices = entry + 2;
+        const int *saves = choices + 2 * nchoices + 1;
+        int nsaves = saves[-1];
+        bool chosen = true;
+
+        entry = saves + nsaves;
+
+        /* every DISPATCH on the way must lead where the entry does */
+        for (int i = 0; i < nchoices && chosen; ++i)
+            chosen = ch >= 0 && instructions[choices[2 * i]].table[ch] &&
+                     choices[2 * i] + instructions[choices[2 * i]].table[ch] ==
+                         choices[2 * i + 1];
+        if (!chosen || list->threads[to].visited == visited)
+            continue;
+        list->threads[to].visited = visited;
+
+        vm_thread *thread = list->threads + list->nthreads++;
+        thread->pc = instructions + to;
+        if (nmatches > 0)
+            memcpy(thread->matches, matches, sizeof(matches[0]) * nmatches);
+        for (int i = 0; i < nsaves; ++i)
+            if (saves[i] < nmatches)
+                thread->matches[saves[i]] = sp;
+    }
+}
+
+/* Add a thread, through the closures of pc if there are any. When
+ * profiling, control flow is followed so that its instructions are counted.
+ */
+static void vm_add(const vm_context *context,
+                   vm_thread_list *list,
+                   const cregex_program_instr_t *pc,
+                   const char *sp,
+                   const char **matches)
+{
+    const cregex_program_t *program = context->program;
+
+    if (program->closures && program->closures[pc - program->instructions] &&
+        !context->stats)
+        vm_add_closure(context, list, pc, sp, matches);
+    else
+        vm_add_thread(context, list, pc, sp, matches);
+}
+
 /* Upper bound of number of threads required to run program */
 static int vm_estimate_threads(const cregex_program_t *program)
 {
     return program->ninstructions * 2;
 }
 
-static int vm_run(const cregex_program_t *program,
-                  const char *string,
+static int vm_run(const vm_context *context,
                   const char **matches,
-                  int nmatches)
+                  vm_thread *threads)
 {
-    size_t size = sizeof(vm_thread) * vm_estimate_threads(program);
-    vm_thread *threads;
-    int matched;
+    const cregex_program_t *program = context->program;
+    const char *start;
+    int matched = 0;
 
-    if (!(threads = malloc(size)))
-        return -1;
+    switch (program->plan) {
+    case CREGEX_PLAN_REVERSE:
+        if (!(start = vm_run_reverse(context, threads, &matched))) {
+            /* no match, or the budget ran out */
+        } else if (context->nmatches > 2) {
+            /* captures are needed: rerun forwards, anchored at the match
+             * start. No match can start further left, so this finds the
+             * same match as a forward run from the beginning of the string
+             * would.
+             */
+            matched = vm_run_with_threads(
+                context, program->instructions + program->start, start,
+                matches, threads);
+        } else {
+            if (context->nmatches > 0)
+                matches[0] = start;
+            if (context->nmatches > 1)
+                matches[1] = context->end;
+            matched = 1;
+        }
+        break;
+
+    /* the prefilter is applied by vm_run_with_threads() itself */
+    default:
+        matched = vm_run_with_threads(context, program->instructions,
+                                      context->string, matches, threads);
+        break;
+    }
 
-    matched = vm_run_with_threads(program, string, matches, nmatches, threads);
-    free(threads);
     return matched;
 }
 
-static int vm_run_with_threads(const cregex_program_t *program,
-                               const char *string,
+static int vm_run_with_threads(const vm_context *context,
+                               const cregex_program_instr_t *pc,
+                               const char *from,
                                const char **matches,
-                               int nmatches,
                                vm_thread *threads)
 {
+    const cregex_program_t *program = context->program;
+    int nmatches = context->nmatches;
     vm_thread_list *current =
         &(vm_thread_list){.nthreads = 0, .threads = threads};
     vm_thread_list *next = &(vm_thread_list){
         .nthreads = 0, .threads = threads + program->ninstructions};
+    vm_budget budget = *context->budget;
     int matched = 0;
+    /* instead of running the .*? prefix, start threads at the pattern body
+     * only where the input byte can begin a match
+     */
+    bool seed = pc == program->instructions &&
+                program->plan == CREGEX_PLAN_PREFILTER;
 
     memset(threads, 0, sizeof(vm_thread) * program->ninstructions * 2);
 
-    vm_add_thread(current, program, program->instructions, string, string,
-                  matches, nmatches);
+    if (seed)
+        pc += program->start;
+    else
+        vm_add(context, current, pc, from, matches);
+
+    for (const char *sp = from;; ++sp) {
+        if (seed) {
+            /* nothing running: skip to the next candidate position, looking
+             * no further than the byte budget allows
+             */
+            if (current->nthreads == 0) {
+                const char *limit =
+                    ((size_t) (context->end - sp) > budget.bytes)
+                        ? sp + budget.bytes
+                        : context->end;
+                const char *found = regex_scan_first(program, sp, limit);
+                budget.bytes -= found - sp;
+                if ((sp = found) == context->end)
+                    break;
+            }
+            /* lowest priority, where the .*? prefix would add it */
+            if (sp < context->end &&
+                cregex_char_class_contains(program->first, (unsigned char) *sp))
+                vm_add(context, current, pc, sp, matches);
+        }
+
+        /* current input byte, or -1 once the end of string is reached */
+        int ch = (sp < context->end) ? (unsigned char) *sp : -1;
+
+        if (budget.steps < (size_t) current->nthreads ||
+            (ch >= 0 && budget.bytes == 0)) {
+            matched = CREGEX_ERROR_LIMIT;
+            break;
+        }
+        budget.steps -= current->nthreads;
+        budget.bytes -= (ch >= 0);
+
+        VM_STATS(context, stats->nbytes += (ch >= 0));
 
-    for (const char *sp = string;; ++sp) {
         for (int i = 0; i < current->nthreads; ++i) {
             vm_thread *thread = current->threads + i;
-            switch (thread->pc->opcode) {
-            case REGEX_PROGRAM_OPCODE_MATCH:
+            VM_HIT(context, thread->pc);
+
+            if (thread->pc->opcode == REGEX_PROGRAM_OPCODE_MATCH) {
                 matched = 1;
                 current->nthreads = 0;
-                memcpy(matches, thread->matches,
-                       sizeof(matches[0]) * ((nmatches <= REGEX_VM_MAX_MATCHES)
-                                                 ? nmatches
-                                                 : REGEX_VM_MAX_MATCHES));
+                seed = false;
+                if (nmatches > 0)
+                    memcpy(matches, thread->matches,
+                           sizeof(matches[0]) *
+                               ((nmatches <= REGEX_VM_MAX_MATCHES)
+                                    ? nmatches
+                                    : REGEX_VM_MAX_MATCHES));
                 continue;
+            }
 
-            /* Characters */
-            case REGEX_PROGRAM_OPCODE_CHARACTER:
-                if (*sp == thread->pc->ch)
-                    break;
-                continue;
-            case REGEX_PROGRAM_OPCODE_ANY_CHARACTER:
-                if (*sp)
-                    break;
-                continue;
-            case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS:
-                if (cregex_char_class_contains(thread->pc->klass, *sp))
-                    break;
-                continue;
-            case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS_NEGATED:
-                if (!cregex_char_class_contains(thread->pc->klass, *sp))
-                    break;
-                continue;
+            if (regex_accepts(thread->pc, ch))
+                vm_add(context, next, thread->pc + 1, sp + 1,
+                       thread->matches);
+        }
+
+        /* swap current and next thread list */
+        vm_thread_list *swap = current;
+        current = next;
+        next = swap;
+        next->nthreads = 0;
+
+        /* done if no more threads are running or end of string reached */
+        if ((current->nthreads == 0 && !seed) || sp == context->end)
+            break;
+    }
 
-            /* Control-flow */
-            case REGEX_PROGRAM_OPCODE_SPLIT:
-            case REGEX_PROGRAM_OPCODE_JUMP:
-                /* fall-through */
+    *context->budget = budget;
+    return matched;
+}
+
+static const char *vm_run_reverse(const vm_context *context,
+                                  vm_thread *threads,
+                                  int *status)
+{
+    const cregex_program_t *program = context->program;
+    /* the reversed program has no captures */
+    const vm_context *reverse = &(vm_context){.program = program,
+                                              .string = context->string,
+                                              .end = context->end,
+                                              .nmatches = 0,
+                                              .stats = context->stats,
+                                              .budget = context->budget};
+    vm_thread_list *current =
+        &(vm_thread_list){.nthreads = 0, .threads = threads};
+    vm_thread_list *next = &(vm_thread_list){
+        .nthreads = 0, .threads = threads + program->ninstructions};
+    vm_budget budget = *context->budget;
+    const char *start = NULL;
+
+    memset(threads, 0, sizeof(vm_thread) * program->ninstructions * 2);
+
+    vm_add(reverse, current, program->instructions + program->reverse,
+           context->end, NULL);
+
+    for (const char *sp = context->end;; --sp) {
+        /* byte before the current position, or -1 at the beginning */
+        int ch = (sp > context->string) ? (unsigned char) sp[-1] : -1;
 
-            /* Assertions */
-            case REGEX_PROGRAM_OPCODE_ASSERT_BEGIN:
-            case REGEX_PROGRAM_OPCODE_ASSERT_END:
-                /* fall-through */
+        if (budget.steps < (size_t) current->nthreads ||
+            (ch >= 0 && budget.bytes == 0)) {
+            *status = CREGEX_ERROR_LIMIT;
+            start = NULL;
+            break;
+        }
+        budget.steps -= current->nthreads;
+        budget.bytes -= (ch >= 0);
+
+        VM_STATS(context, stats->nbytes += (ch >= 0));
+
+        for (int i = 0; i < current->nthreads; ++i) {
+            vm_thread *thread = current->threads + i;
+            VM_HIT(context, thread->pc);
 
-            /* Saving */
-            case REGEX_PROGRAM_OPCODE_SAVE:
-                /* handled in vm_add_thread() */
-                abort();
+            /* keep going: any later match starts further left */
+            if (thread->pc->opcode == REGEX_PROGRAM_OPCODE_MATCH) {
+                start = sp;
+                continue;
             }
 
-            vm_add_thread(next, program, thread->pc + 1, string, sp + 1,
-                          thread->matches, nmatches);
+            if (regex_accepts(thread->pc, ch))
+                vm_add(reverse, next, thread->pc + 1, sp - 1, NULL);
         }
 
         /* swap current and next thread list */
@@ -195,12 +449,14 @@ static int vm_run_with_threads(const cregex_program_t *program,
         next = swap;
         next->nthreads = 0;
 
-        /* done if no more threads are running or end of string reached */
-        if (current->nthreads == 0 || !*sp)
+        /* done if no more threads are running or beginning of string reached
+         */
+        if (current->nthreads == 0 || sp == context->string)
             break;
     }
 
-    return matched;
+    *context->budget = budget;
+    return start;
 }
 
 int cregex_program_run(const cregex_program_t *program,
@@ -208,5 +464,690 @@ int cregex_program_run(const cregex_program_t *program,
                        const char **matches,
                        int nmatches)
 {
-    return vm_run(program, string, matches, nmatches);
+    size_t length = 0;
+
+    /* a match of an anchored pattern of bounded length never extends past
+     * its maximum length, so one more byte is enough to tell whether $ can
+     * match there; the rest of the string need not even be measured
+     */
+    if (program->start == 0 && program->max_length >= 0) {
+        while (length <= (size_t) program->max_length && string[length])
+            ++length;
+    } else {
+        length = strlen(string);
+    }
+
+    return cregex_program_run_n(program, string, length, matches, nmatches);
+}
+
+int cregex_program_run_n(const cregex_program_t *program,
+                         const char *string,
+                         size_t length,
+                         const char **matches,
+                         int nmatches)
+{
+    return cregex_program_run_stats(program, string, length, matches,
+                                    nmatches, NULL);
+}
+
+/* Find a pure literal program without the VM, filling in matches as the VM
+ * would. Only bytes within the byte budget are looked at.
+ */
+static int literal_run(const cregex_program_t *program,
+                       const char *string,
+                       const char *end,
+                       const char **matches,
+                       int nmatches,
+                       size_t budget)
+{
+    const char *literal = regex_literal(program);
+    size_t length = program->literal.length;
+    const char *found, *limit;
+
+    if (program->literal.begin || program->literal.end) {
+        /* one place to look, and the string is no shorter than length */
+        if (length > budget)
+            return CREGEX_ERROR_LIMIT;
+        if (program->literal.begin && program->literal.end &&
+            (size_t) (end - string) != length)
+            return 0;
+        found = program->literal.begin ? string : end - length;
+        if (memcmp(found, literal, length) != 0)
+            return 0;
+    } else {
+        limit = ((size_t) (end - string) > budget) ? string + budget : end;
+        if (!(found = regex_scan_literal(literal, length, string, limit)))
+            return (limit < end) ? CREGEX_ERROR_LIMIT : 0;
+    }
+
+    /* the whole match, and the capture group around it, if any */
+    for (int i = 0; i < nmatches && i < 2 + 2 * program->literal.capture; ++i)
+        matches[i] = (i % 2) ? found + length : found;
+    return 1;
+}
+
+/* Run program with optional statistics and limits */
+static int program_run(const cregex_program_t *program,
+                       const char *string,
+                       size_t length,
+                       const char **matches,
+                       int nmatches,
+                       cregex_program_stats_t *stats,
+                       const cregex_limits_t *limits)
+{
+    vm_budget budget = {SIZE_MAX, SIZE_MAX};
+    vm_thread *threads;
+    int matched;
+
+    if (limits && limits->max_steps)
+        budget.steps = limits->max_steps;
+    if (limits && limits->max_bytes)
+        budget.bytes = limits->max_bytes;
+
+    /* too short for any match */
+    if (length < (size_t) program->min_length)
+        return 0;
+
+    /* the VM is still run when profiling, so that there is a profile */
+    if (program->plan == CREGEX_PLAN_LITERAL && !stats)
+        return literal_run(program, string, string + length, matches,
+                           nmatches, budget.bytes);
+
+    if (!(threads = malloc(sizeof(vm_thread) * vm_estimate_threads(program))))
+        return CREGEX_ERROR;
+    matched = vm_run(&(vm_context){.program = program,
+                                   .string = string,
+                                   .end = string + length,
+                                   .nmatches = nmatches,
+                                   .stats = stats,
+                                   .budget = &budget},
+                     matches, threads);
+    free(threads);
+    return matched;
+}
+
+int cregex_program_run_stats(const cregex_program_t *program,
+                             const char *string,
+                             size_t length,
+                             const char **matches,
+                             int nmatches,
+                             cregex_program_stats_t *stats)
+{
+    return program_run(program, string, length, matches, nmatches, stats,
+                       NULL);
+}
+
+int cregex_program_run_limited(const cregex_program_t *program,
+                               const char *string,
+                               size_t length,
+                               const char **matches,
+                               int nmatches,
+                               const cregex_limits_t *limits)
+{
+    return program_run(program, string, length, matches, nmatches, NULL,
+                       limits);
+}
+
+size_t regex_search_scratch_size(const cregex_program_t *program)
+{
+    return sizeof(vm_thread) * vm_estimate_threads(program);
+}
+
+int regex_search(const cregex_program_t *program,
+                 const char *string,
+                 const char *from,
+                 const char *end,
+                 const char **matches,
+                 int nmatches,
+                 void *scratch)
+{
+    vm_budget budget = {SIZE_MAX, SIZE_MAX};
+    const vm_context *context = &(vm_context){.program = program,
+                                              .string = string,
+                                              .end = end,
+                                              .nmatches = nmatches,
+                                              .budget = &budget};
+
+    if ((size_t) (end - from) < (size_t) program->min_length)
+        return 0;
+
+    if (program->plan == CREGEX_PLAN_LITERAL) {
+        if (program->literal.begin && from != string)
+            return 0;
+        return literal_run(program, from, end, matches, nmatches, SIZE_MAX);
+    }
+
+    if (from == string)
+        return vm_run(context, matches, scratch);
+
+    /* past the beginning, ^ can no longer match, and the reverse plan would
+     * look left of from, so the forward program is run from there
+     */
+    return vm_run_with_threads(context, program->instructions, from, matches,
+                               scratch);
+}
+
+/* Where an incremental scan can be resumed: the VM about to read the byte at
+ * position. The pc and slots of each thread, then the slots of the pending
+ * match (if any) are kept in the states of the scan, as offsets into the
+ * string (-1 for NULL).
+ */
+typedef struct {
+    size_t position;
+    size_t nfound; /* matches found before */
+    size_t state;
+    int nthreads;
+    bool matched;
+    /* end of the last match if the search started there, else -1: only
+     * then can it decide whether an empty match is skipped
+     */
+    ptrdiff_t last;
+} vm_checkpoint;
+
+struct cregex_incremental {
+    const cregex_program_t *program;
+    size_t length;
+    int nslots;
+    size_t interval;
+    size_t rescanned;
+
+    /* nfound matches of nslots offsets each */
+    ptrdiff_t *found;
+    size_t nfound, found_capacity;
+
+    vm_checkpoint *checkpoints;
+    size_t ncheckpoints, checkpoints_capacity;
+    ptrdiff_t *states;
+    size_t nstates, states_capacity;
+
+    vm_thread *threads;
+};
+
+/* Checkpoints and matches a scan had past the checkpoint an edit resumes
+ * from. Those after the edited bytes are reused, moved by the edit, once the
+ * rescan reaches the state one of them was taken in.
+ */
+typedef struct {
+    size_t offset, removed, inserted;
+    vm_checkpoint *checkpoints;
+    size_t ncheckpoints, next;
+    ptrdiff_t *states;
+    size_t state_base; /* where states started in the states of the scan */
+    ptrdiff_t *found;
+    size_t nfound, found_base;
+} vm_tail;
+
+/* Checkpoints taken every this many bytes, unless told otherwise */
+#define REGEX_VM_CHECKPOINT_INTERVAL 1024
+
+/* Number of ints the state of checkpoint takes */
+static size_t vm_state_size(const vm_checkpoint *checkpoint, int nslots)
+{
+    return (size_t) checkpoint->nthreads * (1 + nslots) +
+           checkpoint->matched * nslots;
+}
+
+static inline ptrdiff_t vm_offset(const char *string, const char *sp)
+{
+    return sp ? sp - string : -1;
+}
+
+/* Where offset of the text before an edit is after it, or -2 if the edit
+ * removed it. An offset is taken to lie just before its byte, so that where
+ * the edit happens it moves with the bytes which follow.
+ */
+static ptrdiff_t vm_map(const vm_tail *tail, ptrdiff_t offset)
+{
+    if (offset < 0 || (size_t) offset < tail->offset)
+        return offset;
+    if ((size_t) offset >= tail->offset + tail->removed)
+        return offset - (ptrdiff_t) tail->removed + (ptrdiff_t) tail->inserted;
+    return -2;
+}
+
+/* Grow array of *capacity elements of size bytes to hold needed, returning
+ * NULL if memory runs out
+ */
+static void *vm_grow(void *array, size_t *capacity, size_t needed, size_t size)
+{
+    size_t grown = *capacity ? *capacity : 16;
+
+    if (array && needed <= *capacity)
+        return array;
+    while (grown < needed)
+        grown *= 2;
+    if ((array = realloc(array, grown * size)))
+        *capacity = grown;
+    return array;
+}
+
+/* Take a checkpoint of the VM at sp */
+static bool vm_checkpoint_take(cregex_incremental_t *scan,
+                               const char *string,
+                               const char *sp,
+                               const vm_thread_list *list,
+                               const char **pending,
+                               bool matched,
+                               const char *last)
+{
+    int nslots = scan->nslots;
+    vm_checkpoint checkpoint = {.position = sp - string,
+                                .nfound = scan->nfound,
+                                .state = scan->nstates,
+                                .nthreads = list->nthreads,
+                                .matched = matched,
+                                .last = vm_offset(string, last)};
+    size_t size = vm_state_size(&checkpoint, nslots);
+    vm_checkpoint *checkpoints;
+    ptrdiff_t *states;
+
+    if (!(checkpoints = vm_grow(scan->checkpoints,
+                                &scan->checkpoints_capacity,
+                                scan->ncheckpoints + 1, sizeof(*checkpoints))))
+        return false;
+    scan->checkpoints = checkpoints;
+    if (!(states = vm_grow(scan->states, &scan->states_capacity,
+                           scan->nstates + size, sizeof(*states))))
+        return false;
+    scan->states = states;
+
+    states += scan->nstates;
+    for (int i = 0; i < list->nthreads; ++i) {
+        *states++ = list->threads[i].pc - scan->program->instructions;
+        for (int j = 0; j < nslots; ++j)
+            *states++ = vm_offset(string, list->threads[i].matches[j]);
+    }
+    for (int j = 0; matched && j < nslots; ++j)
+        *states++ = vm_offset(string, pending[j]);
+
+    scan->checkpoints[scan->ncheckpoints++] = checkpoint;
+    scan->nstates += size;
+    return true;
+}
+
+/* Whether the VM at sp is where it was at checkpoint before the edit, and
+ * reads no edited byte from then on
+ */
+static bool vm_checkpoint_reached(const cregex_incremental_t *scan,
+                                  const vm_tail *tail,
+                                  const vm_checkpoint *checkpoint,
+                                  const char *string,
+                                  const vm_thread_list *list,
+                                  const char **pending,
+                                  bool matched,
+                                  const char *last)
+{
+    const ptrdiff_t *state =
+        tail->states + (checkpoint->state - tail->state_base);
+    int nslots = scan->nslots;
+
+    if (checkpoint->nthreads != list->nthreads ||
+        checkpoint->matched != matched ||
+        vm_map(tail, checkpoint->last) != vm_offset(string, last))
+        return false;
+    /* the next search starts where the pending match ends */
+    if (matched && (size_t) (pending[1] - string) <
+                       tail->offset + tail->inserted)
+        return false;
+
+    for (int i = 0; i < list->nthreads; ++i) {
+        if (*state++ != list->threads[i].pc - scan->program->instructions)
+            return false;
+        for (int j = 0; j < nslots; ++j)
+            if (vm_map(tail, *state++) !=
+                vm_offset(string, list->threads[i].matches[j]))
+                return false;
+    }
+    for (int j = 0; matched && j < nslots; ++j)
+        if (vm_map(tail, *state++) != vm_offset(string, pending[j]))
+            return false;
+    return true;
+}
+
+/* Append the matches and checkpoints of tail from checkpoint on, moved by
+ * the edit
+ */
+static bool vm_tail_append(cregex_incremental_t *scan,
+                           const vm_tail *tail,
+                           const vm_checkpoint *checkpoint)
+{
+    int nslots = scan->nslots;
+    size_t first = checkpoint->nfound - tail->found_base;
+    size_t nfound = scan->nfound;
+    ptrdiff_t *found;
+
+    if (!(found = vm_grow(scan->found, &scan->found_capacity,
+                          (nfound + tail->nfound - first) * nslots,
+                          sizeof(*found))))
+        return false;
+    scan->found = found;
+    for (size_t i = first * nslots; i < tail->nfound * nslots; ++i)
+        found[scan->nfound * nslots + i - first * nslots] =
+            vm_map(tail, tail->found[i]);
+    scan->nfound += tail->nfound - first;
+
+    for (size_t i = checkpoint - tail->checkpoints; i < tail->ncheckpoints;
+         ++i) {
+        vm_checkpoint moved = tail->checkpoints[i];
+        const ptrdiff_t *state =
+            tail->states + (moved.state - tail->state_base);
+        size_t size = vm_state_size(&moved, nslots);
+        vm_checkpoint *checkpoints;
+        ptrdiff_t *states;
+
+        if (!(checkpoints = vm_grow(scan->checkpoints,
+                                    &scan->checkpoints_capacity,
+                                    scan->ncheckpoints + 1,
+                                    sizeof(*checkpoints))))
+            return false;
+        scan->checkpoints = checkpoints;
+        if (!(states = vm_grow(scan->states, &scan->states_capacity,
+                               scan->nstates + size, sizeof(*states))))
+            return false;
+        scan->states = states;
+
+        /* pcs stay, offsets move */
+        states += scan->nstates;
+        for (size_t j = 0; j < size; ++j)
+            states[j] = (j < (size_t) moved.nthreads * (1 + nslots) &&
+                         j % (1 + nslots) == 0)
+                            ? state[j]
+                            : vm_map(tail, state[j]);
+
+        moved.position = vm_map(tail, moved.position);
+        moved.nfound = moved.nfound - checkpoint->nfound + nfound;
+        moved.state = scan->nstates;
+        moved.last = vm_map(tail, moved.last);
+        scan->checkpoints[scan->ncheckpoints++] = moved;
+        scan->nstates += size;
+    }
+    return true;
+}
+
+/* Find the matches of the scan in string, left to right as
+ * cregex_program_replace() does, from checkpoint (or the beginning if NULL).
+ * After an edit, the rest of tail is taken over once the VM reaches the
+ * state of one of its checkpoints.
+ */
+static int vm_scan(cregex_incremental_t *scan,
+                   const char *string,
+                   const char *end,
+                   const vm_checkpoint *checkpoint,
+                   vm_tail *tail)
+{
+    const cregex_program_t *program = scan->program;
+    int nslots = scan->nslots;
+    vm_budget budget = {SIZE_MAX, SIZE_MAX};
+    const vm_context *context = &(vm_context){.program = program,
+                                              .string = string,
+                                              .end = end,
+                                              .nmatches = nslots,
+                                              .budget = &budget};
+    vm_thread_list *current =
+        &(vm_thread_list){.nthreads = 0, .threads = scan->threads};
+    vm_thread_list *next = &(vm_thread_list){
+        .nthreads = 0, .threads = scan->threads + program->ninstructions};
+    const char *pending[REGEX_VM_MAX_MATCHES] = {0};
+    const char *none[REGEX_VM_MAX_MATCHES] = {0};
+    const char *sp = string, *from = NULL, *last = NULL;
+    bool searching = false, matched = false;
+    /* threads are started where the input byte can begin a match, as in
+     * vm_run_with_threads(), until a search finds one
+     */
+    bool seed = program->plan == CREGEX_PLAN_PREFILTER;
+    /* checkpoints are taken the first time the VM gets to a position */
+    ptrdiff_t seen = -1;
+    size_t due = 0;
+
+    if (checkpoint) {
+        const ptrdiff_t *state = scan->states + checkpoint->state;
+
+        memset(scan->threads, 0,
+               sizeof(vm_thread) * program->ninstructions * 2);
+        for (int i = 0; i < checkpoint->nthreads; ++i) {
+            vm_thread *thread = current->threads + i;
+            thread->pc = program->instructions + *state++;
+            for (int j = 0; j < nslots; ++j, ++state)
+                thread->matches[j] = (*state < 0) ? NULL : string + *state;
+        }
+        current->nthreads = checkpoint->nthreads;
+        for (int j = 0; checkpoint->matched && j < nslots; ++j, ++state)
+            pending[j] = (*state < 0) ? NULL : string + *state;
+        matched = checkpoint->matched;
+        from = last = (checkpoint->last < 0) ? NULL : string + checkpoint->last;
+        searching = true;
+        sp = string + checkpoint->position;
+        seen = checkpoint->position;
+        due = checkpoint->position + scan->interval;
+    }
+
+    for (;;) {
+        if (!searching) {
+            /* a search may start left of where the last one got to */
+            memset(scan->threads, 0,
+                   sizeof(vm_thread) * program->ninstructions * 2);
+            current->nthreads = 0;
+            if (!seed)
+                vm_add(context, current, program->instructions, sp, none);
+            from = sp;
+            matched = false;
+            searching = true;
+        }
+
+        if (sp - string > seen) {
+            const char *relevant = (last == from) ? last : NULL;
+            seen = sp - string;
+
+            /* skip checkpoints of the edited text and left of sp */
+            while (tail && tail->next < tail->ncheckpoints &&
+                   (tail->checkpoints[tail->next].position <
+                        tail->offset + tail->removed ||
+                    vm_map(tail, tail->checkpoints[tail->next].position) <
+                        seen))
+                ++tail->next;
+            if (tail && tail->next < tail->ncheckpoints &&
+                vm_map(tail, tail->checkpoints[tail->next].position) == seen &&
+                vm_checkpoint_reached(scan, tail,
+                                      tail->checkpoints + tail->next, string,
+                                      current, pending, matched, relevant))
+                return vm_tail_append(scan, tail,
+                                      tail->checkpoints + tail->next)
+                           ? 0
+                           : CREGEX_ERROR;
+
+            if ((size_t) seen >= due) {
+                if (!vm_checkpoint_take(scan, string, sp, current, pending,
+                                        matched, relevant))
+                    return CREGEX_ERROR;
+                due = seen + scan->interval;
+            }
+        }
+
+        if (seed && !matched) {
+            /* nothing running: skip to the next candidate position */
+            if (current->nthreads == 0) {
+                const char *found = regex_scan_first(program, sp, end);
+                scan->rescanned += found - sp;
+                if ((sp = found) == end)
+                    return 0;
+            }
+            /* lowest priority, where the .*? prefix would add it */
+            if (sp < end && cregex_char_class_contains(program->first,
+                                                       (unsigned char) *sp))
+                vm_add(context, current,
+                       program->instructions + program->start, sp, none);
+        }
+
+        /* current input byte, or -1 once the end of string is reached */
+        int ch = (sp < end) ? (unsigned char) *sp : -1;
+        scan->rescanned += (ch >= 0);
+
+        for (int i = 0; i < current->nthreads; ++i) {
+            vm_thread *thread = current->threads + i;
+
+            if (thread->pc->opcode == REGEX_PROGRAM_OPCODE_MATCH) {
+                matched = true;
+                current->nthreads = 0;
+                memcpy(pending, thread->matches, sizeof(pending[0]) * nslots);
+                continue;
+            }
+
+            if (regex_accepts(thread->pc, ch))
+                vm_add(context, next, thread->pc + 1, sp + 1,
+                       thread->matches);
+        }
+
+        /* swap current and next thread list */
+        vm_thread_list *swap = current;
+        current = next;
+        next = swap;
+        next->nthreads = 0;
+
+        if ((current->nthreads || (seed && !matched)) && sp < end) {
+            ++sp;
+            continue;
+        }
+
+        /* the search is over; none later finds a match if it did not */
+        searching = false;
+        if (!matched)
+            return 0;
+
+        /* skip an empty match where the last match ended, as RE2 does */
+        if (pending[0] == pending[1] && pending[0] == last) {
+            if (last == end)
+                return 0;
+            sp = regex_next_character(program, last, end);
+            continue;
+        }
+
+        ptrdiff_t *found;
+        if (!(found = vm_grow(scan->found, &scan->found_capacity,
+                              (scan->nfound + 1) * nslots, sizeof(*found))))
+            return CREGEX_ERROR;
+        scan->found = found;
+        found += scan->nfound++ * nslots;
+        for (int j = 0; j < nslots; ++j)
+            found[j] = vm_offset(string, pending[j]);
+        sp = last = pending[1];
+    }
+}
+
+cregex_incremental_t *cregex_incremental_scan(const cregex_program_t *program,
+                                              const char *string,
+                                              size_t length,
+                                              int nmatches,
+                                              size_t interval)
+{
+    cregex_incremental_t *scan = calloc(1, sizeof(*scan));
+
+    if (!scan)
+        return NULL;
+    scan->program = program;
+    scan->length = length;
+    scan->nslots = (nmatches < 2)                      ? 2
+                   : (nmatches > REGEX_VM_MAX_MATCHES) ? REGEX_VM_MAX_MATCHES
+                                                       : nmatches;
+    scan->interval = interval ? interval : REGEX_VM_CHECKPOINT_INTERVAL;
+
+    if (!(scan->threads =
+              malloc(sizeof(vm_thread) * vm_estimate_threads(program))) ||
+        vm_scan(scan, string, string + length, NULL, NULL) < 0) {
+        cregex_incremental_free(scan);
+        return NULL;
+    }
+    return scan;
+}
+
+int cregex_incremental_edit(cregex_incremental_t *scan,
+                            const char *string,
+                            size_t length,
+                            size_t offset,
+                            size_t removed,
+                            size_t inserted)
+{
+    vm_tail tail = {.offset = offset, .removed = removed, .inserted = inserted};
+    vm_checkpoint resume;
+    size_t lo = 0, hi = scan->ncheckpoints, nstates = 0, nfound = 0;
+    int status = CREGEX_ERROR;
+
+    if (offset > scan->length || removed > scan->length - offset ||
+        length != scan->length - removed + inserted)
+        return CREGEX_ERROR;
+
+    /* the last checkpoint left of the edit, whose state does not depend on
+     * the byte at offset
+     */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (scan->checkpoints[mid].position < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > 0) {
+        resume = scan->checkpoints[lo - 1];
+        nstates = resume.state + vm_state_size(&resume, scan->nslots);
+        nfound = resume.nfound;
+    }
+
+    /* set the rest aside, to be taken over where the rescan converges */
+    tail.ncheckpoints = scan->ncheckpoints - lo;
+    tail.state_base = nstates;
+    tail.nfound = scan->nfound - nfound;
+    tail.found_base = nfound;
+    tail.checkpoints = malloc(sizeof(vm_checkpoint) * (tail.ncheckpoints + 1));
+    tail.states = malloc(sizeof(ptrdiff_t) * (scan->nstates - nstates + 1));
+    tail.found =
+        malloc(sizeof(ptrdiff_t) * (tail.nfound * scan->nslots + 1));
+    if (tail.checkpoints && tail.states && tail.found) {
+        if (tail.ncheckpoints)
+            memcpy(tail.checkpoints, scan->checkpoints + lo,
+                   sizeof(vm_checkpoint) * tail.ncheckpoints);
+        if (scan->nstates > nstates)
+            memcpy(tail.states, scan->states + nstates,
+                   sizeof(ptrdiff_t) * (scan->nstates - nstates));
+        if (tail.nfound)
+            memcpy(tail.found, scan->found + nfound * scan->nslots,
+                   sizeof(ptrdiff_t) * tail.nfound * scan->nslots);
+        scan->ncheckpoints = lo;
+        scan->nstates = nstates;
+        scan->nfound = nfound;
+        scan->length = length;
+        scan->rescanned = 0;
+        status = vm_scan(scan, string, string + length,
+                         (lo > 0) ? &resume : NULL, &tail);
+    }
+
+    free(tail.checkpoints);
+    free(tail.states);
+    free(tail.found);
+    return status;
+}
+
+size_t cregex_incremental_count(const cregex_incremental_t *scan)
+{
+    return scan->nfound;
+}
+
+const ptrdiff_t *cregex_incremental_match(const cregex_incremental_t *scan,
+                                          size_t i)
+{
+    return scan->found + i * scan->nslots;
+}
+
+size_t cregex_incremental_rescanned(const cregex_incremental_t *scan)
+{
+    return scan->rescanned;
+}
+
+void cregex_incremental_free(cregex_incremental_t *scan)
+{
+    if (!scan)
+        return;
+    free(scan->found);
+    free(scan->checkpoints);
+    free(scan->states);
+    free(scan->threads);
+    free(scan);
 }
@@ -0,0 +1,1018 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <regex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <cregex.h>
+
+/* Minimum number of samples and time spent per measured phase */
+#define BENCH_MIN_SAMPLES 16
+#define BENCH_MAX_SAMPLES 100000
+#define BENCH_MIN_NS 200000000ULL
+
+/* Submatch slots reported per run when extracting fields */
+#define BENCH_FIELD_MATCHES 8
+
+typedef enum {
+    BENCH_CORPUS_RANDOM, /* random printable text with occasional newlines */
+    BENCH_CORPUS_LOG,    /* log-like lines */
+} bench_corpus;
+
+typedef enum {
+    BENCH_MODE_BUFFER,  /* one run over the whole corpus */
+    BENCH_MODE_LINES,   /* one run per line, like tests/cgrep */
+    BENCH_MODE_REPLACE, /* replace every match in the whole corpus */
+    BENCH_MODE_FIELDS,  /* one run per line, reporting every submatch */
+    BENCH_MODE_EDIT,    /* a one-byte edit in the middle of a scanned corpus */
+} bench_mode;
+
+typedef struct {
+    const char *name;
+    const char *pattern;
+    bench_corpus corpus;
+    bench_mode mode;
+    int flags;
+} bench_case;
+
+typedef struct {
+    uint64_t p50, p99;
+} bench_latency;
+
+typedef struct {
+    bench_latency parse, compile, run;
+    long nmatches;
+} bench_result;
+
+typedef struct {
+    int json;
+    int quick;
+    int jit;   /* run through cregex_jit_run() */
+    int dfa;   /* run through cregex_dfa_run() */
+    int tdfa;  /* run through cregex_tdfa_run() */
+    int posix; /* compare with regcomp()/regexec() */
+    const char *filter;
+} bench_options;
+
+/* RE2/Go regexp benchmark patterns and typical log queries */
+static const bench_case cases[] = {
+    {"easy0", "ABCDEFGHIJKLMNOPQRSTUVWXYZ$", BENCH_CORPUS_RANDOM,
+     BENCH_MODE_BUFFER},
+    {"easy1", "A[AB]B[BC]C[CD]D[DE]E[EF]F[FG]G[GH]H[HI]I[IJ]J$",
+     BENCH_CORPUS_RANDOM, BENCH_MODE_BUFFER},
+    {"medium", "[XYZ]ABCDEFGHIJKLMNOPQRSTUVWXYZ$", BENCH_CORPUS_RANDOM,
+     BENCH_MODE_BUFFER},
+    {"hard", "[ -~]*ABCDEFGHIJKLMNOPQRSTUVWXYZ$", BENCH_CORPUS_RANDOM,
+     BENCH_MODE_BUFFER},
+    {"hard1", "ABCD|CDEF|EFGH|GHIJ|IJKL|KLMN|MNOP|OPQR|QRST|STUV|UVWX|WXYZ",
+     BENCH_CORPUS_RANDOM, BENCH_MODE_BUFFER},
+    {"log-literal", "ERROR", BENCH_CORPUS_LOG, BENCH_MODE_LINES},
+    {"log-anchored", "^2026-10-1[0-9] ", BENCH_CORPUS_LOG, BENCH_MODE_LINES},
+    {"log-field", "took ([0-9]+)ms$", BENCH_CORPUS_LOG, BENCH_MODE_LINES},
+    {"log-alternation", "(WARN|ERROR) \\[worker-[0-9]+\\]", BENCH_CORPUS_LOG,
+     BENCH_MODE_LINES},
+    {"log-ipv4", "[0-9]+\\.[0-9]+\\.[0-9]+\\.[0-9]+", BENCH_CORPUS_LOG,
+     BENCH_MODE_LINES},
+    {"log-hex", "[0-9a-f]{8} took", BENCH_CORPUS_LOG, BENCH_MODE_LINES},
+    {"log-icase", "error \\[worker", BENCH_CORPUS_LOG, BENCH_MODE_LINES,
+     CREGEX_FLAG_ICASE},
+    {"log-redact", "id=[0-9a-f]+", BENCH_CORPUS_LOG, BENCH_MODE_REPLACE},
+    {"log-extract", "\\[worker-([0-9]+)\\] ([a-z ]+) .*took ([0-9]+)ms",
+     BENCH_CORPUS_LOG, BENCH_MODE_FIELDS},
+    {"log-edit", "id=[0-9a-f]+", BENCH_CORPUS_LOG, BENCH_MODE_EDIT},
+};
+
+static const size_t corpus_sizes[] = {32, 1 << 10, 32 << 10, 1 << 20};
+static const int repeat_sizes[] = {8, 16, 32, 64};
+/* alternations of indicators of compromise, for compile scaling */
+static const size_t ioc_sizes[] = {1 << 10, 10 << 10, 100 << 10, 1 << 20};
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+/* xorshift64*, so corpora are identical across runs and platforms */
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 0x2545f4914f6cdd1dULL) >> 32;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void usage(FILE *file, const char *program)
+{
+    fprintf(file,
+            "usage: %s [--json] [--quick] [--jit] [--dfa] [--tdfa] "
+            "[--posix] [filter]\n",
+            program);
+}
+
+/* Random text as in Go's regexp benchmarks: printable ASCII, with a newline
+ * roughly every 30 characters
+ */
+static void make_random(char *text, size_t size)
+{
+    rng_state = 0x9e3779b97f4a7c15ULL;
+    for (size_t i = 0; i < size; ++i)
+        text[i] = (rng() % 30 == 0) ? '\n' : ' ' + rng() % ('~' - ' ' + 1);
+}
+
+static void make_log(char *text, size_t size)
+{
+    static const char *levels[] = {"DEBUG", "INFO", "INFO", "INFO", "WARN",
+                                   "ERROR"};
+    static const char *messages[] = {
+        "request served", "cache miss for key", "connection from",
+        "slow query detected", "retrying upstream"};
+    char line[160];
+    size_t length = 0;
+
+    rng_state = 0x2545f4914f6cdd1dULL;
+    while (length < size) {
+        int n = snprintf(
+            line, sizeof(line),
+            "2026-10-%02u %02u:%02u:%02u %s [worker-%u] %s %u.%u.%u.%u "
+            "id=%08x took %ums\n",
+            1 + rng() % 28, rng() % 24, rng() % 60, rng() % 60,
+            levels[rng() % 6], rng() % 16, messages[rng() % 5], rng() % 256,
+            rng() % 256, rng() % 256, rng() % 256, rng(), rng() % 2000);
+        if ((size_t) n > size - length)
+            n = size - length;
+        memcpy(text + length, line, n);
+        length += n;
+    }
+}
+
+/* Addresses, host names and hashes joined by |, as generated from threat
+ * feeds, of at most size - 1 bytes
+ */
+static void make_iocs(char *pattern, size_t size)
+{
+    char ioc[64];
+    size_t length = 0;
+    int n;
+
+    rng_state = 0x243f6a8885a308d3ULL;
+    for (;;) {
+        switch (rng() % 3) {
+        case 0:
+            n = snprintf(ioc, sizeof(ioc), "%u\\.%u\\.%u\\.%u",
+                         rng() % 256, rng() % 256, rng() % 256, rng() % 256);
+            break;
+        case 1:
+            n = snprintf(ioc, sizeof(ioc), "cdn%u\\.evil-%u\\.net",
+                         rng() % 100, rng() % 100000);
+            break;
+        default:
+            n = snprintf(ioc, sizeof(ioc), "%08x%08x%08x%08x", rng(), rng(),
+                         rng(), rng());
+            break;
+        }
+        if (length + 1 + n >= size)
+            break;
+        if (length)
+            pattern[length++] = '|';
+        memcpy(pattern + length, ioc, n);
+        length += n;
+    }
+    pattern[length] = '\0';
+}
+
+/* Groups nested depth deep, each starting and ending with a run of letters,
+ * optionally anchored with $, which reversed compilation must also handle in
+ * time linear in the pattern size
+ */
+static void make_nested(char *pattern, int depth, int width, int end)
+{
+    size_t length = 0;
+
+    for (int i = 0; i < depth; ++i) {
+        pattern[length++] = '(';
+        for (int j = 0; j < width; ++j)
+            pattern[length++] = 'a' + j % 26;
+    }
+    for (int i = 0; i < depth; ++i) {
+        for (int j = 0; j < width / 2; ++j)
+            pattern[length++] = 'b';
+        pattern[length++] = ')';
+    }
+    if (end)
+        pattern[length++] = '$';
+    pattern[length] = '\0';
+}
+
+/* Allocator counting the bytes handed out to its context, a size_t */
+static void *counting_alloc(void *context, size_t size)
+{
+    *(size_t *) context += size;
+    return malloc(size);
+}
+
+static void counting_free(void *context, void *ptr)
+{
+    (void) context;
+    free(ptr);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static bench_latency percentiles(uint64_t *samples, int nsamples)
+{
+    qsort(samples, nsamples, sizeof(samples[0]), compare_u64);
+    return (bench_latency){
+        .p50 = samples[nsamples / 2],
+        .p99 = samples[(int) ((nsamples - 1) * 0.99)],
+    };
+}
+
+/* Run program (or jit, dfa or tdfa, if not NULL) on the first size bytes
+ * of string
+ */
+static int run_n(const cregex_program_t *program,
+                 const cregex_jit_t *jit,
+                 const cregex_dfa_t *dfa,
+                 const cregex_tdfa_t *tdfa,
+                 const char *string,
+                 size_t size,
+                 const char **matches,
+                 int nmatches)
+{
+    if (jit)
+        return cregex_jit_run(jit, string, size, matches, nmatches);
+    if (dfa)
+        return cregex_dfa_run(dfa, string, size, matches, nmatches);
+    if (tdfa)
+        return cregex_tdfa_run(tdfa, string, size, matches, nmatches);
+    return cregex_program_run_n(program, string, size, matches, nmatches);
+}
+
+/* Run the pattern on text once, returning the number of matches */
+static long run_once(const cregex_program_t *program,
+                     const cregex_jit_t *jit,
+                     const cregex_dfa_t *dfa,
+                     const cregex_tdfa_t *tdfa,
+                     bench_mode mode,
+                     const char *text,
+                     size_t size)
+{
+    const char *matches[BENCH_FIELD_MATCHES];
+    int nslots = (mode == BENCH_MODE_FIELDS) ? BENCH_FIELD_MATCHES : 2;
+    long nmatches = 0;
+    char *output;
+
+    if (mode == BENCH_MODE_BUFFER)
+        return run_n(program, jit, dfa, tdfa, text, size, matches, nslots);
+
+    /* the interpreter only: replacing needs the match bounds anyway */
+    if (mode == BENCH_MODE_REPLACE) {
+        nmatches = cregex_program_replace_with(program, text, size,
+                                               "id=<redacted>", NULL, &output,
+                                               NULL);
+        if (nmatches >= 0)
+            free(output);
+        return nmatches;
+    }
+
+    for (const char *line = text, *end = text + size, *eol; line < end;
+         line = eol + 1) {
+        if (!(eol = memchr(line, '\n', end - line)))
+            eol = end;
+        int matched = run_n(program, jit, dfa, tdfa, line, eol - line,
+                            matches, nslots);
+        if (matched < 0)
+            return -1;
+        nmatches += matched;
+    }
+    return nmatches;
+}
+
+/* Change the byte in the middle of text back and forth, updating the matches
+ * of scan, and return their number
+ */
+static long run_edit(cregex_incremental_t *scan, char *text, size_t size)
+{
+    size_t middle = size / 2;
+
+    text[middle] = (text[middle] == 'x') ? 'y' : 'x';
+    if (cregex_incremental_edit(scan, text, size, middle, 1, 1) < 0)
+        return -1;
+    return cregex_incremental_count(scan);
+}
+
+/* Run regex on the first size bytes of string. REG_STARTEND, where the C
+ * library has it, bounds the string without copying; otherwise the bytes are
+ * copied to scratch, which must hold size + 1 bytes.
+ */
+static int run_posix(const regex_t *regex,
+                     const char *string,
+                     size_t size,
+                     char *scratch,
+                     regmatch_t *match)
+{
+    int result;
+
+#ifdef REG_STARTEND
+    (void) scratch;
+    match->rm_so = 0;
+    match->rm_eo = size;
+    result = regexec(regex, string, 1, match, REG_STARTEND);
+#else
+    memcpy(scratch, string, size);
+    scratch[size] = '\0';
+    result = regexec(regex, scratch, 1, match, 0);
+#endif
+
+    if (result == REG_NOMATCH)
+        return 0;
+    return result == 0 ? 1 : -1;
+}
+
+/* run_once() for regexec() */
+static long run_once_posix(const regex_t *regex,
+                           bench_mode mode,
+                           const char *text,
+                           size_t size,
+                           char *scratch)
+{
+    regmatch_t match;
+    long nmatches = 0;
+
+    if (mode == BENCH_MODE_BUFFER)
+        return run_posix(regex, text, size, scratch, &match);
+
+    for (const char *line = text, *end = text + size, *eol; line < end;
+         line = eol + 1) {
+        if (!(eol = memchr(line, '\n', end - line)))
+            eol = end;
+        int matched = run_posix(regex, line, eol - line, scratch, &match);
+        if (matched < 0)
+            return -1;
+        nmatches += matched;
+    }
+    return nmatches;
+}
+
+/* Check that every run of the pattern on text finds the same match bounds
+ * with cregex as with regexec(), returning the number of disagreements.
+ * Patterns are chosen so that leftmost-first and POSIX leftmost-longest
+ * semantics coincide.
+ */
+static long check_posix(const char *name,
+                        const cregex_program_t *program,
+                        const regex_t *regex,
+                        bench_mode mode,
+                        const char *text,
+                        size_t size,
+                        char *scratch)
+{
+    long ndisagreements = 0;
+
+    for (const char *line = text, *end = text + size, *eol; line < end;
+         line = eol + 1) {
+        const char *matches[2] = {0};
+        regmatch_t match;
+
+        if (mode == BENCH_MODE_BUFFER ||
+            !(eol = memchr(line, '\n', end - line)))
+            eol = end;
+
+        int matched =
+            cregex_program_run_n(program, line, eol - line, matches, 2);
+        int posix_matched = run_posix(regex, line, eol - line, scratch, &match);
+        if (matched != posix_matched ||
+            (matched > 0 && (matches[0] - line != match.rm_so ||
+                             matches[1] - line != match.rm_eo))) {
+            if (ndisagreements++ == 0)
+                fprintf(stderr,
+                        "%s: cregex and regexec() disagree at offset %ld: "
+                        "%d (%ld,%ld) vs %d (%ld,%ld)\n",
+                        name, (long) (line - text), matched,
+                        matched > 0 ? (long) (matches[0] - line) : -1L,
+                        matched > 0 ? (long) (matches[1] - line) : -1L,
+                        posix_matched,
+                        posix_matched > 0 ? (long) match.rm_so : -1L,
+                        posix_matched > 0 ? (long) match.rm_eo : -1L);
+        }
+    }
+    return ndisagreements;
+}
+
+static int measure_cregex(const bench_options *options,
+                          const char *name,
+                          const char *pattern,
+                          int flags,
+                          bench_mode mode,
+                          const char *text,
+                          size_t size,
+                          uint64_t *samples,
+                          bench_result *result)
+{
+    cregex_node_t *node = NULL;
+    cregex_program_t *program = NULL;
+    cregex_jit_t *jit = NULL;
+    cregex_dfa_t *dfa = NULL;
+    cregex_tdfa_t *tdfa = NULL;
+    cregex_incremental_t *scan = NULL;
+    char *edited = NULL;
+    uint64_t min_ns = options->quick ? BENCH_MIN_NS / 20 : BENCH_MIN_NS;
+    uint64_t total, start;
+    int n;
+
+    /* parse */
+    for (n = 0, total = 0; n < BENCH_MAX_SAMPLES &&
+                           (n < BENCH_MIN_SAMPLES || total < min_ns / 4);
+         ++n) {
+        start = now_ns();
+        node = cregex_parse(pattern);
+        samples[n] = now_ns() - start;
+        total += samples[n];
+        if (!node) {
+            fprintf(stderr, "%s: cregex_parse() failed\n", name);
+            return -1;
+        }
+        cregex_parse_free(node);
+    }
+    result->parse = percentiles(samples, n);
+
+    /* compile, including translation to native code with --jit and
+     * building the minimized DFA with --dfa or the tagged DFA with --tdfa
+     */
+    if (!(node = cregex_parse(pattern)))
+        return -1;
+    for (n = 0, total = 0; n < BENCH_MAX_SAMPLES &&
+                           (n < BENCH_MIN_SAMPLES || total < min_ns / 4);
+         ++n) {
+        start = now_ns();
+        program = cregex_compile_node_with(node, flags, NULL);
+        if (program && options->jit)
+            jit = cregex_jit_compile(program);
+        if (program && options->dfa)
+            dfa = cregex_dfa_compile(program, 0);
+        if (program && options->tdfa)
+            tdfa = cregex_tdfa_compile(program, 0);
+        samples[n] = now_ns() - start;
+        total += samples[n];
+        if (!program || (options->jit && !jit) || (options->dfa && !dfa) ||
+            (options->tdfa && !tdfa)) {
+            fprintf(stderr, "%s: compilation failed\n", name);
+            cregex_jit_free(jit);
+            cregex_dfa_free(dfa);
+            cregex_tdfa_free(tdfa);
+            cregex_compile_free(program);
+            cregex_parse_free(node);
+            return -1;
+        }
+        cregex_jit_free(jit);
+        cregex_dfa_free(dfa);
+        cregex_tdfa_free(tdfa);
+        cregex_compile_free(program);
+    }
+    result->compile = percentiles(samples, n);
+    program = cregex_compile_node_with(node, flags, NULL);
+    cregex_parse_free(node);
+    if (!program)
+        return -1;
+    if ((options->jit && !(jit = cregex_jit_compile(program))) ||
+        (options->dfa && !(dfa = cregex_dfa_compile(program, 0))) ||
+        (options->tdfa && !(tdfa = cregex_tdfa_compile(program, 0)))) {
+        cregex_jit_free(jit);
+        cregex_dfa_free(dfa);
+        cregex_compile_free(program);
+        return -1;
+    }
+
+    /* edits are made to a copy of the corpus, scanned beforehand */
+    if (mode == BENCH_MODE_EDIT &&
+        (!(edited = malloc(size)) ||
+         !(scan = cregex_incremental_scan(program, text, size, 2, 0)))) {
+        free(edited);
+        cregex_compile_free(program);
+        return -1;
+    }
+    if (edited)
+        memcpy(edited, text, size);
+
+    /* run */
+    for (n = 0, total = 0;
+         n < BENCH_MAX_SAMPLES && (n < BENCH_MIN_SAMPLES || total < min_ns);
+         ++n) {
+        start = now_ns();
+        result->nmatches =
+            scan ? run_edit(scan, edited, size)
+                 : run_once(program, jit, dfa, tdfa, mode, text, size);
+        samples[n] = now_ns() - start;
+        total += samples[n];
+        if (result->nmatches < 0) {
+            fprintf(stderr, "%s: cregex_program_run_n() failed\n", name);
+            cregex_incremental_free(scan);
+            free(edited);
+            cregex_jit_free(jit);
+            cregex_dfa_free(dfa);
+            cregex_tdfa_free(tdfa);
+            cregex_compile_free(program);
+            return -1;
+        }
+    }
+    cregex_incremental_free(scan);
+    free(edited);
+    cregex_jit_free(jit);
+    cregex_dfa_free(dfa);
+    cregex_tdfa_free(tdfa);
+    cregex_compile_free(program);
+    result->run = percentiles(samples, n);
+    return 0;
+}
+
+
+/* regcomp() parses and compiles in one step, so it is measured as compile
+ * time, leaving parse time at zero
+ */
+static int measure_posix(const bench_options *options,
+                         const char *name,
+                         const char *pattern,
+                         int flags,
+                         bench_mode mode,
+                         const char *text,
+                         size_t size,
+                         uint64_t *samples,
+                         bench_result *result)
+{
+    int cflags = REG_EXTENDED | ((flags & CREGEX_FLAG_ICASE) ? REG_ICASE : 0);
+    uint64_t min_ns = options->quick ? BENCH_MIN_NS / 20 : BENCH_MIN_NS;
+    uint64_t total, start;
+    regex_t regex;
+    char *scratch;
+    int n;
+
+    result->parse = (bench_latency){0, 0};
+
+    /* compile */
+    for (n = 0, total = 0; n < BENCH_MAX_SAMPLES &&
+                           (n < BENCH_MIN_SAMPLES || total < min_ns / 4);
+         ++n) {
+        start = now_ns();
+        int error = regcomp(&regex, pattern, cflags);
+        samples[n] = now_ns() - start;
+        total += samples[n];
+        if (error) {
+            fprintf(stderr, "%s: regcomp() failed\n", name);
+            return -1;
+        }
+        regfree(&regex);
+    }
+    result->compile = percentiles(samples, n);
+
+    if (!(scratch = malloc(size + 1)))
+        return -1;
+    if (regcomp(&regex, pattern, cflags)) {
+        free(scratch);
+        return -1;
+    }
+
+    /* run */
+    for (n = 0, total = 0;
+         n < BENCH_MAX_SAMPLES && (n < BENCH_MIN_SAMPLES || total < min_ns);
+         ++n) {
+        start = now_ns();
+        result->nmatches = run_once_posix(&regex, mode, text, size, scratch);
+        samples[n] = now_ns() - start;
+        total += samples[n];
+        if (result->nmatches < 0) {
+            fprintf(stderr, "%s: regexec() failed\n", name);
+            break;
+        }
+    }
+    regfree(&regex);
+    free(scratch);
+    if (result->nmatches < 0)
+        return -1;
+    result->run = percentiles(samples, n);
+    return 0;
+}
+
+/* Print one row of results. Against a baseline, the row also gives how many
+ * times faster the baseline runs and compiles.
+ */
+static void print_result(const bench_options *options,
+                         const char *name,
+                         size_t size,
+                         const bench_result *result,
+                         const bench_result *baseline)
+{
+    const bench_latency *parse = &result->parse, *compile = &result->compile,
+                        *run = &result->run;
+    double mb_per_s = run->p50 ? size * 1e3 / run->p50 : 0;
+    double ns_per_match =
+        (double) run->p50 / (result->nmatches ? result->nmatches : 1);
+    double run_speedup = 0, compile_speedup = 0;
+
+    if (baseline) {
+        run_speedup = baseline->run.p50 ? (double) run->p50 / baseline->run.p50
+                                        : 0;
+        compile_speedup = baseline->compile.p50 ? (double) compile->p50 /
+                                                      baseline->compile.p50
+                                                : 0;
+    }
+
+    if (options->json) {
+        printf(
+            "{\"name\":\"%s\",\"size\":%zu,\"matches\":%ld,"
+            "\"parse_p50_ns\":%llu,\"parse_p99_ns\":%llu,"
+            "\"compile_p50_ns\":%llu,\"compile_p99_ns\":%llu,"
+            "\"run_p50_ns\":%llu,\"run_p99_ns\":%llu,"
+            "\"mb_per_s\":%.2f,\"ns_per_match\":%.1f",
+            name, size, result->nmatches, (unsigned long long) parse->p50,
+            (unsigned long long) parse->p99, (unsigned long long) compile->p50,
+            (unsigned long long) compile->p99, (unsigned long long) run->p50,
+            (unsigned long long) run->p99, mb_per_s, ns_per_match);
+        if (baseline)
+            printf(",\"run_speedup\":%.2f,\"compile_speedup\":%.2f",
+                   run_speedup, compile_speedup);
+        printf("}\n");
+    } else {
+        printf(
+            "%-21s %8zu %7ld %8llu %8llu %8llu %8llu %10llu %10llu %9.2f "
+            "%11.1f",
+            name, size, result->nmatches, (unsigned long long) parse->p50,
+            (unsigned long long) parse->p99, (unsigned long long) compile->p50,
+            (unsigned long long) compile->p99, (unsigned long long) run->p50,
+            (unsigned long long) run->p99, mb_per_s, ns_per_match);
+        if (baseline)
+            printf(" %7.2fx %7.2fx", run_speedup, compile_speedup);
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+/* Parse and compile a large pattern, reporting time and memory */
+static int bench_compile(const bench_options *options,
+                         const char *name,
+                         const char *pattern,
+                         uint64_t *samples)
+{
+    uint64_t min_ns = options->quick ? BENCH_MIN_NS / 20 : BENCH_MIN_NS;
+    size_t size = strlen(pattern), parse_bytes = 0, program_bytes = 0;
+    cregex_allocator_t parse_allocator = {counting_alloc, counting_free,
+                                          &parse_bytes},
+                       program_allocator = {counting_alloc, counting_free,
+                                            &program_bytes};
+    bench_latency parse, compile;
+    cregex_node_t *node;
+    cregex_program_t *program;
+    uint64_t total, start;
+    int n, ninstructions;
+
+    for (n = 0, total = 0; n < BENCH_MAX_SAMPLES &&
+                           (n < BENCH_MIN_SAMPLES || total < min_ns / 4);
+         ++n) {
+        start = now_ns();
+        node = cregex_parse(pattern);
+        samples[n] = now_ns() - start;
+        total += samples[n];
+        if (!node) {
+            fprintf(stderr, "%s: cregex_parse() failed\n", name);
+            return -1;
+        }
+        cregex_parse_free(node);
+    }
+    parse = percentiles(samples, n);
+
+    if (!(node = cregex_parse_with(pattern, &parse_allocator)))
+        return -1;
+    for (n = 0, total = 0; n < BENCH_MAX_SAMPLES &&
+                           (n < BENCH_MIN_SAMPLES || total < min_ns / 4);
+         ++n) {
+        start = now_ns();
+        program = cregex_compile_node(node);
+        samples[n] = now_ns() - start;
+        total += samples[n];
+        if (!program) {
+            fprintf(stderr, "%s: cregex_compile_node() failed\n", name);
+            cregex_parse_free_with(node, &parse_allocator);
+            return -1;
+        }
+        cregex_compile_free(program);
+    }
+    compile = percentiles(samples, n);
+    program = cregex_compile_node_with(node, 0, &program_allocator);
+    cregex_parse_free_with(node, &parse_allocator);
+    if (!program)
+        return -1;
+    ninstructions = program->ninstructions;
+    cregex_compile_free_with(program, &program_allocator);
+
+    if (options->json) {
+        printf("{\"name\":\"%s\",\"pattern_bytes\":%zu,"
+               "\"instructions\":%d,\"parse_p50_ns\":%llu,"
+               "\"parse_p99_ns\":%llu,\"compile_p50_ns\":%llu,"
+               "\"compile_p99_ns\":%llu,\"parse_bytes\":%zu,"
+               "\"program_bytes\":%zu}\n",
+               name, size, ninstructions, (unsigned long long) parse.p50,
+               (unsigned long long) parse.p99,
+               (unsigned long long) compile.p50,
+               (unsigned long long) compile.p99, parse_bytes, program_bytes);
+    } else {
+        printf("%-21s %8zu %8d %8llu %8llu %8llu %8llu %10zu %10zu %8.1f\n",
+               name, size, ninstructions, (unsigned long long) parse.p50,
+               (unsigned long long) parse.p99,
+               (unsigned long long) compile.p50,
+               (unsigned long long) compile.p99, parse_bytes, program_bytes,
+               (double) (parse.p50 + compile.p50) / size);
+    }
+    fflush(stdout);
+    return 0;
+}
+
+/* Compile the alternatives of a large pattern as separate patterns, one at a
+ * time and as a set in one thread per CPU
+ */
+static int bench_compile_set(const bench_options *options,
+                             const char *name,
+                             const char *pattern,
+                             uint64_t *samples)
+{
+    uint64_t min_ns = options->quick ? BENCH_MIN_NS / 20 : BENCH_MIN_NS;
+    char *copy = strdup(pattern);
+    size_t size = strlen(pattern) + 1, npatterns = 0;
+    const char **patterns = malloc(sizeof(patterns[0]) * size);
+    cregex_program_t **programs = malloc(sizeof(programs[0]) * size);
+    bench_latency serial, parallel;
+    cregex_program_set_t *set;
+    uint64_t total, start;
+    int n;
+
+    if (!copy || !patterns || !programs) {
+        free(copy);
+        free(patterns);
+        free(programs);
+        return -1;
+    }
+    for (char *p = strtok(copy, "|"); p; p = strtok(NULL, "|"))
+        patterns[npatterns++] = p;
+
+    for (n = 0, total = 0; n < BENCH_MAX_SAMPLES &&
+                           (n < BENCH_MIN_SAMPLES || total < min_ns / 4);
+         ++n) {
+        start = now_ns();
+        for (size_t i = 0; i < npatterns; ++i)
+            programs[i] = cregex_compile(patterns[i], 0, NULL);
+        samples[n] = now_ns() - start;
+        total += samples[n];
+        for (size_t i = 0; i < npatterns; ++i)
+            cregex_compile_free(programs[i]);
+    }
+    serial = percentiles(samples, n);
+
+    for (n = 0, total = 0; n < BENCH_MAX_SAMPLES &&
+                           (n < BENCH_MIN_SAMPLES || total < min_ns / 4);
+         ++n) {
+        start = now_ns();
+        set = cregex_compile_set(patterns, npatterns, 0, NULL, 0);
+        samples[n] = now_ns() - start;
+        total += samples[n];
+        if (!set) {
+            fprintf(stderr, "%s: cregex_compile_set() failed\n", name);
+            free(copy);
+            free(patterns);
+            free(programs);
+            return -1;
+        }
+        cregex_program_set_free(set);
+    }
+    parallel = percentiles(samples, n);
+
+    if (options->json) {
+        printf("{\"name\":\"%s\",\"patterns\":%zu,"
+               "\"serial_p50_ns\":%llu,\"serial_p99_ns\":%llu,"
+               "\"set_p50_ns\":%llu,\"set_p99_ns\":%llu}\n",
+               name, npatterns, (unsigned long long) serial.p50,
+               (unsigned long long) serial.p99,
+               (unsigned long long) parallel.p50,
+               (unsigned long long) parallel.p99);
+    } else {
+        printf("%-21s %8zu %10llu %10llu %10llu %10llu %7.2fx\n", name,
+               npatterns, (unsigned long long) serial.p50,
+               (unsigned long long) serial.p99,
+               (unsigned long long) parallel.p50,
+               (unsigned long long) parallel.p99,
+               parallel.p50 ? (double) serial.p50 / parallel.p50 : 0);
+    }
+    fflush(stdout);
+    free(copy);
+    free(patterns);
+    free(programs);
+    return 0;
+}
+
+static int bench_one(const bench_options *options,
+                     const char *name,
+                     const char *pattern,
+                     int flags,
+                     bench_mode mode,
+                     const char *text,
+                     size_t size,
+                     uint64_t *samples)
+{
+    bench_result result, posix;
+    cregex_program_t *program;
+    regex_t regex;
+    char posix_name[64], *scratch;
+    long ndisagreements;
+
+    if (measure_cregex(options, name, pattern, flags, mode, text, size,
+                       samples, &result) < 0)
+        return -1;
+    print_result(options, name, size, &result, NULL);
+    /* regexec() has no replacement or incremental scan to compare with */
+    if (!options->posix || mode == BENCH_MODE_REPLACE ||
+        mode == BENCH_MODE_EDIT)
+        return 0;
+
+    /* the same runs through regexec(), which must find the same matches */
+    if (!(program = cregex_compile(pattern, flags, NULL)))
+        return -1;
+    if (regcomp(&regex, pattern,
+                REG_EXTENDED |
+                    ((flags & CREGEX_FLAG_ICASE) ? REG_ICASE : 0))) {
+        fprintf(stderr, "%s: regcomp() failed\n", name);
+        cregex_compile_free(program);
+        return -1;
+    }
+    if (!(scratch = malloc(size + 1))) {
+        regfree(&regex);
+        cregex_compile_free(program);
+        return -1;
+    }
+    ndisagreements =
+        check_posix(name, program, &regex, mode, text, size, scratch);
+    free(scratch);
+    regfree(&regex);
+    cregex_compile_free(program);
+
+    snprintf(posix_name, sizeof(posix_name), "%s/posix", name);
+    if (measure_posix(options, posix_name, pattern, flags, mode, text, size,
+                      samples, &posix) < 0)
+        return -1;
+    print_result(options, posix_name, size, &posix, &result);
+
+    if (ndisagreements) {
+        fprintf(stderr, "%s: %ld run(s) disagree with regexec()\n", name,
+                ndisagreements);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_options options = {0};
+    size_t max_size = corpus_sizes[sizeof(corpus_sizes) /
+                                       sizeof(corpus_sizes[0]) -
+                                   1];
+    uint64_t *samples;
+    char *random_text, *log_text;
+    int status = EXIT_SUCCESS;
+
+    /* process command line */
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            options.json = 1;
+        } else if (strcmp(argv[i], "--quick") == 0) {
+            options.quick = 1;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            options.jit = 1;
+        } else if (strcmp(argv[i], "--dfa") == 0) {
+            options.dfa = 1;
+        } else if (strcmp(argv[i], "--tdfa") == 0) {
+            options.tdfa = 1;
+        } else if (strcmp(argv[i], "--posix") == 0) {
+            options.posix = 1;
+        } else if (argv[i][0] != '-' && !options.filter) {
+            options.filter = argv[i];
+        } else {
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* generate corpora */
+    samples = malloc(sizeof(samples[0]) * BENCH_MAX_SAMPLES);
+    random_text = malloc(max_size);
+    log_text = malloc(max_size);
+    if (!samples || !random_text || !log_text) {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    make_random(random_text, max_size);
+    make_log(log_text, max_size);
+
+    /* with --posix, regexec() rows also give how many times longer they
+     * take than cregex
+     */
+    if (!options.json) {
+        printf("%-21s %8s %7s %8s %8s %8s %8s %10s %10s %9s %11s", "name",
+               "size", "matches", "parse50", "parse99", "comp50", "comp99",
+               "run50", "run99", "MB/s", "ns/match");
+        if (options.posix)
+            printf(" %8s %8s", "run-x", "comp-x");
+        printf("\n");
+    }
+
+    /* standard workloads */
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        const bench_case *bench = &cases[i];
+        if (options.filter && !strstr(bench->name, options.filter))
+            continue;
+
+        for (size_t j = 0; j < sizeof(corpus_sizes) / sizeof(corpus_sizes[0]);
+             ++j) {
+            const char *text =
+                (bench->corpus == BENCH_CORPUS_LOG) ? log_text : random_text;
+            if (bench_one(&options, bench->name, bench->pattern, bench->flags,
+                          bench->mode, text, corpus_sizes[j], samples) < 0)
+                status = EXIT_FAILURE;
+        }
+    }
+
+    /* pathological (a?){n}a{n} against a^n */
+    if (!options.filter || strstr("repeat", options.filter)) {
+        for (size_t i = 0; i < sizeof(repeat_sizes) / sizeof(repeat_sizes[0]);
+             ++i) {
+            int n = repeat_sizes[i];
+            char pattern[64], text[128], name[32];
+
+            snprintf(pattern, sizeof(pattern), "(a?){%d}a{%d}", n, n);
+            memset(text, 'a', n);
+            snprintf(name, sizeof(name), "repeat-%d", n);
+            if (bench_one(&options, name, pattern, 0, BENCH_MODE_BUFFER, text,
+                          n, samples) < 0)
+                status = EXIT_FAILURE;
+        }
+    }
+
+    /* compile time and memory of large patterns, with their own columns */
+    if (!options.filter || strstr("compile", options.filter)) {
+        char *pattern = malloc(ioc_sizes[sizeof(ioc_sizes) /
+                                               sizeof(ioc_sizes[0]) -
+                                           1]);
+        if (!pattern) {
+            fprintf(stderr, "%s: out of memory\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (!options.json)
+            printf("\n%-21s %8s %8s %8s %8s %8s %8s %10s %10s %8s\n", "name",
+                   "size", "instrs", "parse50", "parse99", "comp50", "comp99",
+                   "parse-B", "program-B", "ns/byte");
+        for (size_t i = 0; i < sizeof(ioc_sizes) / sizeof(ioc_sizes[0]); ++i) {
+            char name[32];
+            make_iocs(pattern, ioc_sizes[i]);
+            snprintf(name, sizeof(name), "compile-ioc-%zuk", ioc_sizes[i] >> 10);
+            if (bench_compile(&options, name, pattern, samples) < 0)
+                status = EXIT_FAILURE;
+        }
+        /* about 100 KB of groups nested 999 deep, with and without $ */
+        for (int end = 0; end <= 1; ++end) {
+            make_nested(pattern, 999, 66, end);
+            if (bench_compile(&options,
+                              end ? "compile-nested-end" : "compile-nested",
+                              pattern, samples) < 0)
+                status = EXIT_FAILURE;
+        }
+
+        /* the same indicators as a set of patterns */
+        if (!options.json)
+            printf("\n%-21s %8s %10s %10s %10s %10s %8s\n", "name",
+                   "patterns", "serial50", "serial99", "set50", "set99",
+                   "speedup");
+        for (size_t i = 0; i < sizeof(ioc_sizes) / sizeof(ioc_sizes[0]); ++i) {
+            char name[32];
+            make_iocs(pattern, ioc_sizes[i]);
+            snprintf(name, sizeof(name), "compile-set-%zuk",
+                     ioc_sizes[i] >> 10);
+            if (bench_compile_set(&options, name, pattern, samples) < 0)
+                status = EXIT_FAILURE;
+        }
+        free(pattern);
+    }
+
+    free(log_text);
+    free(random_text);
+    free(samples);
+    return status;
+}
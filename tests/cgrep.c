@@ -0,0 +1,340 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cregex.h>
+
+/* Files at least this large are split across worker threads */
+#define CGREP_PARALLEL_MIN (1 << 20)
+#define CGREP_MAX_THREADS 64
+
+typedef struct {
+    int count_only;   /* -c: print number of matching lines only */
+    int flags;        /* -i, -u: compile flags */
+    int byte_offset;  /* -b: prefix lines with their byte offset */
+    int nthreads;     /* -j: number of worker threads */
+    int print_name;   /* prefix lines with the file name */
+} cgrep_options;
+
+/* A line-aligned slice of the input searched by one worker */
+typedef struct {
+    const cregex_jit_t *jit;
+    const char *buffer, *from, *to;
+    int collect;
+    int error;
+    size_t count;
+    size_t *lines, nlines, capacity; /* offsets of matching lines */
+} cgrep_chunk;
+
+static void usage(FILE *file, const char *program)
+{
+    fprintf(file, "usage: %s [-c] [-b] [-i] [-u] [-j threads] pattern [file...]\n",
+            program);
+}
+
+static int chunk_append(cgrep_chunk *chunk, size_t offset)
+{
+    if (chunk->nlines == chunk->capacity) {
+        size_t capacity = chunk->capacity ? chunk->capacity * 2 : 256;
+        size_t *lines = realloc(chunk->lines, sizeof(lines[0]) * capacity);
+        if (!lines)
+            return -1;
+        chunk->lines = lines;
+        chunk->capacity = capacity;
+    }
+    chunk->lines[chunk->nlines++] = offset;
+    return 0;
+}
+
+static void *search_chunk(void *arg)
+{
+    cgrep_chunk *chunk = arg;
+
+    for (const char *line = chunk->from, *eol; line < chunk->to;
+         line = eol + 1) {
+        if (!(eol = memchr(line, '\n', chunk->to - line)))
+            eol = chunk->to;
+
+        int matched = cregex_jit_run(chunk->jit, line, eol - line, NULL, 0);
+        if (matched < 0) {
+            chunk->error = 1;
+            break;
+        }
+        if (!matched)
+            continue;
+
+        ++chunk->count;
+        if (chunk->collect && chunk_append(chunk, line - chunk->buffer) < 0) {
+            chunk->error = 1;
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/* Split buffer into at most nchunks line-aligned chunks */
+static int split_chunks(const char *buffer,
+                        size_t size,
+                        cgrep_chunk *chunks,
+                        int nchunks)
+{
+    const char *from = buffer, *end = buffer + size;
+    int n = 0;
+
+    for (int i = 0; i < nchunks && from < end; ++i) {
+        const char *to = from + (end - from) / (nchunks - i);
+        const char *eol;
+        if (to < end && (eol = memchr(to, '\n', end - to)))
+            to = eol + 1;
+        else
+            to = end;
+        chunks[n].from = from;
+        chunks[n].to = to;
+        ++n;
+        from = to;
+    }
+
+    return n;
+}
+
+static void print_line(const cgrep_options *options,
+                       const char *name,
+                       const char *buffer,
+                       size_t size,
+                       size_t offset)
+{
+    const char *line = buffer + offset;
+    const char *eol = memchr(line, '\n', size - offset);
+    size_t length = eol ? (size_t) (eol - line) : size - offset;
+
+    if (options->print_name)
+        printf("%s:", name);
+    if (options->byte_offset)
+        printf("%zu:", offset);
+    fwrite(line, 1, length, stdout);
+    putchar('\n');
+}
+
+/* Search buffer, returning the number of matching lines or -1 on error */
+static long search_buffer(const cregex_jit_t *jit,
+                          const cgrep_options *options,
+                          const char *name,
+                          const char *buffer,
+                          size_t size)
+{
+    cgrep_chunk chunks[CGREP_MAX_THREADS] = {{0}};
+    pthread_t threads[CGREP_MAX_THREADS];
+    int nchunks = (size >= CGREP_PARALLEL_MIN) ? options->nthreads : 1;
+    long count = 0;
+    int error = 0;
+
+    nchunks = split_chunks(buffer, size, chunks, nchunks);
+    for (int i = 0; i < nchunks; ++i) {
+        chunks[i].jit = jit;
+        chunks[i].buffer = buffer;
+        chunks[i].collect = !options->count_only;
+    }
+
+    /* the calling thread searches the first chunk itself, plus any chunk
+     * for which no worker could be started
+     */
+    int nstarted = 1;
+    while (nstarted < nchunks && !pthread_create(&threads[nstarted], NULL,
+                                                 search_chunk,
+                                                 &chunks[nstarted]))
+        ++nstarted;
+    if (nchunks > 0)
+        search_chunk(&chunks[0]);
+    for (int i = nstarted; i < nchunks; ++i)
+        search_chunk(&chunks[i]);
+    for (int i = 1; i < nstarted; ++i)
+        pthread_join(threads[i], NULL);
+
+    /* report results in input order */
+    for (int i = 0; i < nchunks; ++i) {
+        error |= chunks[i].error;
+        count += chunks[i].count;
+        for (size_t j = 0; !error && j < chunks[i].nlines; ++j)
+            print_line(options, name, buffer, size, chunks[i].lines[j]);
+        free(chunks[i].lines);
+    }
+
+    if (error)
+        return -1;
+
+    if (options->count_only) {
+        if (options->print_name)
+            printf("%s:", name);
+        printf("%ld\n", count);
+    }
+
+    return count;
+}
+
+/* Read a non-mappable stream (e.g. a pipe) into memory */
+static char *read_stream(int fd, size_t *size)
+{
+    size_t capacity = 1 << 16, length = 0;
+    char *buffer = malloc(capacity);
+
+    while (buffer) {
+        if (length == capacity) {
+            char *grown = realloc(buffer, capacity *= 2);
+            if (!grown)
+                break;
+            buffer = grown;
+        }
+
+        ssize_t n = read(fd, buffer + length, capacity - length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            break;
+        if (n == 0) {
+            *size = length;
+            return buffer;
+        }
+        length += n;
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+static long search_file(const cregex_jit_t *jit,
+                        const cgrep_options *options,
+                        const char *name)
+{
+    int fd = (strcmp(name, "-") == 0) ? STDIN_FILENO : open(name, O_RDONLY);
+    struct stat st;
+    long count;
+
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(name);
+        if (fd > STDIN_FILENO)
+            close(fd);
+        return -1;
+    }
+
+    if (S_ISREG(st.st_mode)) {
+        void *buffer = NULL;
+        if (st.st_size > 0 &&
+            (buffer = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) ==
+                MAP_FAILED) {
+            perror(name);
+            if (fd > STDIN_FILENO)
+                close(fd);
+            return -1;
+        }
+        if (buffer)
+            posix_madvise(buffer, st.st_size, POSIX_MADV_SEQUENTIAL);
+        count = search_buffer(jit, options, name, buffer, st.st_size);
+        if (buffer)
+            munmap(buffer, st.st_size);
+    } else {
+        size_t size;
+        char *buffer = read_stream(fd, &size);
+        if (!buffer) {
+            perror(name);
+            if (fd > STDIN_FILENO)
+                close(fd);
+            return -1;
+        }
+        count = search_buffer(jit, options, name, buffer, size);
+        free(buffer);
+    }
+
+    if (fd > STDIN_FILENO)
+        close(fd);
+    if (count < 0)
+        fprintf(stderr, "%s: cregex_jit_run() failed\n", name);
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    cgrep_options options = {0};
+    cregex_program_t *program;
+    cregex_jit_t *jit;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt, status = 1, nfiles;
+
+    options.nthreads = (online > 0) ? online : 1;
+
+    /* process command line */
+    if (argc > 1 && strcmp(argv[1], "--help") == 0) {
+        usage(stdout, argv[0]);
+        return EXIT_SUCCESS;
+    }
+
+    while ((opt = getopt(argc, argv, "cbiuj:h")) != -1) {
+        switch (opt) {
+        case 'c':
+            options.count_only = 1;
+            break;
+        case 'b':
+            options.byte_offset = 1;
+            break;
+        case 'i':
+            options.flags |= CREGEX_FLAG_ICASE;
+            break;
+        case 'u':
+            options.flags |= CREGEX_FLAG_UTF8;
+            break;
+        case 'j':
+            options.nthreads = atoi(optarg);
+            break;
+        case 'h':
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            usage(stderr, argv[0]);
+            return 2;
+        }
+    }
+
+    if (optind >= argc || options.nthreads < 1) {
+        usage(stderr, argv[0]);
+        return 2;
+    }
+    if (options.nthreads > CGREP_MAX_THREADS)
+        options.nthreads = CGREP_MAX_THREADS;
+
+    /* parse and compile pattern */
+    if (!(program = cregex_compile(argv[optind], options.flags, NULL))) {
+        fprintf(stderr, "%s: cregex_compile() failed\n", argv[0]);
+        return 2;
+    }
+
+    /* lines are only tested for a match, which native code answers alone */
+    if (!(jit = cregex_jit_compile(program))) {
+        fprintf(stderr, "%s: cregex_jit_compile() failed\n", argv[0]);
+        cregex_compile_free(program);
+        return 2;
+    }
+
+    /* search file(s), or standard input if none given */
+    nfiles = argc - optind - 1;
+    options.print_name = nfiles > 1;
+    for (int i = 0; i < (nfiles ? nfiles : 1); ++i) {
+        long count = search_file(jit, &options,
+                                 nfiles ? argv[optind + 1 + i] : "-");
+        if (count < 0)
+            status = 2;
+        else if (count > 0 && status == 1)
+            status = 0;
+    }
+
+    cregex_jit_free(jit);
+    cregex_compile_free(program);
+    return status;
+}
@@ -7,7 +7,7 @@
 
 static void usage(FILE *file, const char *program)
 {
-    fprintf(file, "usage: %s pattern [string...]\n", program);
+    fprintf(file, "usage: %s [--profile] pattern [string...]\n", program);
 }
 
 static void print_node(FILE *file, cregex_node_t *node, int depth)
@@ -97,9 +97,12 @@ static void print_char_class(FILE *file,
 
 static void print_instruction(FILE *file,
                               const cregex_program_t *program,
-                              const cregex_program_instr_t *instruction)
+                              const cregex_program_instr_t *instruction,
+                              const unsigned long *hits)
 {
     fprintf(file, "[%04x] ", (int) (instruction - program->instructions));
+    if (hits)
+        fprintf(file, "%10lu  ", hits[instruction - program->instructions]);
 
     switch (instruction->opcode) {
     case REGEX_PROGRAM_OPCODE_MATCH:
@@ -137,6 +140,24 @@ static void print_instruction(FILE *file,
                 (int) (instruction->first - program->instructions),
                 (int) (instruction->second - program->instructions));
         break;
+    case REGEX_PROGRAM_OPCODE_DISPATCH:
+        /* runs of bytes and the alternatives they select */
+        fprintf(file, "DISPATCH");
+        for (int ch = 0, to; ch <= UCHAR_MAX; ch = to) {
+            int offset = instruction->table[ch];
+            for (to = ch + 1;
+                 to <= UCHAR_MAX && instruction->table[to] == offset; ++to)
+                ;
+            if (!offset)
+                continue;
+            fprintf(file, isprint(ch) ? " %c" : " %02x", ch);
+            if (to > ch + 1)
+                fprintf(file, isprint(to - 1) ? "-%c" : "-%02x", to - 1);
+            fprintf(file, ":%04x",
+                    (int) (instruction + offset - program->instructions));
+        }
+        fprintf(file, "\n");
+        break;
 
     /* Assertions */
     case REGEX_PROGRAM_OPCODE_ASSERT_BEGIN:
@@ -153,16 +174,87 @@ static void print_instruction(FILE *file,
     }
 }
 
-static void print_program(FILE *file, const cregex_program_t *program)
+/* Print program listing, annotated with execution counts if hits is given */
+static void print_program(FILE *file,
+                          const cregex_program_t *program,
+                          const unsigned long *hits)
+{
+    for (int i = 0; i < program->ninstructions; ++i) {
+        if (program->reverse && i == program->reverse)
+            fprintf(file, "; reversed program, run from the end of string\n");
+        print_instruction(file, program, program->instructions + i, hits);
+    }
+}
+
+/* Print the execution plan and what it was chosen from */
+static void print_plan(FILE *file, const cregex_program_t *program)
 {
-    for (int i = 0; i < program->ninstructions; ++i)
-        print_instruction(file, program, program->instructions + i);
+    cregex_plan_info_t info;
+
+    cregex_program_plan(program, &info);
+    fprintf(file, "; plan: %s, as %s\n", cregex_plan_name(info.plan),
+            info.reason);
+    fprintf(file,
+            "; %d instructions, %d capture(s), match length %d..",
+            info.ninstructions, info.ncaptures, program->min_length);
+    if (program->max_length < 0)
+        fprintf(file, "unbounded");
+    else
+        fprintf(file, "%d", program->max_length);
+    fprintf(file, ", literal prefix of %d byte(s)\n", info.prefix_length);
+    fprintf(file, "; %s, %s, %s",
+            info.anchored ? "anchored" : "unanchored",
+            info.end_anchored ? "end-anchored" : "not end-anchored",
+            info.onepass ? "one-pass" : "not one-pass");
+    if (info.nfirst)
+        fprintf(file, ", %d byte(s) can begin a match", info.nfirst);
+    fprintf(file, "\n");
+
+    cregex_dfa_t *dfa = cregex_dfa_compile(program, 0);
+    if (dfa && cregex_dfa_nstates(dfa))
+        fprintf(file, "; minimized DFA of %d states, %zu bytes saved\n",
+                cregex_dfa_nstates(dfa), cregex_dfa_save(dfa, NULL, 0));
+    else if (dfa)
+        fprintf(file, "; no DFA table\n");
+    cregex_dfa_free(dfa);
+
+    cregex_tdfa_t *tdfa = cregex_tdfa_compile(program, 0);
+    if (tdfa && cregex_tdfa_nstates(tdfa))
+        fprintf(file, "; tagged DFA of %d states\n", cregex_tdfa_nstates(tdfa));
+    else if (tdfa)
+        fprintf(file, "; no tagged DFA\n");
+    cregex_tdfa_free(tdfa);
+}
+
+/* Print what the parsed pattern would cost to run */
+static void print_cost(FILE *file, const cregex_node_t *node)
+{
+    cregex_cost_t cost;
+
+    cregex_node_cost(node, 0, &cost);
+    fprintf(file,
+            "; cost: %d instructions, %d capture(s), up to %d threads, "
+            "at most %d instructions per byte, %d cop(ies) of the most "
+            "repeated part\n",
+            cost.ninstructions, cost.ncaptures, cost.max_threads,
+            cost.work_per_byte, cost.repetition_copies);
+}
+
+static void print_stats(FILE *file, const cregex_program_stats_t *stats)
+{
+    fprintf(file,
+            "bytes scanned: %zu, threads added: %zu, peak threads: %d, "
+            "vm_add_thread calls: %zu\n",
+            stats->nbytes, stats->nthreads, stats->max_threads,
+            stats->nadd_thread);
 }
 
 int main(int argc, char *argv[])
 {
     cregex_node_t *node;
     cregex_program_t *program;
+    cregex_program_stats_t stats = {0};
+    int profile = 0, first = 1;
 
     /* process command line */
     if (argc < 2) {
@@ -175,10 +267,20 @@ int main(int argc, char *argv[])
         return EXIT_SUCCESS;
     }
 
+    if (strcmp(argv[1], "--profile") == 0) {
+        profile = 1;
+        if (argc < 3) {
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+        ++first;
+    }
+
     /* parse pattern */
-    if ((node = cregex_parse(argv[1])))
+    if ((node = cregex_parse(argv[first]))) {
         print_node(stdout, node, 0);
-    else {
+        print_cost(stdout, node);
+    } else {
         fprintf(stderr, "%s: cregex_parse() failed\n", argv[0]);
         return EXIT_FAILURE;
     }
@@ -186,18 +288,34 @@ int main(int argc, char *argv[])
     /* compile parsed pattern */
     program = cregex_compile_node(node);
     cregex_parse_free(node);
-    if (program)
-        print_program(stdout, program);
-    else {
+    if (!program) {
         fprintf(stderr, "%s: cregex_compile_node() failed\n", argv[0]);
         return EXIT_FAILURE;
     }
 
+    /* with --profile, the listing is printed after the runs */
+    if (profile) {
+        stats.hits = calloc(program->ninstructions, sizeof(stats.hits[0]));
+        if (!stats.hits) {
+            fprintf(stderr, "%s: out of memory\n", argv[0]);
+            cregex_compile_free(program);
+            return EXIT_FAILURE;
+        }
+    } else {
+        print_program(stdout, program, NULL);
+        print_plan(stdout, program);
+    }
+
     /* run program on string(s) */
-    for (int i = 2; i < argc; ++i) {
+    for (int i = first + 1; i < argc; ++i) {
         const char *matches[20] = {0};
+        int matched =
+            profile ? cregex_program_run_stats(program, argv[i],
+                                               strlen(argv[i]), matches, 20,
+                                               &stats)
+                    : cregex_program_run(program, argv[i], matches, 20);
 
-        if (cregex_program_run(program, argv[i], matches, 20) > 0) {
+        if (matched > 0) {
             int nmatches = 0;
             for (int j = 0; j < sizeof(matches) / sizeof(matches[0]); ++j)
                 if (matches[j])
@@ -224,6 +342,13 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (profile) {
+        print_program(stdout, program, stats.hits);
+        print_plan(stdout, program);
+        print_stats(stdout, &stats);
+        free(stats.hits);
+    }
+
     cregex_compile_free(program);
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,1927 @@
+/* generated by tests/generator.rb tests/nullsubexpr.dat tests/repetition.dat tests/utf8.dat */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cregex.h>
+
+#ifdef __GNUC__
+static void success(const char *source, const char *format, ...)
+    __attribute__ ((format(printf, 2, 3)));
+static void fail(const char *source, const char *format, ...)
+    __attribute__ ((format(printf, 2, 3)));
+#endif
+
+static void success(const char *source, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    printf("%s [\x1b[32mSUCCESS\x1b[0m] ", source);
+    vprintf(format, ap);
+    printf("\n");
+    va_end(ap);
+}
+
+static void fail(const char *source, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+    printf("%s [\x1b[31mFAIL   \x1b[0m] ", source);
+    vprintf(format, ap);
+    printf("\n");
+    va_end(ap);
+}
+
+/* Whether the minimized DFA of program gives result on string, as built and
+ * once saved and loaded back
+ */
+static int check_dfa(const cregex_program_t *program, const char *string,
+                     int result)
+{
+    cregex_dfa_t *dfa = cregex_dfa_compile(program, 0), *loaded = NULL;
+    size_t size = dfa ? cregex_dfa_save(dfa, NULL, 0) : 0;
+    char *saved = malloc(size);
+    int ok = 0;
+
+    if (dfa && saved && cregex_dfa_save(dfa, saved, size) == size &&
+        (loaded = cregex_dfa_load(program, saved, size)))
+        ok = cregex_dfa_run(dfa, string, strlen(string), NULL, 0) == result &&
+             cregex_dfa_run(loaded, string, strlen(string), NULL, 0) ==
+                 result;
+
+    cregex_dfa_free(loaded);
+    free(saved);
+    cregex_dfa_free(dfa);
+    return ok;
+}
+
+/* Whether the tagged DFA of program gives result and the submatches found by
+ * the interpreter on string
+ */
+static int check_tdfa(const cregex_program_t *program, const char *string,
+                      int result, const char **matches, int nmatches)
+{
+    cregex_tdfa_t *tdfa = cregex_tdfa_compile(program, 0);
+    const char *tdfa_matches[20] = {0};
+    int ok = 0;
+
+    if (tdfa)
+        ok = cregex_tdfa_run(tdfa, string, strlen(string), NULL, 0) ==
+                 result &&
+             cregex_tdfa_run(tdfa, string, strlen(string), tdfa_matches,
+                             nmatches) == result &&
+             memcmp(matches, tdfa_matches, sizeof(matches[0]) * nmatches) ==
+                 0;
+
+    cregex_tdfa_free(tdfa);
+    return ok;
+}
+
+/* Whether the matches of scan are those of a fresh scan of string */
+static int same_matches(const cregex_incremental_t *scan,
+                        const cregex_program_t *program,
+                        const char *string, size_t length)
+{
+    cregex_incremental_t *fresh =
+        cregex_incremental_scan(program, string, length, 20, 0);
+    int ok = fresh && cregex_incremental_count(scan) ==
+                          cregex_incremental_count(fresh);
+
+    for (size_t i = 0; ok && i < cregex_incremental_count(scan); ++i)
+        ok = memcmp(cregex_incremental_match(scan, i),
+                    cregex_incremental_match(fresh, i),
+                    sizeof(ptrdiff_t) * 20) == 0;
+    cregex_incremental_free(fresh);
+    return ok;
+}
+
+/* Whether an incremental scan of string finds as many matches as replacing
+ * them does, and keeps finding those of a fresh scan once a byte in the
+ * middle is replaced, removed and put back
+ */
+static int check_incremental(const cregex_program_t *program,
+                             const char *string)
+{
+    size_t length = strlen(string), middle = length / 2;
+    char *edited = malloc(length + 1);
+    cregex_incremental_t *scan =
+        cregex_incremental_scan(program, string, length, 20, 1);
+    int ok = 0;
+
+    if (edited && scan &&
+        cregex_incremental_count(scan) ==
+            (size_t) cregex_program_replace(program, string, length, "", NULL,
+                                            0, NULL)) {
+        memcpy(edited, string, length + 1);
+        ok = same_matches(scan, program, edited, length);
+        if (ok && middle < length) {
+            edited[middle] = 'x';
+            ok = cregex_incremental_edit(scan, edited, length, middle, 1, 1) ==
+                     0 &&
+                 same_matches(scan, program, edited, length);
+            memmove(edited + middle, edited + middle + 1, length - middle);
+            ok = ok &&
+                 cregex_incremental_edit(scan, edited, length - 1, middle, 1,
+                                         0) == 0 &&
+                 same_matches(scan, program, edited, length - 1);
+            ok = ok &&
+                 cregex_incremental_edit(scan, string, length, middle, 0, 1) ==
+                     0 &&
+                 same_matches(scan, program, string, length);
+        }
+    }
+
+    cregex_incremental_free(scan);
+    free(edited);
+    return ok;
+}
+
+/* Whether a set compiled from pattern, an invalid pattern and pattern again
+ * in two threads gives result and matches on string for both copies, and an
+ * error for the invalid pattern only
+ */
+static int check_set(const char *pattern, int flags, const char *string,
+                     int result, const char **matches, int nmatches)
+{
+    const char *patterns[] = {pattern, "(", pattern};
+    cregex_program_set_t *set =
+        cregex_compile_set(patterns, 3, flags, NULL, 2);
+    int ok = set && cregex_program_set_count(set) == 3 &&
+             cregex_program_set_error(set, 1) == CREGEX_ERROR &&
+             !cregex_program_set_program(set, 1);
+
+    for (size_t i = 0; ok && i < 3; i += 2) {
+        const cregex_program_t *program = cregex_program_set_program(set, i);
+        const char *set_matches[20] = {0};
+        ok = program && cregex_program_set_error(set, i) == 0 &&
+             cregex_program_run(program, string, set_matches, nmatches) ==
+                 result &&
+             memcmp(matches, set_matches, sizeof(matches[0]) * nmatches) == 0;
+    }
+
+    cregex_program_set_free(set);
+    return ok;
+}
+
+/* Patterns which must not compile */
+static int test_error(const char *source, const char *pattern, int flags)
+{
+    cregex_program_t *program = cregex_compile(pattern, flags, NULL);
+
+    if (program) {
+        fail(source, "/%s/ compiled", pattern);
+        cregex_compile_free(program);
+        return -1;
+    }
+    success(source, "/%s/ rejected", pattern);
+    return 0;
+}
+
+static int test(const char *source,
+                const char *pattern, const char *string,
+                int flags,
+                int nmatches,
+                ...)
+{
+    cregex_node_t *root;
+    cregex_program_t *program;
+    cregex_jit_t *jit;
+    const char *matches[20] = {0}, *jit_matches[20] = {0};
+    int result = 0;
+    va_list ap;
+
+    /* parse pattern */
+    if (!(root = cregex_parse_with_flags(pattern, flags, NULL))) {
+        fail(source, "cregex_parse_with_flags() failed");
+        return -1;
+    }
+
+    /* compile parsed pattern */
+    program = cregex_compile_node_with(root, flags, NULL);
+    cregex_parse_free(root);
+    if (!program) {
+        fail(source, "cregex_compile_node_with() failed");
+        return -1;
+    }
+
+    /* run program on string */
+    if ((result = cregex_program_run(program, string, matches,
+                                     sizeof (matches) / sizeof (matches[0]))) <
+        0) {
+        fail(source, "cregex_program_run() failed");
+        cregex_compile_free(program);
+        return -1;
+    }
+
+    /* the JIT must agree with the interpreter, with and without submatches */
+    if (!(jit = cregex_jit_compile(program))) {
+        fail(source, "cregex_jit_compile() failed");
+        cregex_compile_free(program);
+        return -1;
+    }
+    if (cregex_jit_run(jit, string, strlen(string), NULL, 0) != result ||
+        cregex_jit_run(jit, string, strlen(string), jit_matches,
+                       sizeof (jit_matches) / sizeof (jit_matches[0])) !=
+            result ||
+        memcmp(matches, jit_matches, sizeof (matches)) != 0) {
+        fail(source, "/%s/ cregex_jit_run() disagrees with cregex_program_run()",
+             pattern);
+        cregex_jit_free(jit);
+        cregex_compile_free(program);
+        return -1;
+    }
+    cregex_jit_free(jit);
+
+    /* and so must the minimized DFA */
+    if (!check_dfa(program, string, result)) {
+        fail(source, "/%s/ cregex_dfa_run() disagrees with cregex_program_run()",
+             pattern);
+        cregex_compile_free(program);
+        return -1;
+    }
+
+    /* and the tagged DFA, submatches included */
+    if (!check_tdfa(program, string, result, matches,
+                    sizeof (matches) / sizeof (matches[0]))) {
+        fail(source, "/%s/ cregex_tdfa_run() disagrees with cregex_program_run()",
+             pattern);
+        cregex_compile_free(program);
+        return -1;
+    }
+
+    /* an incremental scan must find every match, also after edits */
+    if (!check_incremental(program, string)) {
+        fail(source, "/%s/ cregex_incremental_edit() disagrees with a rescan",
+             pattern);
+        cregex_compile_free(program);
+        return -1;
+    }
+
+    /* and a program compiled as part of a set */
+    if (!check_set(pattern, flags, string, result, matches,
+                   sizeof (matches) / sizeof (matches[0]))) {
+        fail(source, "/%s/ the program of cregex_compile_set() disagrees",
+             pattern);
+        cregex_compile_free(program);
+        return -1;
+    }
+
+    va_start(ap, nmatches);
+    if (result > 0) {
+        if (nmatches > 0) {
+            success(source, "/%s/ =~ \"%s\"", pattern, string);
+            result = 0;
+            for (int i = 0; i + 1 < nmatches &&
+                            i + 1 < sizeof (matches) / sizeof (matches[0]);
+                 i += 2) {
+                int begin = va_arg(ap, int), end = va_arg(ap, int);
+                if ((begin == -1 || begin == matches[i] - string) &&
+                    (end == -1 || end == matches[i + 1] - string)) {
+                    // success(source, "(%d,%d)", begin, end);
+                } else if (matches[i] && matches[i + 1]) {
+                    fail(source, "expected (%d,%d), got (%d,%d)", begin, end,
+                         (int) (matches[i] - string),
+                         (int) (matches[i + 1] - string));
+                    result = -1;
+                } else {
+                    fail(source, "expected (%d,%d), got (NULL,NULL)", begin, end);
+                    result = -1;
+                }
+            }
+        } else {
+            fail(source, "/%s/ =~ \"%s\"", pattern, string);
+            result = -1;
+        }
+    } else if (result == 0) {
+        if (nmatches == 0)
+            success(source, "/%s/ !~ \"%s\"", pattern, string);
+        else {
+            fail(source, "/%s/ !~ \"%s\"", pattern, string);
+            result = -1;
+        }
+    }
+
+    va_end(ap);
+    cregex_compile_free(program);
+    return result;
+}
+
+/* Programs compiled into an arena whose buffer is not aligned are */
+static int test_arena_offset(void)
+{
+    static max_align_t storage[4096];
+    cregex_arena_t arena;
+    cregex_allocator_t allocator;
+    cregex_program_t *program;
+    const char *matches[2] = {0};
+    const char *string = "xababc";
+
+    cregex_arena_init(&arena, (char *) storage + 1, sizeof(storage) - 1);
+    allocator = cregex_arena_allocator(&arena);
+    if (!(program = cregex_compile("(a|b)*c", 0, &allocator)) ||
+        (uintptr_t) program % _Alignof(max_align_t) != 0 ||
+        cregex_program_run(program, string, matches, 2) != 1 ||
+        matches[0] != string + 1 || matches[1] != string + 6) {
+        fail("arena", "program at buffer + 1 misaligned or wrong");
+        return -1;
+    }
+    success("arena", "program at buffer + 1 aligned");
+    return 0;
+}
+
+typedef struct {
+    size_t nallocs, nfrees;
+} counted;
+
+static void *counted_alloc(void *context, size_t size)
+{
+    ++((counted *) context)->nallocs;
+    return malloc(size);
+}
+
+static void counted_free(void *context, void *ptr)
+{
+    if (ptr)
+        ++((counted *) context)->nfrees;
+    free(ptr);
+}
+
+/* Compiling allocates its temporaries (UTF-8 classes, their ranges and the
+ * items of a reversed program) with the caller's allocator too
+ */
+static int test_allocator_temporaries(void)
+{
+    counted count = {0};
+    cregex_allocator_t allocator = {counted_alloc, counted_free, &count};
+    cregex_node_t *root = cregex_parse_with_flags("[a-\xc3\xa9]+x$",
+                                                  CREGEX_FLAG_UTF8, NULL);
+    cregex_program_t *program =
+        root ? cregex_compile_node_with(root, CREGEX_FLAG_UTF8, &allocator)
+             : NULL;
+    size_t kept = program ? 1 + (program->closures != NULL) : 0;
+    int ok = program && count.nfrees >= 3 &&
+             count.nallocs - count.nfrees == kept;
+
+    cregex_compile_free_with(program, &allocator);
+    cregex_parse_free(root);
+    if (!ok || count.nallocs != count.nfrees) {
+        fail("allocator", "%zu allocation(s), %zu free(s)", count.nallocs,
+             count.nfrees);
+        return -1;
+    }
+    success("allocator", "%zu allocation(s), all freed", count.nallocs);
+    return 0;
+}
+
+/* A saved DFA loads for another compile of its pattern only */
+static int test_dfa_load_other(void)
+{
+    cregex_program_t *ab = cregex_compile("ab", 0, NULL);
+    cregex_program_t *again = cregex_compile("ab", 0, NULL);
+    cregex_program_t *cd = cregex_compile("cd", 0, NULL);
+    cregex_dfa_t *dfa = ab ? cregex_dfa_compile(ab, 0) : NULL;
+    cregex_dfa_t *same = NULL, *other = NULL;
+    size_t size = dfa ? cregex_dfa_save(dfa, NULL, 0) : 0;
+    char *saved = malloc(size);
+    int ok = dfa && again && cd && saved &&
+             cregex_dfa_save(dfa, saved, size) == size &&
+             (same = cregex_dfa_load(again, saved, size)) &&
+             !(other = cregex_dfa_load(cd, saved, size));
+
+    cregex_dfa_free(other);
+    cregex_dfa_free(same);
+    free(saved);
+    cregex_dfa_free(dfa);
+    cregex_compile_free(cd);
+    cregex_compile_free(again);
+    cregex_compile_free(ab);
+    if (!ok) {
+        fail("dfa", "DFA saved for /ab/ not loaded for /ab/ or loaded for /cd/");
+        return -1;
+    }
+    success("dfa", "DFA saved for /ab/ loaded for /ab/ only");
+    return 0;
+}
+
+/* Whether replacing the matches of pattern in string gives expected and
+ * count (or CREGEX_ERROR), both into a buffer large enough and into an
+ * allocated one
+ */
+static int check_replace(const char *pattern, int flags, const char *string,
+                         const char *replacement, const char *expected,
+                         int count)
+{
+    cregex_program_t *program = cregex_compile(pattern, flags, NULL);
+    char output[64], *allocated = NULL;
+    size_t length = 0, allocated_length = 0;
+    int ok = program &&
+             cregex_program_replace(program, string, strlen(string),
+                                    replacement, output, sizeof(output),
+                                    &length) == count &&
+             cregex_program_replace_with(program, string, strlen(string),
+                                         replacement, NULL, &allocated,
+                                         &allocated_length) == count;
+
+    if (ok && count >= 0)
+        ok = length == strlen(expected) && strcmp(output, expected) == 0 &&
+             allocated_length == length && strcmp(allocated, expected) == 0;
+    free(allocated);
+    cregex_compile_free(program);
+    return ok;
+}
+
+/* Replacement text, group references and escapes, and the snprintf()-like
+ * handling of short buffers
+ */
+static int test_replace_output(void)
+{
+    static const struct {
+        const char *pattern, *string, *replacement, *expected;
+        int flags, count;
+    } cases[] = {
+        {"b+", "abbcb", "X", "aXcX", 0, 2},
+        {"([a-z]+)@([a-z]+)", "me@host, you@there", "\\2 at \\1 (\\0)",
+         "host at me (me@host), there at you (you@there)", 0, 2},
+        {"-", "a-b", "\\\\", "a\\b", 0, 1},
+        {"(a)|b", "ab", "[\\1]", "[a][]", 0, 2},
+        {"x*", "a\xc3\xa9", "-", "-a-\xc3\xa9-", CREGEX_FLAG_UTF8, 3},
+        {"a", "a", "\\q", NULL, 0, CREGEX_ERROR},
+        {"a", "a", "x\\", NULL, 0, CREGEX_ERROR},
+        {"(a)", "a", "\\2", NULL, 0, CREGEX_ERROR},
+    };
+    cregex_program_t *program = cregex_compile("a", 0, NULL);
+    char output[5] = "????";
+    size_t length = 0, nolength = 0;
+    int nerrors = 0;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        if (!check_replace(cases[i].pattern, cases[i].flags, cases[i].string,
+                           cases[i].replacement, cases[i].expected,
+                           cases[i].count)) {
+            fail("replace", "/%s/ with \"%s\" in \"%s\"", cases[i].pattern,
+                 cases[i].replacement, cases[i].string);
+            --nerrors;
+        }
+    }
+
+    /* the full length is returned, the output truncated and terminated */
+    if (!program ||
+        cregex_program_replace(program, "aaa", 3, "xyz", output,
+                               sizeof(output), &length) != 3 ||
+        length != 9 || strcmp(output, "xyzx") != 0 ||
+        cregex_program_replace(program, "aaa", 3, "xyz", NULL, 0,
+                               &nolength) != 3 ||
+        nolength != 9) {
+        fail("replace", "/a/ with \"xyz\" in \"aaa\" into 5 bytes");
+        --nerrors;
+    }
+    cregex_compile_free(program);
+
+    if (!nerrors)
+        success("replace", "replacement output");
+    return nerrors ? -1 : 0;
+}
+
+/* Whether the program of entry matches string */
+static int entry_matches(const cregex_cache_entry_t *entry, const char *string)
+{
+    const char *matches[2];
+    return cregex_program_run(cregex_cache_program(entry), string, matches,
+                              2) == 1;
+}
+
+/* Whether holding pattern, getting other from a cache with no budget evicts
+ * pattern, i.e. other went to the same shard
+ */
+static int evicts(const char *pattern, const char *other)
+{
+    cregex_cache_t *cache = cregex_cache_create(0);
+    cregex_cache_entry_t *held = cregex_cache_get(cache, pattern), *again;
+    int evicted;
+
+    cregex_cache_release(cregex_cache_get(cache, other));
+    again = cregex_cache_get(cache, pattern);
+    evicted = again != held;
+    cregex_cache_release(again);
+    cregex_cache_release(held);
+    cregex_cache_free(cache);
+    return evicted;
+}
+
+/* Hits return the same entry, entries past the budget are evicted least
+ * recently used first, and evicted entries stay valid while referenced
+ */
+static int test_cache(void)
+{
+    cregex_cache_t *cache = cregex_cache_create(1 << 20);
+    cregex_cache_entry_t *first = cregex_cache_get(cache, "a+b");
+    cregex_cache_entry_t *hit = cregex_cache_get(cache, "a+b");
+    cregex_cache_entry_t *held, *recent, *again;
+    char other[16] = "";
+    int ok = first && first == hit;
+
+    cregex_cache_release(hit);
+    cregex_cache_release(first);
+    cregex_cache_free(cache);
+
+    /* another pattern which ends up next to a+b */
+    for (int i = 0; ok && i < 1000 && !other[0]; ++i) {
+        char candidate[16];
+        snprintf(candidate, sizeof(candidate), "x%d", i);
+        if (evicts("a+b", candidate))
+            strcpy(other, candidate);
+    }
+    ok = ok && other[0];
+
+    /* with no budget, only the most recently used entry stays cached */
+    cache = cregex_cache_create(0);
+    held = cregex_cache_get(cache, "a+b");
+    recent = cregex_cache_get(cache, other);
+    again = cregex_cache_get(cache, other);
+    ok = ok && held && recent && again == recent;
+    cregex_cache_release(again);
+    again = cregex_cache_get(cache, "a+b");
+    ok = ok && again && again != held && entry_matches(held, "xaab");
+    cregex_cache_release(again);
+    cregex_cache_release(recent);
+    cregex_cache_free(cache);
+    /* dropped by the cache (and the cache freed) before this */
+    ok = ok && entry_matches(held, "xaab");
+    cregex_cache_release(held);
+
+    if (!ok) {
+        fail("cache", "hits, eviction or references past eviction");
+        return -1;
+    }
+    success("cache", "hits, eviction and references past eviction");
+    return 0;
+}
+
+typedef struct {
+    cregex_cache_t *cache;
+    const cregex_cache_entry_t *shared; /* the entry of k0, held by main */
+    int nerrors;
+} cache_job;
+
+/* Get patterns k0 to k7 over and over, checking what they match */
+static void *cache_thread(void *arg)
+{
+    cache_job *job = arg;
+
+    for (int i = 0; i < 2000; ++i) {
+        char pattern[8], string[8];
+        cregex_cache_entry_t *entry;
+
+        snprintf(pattern, sizeof(pattern), "k%d+", i % 8);
+        snprintf(string, sizeof(string), "k%d%d", i % 8, i % 8);
+        if (!(entry = cregex_cache_get(job->cache, pattern)) ||
+            !entry_matches(entry, string) ||
+            (job->shared && i % 8 == 0 && entry != job->shared))
+            ++job->nerrors;
+        cregex_cache_release(entry);
+    }
+    return NULL;
+}
+
+/* Threads getting the same patterns at once share entries within the
+ * budget, and evict each other's without harm when it is exceeded
+ */
+static int test_cache_threads(void)
+{
+    pthread_t threads[4];
+    cache_job jobs[4];
+    int nerrors = 0;
+
+    for (size_t capacity = 0; capacity <= (1 << 20); capacity += 1 << 20) {
+        cregex_cache_t *cache = cregex_cache_create(capacity);
+        cregex_cache_entry_t *shared = cregex_cache_get(cache, "k0+");
+        int nstarted = 0;
+
+        for (; nstarted < 4; ++nstarted) {
+            jobs[nstarted] = (cache_job){cache, capacity ? shared : NULL, 0};
+            if (pthread_create(&threads[nstarted], NULL, cache_thread,
+                               &jobs[nstarted]))
+                break;
+        }
+        for (int i = 0; i < nstarted; ++i) {
+            pthread_join(threads[i], NULL);
+            nerrors += jobs[i].nerrors;
+        }
+        nerrors += !shared || nstarted < 4;
+        cregex_cache_release(shared);
+        cregex_cache_free(cache);
+    }
+
+    if (nerrors) {
+        fail("cache", "%d error(s) getting patterns in 4 threads", nerrors);
+        return -1;
+    }
+    success("cache", "patterns got in 4 threads");
+    return 0;
+}
+
+/* Smallest budget, set by budget(), with which program runs on string as
+ * without limits, after checking that one less gives CREGEX_ERROR_LIMIT, or
+ * 0 if none up to 4096 does
+ */
+static size_t least_budget(const cregex_program_t *program,
+                           const char *string,
+                           void (*budget)(cregex_limits_t *limits, size_t n))
+{
+    const char *matches[4] = {0}, *limited[4] = {0};
+    int result = cregex_program_run(program, string, matches, 4);
+
+    for (size_t n = 1; n <= 4096; ++n) {
+        cregex_limits_t limits = {0};
+        int status;
+
+        budget(&limits, n);
+        status = cregex_program_run_limited(program, string, strlen(string),
+                                            limited, 4, &limits);
+        if (status == CREGEX_ERROR_LIMIT)
+            continue;
+        return (status == result && n > 1 &&
+                memcmp(matches, limited, sizeof(matches)) == 0)
+                   ? n
+                   : 0;
+    }
+    return 0;
+}
+
+static void budget_steps(cregex_limits_t *limits, size_t n)
+{
+    limits->max_steps = n;
+}
+
+static void budget_bytes(cregex_limits_t *limits, size_t n)
+{
+    limits->max_bytes = n;
+}
+
+/* Each budget of cregex_limits_t fails with CREGEX_ERROR_LIMIT one short of
+ * what a pattern needs, and succeeds with just enough
+ */
+static int test_limits(void)
+{
+    const char *pattern = "(a|b)*(ab){20}c";
+    const char *string = "xxabababab" "abababababababababababababababababc";
+    cregex_cost_t cost;
+    cregex_limits_t limits = {0};
+    cregex_program_t *program = NULL, *refused;
+    size_t steps = 0, bytes = 0;
+    int error = 0, ok = cregex_cost(pattern, 0, &cost) == 0;
+
+    /* max_instructions */
+    limits.max_instructions = cost.ninstructions - 1;
+    refused = cregex_compile_limited(pattern, 0, NULL, &limits, &error);
+    ok = ok && !refused && error == CREGEX_ERROR_LIMIT;
+    limits.max_instructions = cost.ninstructions;
+    ok = ok &&
+         (program = cregex_compile_limited(pattern, 0, NULL, &limits, &error));
+
+    /* max_steps and max_bytes */
+    ok = ok && (steps = least_budget(program, string, budget_steps)) &&
+         (bytes = least_budget(program, string, budget_bytes)) ==
+             strlen(string);
+
+    cregex_compile_free(refused);
+    cregex_compile_free(program);
+    if (!ok) {
+        fail("limits", "budgets not exact");
+        return -1;
+    }
+    success("limits", "%d instruction(s), %zu step(s), %zu byte(s) exact",
+            cost.ninstructions, steps, bytes);
+    return 0;
+}
+
+/* Cost of pattern, or costs of all -1 if it does not parse */
+static cregex_cost_t node_cost(const char *pattern)
+{
+    cregex_node_t *root = cregex_parse(pattern);
+    cregex_cost_t cost = {-1, -1, -1, -1, -1};
+
+    if (root)
+        cregex_node_cost(root, 0, &cost);
+    cregex_parse_free(root);
+    return cost;
+}
+
+/* The cost model ranks nested repetitions above a literal, and alternations
+ * by their number of branches
+ */
+static int test_cost_order(void)
+{
+    cregex_cost_t literal = node_cost("a"), nested = node_cost("(a*)*");
+    cregex_cost_t previous = literal;
+    char pattern[32] = "a";
+    int ok = literal.ninstructions > 0 &&
+             nested.ninstructions > literal.ninstructions &&
+             nested.work_per_byte > literal.work_per_byte;
+
+    for (int nbranches = 2; ok && nbranches <= 12; ++nbranches) {
+        cregex_cost_t cost;
+        size_t length = strlen(pattern);
+
+        pattern[length] = '|';
+        pattern[length + 1] = 'a' + nbranches - 1;
+        pattern[length + 2] = '\0';
+        cost = node_cost(pattern);
+        ok = cost.ninstructions > previous.ninstructions &&
+             cost.max_threads > previous.max_threads &&
+             cost.work_per_byte > previous.work_per_byte;
+        previous = cost;
+    }
+
+    if (!ok) {
+        fail("cost", "/(a*)*/ not above /a/ or /%s/ not above fewer branches",
+             pattern);
+        return -1;
+    }
+    success("cost", "/(a*)*/ above /a/, alternations by branch count");
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int nerrors = 0;
+  nerrors += test("tests/basic.dat:003", "abracadabra$", "abracadabracadabra",
+    0,
+    2, 7, 18);
+  nerrors += test("tests/basic.dat:004", "a...b", "abababbb",
+    0,
+    2, 2, 7);
+  nerrors += test("tests/basic.dat:005", "XXXXXX", "..XXXXXX",
+    0,
+    2, 2, 8);
+  nerrors += test("tests/basic.dat:006", "\\)", "()",
+    0,
+    2, 1, 2);
+  nerrors += test("tests/basic.dat:007", "a]", "a]a",
+    0,
+    2, 0, 2);
+  nerrors += test("tests/basic.dat:008", "}", "}",
+    0,
+    2, 0, 1);
+  nerrors += test("tests/basic.dat:009", "\\}", "}",
+    0,
+    2, 0, 1);
+  nerrors += test("tests/basic.dat:010", "\\]", "]",
+    0,
+    2, 0, 1);
+  nerrors += test("tests/basic.dat:011", "]", "]",
+    0,
+    2, 0, 1);
+  nerrors += test("tests/basic.dat:012", "]", "]",
+    0,
+    2, 0, 1);
+  nerrors += test("tests/basic.dat:013", "{", "{",
+    0,
+    2, 0, 1);
+  nerrors += test("tests/basic.dat:014", "}", "}",
+    0,
+    2, 0, 1);
+  nerrors += test("tests/basic.dat:015", "^a", "ax",
+    0,
+    2, 0, 1);
+  nerrors += test("tests/basic.dat:016", "\\^a", "a^a",
+    0,
+    2, 1, 3);
+  nerrors += test("tests/basic.dat:017", "a\\^", "a^",
+    0,
+    2, 0, 2);
+  nerrors += test("tests/basic.dat:018", "a$", "aa",
+    0,
+    2, 1, 2);
+  nerrors += test("tests/basic.dat:019", "a\\$", "a$",
+    0,
+    2, 0, 2);
+  nerrors += test("tests/basic.dat:020", "^$", "",
+    0,
+    2, 0, 0);
+  nerrors += test("tests/basic.dat:021", "$^", "",
+    0,
+    2, 0, 0);
+  nerrors += test("tests/basic.dat:022", "a($)", "aa",
+    0,
+    4, 1, 2, 2, 2);
+  nerrors += test("tests/basic.dat:023", "a*(^a)", "aa",
+    0,
+    4, 0, 1, 0, 1);
+  nerrors += test("tests/basic.dat:024", "(..)*(...)*", "a",
+    0,
+    2, 0, 0);
+  nerrors += test("tests/basic.dat:025", "(..)*(...)*", "abcd",
+    0,
+    4, 0, 4, 2, 4);
+  nerrors += test("tests/basic.dat:026", "(ab|a)(bc|c)", "abc",
+    0,
+    6, 0, 3, 0, 2, 2, 3);
+  nerrors += test("tests/basic.dat:027", "(ab)c|abc", "abc",
+    0,
+    4, 0, 3, 0, 2);
+  nerrors += test("tests/basic.dat:028", "a{0}b", "ab",
+    0,
+    2, 1, 2);
+  nerrors += test("tests/basic.dat:029", "(a*)(b?)(b+)b{3}", "aaabbbbbbb",
+    0,
+    8, 0, 10, 0, 3, 3, 4, 4, 7);
+  nerrors += test("tests/basic.dat:030", "(a*)(b{0,1})(b{1,})b{3}", "aaabbbbbbb",
+    0,
+    8, 0, 10, 0, 3, 3, 4, 4, 7);
+  nerrors += test("tests/basic.dat:031", "((a|a)|a)", "a",
+    0,
+    6, 0, 1, 0, 1, 0, 1);
+  nerrors += test("tests/basic.dat:032", "(a*)(a|aa)", "aaaa",
+    0,
+    6, 0, 4, 0, 3, 3, 4);
+  nerrors += test("tests/basic.dat:033", "a*(a.|aa)", "aaaa",
+    0,
+    4, 0, 4, 2, 4);
+  nerrors += test("tests/basic.dat:034", "a(b)|c(d)|a(e)f", "aef",
+    0,
+    8, 0, 3, -1, -1, -1, -1, 1, 2);
+  nerrors += test("tests/basic.dat:035", "(a|b)?.*", "b",
+    0,
+    4, 0, 1, 0, 1);
+  nerrors += test("tests/basic.dat:036", "(a|b)c|a(b|c)", "ac",
+    0,
+    4, 0, 2, 0, 1);
+  nerrors += test("tests/basic.dat:037", "(a|b)c|a(b|c)", "ab",
+    0,
+    6, 0, 2, -1, -1, 1, 2);
+  nerrors += test("tests/basic.dat:038", "(a|b)*c|(a|ab)*c", "abc",
+    0,
+    4, 0, 3, 1, 2);
+  nerrors += test("tests/basic.dat:039", "(a|b)*c|(a|ab)*c", "xc",
+    0,
+    2, 1, 2);
+  nerrors += test("tests/basic.dat:040", "(.a|.b).*|.*(.a|.b)", "xa",
+    0,
+    4, 0, 2, 0, 2);
+  nerrors += test("tests/basic.dat:041", "a?(ab|ba)ab", "abab",
+    0,
+    4, 0, 4, 0, 2);
+  nerrors += test("tests/basic.dat:042", "a?(ac{0}b|ba)ab", "abab",
+    0,
+    4, 0, 4, 0, 2);
+  nerrors += test("tests/basic.dat:043", "ab|abab", "abbabab",
+    0,
+    2, 0, 2);
+  nerrors += test("tests/basic.dat:044", "aba|bab|bba", "baaabbbaba",
+    0,
+    2, 5, 8);
+  nerrors += test("tests/basic.dat:045", "aba|bab", "baaabbbaba",
+    0,
+    2, 6, 9);
+  nerrors += test("tests/basic.dat:046", "(aa|aaa)*|(a|aaaaa)", "aa",
+    0,
+    4, 0, 2, 0, 2);
+  nerrors += test("tests/basic.dat:047", "(a.|.a.)*|(a|.a...)", "aa",
+    0,
+    4, 0, 2, 0, 2);
+  nerrors += test("tests/basic.dat:048", "ab|a", "xabc",
+    0,
+    2, 1, 3);
+  nerrors += test("tests/basic.dat:049", "ab|a", "xxabc",
+    0,
+    2, 2, 4);
+  nerrors += test("tests/basic.dat:050", "(Ab|cD)*", "aBcD",
+    CREGEX_FLAG_ICASE,
+    4, 0, 4, 2, 4);
+  nerrors += test("tests/basic.dat:051", "[^-]", "--a",
+    0,
+    2, 2, 3);
+  nerrors += test("tests/basic.dat:052", "[a-]*", "--a",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:053", "[a-m-]*", "--amoma--",
+    0,
+    2, 0, 4);
+  nerrors += test("tests/basic.dat:054", ":::1:::0:|:::1:1:0:", ":::0:::1:::1:::0:",
+    0,
+    2, 8, 17);
+  nerrors += test("tests/basic.dat:055", ":::1:::0:|:::1:1:1:", ":::0:::1:::1:::0:",
+    0,
+    2, 8, 17);
+  nerrors += test("tests/basic.dat:056", "[[:upper:]]", "A",
+    0,
+    2, 0, 1);
+  nerrors += test("tests/basic.dat:057", "[[:lower:]]+", "`az{",
+    0,
+    2, 1, 3);
+  nerrors += test("tests/basic.dat:058", "[[:upper:]]+", "@AZ[",
+    0,
+    2, 1, 3);
+  nerrors += test("tests/basic.dat:064", "\n", "\n",
+    0,
+    2, 0, 1);
+  nerrors += test("tests/basic.dat:065", "\n", "\n",
+    0,
+    2, 0, 1);
+  nerrors += test("tests/basic.dat:066", "[^a]", "\n",
+    0,
+    2, 0, 1);
+  nerrors += test("tests/basic.dat:067", "\na", "\na",
+    0,
+    2, 0, 2);
+  nerrors += test("tests/basic.dat:068", "(a)(b)(c)", "abc",
+    0,
+    8, 0, 3, 0, 1, 1, 2, 2, 3);
+  nerrors += test("tests/basic.dat:069", "xxx", "xxx",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:070", "(^|[ (,;])((([Ff]eb[^ ]* *|0*2/|\\* */?)0*[6-7]))([^0-9]|$)", "feb 6,",
+    0,
+    2, 0, 6);
+  nerrors += test("tests/basic.dat:071", "(^|[ (,;])((([Ff]eb[^ ]* *|0*2/|\\* */?)0*[6-7]))([^0-9]|$)", "2/7",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:072", "(^|[ (,;])((([Ff]eb[^ ]* *|0*2/|\\* */?)0*[6-7]))([^0-9]|$)", "feb 1,Feb 6",
+    0,
+    2, 5, 11);
+  nerrors += test("tests/basic.dat:073", "((((((((((((((((((((((((((((((x))))))))))))))))))))))))))))))", "x",
+    0,
+    6, 0, 1, 0, 1, 0, 1);
+  nerrors += test("tests/basic.dat:074", "((((((((((((((((((((((((((((((x))))))))))))))))))))))))))))))*", "xx",
+    0,
+    6, 0, 2, 1, 2, 1, 2);
+  nerrors += test("tests/basic.dat:075", "a?(ab|ba)*", "ababababababababababababababababababababababababababababababababababababababababa",
+    0,
+    4, 0, 81, 79, 81);
+  nerrors += test("tests/basic.dat:076", "abaa|abbaa|abbbaa|abbbbaa", "ababbabbbabbbabbbbabbbbaa",
+    0,
+    2, 18, 25);
+  nerrors += test("tests/basic.dat:077", "abaa|abbaa|abbbaa|abbbbaa", "ababbabbbabbbabbbbabaa",
+    0,
+    2, 18, 22);
+  nerrors += test("tests/basic.dat:078", "aaac|aabc|abac|abbc|baac|babc|bbac|bbbc", "baaabbbabac",
+    0,
+    2, 7, 11);
+  nerrors += test("tests/basic.dat:079", ".*", "\x01\xff",
+    0,
+    2, 0, 2);
+  nerrors += test("tests/basic.dat:080", "aaaa|bbbb|cccc|ddddd|eeeeee|fffffff|gggg|hhhh|iiiii|jjjjj|kkkkk|llll", "XaaaXbbbXcccXdddXeeeXfffXgggXhhhXiiiXjjjXkkkXlllXcbaXaaaa",
+    0,
+    2, 53, 57);
+  nerrors += test("tests/basic.dat:081", "aaaa\\nbbbb\\ncccc\\nddddd\\neeeeee\\nfffffff\\ngggg\\nhhhh\\niiiii\\njjjjj\\nkkkkk\\nllll", "XaaaXbbbXcccXdddXeeeXfffXgggXhhhXiiiXjjjXkkkXlllXcbaXaaaa",
+    0,
+    0);
+  nerrors += test("tests/basic.dat:082", "a*a*a*a*a*b", "aaaaaaaaab",
+    0,
+    2, 0, 10);
+  nerrors += test("tests/basic.dat:083", "^", "",
+    0,
+    2, 0, 0);
+  nerrors += test("tests/basic.dat:084", "$", "",
+    0,
+    2, 0, 0);
+  nerrors += test("tests/basic.dat:085", "^$", "",
+    0,
+    2, 0, 0);
+  nerrors += test("tests/basic.dat:086", "^a$", "a",
+    0,
+    2, 0, 1);
+  nerrors += test("tests/basic.dat:087", "abc", "abc",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:088", "abc", "xabcy",
+    0,
+    2, 1, 4);
+  nerrors += test("tests/basic.dat:089", "abc", "ababc",
+    0,
+    2, 2, 5);
+  nerrors += test("tests/basic.dat:090", "ab*c", "abc",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:091", "ab*bc", "abc",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:092", "ab*bc", "abbc",
+    0,
+    2, 0, 4);
+  nerrors += test("tests/basic.dat:093", "ab*bc", "abbbbc",
+    0,
+    2, 0, 6);
+  nerrors += test("tests/basic.dat:094", "ab+bc", "abbc",
+    0,
+    2, 0, 4);
+  nerrors += test("tests/basic.dat:095", "ab+bc", "abbbbc",
+    0,
+    2, 0, 6);
+  nerrors += test("tests/basic.dat:096", "ab?bc", "abbc",
+    0,
+    2, 0, 4);
+  nerrors += test("tests/basic.dat:097", "ab?bc", "abc",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:098", "ab?c", "abc",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:099", "^abc$", "abc",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:100", "^abc", "abcc",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:101", "abc$", "aabc",
+    0,
+    2, 1, 4);
+  nerrors += test("tests/basic.dat:102", "^", "abc",
+    0,
+    2, 0, 0);
+  nerrors += test("tests/basic.dat:103", "$", "abc",
+    0,
+    2, 3, 3);
+  nerrors += test("tests/basic.dat:104", "a.c", "abc",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:105", "a.c", "axc",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:106", "a.*c", "axyzc",
+    0,
+    2, 0, 5);
+  nerrors += test("tests/basic.dat:107", "a[bc]d", "abd",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:108", "a[b-d]e", "ace",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:109", "a[b-d]", "aac",
+    0,
+    2, 1, 3);
+  nerrors += test("tests/basic.dat:110", "a[-b]", "a-",
+    0,
+    2, 0, 2);
+  nerrors += test("tests/basic.dat:111", "a[b-]", "a-",
+    0,
+    2, 0, 2);
+  nerrors += test("tests/basic.dat:112", "a]", "a]",
+    0,
+    2, 0, 2);
+  nerrors += test("tests/basic.dat:113", "a[]]b", "a]b",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:114", "a[^bc]d", "aed",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:115", "a[^-b]c", "adc",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:116", "a[^]b]c", "adc",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:117", "ab|cd", "abc",
+    0,
+    2, 0, 2);
+  nerrors += test("tests/basic.dat:118", "ab|cd", "abcd",
+    0,
+    2, 0, 2);
+  nerrors += test("tests/basic.dat:119", "a\\(b", "a(b",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:120", "a\\(*b", "ab",
+    0,
+    2, 0, 2);
+  nerrors += test("tests/basic.dat:121", "a\\(*b", "a((b",
+    0,
+    2, 0, 4);
+  nerrors += test("tests/basic.dat:122", "((a))", "abc",
+    0,
+    6, 0, 1, 0, 1, 0, 1);
+  nerrors += test("tests/basic.dat:123", "(a)b(c)", "abc",
+    0,
+    6, 0, 3, 0, 1, 2, 3);
+  nerrors += test("tests/basic.dat:124", "a+b+c", "aabbabc",
+    0,
+    2, 4, 7);
+  nerrors += test("tests/basic.dat:125", "a*", "aaa",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:126", "(a*)*", "-",
+    0,
+    4, 0, 0, 0, 0);
+  nerrors += test("tests/basic.dat:127", "(a*)+", "-",
+    0,
+    4, 0, 0, 0, 0);
+  nerrors += test("tests/basic.dat:128", "(a*|b)*", "-",
+    0,
+    4, 0, 0, 0, 0);
+  nerrors += test("tests/basic.dat:129", "(a+|b)*", "ab",
+    0,
+    4, 0, 2, 1, 2);
+  nerrors += test("tests/basic.dat:130", "(a+|b)+", "ab",
+    0,
+    4, 0, 2, 1, 2);
+  nerrors += test("tests/basic.dat:131", "(a+|b)?", "ab",
+    0,
+    4, 0, 1, 0, 1);
+  nerrors += test("tests/basic.dat:132", "[^ab]*", "cde",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:133", "(^)*", "-",
+    0,
+    4, 0, 0, 0, 0);
+  nerrors += test("tests/basic.dat:134", "a*", "",
+    0,
+    2, 0, 0);
+  nerrors += test("tests/basic.dat:135", "([abc])*d", "abbbcd",
+    0,
+    4, 0, 6, 4, 5);
+  nerrors += test("tests/basic.dat:136", "([abc])*bcd", "abcd",
+    0,
+    4, 0, 4, 0, 1);
+  nerrors += test("tests/basic.dat:137", "a|b|c|d|e", "e",
+    0,
+    2, 0, 1);
+  nerrors += test("tests/basic.dat:138", "(a|b|c|d|e)f", "ef",
+    0,
+    4, 0, 2, 0, 1);
+  nerrors += test("tests/basic.dat:139", "((a*|b))*", "-",
+    0,
+    6, 0, 0, 0, 0, 0, 0);
+  nerrors += test("tests/basic.dat:140", "abcd*efg", "abcdefg",
+    0,
+    2, 0, 7);
+  nerrors += test("tests/basic.dat:141", "ab*", "xabyabbbz",
+    0,
+    2, 1, 3);
+  nerrors += test("tests/basic.dat:142", "ab*", "xayabbbz",
+    0,
+    2, 1, 2);
+  nerrors += test("tests/basic.dat:143", "(ab|cd)e", "abcde",
+    0,
+    4, 2, 5, 2, 4);
+  nerrors += test("tests/basic.dat:144", "[abhgefdc]ij", "hij",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:145", "(a|b)c*d", "abcd",
+    0,
+    4, 1, 4, 1, 2);
+  nerrors += test("tests/basic.dat:146", "(ab|ab*)bc", "abc",
+    0,
+    4, 0, 3, 0, 1);
+  nerrors += test("tests/basic.dat:147", "a([bc]*)c*", "abc",
+    0,
+    4, 0, 3, 1, 3);
+  nerrors += test("tests/basic.dat:148", "a([bc]*)(c*d)", "abcd",
+    0,
+    6, 0, 4, 1, 3, 3, 4);
+  nerrors += test("tests/basic.dat:149", "a([bc]+)(c*d)", "abcd",
+    0,
+    6, 0, 4, 1, 3, 3, 4);
+  nerrors += test("tests/basic.dat:150", "a([bc]*)(c+d)", "abcd",
+    0,
+    6, 0, 4, 1, 2, 2, 4);
+  nerrors += test("tests/basic.dat:151", "a[bcd]*dcdcde", "adcdcde",
+    0,
+    2, 0, 7);
+  nerrors += test("tests/basic.dat:152", "(ab|a)b*c", "abc",
+    0,
+    4, 0, 3, 0, 2);
+  nerrors += test("tests/basic.dat:153", "((a)(b)c)(d)", "abcd",
+    0,
+    10, 0, 4, 0, 3, 0, 1, 1, 2, 3, 4);
+  nerrors += test("tests/basic.dat:154", "[A-Za-z_][A-Za-z0-9_]*", "alpha",
+    0,
+    2, 0, 5);
+  nerrors += test("tests/basic.dat:155", "^a(bc+|b[eh])g|.h$", "abh",
+    0,
+    2, 1, 3);
+  nerrors += test("tests/basic.dat:156", "(bc+d$|ef*g.|h?i(j|k))", "effgz",
+    0,
+    4, 0, 5, 0, 5);
+  nerrors += test("tests/basic.dat:157", "(bc+d$|ef*g.|h?i(j|k))", "ij",
+    0,
+    6, 0, 2, 0, 2, 1, 2);
+  nerrors += test("tests/basic.dat:158", "(bc+d$|ef*g.|h?i(j|k))", "reffgz",
+    0,
+    4, 1, 6, 1, 6);
+  nerrors += test("tests/basic.dat:159", "(((((((((a)))))))))", "a",
+    0,
+    20, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1);
+  nerrors += test("tests/basic.dat:160", "multiple words", "multiple words yeah",
+    0,
+    2, 0, 14);
+  nerrors += test("tests/basic.dat:161", "(.*)c(.*)", "abcde",
+    0,
+    6, 0, 5, 0, 2, 3, 5);
+  nerrors += test("tests/basic.dat:162", "abcd", "abcd",
+    0,
+    2, 0, 4);
+  nerrors += test("tests/basic.dat:163", "a(bc)d", "abcd",
+    0,
+    4, 0, 4, 1, 3);
+  nerrors += test("tests/basic.dat:164", "a[-]?c", "ac",
+    0,
+    2, 0, 3);
+  nerrors += test("tests/basic.dat:165", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Muammar Qaddafi",
+    0,
+    6, 0, 15, -1, -1, 10, 12);
+  nerrors += test("tests/basic.dat:166", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Mo'ammar Gadhafi",
+    0,
+    6, 0, 16, -1, -1, 11, 13);
+  nerrors += test("tests/basic.dat:167", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Muammar Kaddafi",
+    0,
+    6, 0, 15, -1, -1, 10, 12);
+  nerrors += test("tests/basic.dat:168", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Muammar Qadhafi",
+    0,
+    6, 0, 15, -1, -1, 10, 12);
+  nerrors += test("tests/basic.dat:169", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Muammar Gadafi",
+    0,
+    6, 0, 14, -1, -1, 10, 11);
+  nerrors += test("tests/basic.dat:170", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Mu'ammar Qadafi",
+    0,
+    6, 0, 15, -1, -1, 11, 12);
+  nerrors += test("tests/basic.dat:171", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Moamar Gaddafi",
+    0,
+    6, 0, 14, -1, -1, 9, 11);
+  nerrors += test("tests/basic.dat:172", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Mu'ammar Qadhdhafi",
+    0,
+    6, 0, 18, -1, -1, 13, 15);
+  nerrors += test("tests/basic.dat:173", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Muammar Khaddafi",
+    0,
+    6, 0, 16, -1, -1, 11, 13);
+  nerrors += test("tests/basic.dat:174", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Muammar Ghaddafy",
+    0,
+    6, 0, 16, -1, -1, 11, 13);
+  nerrors += test("tests/basic.dat:175", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Muammar Ghadafi",
+    0,
+    6, 0, 15, -1, -1, 11, 12);
+  nerrors += test("tests/basic.dat:176", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Muammar Ghaddafi",
+    0,
+    6, 0, 16, -1, -1, 11, 13);
+  nerrors += test("tests/basic.dat:177", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Muamar Kaddafi",
+    0,
+    6, 0, 14, -1, -1, 9, 11);
+  nerrors += test("tests/basic.dat:178", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Muammar Quathafi",
+    0,
+    6, 0, 16, -1, -1, 11, 13);
+  nerrors += test("tests/basic.dat:179", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Muammar Gheddafi",
+    0,
+    6, 0, 16, -1, -1, 11, 13);
+  nerrors += test("tests/basic.dat:180", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Moammar Khadafy",
+    0,
+    6, 0, 15, -1, -1, 11, 12);
+  nerrors += test("tests/basic.dat:181", "M[ou]'?am+[ae]r .*([AEae]l[- ])?[GKQ]h?[aeu]+([dtz][dhz]?)+af[iy]", "Moammar Qudhafi",
+    0,
+    6, 0, 15, -1, -1, 10, 12);
+  nerrors += test("tests/basic.dat:182", "a+(b|c)*d+", "aabcdd",
+    0,
+    4, 0, 6, 3, 4);
+  nerrors += test("tests/basic.dat:183", "^.+$", "vivi",
+    0,
+    2, 0, 4);
+  nerrors += test("tests/basic.dat:184", "^(.+)$", "vivi",
+    0,
+    4, 0, 4, 0, 4);
+  nerrors += test("tests/basic.dat:185", "^([^!.]+).att.com!(.+)$", "gryphon.att.com!eby",
+    0,
+    6, 0, 19, 0, 7, 16, 19);
+  nerrors += test("tests/basic.dat:186", "^([^!]+!)?([^!]+)$", "bas",
+    0,
+    6, 0, 3, -1, -1, 0, 3);
+  nerrors += test("tests/basic.dat:187", "^([^!]+!)?([^!]+)$", "bar!bas",
+    0,
+    6, 0, 7, 0, 4, 4, 7);
+  nerrors += test("tests/basic.dat:188", "^([^!]+!)?([^!]+)$", "foo!bas",
+    0,
+    6, 0, 7, 0, 4, 4, 7);
+  nerrors += test("tests/basic.dat:189", "^.+!([^!]+!)([^!]+)$", "foo!bar!bas",
+    0,
+    6, 0, 11, 4, 8, 8, 11);
+  nerrors += test("tests/basic.dat:190", "((foo)|(bar))!bas", "bar!bas",
+    0,
+    8, 0, 7, 0, 3, -1, -1, 0, 3);
+  nerrors += test("tests/basic.dat:191", "((foo)|(bar))!bas", "foo!bar!bas",
+    0,
+    8, 4, 11, 4, 7, -1, -1, 4, 7);
+  nerrors += test("tests/basic.dat:192", "((foo)|(bar))!bas", "foo!bas",
+    0,
+    6, 0, 7, 0, 3, 0, 3);
+  nerrors += test("tests/basic.dat:193", "((foo)|bar)!bas", "bar!bas",
+    0,
+    4, 0, 7, 0, 3);
+  nerrors += test("tests/basic.dat:194", "((foo)|bar)!bas", "foo!bar!bas",
+    0,
+    4, 4, 11, 4, 7);
+  nerrors += test("tests/basic.dat:195", "((foo)|bar)!bas", "foo!bas",
+    0,
+    6, 0, 7, 0, 3, 0, 3);
+  nerrors += test("tests/basic.dat:196", "(foo|(bar))!bas", "bar!bas",
+    0,
+    6, 0, 7, 0, 3, 0, 3);
+  nerrors += test("tests/basic.dat:197", "(foo|(bar))!bas", "foo!bar!bas",
+    0,
+    6, 4, 11, 4, 7, 4, 7);
+  nerrors += test("tests/basic.dat:198", "(foo|(bar))!bas", "foo!bas",
+    0,
+    4, 0, 7, 0, 3);
+  nerrors += test("tests/basic.dat:199", "(foo|bar)!bas", "bar!bas",
+    0,
+    4, 0, 7, 0, 3);
+  nerrors += test("tests/basic.dat:200", "(foo|bar)!bas", "foo!bar!bas",
+    0,
+    4, 4, 11, 4, 7);
+  nerrors += test("tests/basic.dat:201", "(foo|bar)!bas", "foo!bas",
+    0,
+    4, 0, 7, 0, 3);
+  nerrors += test("tests/basic.dat:202", "^(([^!]+!)?([^!]+)|.+!([^!]+!)([^!]+))$", "foo!bar!bas",
+    0,
+    12, 0, 11, 0, 11, -1, -1, -1, -1, 4, 8, 8, 11);
+  nerrors += test("tests/basic.dat:203", "^([^!]+!)?([^!]+)$|^.+!([^!]+!)([^!]+)$", "bas",
+    0,
+    6, 0, 3, -1, -1, 0, 3);
+  nerrors += test("tests/basic.dat:204", "^([^!]+!)?([^!]+)$|^.+!([^!]+!)([^!]+)$", "bar!bas",
+    0,
+    6, 0, 7, 0, 4, 4, 7);
+  nerrors += test("tests/basic.dat:205", "^([^!]+!)?([^!]+)$|^.+!([^!]+!)([^!]+)$", "foo!bar!bas",
+    0,
+    10, 0, 11, -1, -1, -1, -1, 4, 8, 8, 11);
+  nerrors += test("tests/basic.dat:206", "^([^!]+!)?([^!]+)$|^.+!([^!]+!)([^!]+)$", "foo!bas",
+    0,
+    6, 0, 7, 0, 4, 4, 7);
+  nerrors += test("tests/basic.dat:207", "^(([^!]+!)?([^!]+)|.+!([^!]+!)([^!]+))$", "bas",
+    0,
+    8, 0, 3, 0, 3, -1, -1, 0, 3);
+  nerrors += test("tests/basic.dat:208", "^(([^!]+!)?([^!]+)|.+!([^!]+!)([^!]+))$", "bar!bas",
+    0,
+    8, 0, 7, 0, 7, 0, 4, 4, 7);
+  nerrors += test("tests/basic.dat:209", "^(([^!]+!)?([^!]+)|.+!([^!]+!)([^!]+))$", "foo!bar!bas",
+    0,
+    12, 0, 11, 0, 11, -1, -1, -1, -1, 4, 8, 8, 11);
+  nerrors += test("tests/basic.dat:210", "^(([^!]+!)?([^!]+)|.+!([^!]+!)([^!]+))$", "foo!bas",
+    0,
+    8, 0, 7, 0, 7, 0, 4, 4, 7);
+  nerrors += test("tests/basic.dat:211", ".*(/XXX).*", "/XXX",
+    0,
+    4, 0, 4, 0, 4);
+  nerrors += test("tests/basic.dat:212", ".*(\\\\XXX).*", "\\XXX",
+    0,
+    4, 0, 4, 0, 4);
+  nerrors += test("tests/basic.dat:213", "\\\\XXX", "\\XXX",
+    0,
+    2, 0, 4);
+  nerrors += test("tests/basic.dat:214", ".*(/000).*", "/000",
+    0,
+    4, 0, 4, 0, 4);
+  nerrors += test("tests/basic.dat:215", ".*(\\\\000).*", "\\000",
+    0,
+    4, 0, 4, 0, 4);
+  nerrors += test("tests/basic.dat:216", "\\\\000", "\\000",
+    0,
+    2, 0, 4);
+  nerrors += test("tests/nullsubexpr.dat:003", "(a*)*", "a",
+    0,
+    4, 0, 1, 0, 1);
+  nerrors += test("tests/nullsubexpr.dat:004", "(a*)*", "x",
+    0,
+    4, 0, 0, 0, 0);
+  nerrors += test("tests/nullsubexpr.dat:005", "(a*)*", "aaaaaa",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:006", "(a*)*", "aaaaaax",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:007", "(a*)+", "a",
+    0,
+    4, 0, 1, 0, 1);
+  nerrors += test("tests/nullsubexpr.dat:008", "(a*)+", "x",
+    0,
+    4, 0, 0, 0, 0);
+  nerrors += test("tests/nullsubexpr.dat:009", "(a*)+", "aaaaaa",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:010", "(a*)+", "aaaaaax",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:011", "(a+)*", "a",
+    0,
+    4, 0, 1, 0, 1);
+  nerrors += test("tests/nullsubexpr.dat:012", "(a+)*", "x",
+    0,
+    2, 0, 0);
+  nerrors += test("tests/nullsubexpr.dat:013", "(a+)*", "aaaaaa",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:014", "(a+)*", "aaaaaax",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:015", "(a+)+", "a",
+    0,
+    4, 0, 1, 0, 1);
+  nerrors += test("tests/nullsubexpr.dat:016", "(a+)+", "x",
+    0,
+    0);
+  nerrors += test("tests/nullsubexpr.dat:017", "(a+)+", "aaaaaa",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:018", "(a+)+", "aaaaaax",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:020", "([a]*)*", "a",
+    0,
+    4, 0, 1, 0, 1);
+  nerrors += test("tests/nullsubexpr.dat:021", "([a]*)*", "x",
+    0,
+    4, 0, 0, 0, 0);
+  nerrors += test("tests/nullsubexpr.dat:022", "([a]*)*", "aaaaaa",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:023", "([a]*)*", "aaaaaax",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:024", "([a]*)+", "a",
+    0,
+    4, 0, 1, 0, 1);
+  nerrors += test("tests/nullsubexpr.dat:025", "([a]*)+", "x",
+    0,
+    4, 0, 0, 0, 0);
+  nerrors += test("tests/nullsubexpr.dat:026", "([a]*)+", "aaaaaa",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:027", "([a]*)+", "aaaaaax",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:028", "([^b]*)*", "a",
+    0,
+    4, 0, 1, 0, 1);
+  nerrors += test("tests/nullsubexpr.dat:029", "([^b]*)*", "b",
+    0,
+    4, 0, 0, 0, 0);
+  nerrors += test("tests/nullsubexpr.dat:030", "([^b]*)*", "aaaaaa",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:031", "([^b]*)*", "aaaaaab",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:032", "([ab]*)*", "a",
+    0,
+    4, 0, 1, 0, 1);
+  nerrors += test("tests/nullsubexpr.dat:033", "([ab]*)*", "aaaaaa",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:034", "([ab]*)*", "ababab",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:035", "([ab]*)*", "bababa",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:036", "([ab]*)*", "b",
+    0,
+    4, 0, 1, 0, 1);
+  nerrors += test("tests/nullsubexpr.dat:037", "([ab]*)*", "bbbbbb",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:038", "([ab]*)*", "aaaabcde",
+    0,
+    4, 0, 5, 0, 5);
+  nerrors += test("tests/nullsubexpr.dat:039", "([^a]*)*", "b",
+    0,
+    4, 0, 1, 0, 1);
+  nerrors += test("tests/nullsubexpr.dat:040", "([^a]*)*", "bbbbbb",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:041", "([^a]*)*", "aaaaaa",
+    0,
+    4, 0, 0, 0, 0);
+  nerrors += test("tests/nullsubexpr.dat:042", "([^ab]*)*", "ccccxx",
+    0,
+    4, 0, 6, 0, 6);
+  nerrors += test("tests/nullsubexpr.dat:043", "([^ab]*)*", "ababab",
+    0,
+    4, 0, 0, 0, 0);
+  nerrors += test("tests/nullsubexpr.dat:045", "((z)+|a)*", "zabcde",
+    0,
+    4, 0, 2, 1, 2);
+  nerrors += test("tests/nullsubexpr.dat:054", "\\(a*\\)*\\(x\\)", "x",
+    0,
+    6, 0, 1, 0, 0, 0, 1);
+  nerrors += test("tests/nullsubexpr.dat:055", "\\(a*\\)*\\(x\\)", "ax",
+    0,
+    6, 0, 2, 0, 1, 1, 2);
+  nerrors += test("tests/nullsubexpr.dat:056", "\\(a*\\)*\\(x\\)", "axa",
+    0,
+    6, 0, 2, 0, 1, 1, 2);
+  nerrors += test("tests/nullsubexpr.dat:057", "\\(a*\\)*\\(x\\)\\(\\1\\)", "x",
+    0,
+    8, 0, 1, 0, 0, 0, 1, 1, 1);
+  nerrors += test("tests/nullsubexpr.dat:058", "\\(a*\\)*\\(x\\)\\(\\1\\)", "ax",
+    0,
+    8, 0, 2, 1, 1, 1, 2, 2, 2);
+  nerrors += test("tests/nullsubexpr.dat:059", "\\(a*\\)*\\(x\\)\\(\\1\\)", "axa",
+    0,
+    8, 0, 3, 0, 1, 1, 2, 2, 3);
+  nerrors += test("tests/nullsubexpr.dat:060", "\\(a*\\)*\\(x\\)\\(\\1\\)\\(x\\)", "axax",
+    0,
+    10, 0, 4, 0, 1, 1, 2, 2, 3, 3, 4);
+  nerrors += test("tests/nullsubexpr.dat:061", "\\(a*\\)*\\(x\\)\\(\\1\\)\\(x\\)", "axxa",
+    0,
+    10, 0, 3, 1, 1, 1, 2, 2, 2, 2, 3);
+  nerrors += test("tests/nullsubexpr.dat:063", "(a*)*(x)", "x",
+    0,
+    6, 0, 1, 0, 0, 0, 1);
+  nerrors += test("tests/nullsubexpr.dat:064", "(a*)*(x)", "ax",
+    0,
+    6, 0, 2, 0, 1, 1, 2);
+  nerrors += test("tests/nullsubexpr.dat:065", "(a*)*(x)", "axa",
+    0,
+    6, 0, 2, 0, 1, 1, 2);
+  nerrors += test("tests/nullsubexpr.dat:067", "(a*)+(x)", "x",
+    0,
+    6, 0, 1, 0, 0, 0, 1);
+  nerrors += test("tests/nullsubexpr.dat:068", "(a*)+(x)", "ax",
+    0,
+    6, 0, 2, 0, 1, 1, 2);
+  nerrors += test("tests/nullsubexpr.dat:069", "(a*)+(x)", "axa",
+    0,
+    6, 0, 2, 0, 1, 1, 2);
+  nerrors += test("tests/nullsubexpr.dat:071", "(a*){2}(x)", "x",
+    0,
+    6, 0, 1, 0, 0, 0, 1);
+  nerrors += test("tests/nullsubexpr.dat:072", "(a*){2}(x)", "ax",
+    0,
+    6, 0, 2, 1, 1, 1, 2);
+  nerrors += test("tests/nullsubexpr.dat:073", "(a*){2}(x)", "axa",
+    0,
+    6, 0, 2, 1, 1, 1, 2);
+  nerrors += test("tests/repetition.dat:010", "((..)|(.))", "",
+    0,
+    0);
+  nerrors += test("tests/repetition.dat:011", "((..)|(.))((..)|(.))", "",
+    0,
+    0);
+  nerrors += test("tests/repetition.dat:012", "((..)|(.))((..)|(.))((..)|(.))", "",
+    0,
+    0);
+  nerrors += test("tests/repetition.dat:014", "((..)|(.)){1}", "",
+    0,
+    0);
+  nerrors += test("tests/repetition.dat:015", "((..)|(.)){2}", "",
+    0,
+    0);
+  nerrors += test("tests/repetition.dat:016", "((..)|(.)){3}", "",
+    0,
+    0);
+  nerrors += test("tests/repetition.dat:018", "((..)|(.))*", "",
+    0,
+    2, 0, 0);
+  nerrors += test("tests/repetition.dat:020", "((..)|(.))", "a",
+    0,
+    8, 0, 1, 0, 1, -1, -1, 0, 1);
+  nerrors += test("tests/repetition.dat:021", "((..)|(.))((..)|(.))", "a",
+    0,
+    0);
+  nerrors += test("tests/repetition.dat:022", "((..)|(.))((..)|(.))((..)|(.))", "a",
+    0,
+    0);
+  nerrors += test("tests/repetition.dat:024", "((..)|(.)){1}", "a",
+    0,
+    8, 0, 1, 0, 1, -1, -1, 0, 1);
+  nerrors += test("tests/repetition.dat:025", "((..)|(.)){2}", "a",
+    0,
+    0);
+  nerrors += test("tests/repetition.dat:026", "((..)|(.)){3}", "a",
+    0,
+    0);
+  nerrors += test("tests/repetition.dat:028", "((..)|(.))*", "a",
+    0,
+    8, 0, 1, 0, 1, -1, -1, 0, 1);
+  nerrors += test("tests/repetition.dat:030", "((..)|(.))", "aa",
+    0,
+    8, 0, 2, 0, 2, 0, 2, -1, -1);
+  nerrors += test("tests/repetition.dat:031", "((..)|(.))((..)|(.))", "aa",
+    0,
+    14, 0, 2, 0, 1, -1, -1, 0, 1, 1, 2, -1, -1, 1, 2);
+  nerrors += test("tests/repetition.dat:032", "((..)|(.))((..)|(.))((..)|(.))", "aa",
+    0,
+    0);
+  nerrors += test("tests/repetition.dat:034", "((..)|(.)){1}", "aa",
+    0,
+    8, 0, 2, 0, 2, 0, 2, -1, -1);
+  nerrors += test("tests/repetition.dat:035", "((..)|(.)){2}", "aa",
+    0,
+    8, 0, 2, 1, 2, -1, -1, 1, 2);
+  nerrors += test("tests/repetition.dat:036", "((..)|(.)){3}", "aa",
+    0,
+    0);
+  nerrors += test("tests/repetition.dat:038", "((..)|(.))*", "aa",
+    0,
+    8, 0, 2, 0, 2, 0, 2, -1, -1);
+  nerrors += test("tests/repetition.dat:040", "((..)|(.))", "aaa",
+    0,
+    8, 0, 2, 0, 2, 0, 2, -1, -1);
+  nerrors += test("tests/repetition.dat:041", "((..)|(.))((..)|(.))", "aaa",
+    0,
+    14, 0, 3, 0, 2, 0, 2, -1, -1, 2, 3, -1, -1, 2, 3);
+  nerrors += test("tests/repetition.dat:042", "((..)|(.))((..)|(.))((..)|(.))", "aaa",
+    0,
+    20, 0, 3, 0, 1, -1, -1, 0, 1, 1, 2, -1, -1, 1, 2, 2, 3, -1, -1, 2, 3);
+  nerrors += test("tests/repetition.dat:044", "((..)|(.)){1}", "aaa",
+    0,
+    8, 0, 2, 0, 2, 0, 2, -1, -1);
+  nerrors += test("tests/repetition.dat:046", "((..)|(.)){2}", "aaa",
+    0,
+    8, 0, 3, 2, 3, 0, 2, 2, 3);
+  nerrors += test("tests/repetition.dat:047", "((..)|(.)){3}", "aaa",
+    0,
+    8, 0, 3, 2, 3, -1, -1, 2, 3);
+  nerrors += test("tests/repetition.dat:050", "((..)|(.))*", "aaa",
+    0,
+    8, 0, 3, 2, 3, 0, 2, 2, 3);
+  nerrors += test("tests/repetition.dat:052", "((..)|(.))", "aaaa",
+    0,
+    8, 0, 2, 0, 2, 0, 2, -1, -1);
+  nerrors += test("tests/repetition.dat:053", "((..)|(.))((..)|(.))", "aaaa",
+    0,
+    14, 0, 4, 0, 2, 0, 2, -1, -1, 2, 4, 2, 4, -1, -1);
+  nerrors += test("tests/repetition.dat:054", "((..)|(.))((..)|(.))((..)|(.))", "aaaa",
+    0,
+    20, 0, 4, 0, 2, 0, 2, -1, -1, 2, 3, -1, -1, 2, 3, 3, 4, -1, -1, 3, 4);
+  nerrors += test("tests/repetition.dat:056", "((..)|(.)){1}", "aaaa",
+    0,
+    8, 0, 2, 0, 2, 0, 2, -1, -1);
+  nerrors += test("tests/repetition.dat:057", "((..)|(.)){2}", "aaaa",
+    0,
+    8, 0, 4, 2, 4, 2, 4, -1, -1);
+  nerrors += test("tests/repetition.dat:059", "((..)|(.)){3}", "aaaa",
+    0,
+    8, 0, 4, 3, 4, 0, 2, 3, 4);
+  nerrors += test("tests/repetition.dat:061", "((..)|(.))*", "aaaa",
+    0,
+    8, 0, 4, 2, 4, 2, 4, -1, -1);
+  nerrors += test("tests/repetition.dat:063", "((..)|(.))", "aaaaa",
+    0,
+    8, 0, 2, 0, 2, 0, 2, -1, -1);
+  nerrors += test("tests/repetition.dat:064", "((..)|(.))((..)|(.))", "aaaaa",
+    0,
+    14, 0, 4, 0, 2, 0, 2, -1, -1, 2, 4, 2, 4, -1, -1);
+  nerrors += test("tests/repetition.dat:065", "((..)|(.))((..)|(.))((..)|(.))", "aaaaa",
+    0,
+    20, 0, 5, 0, 2, 0, 2, -1, -1, 2, 4, 2, 4, -1, -1, 4, 5, -1, -1, 4, 5);
+  nerrors += test("tests/repetition.dat:067", "((..)|(.)){1}", "aaaaa",
+    0,
+    8, 0, 2, 0, 2, 0, 2, -1, -1);
+  nerrors += test("tests/repetition.dat:068", "((..)|(.)){2}", "aaaaa",
+    0,
+    8, 0, 4, 2, 4, 2, 4, -1, -1);
+  nerrors += test("tests/repetition.dat:070", "((..)|(.)){3}", "aaaaa",
+    0,
+    8, 0, 5, 4, 5, 2, 4, 4, 5);
+  nerrors += test("tests/repetition.dat:073", "((..)|(.))*", "aaaaa",
+    0,
+    8, 0, 5, 4, 5, 2, 4, 4, 5);
+  nerrors += test("tests/repetition.dat:075", "((..)|(.))", "aaaaaa",
+    0,
+    8, 0, 2, 0, 2, 0, 2, -1, -1);
+  nerrors += test("tests/repetition.dat:076", "((..)|(.))((..)|(.))", "aaaaaa",
+    0,
+    14, 0, 4, 0, 2, 0, 2, -1, -1, 2, 4, 2, 4, -1, -1);
+  nerrors += test("tests/repetition.dat:077", "((..)|(.))((..)|(.))((..)|(.))", "aaaaaa",
+    0,
+    20, 0, 6, 0, 2, 0, 2, -1, -1, 2, 4, 2, 4, -1, -1, 4, 6, 4, 6, -1, -1);
+  nerrors += test("tests/repetition.dat:079", "((..)|(.)){1}", "aaaaaa",
+    0,
+    8, 0, 2, 0, 2, 0, 2, -1, -1);
+  nerrors += test("tests/repetition.dat:080", "((..)|(.)){2}", "aaaaaa",
+    0,
+    8, 0, 4, 2, 4, 2, 4, -1, -1);
+  nerrors += test("tests/repetition.dat:081", "((..)|(.)){3}", "aaaaaa",
+    0,
+    8, 0, 6, 4, 6, 4, 6, -1, -1);
+  nerrors += test("tests/repetition.dat:083", "((..)|(.))*", "aaaaaa",
+    0,
+    8, 0, 6, 4, 6, 4, 6, -1, -1);
+  nerrors += test("tests/repetition.dat:090", "X(.?){0,}Y", "X1234567Y",
+    0,
+    4, 0, 9, 7, 8);
+  nerrors += test("tests/repetition.dat:091", "X(.?){1,}Y", "X1234567Y",
+    0,
+    4, 0, 9, 7, 8);
+  nerrors += test("tests/repetition.dat:092", "X(.?){2,}Y", "X1234567Y",
+    0,
+    4, 0, 9, 7, 8);
+  nerrors += test("tests/repetition.dat:093", "X(.?){3,}Y", "X1234567Y",
+    0,
+    4, 0, 9, 7, 8);
+  nerrors += test("tests/repetition.dat:094", "X(.?){4,}Y", "X1234567Y",
+    0,
+    4, 0, 9, 7, 8);
+  nerrors += test("tests/repetition.dat:095", "X(.?){5,}Y", "X1234567Y",
+    0,
+    4, 0, 9, 7, 8);
+  nerrors += test("tests/repetition.dat:096", "X(.?){6,}Y", "X1234567Y",
+    0,
+    4, 0, 9, 7, 8);
+  nerrors += test("tests/repetition.dat:097", "X(.?){7,}Y", "X1234567Y",
+    0,
+    4, 0, 9, 7, 8);
+  nerrors += test("tests/repetition.dat:098", "X(.?){8,}Y", "X1234567Y",
+    0,
+    4, 0, 9, 8, 8);
+  nerrors += test("tests/repetition.dat:100", "X(.?){0,8}Y", "X1234567Y",
+    0,
+    4, 0, 9, 8, 8);
+  nerrors += test("tests/repetition.dat:102", "X(.?){1,8}Y", "X1234567Y",
+    0,
+    4, 0, 9, 8, 8);
+  nerrors += test("tests/repetition.dat:104", "X(.?){2,8}Y", "X1234567Y",
+    0,
+    4, 0, 9, 8, 8);
+  nerrors += test("tests/repetition.dat:106", "X(.?){3,8}Y", "X1234567Y",
+    0,
+    4, 0, 9, 8, 8);
+  nerrors += test("tests/repetition.dat:108", "X(.?){4,8}Y", "X1234567Y",
+    0,
+    4, 0, 9, 8, 8);
+  nerrors += test("tests/repetition.dat:110", "X(.?){5,8}Y", "X1234567Y",
+    0,
+    4, 0, 9, 8, 8);
+  nerrors += test("tests/repetition.dat:112", "X(.?){6,8}Y", "X1234567Y",
+    0,
+    4, 0, 9, 8, 8);
+  nerrors += test("tests/repetition.dat:114", "X(.?){7,8}Y", "X1234567Y",
+    0,
+    4, 0, 9, 8, 8);
+  nerrors += test("tests/repetition.dat:115", "X(.?){8,8}Y", "X1234567Y",
+    0,
+    4, 0, 9, 8, 8);
+  nerrors += test("tests/repetition.dat:126", "(a|ab|c|bcd){0,}(d*)", "ababcd",
+    0,
+    6, 0, 6, 3, 6, 6, 6);
+  nerrors += test("tests/repetition.dat:127", "(a|ab|c|bcd){1,}(d*)", "ababcd",
+    0,
+    6, 0, 6, 3, 6, 6, 6);
+  nerrors += test("tests/repetition.dat:128", "(a|ab|c|bcd){2,}(d*)", "ababcd",
+    0,
+    6, 0, 6, 3, 6, 6, 6);
+  nerrors += test("tests/repetition.dat:129", "(a|ab|c|bcd){3,}(d*)", "ababcd",
+    0,
+    6, 0, 6, 3, 6, 6, 6);
+  nerrors += test("tests/repetition.dat:130", "(a|ab|c|bcd){4,}(d*)", "ababcd",
+    0,
+    0);
+  nerrors += test("tests/repetition.dat:131", "(a|ab|c|bcd){0,10}(d*)", "ababcd",
+    0,
+    6, 0, 6, 3, 6, 6, 6);
+  nerrors += test("tests/repetition.dat:132", "(a|ab|c|bcd){1,10}(d*)", "ababcd",
+    0,
+    6, 0, 6, 3, 6, 6, 6);
+  nerrors += test("tests/repetition.dat:133", "(a|ab|c|bcd){2,10}(d*)", "ababcd",
+    0,
+    6, 0, 6, 3, 6, 6, 6);
+  nerrors += test("tests/repetition.dat:134", "(a|ab|c|bcd){3,10}(d*)", "ababcd",
+    0,
+    6, 0, 6, 3, 6, 6, 6);
+  nerrors += test("tests/repetition.dat:135", "(a|ab|c|bcd){4,10}(d*)", "ababcd",
+    0,
+    0);
+  nerrors += test("tests/repetition.dat:136", "(a|ab|c|bcd)*(d*)", "ababcd",
+    0,
+    6, 0, 6, 3, 6, 6, 6);
+  nerrors += test("tests/repetition.dat:137", "(a|ab|c|bcd)+(d*)", "ababcd",
+    0,
+    6, 0, 6, 3, 6, 6, 6);
+  nerrors += test("tests/repetition.dat:143", "(ab|a|c|bcd){0,}(d*)", "ababcd",
+    0,
+    6, 0, 6, 4, 5, 5, 6);
+  nerrors += test("tests/repetition.dat:145", "(ab|a|c|bcd){1,}(d*)", "ababcd",
+    0,
+    6, 0, 6, 4, 5, 5, 6);
+  nerrors += test("tests/repetition.dat:147", "(ab|a|c|bcd){2,}(d*)", "ababcd",
+    0,
+    6, 0, 6, 4, 5, 5, 6);
+  nerrors += test("tests/repetition.dat:149", "(ab|a|c|bcd){3,}(d*)", "ababcd",
+    0,
+    6, 0, 6, 4, 5, 5, 6);
+  nerrors += test("tests/repetition.dat:150", "(ab|a|c|bcd){4,}(d*)", "ababcd",
+    0,
+    0);
+  nerrors += test("tests/repetition.dat:152", "(ab|a|c|bcd){0,10}(d*)", "ababcd",
+    0,
+    6, 0, 6, 4, 5, 5, 6);
+  nerrors += test("tests/repetition.dat:154", "(ab|a|c|bcd){1,10}(d*)", "ababcd",
+    0,
+    6, 0, 6, 4, 5, 5, 6);
+  nerrors += test("tests/repetition.dat:156", "(ab|a|c|bcd){2,10}(d*)", "ababcd",
+    0,
+    6, 0, 6, 4, 5, 5, 6);
+  nerrors += test("tests/repetition.dat:158", "(ab|a|c|bcd){3,10}(d*)", "ababcd",
+    0,
+    6, 0, 6, 4, 5, 5, 6);
+  nerrors += test("tests/repetition.dat:159", "(ab|a|c|bcd){4,10}(d*)", "ababcd",
+    0,
+    0);
+  nerrors += test("tests/repetition.dat:161", "(ab|a|c|bcd)*(d*)", "ababcd",
+    0,
+    6, 0, 6, 4, 5, 5, 6);
+  nerrors += test("tests/repetition.dat:163", "(ab|a|c|bcd)+(d*)", "ababcd",
+    0,
+    6, 0, 6, 4, 5, 5, 6);
+  nerrors += test("tests/utf8.dat:005", "é", "café",
+    CREGEX_FLAG_UTF8,
+    2, 3, 5);
+  nerrors += test("tests/utf8.dat:006", "€+", "a€€b",
+    CREGEX_FLAG_UTF8,
+    2, 1, 7);
+  nerrors += test("tests/utf8.dat:007", "(é|ü)x", "aüx",
+    CREGEX_FLAG_UTF8,
+    4, 1, 4, 1, 3);
+  nerrors += test("tests/utf8.dat:008", "caf", "CAFé",
+    CREGEX_FLAG_ICASE | CREGEX_FLAG_UTF8,
+    2, 0, 3);
+  nerrors += test("tests/utf8.dat:009", "CAFÉ", "café",
+    CREGEX_FLAG_ICASE | CREGEX_FLAG_UTF8,
+    0);
+  nerrors += test("tests/utf8.dat:012", "^.$", "é",
+    CREGEX_FLAG_UTF8,
+    2, 0, 2);
+  nerrors += test("tests/utf8.dat:013", "^.$", "€",
+    CREGEX_FLAG_UTF8,
+    2, 0, 3);
+  nerrors += test("tests/utf8.dat:014", "^.$", "😀",
+    CREGEX_FLAG_UTF8,
+    2, 0, 4);
+  nerrors += test("tests/utf8.dat:015", "^..$", "é",
+    CREGEX_FLAG_UTF8,
+    0);
+  nerrors += test("tests/utf8.dat:016", "^..$", "é",
+    0,
+    2, 0, 2);
+  nerrors += test("tests/utf8.dat:017", "a.c", "a€c",
+    CREGEX_FLAG_UTF8,
+    2, 0, 5);
+  nerrors += test("tests/utf8.dat:018", "(.)(.)", "éa",
+    CREGEX_FLAG_UTF8,
+    6, 0, 3, 0, 2, 2, 3);
+  nerrors += test("tests/utf8.dat:019", ".{2}$", "x€ü",
+    CREGEX_FLAG_UTF8,
+    2, 1, 6);
+  nerrors += test("tests/utf8.dat:022", "[a-é]+", "zéü",
+    CREGEX_FLAG_UTF8,
+    2, 0, 3);
+  nerrors += test("tests/utf8.dat:023", "^[a-é]$", "ß",
+    CREGEX_FLAG_UTF8,
+    2, 0, 2);
+  nerrors += test("tests/utf8.dat:024", "[a-é]", "ü",
+    CREGEX_FLAG_UTF8,
+    0);
+  nerrors += test("tests/utf8.dat:025", "^[\x7f-\xe0\xa0\x80]+$", "\x7f\xdf\xbf\xe0\xa0\x80",
+    CREGEX_FLAG_UTF8,
+    2, 0, 6);
+  nerrors += test("tests/utf8.dat:026", "[\x7f-\xe0\xa0\x80]", "\xe0\xa0\x81",
+    CREGEX_FLAG_UTF8,
+    0);
+  nerrors += test("tests/utf8.dat:027", "[\x7f-\xe0\xa0\x80]", "~",
+    CREGEX_FLAG_UTF8,
+    0);
+  nerrors += test("tests/utf8.dat:028", "[😀-😂]", "a😁",
+    CREGEX_FLAG_UTF8,
+    2, 1, 5);
+  nerrors += test("tests/utf8.dat:031", "[^a]", "é",
+    CREGEX_FLAG_UTF8,
+    2, 0, 2);
+  nerrors += test("tests/utf8.dat:032", "[^é]+", "éaüé",
+    CREGEX_FLAG_UTF8,
+    2, 2, 5);
+  nerrors += test("tests/utf8.dat:033", "[^a-é]+", "aéü€",
+    CREGEX_FLAG_UTF8,
+    2, 3, 8);
+  nerrors += test("tests/utf8.dat:034", "^[^a]$", "😀",
+    CREGEX_FLAG_UTF8,
+    2, 0, 4);
+  nerrors += test("tests/utf8.dat:035", "[^a]", "\xff",
+    CREGEX_FLAG_UTF8,
+    0);
+  nerrors += test_error("tests/utf8.dat:038", "\xff",
+    CREGEX_FLAG_UTF8);
+  nerrors += test_error("tests/utf8.dat:039", "a\xc3",
+    CREGEX_FLAG_UTF8);
+  nerrors += test_error("tests/utf8.dat:040", "[\xe9]",
+    CREGEX_FLAG_UTF8);
+  nerrors += test_error("tests/utf8.dat:041", "\xc0\xaf",
+    CREGEX_FLAG_UTF8);
+  nerrors += test_error("tests/utf8.dat:042", "\xed\xa0\x80",
+    CREGEX_FLAG_UTF8);
+  nerrors += test("tests/utf8.dat:043", "\xff", "\xff",
+    0,
+    2, 0, 1);
+  nerrors += test_arena_offset();
+  nerrors += test_allocator_temporaries();
+  nerrors += test_dfa_load_other();
+  nerrors += test_replace_output();
+  nerrors += test_cache();
+  nerrors += test_cache_threads();
+  nerrors += test_limits();
+  nerrors += test_cost_order();
+
+    printf("397 test(s), %d error(s).\n", -nerrors);
+    return 0;
+}
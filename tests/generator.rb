@@ -1,10 +1,23 @@
 #!/usr/bin/env ruby
 
+# With --aot, each pattern is translated to C by tests/re2c and the generated
+# function is checked against the interpreter instead
+aot  = ARGV.delete('--aot')
+re2c = File.join(File.dirname($0), 're2c')
+
+# patterns and strings are bytes (UTF-8 ones too), whatever the locale
+ARGF.binmode
+
 puts <<-END
 /* generated by #{$0}#{ARGV.size > 0 ? ' ' + ARGV.join(' ') : ''} */
 
+#include <pthread.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <cregex.h>
 
@@ -35,28 +48,211 @@ static void fail(const char *source, const char *format, ...)
     va_end(ap);
 }
 
+END
+
+puts(aot ? <<-AOT : <<-END)
+typedef int (*aot_function)(const char *string, size_t length,
+                            const char **matches, int nmatches);
+
+static int test_aot(const char *source,
+                    const char *pattern, const char *string,
+                    int flags,
+                    aot_function function)
+{
+    cregex_program_t *program;
+    const char *matches[20] = {0}, *aot_matches[20] = {0};
+    int result, aot_result;
+
+    if (!(program = cregex_compile(pattern, flags, NULL))) {
+        fail(source, "cregex_compile() failed");
+        return -1;
+    }
+    result = cregex_program_run(program, string, matches,
+                                sizeof (matches) / sizeof (matches[0]));
+    aot_result = function(string, strlen(string), aot_matches,
+                          sizeof (aot_matches) / sizeof (aot_matches[0]));
+    cregex_compile_free(program);
+
+    if (aot_result != result ||
+        memcmp(matches, aot_matches, sizeof (matches)) != 0) {
+        fail(source, "/%s/ generated code disagrees on \\"%s\\"", pattern,
+             string);
+        return -1;
+    }
+    success(source, "/%s/ =~ \\"%s\\" as generated code", pattern, string);
+    return 0;
+}
+
+AOT
+/* Whether the minimized DFA of program gives result on string, as built and
+ * once saved and loaded back
+ */
+static int check_dfa(const cregex_program_t *program, const char *string,
+                     int result)
+{
+    cregex_dfa_t *dfa = cregex_dfa_compile(program, 0), *loaded = NULL;
+    size_t size = dfa ? cregex_dfa_save(dfa, NULL, 0) : 0;
+    char *saved = malloc(size);
+    int ok = 0;
+
+    if (dfa && saved && cregex_dfa_save(dfa, saved, size) == size &&
+        (loaded = cregex_dfa_load(program, saved, size)))
+        ok = cregex_dfa_run(dfa, string, strlen(string), NULL, 0) == result &&
+             cregex_dfa_run(loaded, string, strlen(string), NULL, 0) ==
+                 result;
+
+    cregex_dfa_free(loaded);
+    free(saved);
+    cregex_dfa_free(dfa);
+    return ok;
+}
+
+/* Whether the tagged DFA of program gives result and the submatches found by
+ * the interpreter on string
+ */
+static int check_tdfa(const cregex_program_t *program, const char *string,
+                      int result, const char **matches, int nmatches)
+{
+    cregex_tdfa_t *tdfa = cregex_tdfa_compile(program, 0);
+    const char *tdfa_matches[20] = {0};
+    int ok = 0;
+
+    if (tdfa)
+        ok = cregex_tdfa_run(tdfa, string, strlen(string), NULL, 0) ==
+                 result &&
+             cregex_tdfa_run(tdfa, string, strlen(string), tdfa_matches,
+                             nmatches) == result &&
+             memcmp(matches, tdfa_matches, sizeof(matches[0]) * nmatches) ==
+                 0;
+
+    cregex_tdfa_free(tdfa);
+    return ok;
+}
+
+/* Whether the matches of scan are those of a fresh scan of string */
+static int same_matches(const cregex_incremental_t *scan,
+                        const cregex_program_t *program,
+                        const char *string, size_t length)
+{
+    cregex_incremental_t *fresh =
+        cregex_incremental_scan(program, string, length, 20, 0);
+    int ok = fresh && cregex_incremental_count(scan) ==
+                          cregex_incremental_count(fresh);
+
+    for (size_t i = 0; ok && i < cregex_incremental_count(scan); ++i)
+        ok = memcmp(cregex_incremental_match(scan, i),
+                    cregex_incremental_match(fresh, i),
+                    sizeof(ptrdiff_t) * 20) == 0;
+    cregex_incremental_free(fresh);
+    return ok;
+}
+
+/* Whether an incremental scan of string finds as many matches as replacing
+ * them does, and keeps finding those of a fresh scan once a byte in the
+ * middle is replaced, removed and put back
+ */
+static int check_incremental(const cregex_program_t *program,
+                             const char *string)
+{
+    size_t length = strlen(string), middle = length / 2;
+    char *edited = malloc(length + 1);
+    cregex_incremental_t *scan =
+        cregex_incremental_scan(program, string, length, 20, 1);
+    int ok = 0;
+
+    if (edited && scan &&
+        cregex_incremental_count(scan) ==
+            (size_t) cregex_program_replace(program, string, length, "", NULL,
+                                            0, NULL)) {
+        memcpy(edited, string, length + 1);
+        ok = same_matches(scan, program, edited, length);
+        if (ok && middle < length) {
+            edited[middle] = 'x';
+            ok = cregex_incremental_edit(scan, edited, length, middle, 1, 1) ==
+                     0 &&
+                 same_matches(scan, program, edited, length);
+            memmove(edited + middle, edited + middle + 1, length - middle);
+            ok = ok &&
+                 cregex_incremental_edit(scan, edited, length - 1, middle, 1,
+                                         0) == 0 &&
+                 same_matches(scan, program, edited, length - 1);
+            ok = ok &&
+                 cregex_incremental_edit(scan, string, length, middle, 0, 1) ==
+                     0 &&
+                 same_matches(scan, program, string, length);
+        }
+    }
+
+    cregex_incremental_free(scan);
+    free(edited);
+    return ok;
+}
+
+/* Whether a set compiled from pattern, an invalid pattern and pattern again
+ * in two threads gives result and matches on string for both copies, and an
+ * error for the invalid pattern only
+ */
+static int check_set(const char *pattern, int flags, const char *string,
+                     int result, const char **matches, int nmatches)
+{
+    const char *patterns[] = {pattern, "(", pattern};
+    cregex_program_set_t *set =
+        cregex_compile_set(patterns, 3, flags, NULL, 2);
+    int ok = set && cregex_program_set_count(set) == 3 &&
+             cregex_program_set_error(set, 1) == CREGEX_ERROR &&
+             !cregex_program_set_program(set, 1);
+
+    for (size_t i = 0; ok && i < 3; i += 2) {
+        const cregex_program_t *program = cregex_program_set_program(set, i);
+        const char *set_matches[20] = {0};
+        ok = program && cregex_program_set_error(set, i) == 0 &&
+             cregex_program_run(program, string, set_matches, nmatches) ==
+                 result &&
+             memcmp(matches, set_matches, sizeof(matches[0]) * nmatches) == 0;
+    }
+
+    cregex_program_set_free(set);
+    return ok;
+}
+
+/* Patterns which must not compile */
+static int test_error(const char *source, const char *pattern, int flags)
+{
+    cregex_program_t *program = cregex_compile(pattern, flags, NULL);
+
+    if (program) {
+        fail(source, "/%s/ compiled", pattern);
+        cregex_compile_free(program);
+        return -1;
+    }
+    success(source, "/%s/ rejected", pattern);
+    return 0;
+}
+
 static int test(const char *source,
                 const char *pattern, const char *string,
+                int flags,
                 int nmatches,
                 ...)
 {
     cregex_node_t *root;
     cregex_program_t *program;
-    const char *matches[20] = {0};
+    cregex_jit_t *jit;
+    const char *matches[20] = {0}, *jit_matches[20] = {0};
     int result = 0;
     va_list ap;
 
     /* parse pattern */
-    if (!(root = cregex_parse(pattern))) {
-        fail(source, "cregex_parse() failed");
+    if (!(root = cregex_parse_with_flags(pattern, flags, NULL))) {
+        fail(source, "cregex_parse_with_flags() failed");
         return -1;
     }
 
     /* compile parsed pattern */
-    program = cregex_compile_node(root);
+    program = cregex_compile_node_with(root, flags, NULL);
     cregex_parse_free(root);
     if (!program) {
-        fail(source, "cregex_compile_node() failed");
+        fail(source, "cregex_compile_node_with() failed");
         return -1;
     }
 
@@ -69,6 +265,59 @@ static int test(const char *source,
         return -1;
     }
 
+    /* the JIT must agree with the interpreter, with and without submatches */
+    if (!(jit = cregex_jit_compile(program))) {
+        fail(source, "cregex_jit_compile() failed");
+        cregex_compile_free(program);
+        return -1;
+    }
+    if (cregex_jit_run(jit, string, strlen(string), NULL, 0) != result ||
+        cregex_jit_run(jit, string, strlen(string), jit_matches,
+                       sizeof (jit_matches) / sizeof (jit_matches[0])) !=
+            result ||
+        memcmp(matches, jit_matches, sizeof (matches)) != 0) {
+        fail(source, "/%s/ cregex_jit_run() disagrees with cregex_program_run()",
+             pattern);
+        cregex_jit_free(jit);
+        cregex_compile_free(program);
+        return -1;
+    }
+    cregex_jit_free(jit);
+
+    /* and so must the minimized DFA */
+    if (!check_dfa(program, string, result)) {
+        fail(source, "/%s/ cregex_dfa_run() disagrees with cregex_program_run()",
+             pattern);
+        cregex_compile_free(program);
+        return -1;
+    }
+
+    /* and the tagged DFA, submatches included */
+    if (!check_tdfa(program, string, result, matches,
+                    sizeof (matches) / sizeof (matches[0]))) {
+        fail(source, "/%s/ cregex_tdfa_run() disagrees with cregex_program_run()",
+             pattern);
+        cregex_compile_free(program);
+        return -1;
+    }
+
+    /* an incremental scan must find every match, also after edits */
+    if (!check_incremental(program, string)) {
+        fail(source, "/%s/ cregex_incremental_edit() disagrees with a rescan",
+             pattern);
+        cregex_compile_free(program);
+        return -1;
+    }
+
+    /* and a program compiled as part of a set */
+    if (!check_set(pattern, flags, string, result, matches,
+                   sizeof (matches) / sizeof (matches[0]))) {
+        fail(source, "/%s/ the program of cregex_compile_set() disagrees",
+             pattern);
+        cregex_compile_free(program);
+        return -1;
+    }
+
     va_start(ap, nmatches);
     if (result > 0) {
         if (nmatches > 0) {
@@ -109,14 +358,456 @@ static int test(const char *source,
     return result;
 }
 
-int main(int argc, char *argv[])
+END
+
+# Checks of the library interface the pattern tables do not reach, each a
+# static int test_*(void) returning 0 or -1 like test(), run after them by the
+# interpreter's driver
+checks = aot ? '' : <<-'END'
+/* Programs compiled into an arena whose buffer is not aligned are */
+static int test_arena_offset(void)
+{
+    static max_align_t storage[4096];
+    cregex_arena_t arena;
+    cregex_allocator_t allocator;
+    cregex_program_t *program;
+    const char *matches[2] = {0};
+    const char *string = "xababc";
+
+    cregex_arena_init(&arena, (char *) storage + 1, sizeof(storage) - 1);
+    allocator = cregex_arena_allocator(&arena);
+    if (!(program = cregex_compile("(a|b)*c", 0, &allocator)) ||
+        (uintptr_t) program % _Alignof(max_align_t) != 0 ||
+        cregex_program_run(program, string, matches, 2) != 1 ||
+        matches[0] != string + 1 || matches[1] != string + 6) {
+        fail("arena", "program at buffer + 1 misaligned or wrong");
+        return -1;
+    }
+    success("arena", "program at buffer + 1 aligned");
+    return 0;
+}
+
+typedef struct {
+    size_t nallocs, nfrees;
+} counted;
+
+static void *counted_alloc(void *context, size_t size)
+{
+    ++((counted *) context)->nallocs;
+    return malloc(size);
+}
+
+static void counted_free(void *context, void *ptr)
+{
+    if (ptr)
+        ++((counted *) context)->nfrees;
+    free(ptr);
+}
+
+/* Compiling allocates its temporaries (UTF-8 classes, their ranges and the
+ * items of a reversed program) with the caller's allocator too
+ */
+static int test_allocator_temporaries(void)
 {
+    counted count = {0};
+    cregex_allocator_t allocator = {counted_alloc, counted_free, &count};
+    cregex_node_t *root = cregex_parse_with_flags("[a-\xc3\xa9]+x$",
+                                                  CREGEX_FLAG_UTF8, NULL);
+    cregex_program_t *program =
+        root ? cregex_compile_node_with(root, CREGEX_FLAG_UTF8, &allocator)
+             : NULL;
+    size_t kept = program ? 1 + (program->closures != NULL) : 0;
+    int ok = program && count.nfrees >= 3 &&
+             count.nallocs - count.nfrees == kept;
+
+    cregex_compile_free_with(program, &allocator);
+    cregex_parse_free(root);
+    if (!ok || count.nallocs != count.nfrees) {
+        fail("allocator", "%zu allocation(s), %zu free(s)", count.nallocs,
+             count.nfrees);
+        return -1;
+    }
+    success("allocator", "%zu allocation(s), all freed", count.nallocs);
+    return 0;
+}
+
+/* A saved DFA loads for another compile of its pattern only */
+static int test_dfa_load_other(void)
+{
+    cregex_program_t *ab = cregex_compile("ab", 0, NULL);
+    cregex_program_t *again = cregex_compile("ab", 0, NULL);
+    cregex_program_t *cd = cregex_compile("cd", 0, NULL);
+    cregex_dfa_t *dfa = ab ? cregex_dfa_compile(ab, 0) : NULL;
+    cregex_dfa_t *same = NULL, *other = NULL;
+    size_t size = dfa ? cregex_dfa_save(dfa, NULL, 0) : 0;
+    char *saved = malloc(size);
+    int ok = dfa && again && cd && saved &&
+             cregex_dfa_save(dfa, saved, size) == size &&
+             (same = cregex_dfa_load(again, saved, size)) &&
+             !(other = cregex_dfa_load(cd, saved, size));
+
+    cregex_dfa_free(other);
+    cregex_dfa_free(same);
+    free(saved);
+    cregex_dfa_free(dfa);
+    cregex_compile_free(cd);
+    cregex_compile_free(again);
+    cregex_compile_free(ab);
+    if (!ok) {
+        fail("dfa", "DFA saved for /ab/ not loaded for /ab/ or loaded for /cd/");
+        return -1;
+    }
+    success("dfa", "DFA saved for /ab/ loaded for /ab/ only");
+    return 0;
+}
+
+/* Whether replacing the matches of pattern in string gives expected and
+ * count (or CREGEX_ERROR), both into a buffer large enough and into an
+ * allocated one
+ */
+static int check_replace(const char *pattern, int flags, const char *string,
+                         const char *replacement, const char *expected,
+                         int count)
+{
+    cregex_program_t *program = cregex_compile(pattern, flags, NULL);
+    char output[64], *allocated = NULL;
+    size_t length = 0, allocated_length = 0;
+    int ok = program &&
+             cregex_program_replace(program, string, strlen(string),
+                                    replacement, output, sizeof(output),
+                                    &length) == count &&
+             cregex_program_replace_with(program, string, strlen(string),
+                                         replacement, NULL, &allocated,
+                                         &allocated_length) == count;
+
+    if (ok && count >= 0)
+        ok = length == strlen(expected) && strcmp(output, expected) == 0 &&
+             allocated_length == length && strcmp(allocated, expected) == 0;
+    free(allocated);
+    cregex_compile_free(program);
+    return ok;
+}
+
+/* Replacement text, group references and escapes, and the snprintf()-like
+ * handling of short buffers
+ */
+static int test_replace_output(void)
+{
+    static const struct {
+        const char *pattern, *string, *replacement, *expected;
+        int flags, count;
+    } cases[] = {
+        {"b+", "abbcb", "X", "aXcX", 0, 2},
+        {"([a-z]+)@([a-z]+)", "me@host, you@there", "\\2 at \\1 (\\0)",
+         "host at me (me@host), there at you (you@there)", 0, 2},
+        {"-", "a-b", "\\\\", "a\\b", 0, 1},
+        {"(a)|b", "ab", "[\\1]", "[a][]", 0, 2},
+        {"x*", "a\xc3\xa9", "-", "-a-\xc3\xa9-", CREGEX_FLAG_UTF8, 3},
+        {"a", "a", "\\q", NULL, 0, CREGEX_ERROR},
+        {"a", "a", "x\\", NULL, 0, CREGEX_ERROR},
+        {"(a)", "a", "\\2", NULL, 0, CREGEX_ERROR},
+    };
+    cregex_program_t *program = cregex_compile("a", 0, NULL);
+    char output[5] = "????";
+    size_t length = 0, nolength = 0;
+    int nerrors = 0;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        if (!check_replace(cases[i].pattern, cases[i].flags, cases[i].string,
+                           cases[i].replacement, cases[i].expected,
+                           cases[i].count)) {
+            fail("replace", "/%s/ with \"%s\" in \"%s\"", cases[i].pattern,
+                 cases[i].replacement, cases[i].string);
+            --nerrors;
+        }
+    }
+
+    /* the full length is returned, the output truncated and terminated */
+    if (!program ||
+        cregex_program_replace(program, "aaa", 3, "xyz", output,
+                               sizeof(output), &length) != 3 ||
+        length != 9 || strcmp(output, "xyzx") != 0 ||
+        cregex_program_replace(program, "aaa", 3, "xyz", NULL, 0,
+                               &nolength) != 3 ||
+        nolength != 9) {
+        fail("replace", "/a/ with \"xyz\" in \"aaa\" into 5 bytes");
+        --nerrors;
+    }
+    cregex_compile_free(program);
+
+    if (!nerrors)
+        success("replace", "replacement output");
+    return nerrors ? -1 : 0;
+}
+
+/* Whether the program of entry matches string */
+static int entry_matches(const cregex_cache_entry_t *entry, const char *string)
+{
+    const char *matches[2];
+    return cregex_program_run(cregex_cache_program(entry), string, matches,
+                              2) == 1;
+}
+
+/* Whether holding pattern, getting other from a cache with no budget evicts
+ * pattern, i.e. other went to the same shard
+ */
+static int evicts(const char *pattern, const char *other)
+{
+    cregex_cache_t *cache = cregex_cache_create(0);
+    cregex_cache_entry_t *held = cregex_cache_get(cache, pattern), *again;
+    int evicted;
+
+    cregex_cache_release(cregex_cache_get(cache, other));
+    again = cregex_cache_get(cache, pattern);
+    evicted = again != held;
+    cregex_cache_release(again);
+    cregex_cache_release(held);
+    cregex_cache_free(cache);
+    return evicted;
+}
+
+/* Hits return the same entry, entries past the budget are evicted least
+ * recently used first, and evicted entries stay valid while referenced
+ */
+static int test_cache(void)
+{
+    cregex_cache_t *cache = cregex_cache_create(1 << 20);
+    cregex_cache_entry_t *first = cregex_cache_get(cache, "a+b");
+    cregex_cache_entry_t *hit = cregex_cache_get(cache, "a+b");
+    cregex_cache_entry_t *held, *recent, *again;
+    char other[16] = "";
+    int ok = first && first == hit;
+
+    cregex_cache_release(hit);
+    cregex_cache_release(first);
+    cregex_cache_free(cache);
+
+    /* another pattern which ends up next to a+b */
+    for (int i = 0; ok && i < 1000 && !other[0]; ++i) {
+        char candidate[16];
+        snprintf(candidate, sizeof(candidate), "x%d", i);
+        if (evicts("a+b", candidate))
+            strcpy(other, candidate);
+    }
+    ok = ok && other[0];
+
+    /* with no budget, only the most recently used entry stays cached */
+    cache = cregex_cache_create(0);
+    held = cregex_cache_get(cache, "a+b");
+    recent = cregex_cache_get(cache, other);
+    again = cregex_cache_get(cache, other);
+    ok = ok && held && recent && again == recent;
+    cregex_cache_release(again);
+    again = cregex_cache_get(cache, "a+b");
+    ok = ok && again && again != held && entry_matches(held, "xaab");
+    cregex_cache_release(again);
+    cregex_cache_release(recent);
+    cregex_cache_free(cache);
+    /* dropped by the cache (and the cache freed) before this */
+    ok = ok && entry_matches(held, "xaab");
+    cregex_cache_release(held);
+
+    if (!ok) {
+        fail("cache", "hits, eviction or references past eviction");
+        return -1;
+    }
+    success("cache", "hits, eviction and references past eviction");
+    return 0;
+}
+
+typedef struct {
+    cregex_cache_t *cache;
+    const cregex_cache_entry_t *shared; /* the entry of k0, held by main */
+    int nerrors;
+} cache_job;
+
+/* Get patterns k0 to k7 over and over, checking what they match */
+static void *cache_thread(void *arg)
+{
+    cache_job *job = arg;
+
+    for (int i = 0; i < 2000; ++i) {
+        char pattern[8], string[8];
+        cregex_cache_entry_t *entry;
+
+        snprintf(pattern, sizeof(pattern), "k%d+", i % 8);
+        snprintf(string, sizeof(string), "k%d%d", i % 8, i % 8);
+        if (!(entry = cregex_cache_get(job->cache, pattern)) ||
+            !entry_matches(entry, string) ||
+            (job->shared && i % 8 == 0 && entry != job->shared))
+            ++job->nerrors;
+        cregex_cache_release(entry);
+    }
+    return NULL;
+}
+
+/* Threads getting the same patterns at once share entries within the
+ * budget, and evict each other's without harm when it is exceeded
+ */
+static int test_cache_threads(void)
+{
+    pthread_t threads[4];
+    cache_job jobs[4];
     int nerrors = 0;
+
+    for (size_t capacity = 0; capacity <= (1 << 20); capacity += 1 << 20) {
+        cregex_cache_t *cache = cregex_cache_create(capacity);
+        cregex_cache_entry_t *shared = cregex_cache_get(cache, "k0+");
+        int nstarted = 0;
+
+        for (; nstarted < 4; ++nstarted) {
+            jobs[nstarted] = (cache_job){cache, capacity ? shared : NULL, 0};
+            if (pthread_create(&threads[nstarted], NULL, cache_thread,
+                               &jobs[nstarted]))
+                break;
+        }
+        for (int i = 0; i < nstarted; ++i) {
+            pthread_join(threads[i], NULL);
+            nerrors += jobs[i].nerrors;
+        }
+        nerrors += !shared || nstarted < 4;
+        cregex_cache_release(shared);
+        cregex_cache_free(cache);
+    }
+
+    if (nerrors) {
+        fail("cache", "%d error(s) getting patterns in 4 threads", nerrors);
+        return -1;
+    }
+    success("cache", "patterns got in 4 threads");
+    return 0;
+}
+
+/* Smallest budget, set by budget(), with which program runs on string as
+ * without limits, after checking that one less gives CREGEX_ERROR_LIMIT, or
+ * 0 if none up to 4096 does
+ */
+static size_t least_budget(const cregex_program_t *program,
+                           const char *string,
+                           void (*budget)(cregex_limits_t *limits, size_t n))
+{
+    const char *matches[4] = {0}, *limited[4] = {0};
+    int result = cregex_program_run(program, string, matches, 4);
+
+    for (size_t n = 1; n <= 4096; ++n) {
+        cregex_limits_t limits = {0};
+        int status;
+
+        budget(&limits, n);
+        status = cregex_program_run_limited(program, string, strlen(string),
+                                            limited, 4, &limits);
+        if (status == CREGEX_ERROR_LIMIT)
+            continue;
+        return (status == result && n > 1 &&
+                memcmp(matches, limited, sizeof(matches)) == 0)
+                   ? n
+                   : 0;
+    }
+    return 0;
+}
+
+static void budget_steps(cregex_limits_t *limits, size_t n)
+{
+    limits->max_steps = n;
+}
+
+static void budget_bytes(cregex_limits_t *limits, size_t n)
+{
+    limits->max_bytes = n;
+}
+
+/* Each budget of cregex_limits_t fails with CREGEX_ERROR_LIMIT one short of
+ * what a pattern needs, and succeeds with just enough
+ */
+static int test_limits(void)
+{
+    const char *pattern = "(a|b)*(ab){20}c";
+    const char *string = "xxabababab" "abababababababababababababababababc";
+    cregex_cost_t cost;
+    cregex_limits_t limits = {0};
+    cregex_program_t *program = NULL, *refused;
+    size_t steps = 0, bytes = 0;
+    int error = 0, ok = cregex_cost(pattern, 0, &cost) == 0;
+
+    /* max_instructions */
+    limits.max_instructions = cost.ninstructions - 1;
+    refused = cregex_compile_limited(pattern, 0, NULL, &limits, &error);
+    ok = ok && !refused && error == CREGEX_ERROR_LIMIT;
+    limits.max_instructions = cost.ninstructions;
+    ok = ok &&
+         (program = cregex_compile_limited(pattern, 0, NULL, &limits, &error));
+
+    /* max_steps and max_bytes */
+    ok = ok && (steps = least_budget(program, string, budget_steps)) &&
+         (bytes = least_budget(program, string, budget_bytes)) ==
+             strlen(string);
+
+    cregex_compile_free(refused);
+    cregex_compile_free(program);
+    if (!ok) {
+        fail("limits", "budgets not exact");
+        return -1;
+    }
+    success("limits", "%d instruction(s), %zu step(s), %zu byte(s) exact",
+            cost.ninstructions, steps, bytes);
+    return 0;
+}
+
+/* Cost of pattern, or costs of all -1 if it does not parse */
+static cregex_cost_t node_cost(const char *pattern)
+{
+    cregex_node_t *root = cregex_parse(pattern);
+    cregex_cost_t cost = {-1, -1, -1, -1, -1};
+
+    if (root)
+        cregex_node_cost(root, 0, &cost);
+    cregex_parse_free(root);
+    return cost;
+}
+
+/* The cost model ranks nested repetitions above a literal, and alternations
+ * by their number of branches
+ */
+static int test_cost_order(void)
+{
+    cregex_cost_t literal = node_cost("a"), nested = node_cost("(a*)*");
+    cregex_cost_t previous = literal;
+    char pattern[32] = "a";
+    int ok = literal.ninstructions > 0 &&
+             nested.ninstructions > literal.ninstructions &&
+             nested.work_per_byte > literal.work_per_byte;
+
+    for (int nbranches = 2; ok && nbranches <= 12; ++nbranches) {
+        cregex_cost_t cost;
+        size_t length = strlen(pattern);
+
+        pattern[length] = '|';
+        pattern[length + 1] = 'a' + nbranches - 1;
+        pattern[length + 2] = '\0';
+        cost = node_cost(pattern);
+        ok = cost.ninstructions > previous.ninstructions &&
+             cost.max_threads > previous.max_threads &&
+             cost.work_per_byte > previous.work_per_byte;
+        previous = cost;
+    }
+
+    if (!ok) {
+        fail("cost", "/(a*)*/ not above /a/ or /%s/ not above fewer branches",
+             pattern);
+        return -1;
+    }
+    success("cost", "/(a*)*/ above /a/, alternations by branch count");
+    return 0;
+}
+
 END
+puts checks
 
-filename = nil
-previous = nil
-ntests   = 0
+filename  = nil
+previous  = nil
+ntests    = 0
+functions = ''
+body      = ''
 
 ARGF.each do |line|
   if ARGF.filename != filename
@@ -131,23 +822,60 @@ ARGF.each do |line|
   string   = ''       if string  == 'NULL'
   pattern  = previous if pattern == 'SAME'
   previous = pattern
+  raw      = !options.include?('$') ? pattern : pattern.gsub(/\\(x\h\h|.)/) do
+    {'n' => "\n", 't' => "\t", 'r' => "\r"}.fetch($1) { $1.size == 3 ? $1[1..].hex.chr : $1 }
+  end
   pattern  = pattern.gsub('\\', "\\\\\\\\") unless options.include?('$')
   string   = string .gsub('\\', "\\\\\\\\") unless options.include?('$')
-  captures = captures == 'NOMATCH' \
+  # an error code such as EILLSEQ instead of offsets if the pattern is invalid
+  error    = captures =~ /^E[A-Z]+$/
+  captures = captures == 'NOMATCH' || error \
     ? captures
     : captures
         .scan(/\((.*?),(.*?)\)/)
         .flatten
         .map {|offset| offset == '?' ? -1 : offset.to_i }
 
-  puts <<-END
+  # u is our own, for CREGEX_FLAG_UTF8
+  switches = {'i' => 'ICASE', 'u' => 'UTF8'}.select {|option, _| options.include?(option) }
+  flags    = switches.empty? ? 0 : switches.values.map {|flag| "CREGEX_FLAG_#{flag}" }.join(' | ')
+
+  if aot
+    next if error
+    name = "aot_#{ntests}"
+    functions << IO.popen([re2c, *switches.keys.map {|option| "-#{option}" }, '-n', name, raw], &:read)
+    abort "#{$0}: #{re2c} failed on /#{raw}/" unless $?.success?
+    functions << "\n"
+    body << <<-END
+  nerrors += test_aot("#{ARGF.filename}:#{'%03d' % ARGF.lineno}", "#{pattern}", "#{string}",
+    #{flags}, #{name});
+END
+  elsif error
+    body << <<-END
+  nerrors += test_error("#{ARGF.filename}:#{'%03d' % ARGF.lineno}", "#{pattern}",
+    #{flags});
+END
+  else
+    body << <<-END
   nerrors += test("#{ARGF.filename}:#{'%03d' % ARGF.lineno}", "#{pattern}", "#{string}",
+    #{flags},
     #{captures == 'NOMATCH' ? 0 : "#{captures.size}, #{captures.join(', ')}"});
 END
+  end
   ntests += 1
 end
 
+checks.scan(/^static int (test_\w+)\(void\)/) do |check|
+  body << "  nerrors += #{check[0]}();\n"
+  ntests += 1
+end
+
+puts functions
 puts <<-END
+int main(int argc, char *argv[])
+{
+    int nerrors = 0;
+#{body}
     printf("#{ntests} test(s), %d error(s).\\n", -nerrors);
     return 0;
 }
@@ -0,0 +1,430 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cregex.h>
+
+/* Generate a C function which matches one fixed pattern. The function is a
+ * Pike VM specialized to the compiled program: every instruction becomes a
+ * case of a switch on the program counter, characters and classes become
+ * switches on the input byte, and SAVE instructions become assignments to
+ * capture slots. It follows the interpreter's thread priorities exactly, so
+ * it reports the same matches as cregex_program_run_n().
+ */
+
+static void usage(FILE *file, const char *program)
+{
+    fprintf(file, "usage: %s [-i] [-u] [-n name] pattern\n", program);
+}
+
+/* Number of instructions of the forward program */
+static int forward_size(const cregex_program_t *program)
+{
+    return program->reverse ? program->reverse : program->ninstructions;
+}
+
+static int count_slots(const cregex_program_t *program)
+{
+    int nslots = 2;
+    for (int pc = 0; pc < forward_size(program); ++pc)
+        if (program->instructions[pc].opcode == REGEX_PROGRAM_OPCODE_SAVE &&
+            program->instructions[pc].save >= nslots)
+            nslots = program->instructions[pc].save + 1;
+    return nslots;
+}
+
+static void print_byte(FILE *file, int ch)
+{
+    if (isalnum(ch))
+        fprintf(file, "'%c'", ch);
+    else if (ch < 0)
+        fprintf(file, "-1");
+    else
+        fprintf(file, "0x%02x", ch);
+}
+
+/* The pattern in a comment, which it must not end */
+static void print_pattern(FILE *file, const char *pattern)
+{
+    for (; *pattern; ++pattern) {
+        if (pattern[0] == '*' && pattern[1] == '/')
+            fprintf(file, "*\\");
+        else if (isprint((unsigned char) *pattern))
+            fputc(*pattern, file);
+        else
+            fprintf(file, "\\x%02x", (unsigned char) *pattern);
+    }
+}
+
+/* Whether any instruction of program consumes a byte */
+static int reads_input(const cregex_program_t *program)
+{
+    for (int pc = 0; pc < forward_size(program); ++pc) {
+        switch (program->instructions[pc].opcode) {
+        case REGEX_PROGRAM_OPCODE_CHARACTER:
+        case REGEX_PROGRAM_OPCODE_ANY_CHARACTER:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS_NEGATED:
+            return 1;
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
+/* Whether byte ch (-1 at the end of string) advances instruction */
+static int accepts(const cregex_program_instr_t *instruction, int ch)
+{
+    switch (instruction->opcode) {
+    case REGEX_PROGRAM_OPCODE_CHARACTER:
+        return ch == instruction->ch;
+    case REGEX_PROGRAM_OPCODE_ANY_CHARACTER:
+        return ch >= 0;
+    case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS:
+        return ch >= 0 && cregex_char_class_contains(instruction->klass, ch);
+    case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS_NEGATED:
+        return ch >= 0 && !cregex_char_class_contains(instruction->klass, ch);
+    default:
+        return 0;
+    }
+}
+
+/* Transition of a character instruction at pc, as a switch listing either
+ * the accepted bytes or the rejected ones, whichever is shorter
+ */
+static void print_transition(FILE *file,
+                             const char *name,
+                             const cregex_program_t *program,
+                             int pc)
+{
+    const cregex_program_instr_t *instruction = program->instructions + pc;
+    int naccepted = 0, nlabels = 0, accepted;
+
+    for (int ch = -1; ch <= UCHAR_MAX; ++ch)
+        naccepted += accepts(instruction, ch);
+    accepted = naccepted <= (UCHAR_MAX + 2) / 2;
+
+    fprintf(file, "                switch (ch) {\n");
+    for (int ch = -1; ch <= UCHAR_MAX; ++ch) {
+        if (accepts(instruction, ch) != accepted)
+            continue;
+        /* six labels per line */
+        if (nlabels % 6 == 0)
+            fprintf(file, "%s                ", nlabels ? "\n" : "");
+        else
+            fprintf(file, " ");
+        fprintf(file, "case ");
+        print_byte(file, ch);
+        fprintf(file, ":");
+        ++nlabels;
+    }
+    if (nlabels)
+        fprintf(file, "\n");
+    if (!accepted)
+        fprintf(file, "                    break;\n                default:\n");
+    fprintf(file,
+            "                    %s_add(next, %d, sp + 1, thread->slots, "
+            "string,\n"
+            "                        end);\n"
+            "                }\n",
+            name, pc + 1);
+}
+
+static void print_add(FILE *file,
+                      const char *name,
+                      const cregex_program_t *program)
+{
+    const cregex_program_instr_t *instructions = program->instructions;
+
+    fprintf(file,
+            "static void %s_add(%s_list *list, int pc, const char *sp,\n"
+            "    const char **slots, const char *string, const char *end)\n"
+            "{\n"
+            "    if (list->visited[pc] == sp - string + 1)\n"
+            "        return;\n"
+            "    list->visited[pc] = sp - string + 1;\n"
+            "\n"
+            "    switch (pc) {\n",
+            name, name);
+
+    for (int pc = 0; pc < forward_size(program); ++pc) {
+        const cregex_program_instr_t *instruction = instructions + pc;
+
+        switch (instruction->opcode) {
+        case REGEX_PROGRAM_OPCODE_SPLIT:
+            fprintf(file,
+                    "    case %d: /* SPLIT */\n"
+                    "        %s_add(list, %d, sp, slots, string, end);\n"
+                    "        %s_add(list, %d, sp, slots, string, end);\n"
+                    "        return;\n",
+                    pc, name, (int) (instruction->first - instructions), name,
+                    (int) (instruction->second - instructions));
+            break;
+        case REGEX_PROGRAM_OPCODE_JUMP:
+            fprintf(file,
+                    "    case %d: /* JUMP */\n"
+                    "        %s_add(list, %d, sp, slots, string, end);\n"
+                    "        return;\n",
+                    pc, name, (int) (instruction->target - instructions));
+            break;
+        case REGEX_PROGRAM_OPCODE_DISPATCH:
+            /* the bytes selecting each alternative, listed where the
+             * lowest of them comes up
+             */
+            fprintf(file,
+                    "    case %d: /* DISPATCH */\n"
+                    "        switch (sp < end ? (unsigned char) *sp : -1) {\n",
+                    pc);
+            for (int ch = 0; ch <= UCHAR_MAX; ++ch) {
+                int offset = instruction->table[ch];
+                int listed = 0;
+                for (int lower = 0; lower < ch; ++lower)
+                    listed |= instruction->table[lower] == offset;
+                if (!offset || listed)
+                    continue;
+                for (int to = ch; to <= UCHAR_MAX; ++to)
+                    if (instruction->table[to] == offset)
+                        fprintf(file, "        case %d:\n", to);
+                fprintf(file,
+                        "            %s_add(list, %d, sp, slots, string, "
+                        "end);\n"
+                        "            break;\n",
+                        name, pc + offset);
+            }
+            fprintf(file,
+                    "        }\n"
+                    "        return;\n");
+            break;
+        case REGEX_PROGRAM_OPCODE_ASSERT_BEGIN:
+        case REGEX_PROGRAM_OPCODE_ASSERT_END:
+            fprintf(file,
+                    "    case %d: /* %s */\n"
+                    "        if (sp == %s)\n"
+                    "            %s_add(list, %d, sp, slots, string, end);\n"
+                    "        return;\n",
+                    pc,
+                    instruction->opcode == REGEX_PROGRAM_OPCODE_ASSERT_BEGIN
+                        ? "ASSERT_BEGIN"
+                        : "ASSERT_END",
+                    instruction->opcode == REGEX_PROGRAM_OPCODE_ASSERT_BEGIN
+                        ? "string"
+                        : "end",
+                    name, pc + 1);
+            break;
+        case REGEX_PROGRAM_OPCODE_SAVE:
+            fprintf(file,
+                    "    case %d: { /* SAVE %d */\n"
+                    "        const char *saved = slots[%d];\n"
+                    "        slots[%d] = sp;\n"
+                    "        %s_add(list, %d, sp, slots, string, end);\n"
+                    "        slots[%d] = saved;\n"
+                    "        return;\n"
+                    "    }\n",
+                    pc, instruction->save, instruction->save,
+                    instruction->save, name, pc + 1, instruction->save);
+            break;
+        default:
+            break;
+        }
+    }
+
+    fprintf(file,
+            "    }\n"
+            "\n"
+            "    /* characters and MATCH wait for the next byte */\n"
+            "    list->threads[list->nthreads].pc = pc;\n"
+            "    memcpy(list->threads[list->nthreads].slots, slots,\n"
+            "           sizeof(list->threads[0].slots));\n"
+            "    ++list->nthreads;\n"
+            "}\n\n");
+}
+
+static void print_run(FILE *file,
+                      const char *name,
+                      const cregex_program_t *program)
+{
+    const cregex_program_instr_t *instructions = program->instructions;
+    int ninstructions = forward_size(program);
+
+    fprintf(file,
+            "int %s(const char *string, size_t length, const char **matches,\n"
+            "    int nmatches)\n"
+            "{\n"
+            "    const char *end = string + length, *slots[%d] = {0};\n"
+            "    %s_thread *threads = malloc(sizeof(threads[0]) * %d);\n"
+            "    int *visited = calloc(%d, sizeof(visited[0]));\n"
+            "    %s_list lists[2] = {\n"
+            "        {0, threads, visited},\n"
+            "        {0, threads + %d, visited + %d},\n"
+            "    };\n"
+            "    %s_list *current = &lists[0], *next = &lists[1];\n"
+            "    int matched = 0, ncopy = nmatches < %d ? nmatches : %d;\n"
+            "\n"
+            "    if (!threads || !visited) {\n"
+            "        free(threads);\n"
+            "        free(visited);\n"
+            "        return -1;\n"
+            "    }\n"
+            "\n"
+            "    for (int i = 0; i < ncopy; ++i)\n"
+            "        slots[i] = matches[i];\n"
+            "    %s_add(current, 0, string, slots, string, end);\n"
+            "\n"
+            "    for (const char *sp = string;; ++sp) {\n"
+            "        int ch = (sp < end) ? (unsigned char) *sp : -1;\n"
+            "%s"
+            "\n"
+            "        for (int i = 0; i < current->nthreads; ++i) {\n"
+            "            %s_thread *thread = current->threads + i;\n"
+            "\n"
+            "            switch (thread->pc) {\n",
+            name, count_slots(program), name, ninstructions * 2,
+            ninstructions * 2, name, ninstructions, ninstructions, name,
+            count_slots(program), count_slots(program), name,
+            reads_input(program) ? "" : "        (void) ch;\n", name);
+
+    for (int pc = 0; pc < ninstructions; ++pc) {
+        const cregex_program_instr_t *instruction = instructions + pc;
+
+        switch (instruction->opcode) {
+        case REGEX_PROGRAM_OPCODE_MATCH:
+            fprintf(file,
+                    "            case %d: /* MATCH */\n"
+                    "                matched = 1;\n"
+                    "                memcpy(matches, thread->slots,\n"
+                    "                       sizeof(matches[0]) * ncopy);\n"
+                    "                /* cut off lower priority threads */\n"
+                    "                current->nthreads = 0;\n"
+                    "                break;\n",
+                    pc);
+            break;
+        case REGEX_PROGRAM_OPCODE_ANY_CHARACTER:
+            fprintf(file,
+                    "            case %d: /* ANY_CHAR */\n"
+                    "                if (ch >= 0)\n"
+                    "                    %s_add(next, %d, sp + 1, "
+                    "thread->slots, string,\n"
+                    "                        end);\n"
+                    "                break;\n",
+                    pc, name, pc + 1);
+            break;
+        case REGEX_PROGRAM_OPCODE_CHARACTER:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS:
+        case REGEX_PROGRAM_OPCODE_CHARACTER_CLASS_NEGATED:
+            fprintf(file, "            case %d: /* %s */\n", pc,
+                    instruction->opcode == REGEX_PROGRAM_OPCODE_CHARACTER
+                        ? "CHAR"
+                        : "CHARACTER_CLASS");
+            print_transition(file, name, program, pc);
+            fprintf(file, "                break;\n");
+            break;
+        default:
+            break;
+        }
+    }
+
+    fprintf(file,
+            "            }\n"
+            "        }\n"
+            "\n"
+            "        /* swap current and next thread list */\n"
+            "        %s_list *swap = current;\n"
+            "        current = next;\n"
+            "        next = swap;\n"
+            "        next->nthreads = 0;\n"
+            "\n"
+            "        if (current->nthreads == 0 || sp == end)\n"
+            "            break;\n"
+            "    }\n"
+            "\n"
+            "    free(threads);\n"
+            "    free(visited);\n"
+            "    return matched;\n"
+            "}\n",
+            name);
+}
+
+static void print_c(FILE *file,
+                    const char *name,
+                    const char *pattern,
+                    const cregex_program_t *program)
+{
+    fprintf(file, "/* generated by re2c: ");
+    print_pattern(file, pattern);
+    fprintf(file,
+            " */\n"
+            "\n"
+            "#include <stddef.h>\n"
+            "#include <stdlib.h>\n"
+            "#include <string.h>\n"
+            "\n"
+            "typedef struct {\n"
+            "    int pc;\n"
+            "    const char *slots[%d];\n"
+            "} %s_thread;\n"
+            "\n"
+            "typedef struct {\n"
+            "    int nthreads;\n"
+            "    %s_thread *threads;\n"
+            "    int *visited;\n"
+            "} %s_list;\n"
+            "\n",
+            count_slots(program), name, name, name);
+
+    print_add(file, name, program);
+    print_run(file, name, program);
+}
+
+int main(int argc, char *argv[])
+{
+    cregex_program_t *program;
+    const char *name = "cregex_match";
+    int flags = 0, opt;
+
+    /* process command line */
+    if (argc > 1 && strcmp(argv[1], "--help") == 0) {
+        usage(stdout, argv[0]);
+        return EXIT_SUCCESS;
+    }
+
+    while ((opt = getopt(argc, argv, "iun:h")) != -1) {
+        switch (opt) {
+        case 'i':
+            flags |= CREGEX_FLAG_ICASE;
+            break;
+        case 'u':
+            flags |= CREGEX_FLAG_UTF8;
+            break;
+        case 'n':
+            name = optarg;
+            break;
+        case 'h':
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind + 1 != argc) {
+        usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* parse and compile pattern */
+    if (!(program = cregex_compile(argv[optind], flags, NULL))) {
+        fprintf(stderr, "%s: cregex_compile() failed\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    print_c(stdout, name, argv[optind], program);
+
+    cregex_compile_free(program);
+    return EXIT_SUCCESS;
+}